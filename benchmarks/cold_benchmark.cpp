@@ -8,6 +8,7 @@
 
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/statistics.hpp>
 #include <rdmalib/benchmarker.hpp>
 #include <rdmalib/allocation.hpp>
 #include <rdmalib/functions.hpp>
@@ -26,6 +27,9 @@ int main(int argc, char ** argv)
     spdlog::set_level(spdlog::level::debug);
   else
     spdlog::set_level(spdlog::level::info);
+  auto & stats = rdmalib::StatisticsRegistry::instance();
+  if(opts.connection_stats_period > 0)
+    stats.start_reporting(std::chrono::milliseconds{opts.connection_stats_period}, opts.connection_stats);
   spdlog::info("Executing serverless-rdma test cold_benchmarker");
  
   // Read device details
@@ -55,8 +59,9 @@ int main(int argc, char ** argv)
     settings.device->ip_address,
     settings.rdma_device_port,
     settings.device->default_receive_buffer_size,
-    settings.device->max_inline_data
+    settings.device->inline_threshold()
   );
+  executor._datagram_control = opts.datagram_control;
   std::vector<rdmalib::Buffer<char>> in;
   std::vector<rdmalib::Buffer<char>> out;
   for(int i = 0; i < opts.cores; ++i) {
@@ -121,5 +126,9 @@ int main(int argc, char ** argv)
     printf("\n");
   }
 
+  if(opts.connection_stats_period > 0)
+    stats.stop_reporting();
+  else
+    stats.report(opts.connection_stats);
   return 0;
 }
@@ -12,12 +12,17 @@ namespace cold_benchmarker {
     std::string device_database;
     std::string executors_database;
     std::string output_stats;
+    // Connection statistics, written on exit and every period when it's positive.
+    std::string connection_stats;
+    int connection_stats_period;
     bool verbose;
     std::string fname;
     std::string flib;
     int input_size;
     int cores;
     int pause;
+    // Allocate over the datagram control queue of the executor manager.
+    bool datagram_control;
 
   };
 
@@ -16,12 +16,15 @@ namespace cold_benchmarker {
       ("executors-database", "JSON configuration of executor servers.", cxxopts::value<std::string>()->default_value(""))
       ("output-stats", "Output file for benchmarking statistics.", cxxopts::value<std::string>()->default_value(""))
       ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("connection-stats", "Output JSON file for connection statistics, empty logs them", cxxopts::value<std::string>()->default_value(""))
+      ("connection-stats-period", "Period of connection statistics in ms, 0 reports only on exit", cxxopts::value<int>()->default_value("0"))
       ("name", "Function name", cxxopts::value<std::string>())
       ("functions", "Functions library", cxxopts::value<std::string>())
       ("s,size", "Packet size", cxxopts::value<int>()->default_value("1"))
       ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
       ("cores", "Number of cores", cxxopts::value<int>()->default_value("1"))
       ("pause", "Pause between iterations [ms]", cxxopts::value<int>()->default_value("0"))
+      ("datagram-control", "Send allocation requests over unreliable datagrams", cxxopts::value<bool>()->default_value("false"))
     ;
     auto parsed_options = options.parse(argc, argv);
     if(parsed_options.count("help"))
@@ -38,9 +41,12 @@ namespace cold_benchmarker {
     result.flib = parsed_options["functions"].as<std::string>();
     result.input_size = parsed_options["size"].as<int>();
     result.output_stats = parsed_options["output-stats"].as<std::string>();
+    result.connection_stats = parsed_options["connection-stats"].as<std::string>();
+    result.connection_stats_period = parsed_options["connection-stats-period"].as<int>();
     result.executors_database = parsed_options["executors-database"].as<std::string>();
     result.cores = parsed_options["cores"].as<int>();
     result.pause = parsed_options["pause"].as<int>();
+    result.datagram_control = parsed_options["datagram-control"].as<bool>();
 
     return result;
   }  
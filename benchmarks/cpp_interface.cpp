@@ -8,15 +8,27 @@
 
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/statistics.hpp>
 #include <rdmalib/benchmarker.hpp>
 #include <rdmalib/functions.hpp>
 
+#include <rfaas/coroutines.hpp>
 #include <rfaas/executor.hpp>
 #include <rfaas/resources.hpp>
 
 #include "cpp_interface.hpp"
 #include "settings.hpp"
 
+#ifdef RFAAS_HAS_COROUTINES
+// Parameters, unlike captures of a lambda, are kept in the coroutine frame.
+rfaas::task awaited_invocation(rfaas::invocation_loop & loop, const std::string & fname,
+    rdmalib::Buffer<char> & in, rdmalib::Buffer<char> & out, int & failed)
+{
+  int ret = co_await loop.invoke(fname, in, out);
+  failed += ret != 0;
+}
+#endif
+
 int main(int argc, char ** argv)
 {
   auto opts = cpp_interface::options(argc, argv);
@@ -25,6 +37,9 @@ int main(int argc, char ** argv)
   else
     spdlog::set_level(spdlog::level::info);
   spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  auto & stats = rdmalib::StatisticsRegistry::instance();
+  if(opts.connection_stats_period > 0)
+    stats.start_reporting(std::chrono::milliseconds{opts.connection_stats_period}, opts.connection_stats);
   spdlog::info("Executing serverless-rdma test C++ interface.!");
 
   // Read device details
@@ -54,7 +69,7 @@ int main(int argc, char ** argv)
     settings.device->ip_address,
     settings.rdma_device_port,
     settings.device->default_receive_buffer_size,
-    settings.device->max_inline_data
+    settings.device->inline_threshold()
   );
   if(!executor.allocate(
     opts.flib,
@@ -136,7 +151,29 @@ int main(int argc, char ** argv)
   }
   spdlog::info("NonBlocking execution done {}", ret);
 
+  spdlog::info("Map execution on {} buffers", ins.size());
+  auto mapped = executor.map(opts.fname, ins, outs);
+  bool mapped_correct = mapped.wait();
+  spdlog::info("Map execution done {}, {} failed", mapped_correct, mapped.failed());
+
+#ifdef RFAAS_HAS_COROUTINES
+  spdlog::info("Awaited execution on {} buffers", ins.size());
+  {
+    // The loop owns result polling until it's destroyed.
+    rfaas::invocation_loop loop{executor};
+    int failed = 0;
+    for(size_t i = 0; i < ins.size(); ++i)
+      awaited_invocation(loop, opts.fname, ins[i], outs[i], failed);
+    loop.run();
+    spdlog::info("Awaited execution done, {} failed", failed);
+  }
+#endif
+
   executor.deallocate();
 
+  if(opts.connection_stats_period > 0)
+    stats.stop_reporting();
+  else
+    stats.report(opts.connection_stats);
   return 0;
 }
@@ -12,6 +12,9 @@ namespace cpp_interface {
     std::string device_database;
     std::string executors_database;
     std::string output_stats;
+    // Connection statistics, written on exit and every period when it's positive.
+    std::string connection_stats;
+    int connection_stats_period;
     bool verbose;
     std::string fname;
     std::string flib;
@@ -0,0 +1,106 @@
+
+#include <fstream>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/benchmarker.hpp>
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/rdmalib.hpp>
+
+#include <rfaas/devices.hpp>
+
+#include "inline_calibration.hpp"
+
+// Latency of a signaled RDMA write, from posting to its completion.
+void write_latency(rdmalib::Connection & conn, const rdmalib::Buffer<char> & src,
+    const rdmalib::RemoteBuffer & dest, int size, bool inlined, rdmalib::Benchmarker<2> & benchmarker, int col)
+{
+  benchmarker.start();
+  conn.post_write(src.sge(size, 0), dest, inlined);
+  conn.poll_wc(rdmalib::QueueType::SEND, true, 1);
+  benchmarker.end(col);
+}
+
+int main(int argc, char ** argv)
+{
+  auto opts = inline_calibration::options(argc, argv);
+  if(opts.verbose)
+    spdlog::set_level(spdlog::level::debug);
+  else
+    spdlog::set_level(spdlog::level::info);
+  spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+
+  std::ifstream in_dev{opts.device_database};
+  rfaas::devices::deserialize(in_dev);
+  in_dev.close();
+  rfaas::device_data * dev = rfaas::devices::instance().device(opts.device);
+  if(!dev) {
+    spdlog::error("Data for device {} not found!", opts.device);
+    return 1;
+  }
+
+  // Loopback connection through the device, both sides request the maximal inline size.
+  constexpr int inline_data = rdmalib::ConnectionConfiguration::MAX_INLINE_DATA;
+  rdmalib::RDMAPassive passive{dev->ip_address, opts.port, 1, true, inline_data};
+  rdmalib::Connection* server_conn = nullptr;
+  std::thread server{
+    [&passive, &server_conn]() {
+      while(true) {
+        auto [conn, status] = passive.poll_events();
+        if(status == rdmalib::ConnectionStatus::REQUESTED) {
+          server_conn = conn;
+          passive.accept(conn);
+        } else if(status == rdmalib::ConnectionStatus::ESTABLISHED)
+          break;
+      }
+    }
+  };
+  rdmalib::RDMAActive active{dev->ip_address, passive._addr._port, 1, inline_data};
+  active.allocate();
+  if(!active.connect()) {
+    spdlog::error("Loopback connection on device {} failed!", opts.device);
+    server.join();
+    return 1;
+  }
+  server.join();
+  rdmalib::Connection & conn = active.connection();
+  int max_inline = conn.max_inline_data();
+  spdlog::info("Device {} accepts {} bytes of inline data", opts.device, max_inline);
+
+  rdmalib::Buffer<char> src(std::max(max_inline, 1));
+  src.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE);
+  rdmalib::Buffer<char> dest(std::max(max_inline, 1));
+  dest.register_memory(passive.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+
+  // Largest size at which the inlined write is still faster.
+  int crossover = 0;
+  for(int size = opts.step; size <= max_inline; size += opts.step) {
+    rdmalib::Benchmarker<2> benchmarker{opts.repetitions};
+    for(int i = 0; i < opts.repetitions; ++i) {
+      write_latency(conn, src, remote, size, true, benchmarker, 0);
+      write_latency(conn, src, remote, size, false, benchmarker, 1);
+    }
+    auto [inline_median, inline_avg] = benchmarker.summary(0);
+    auto [dma_median, dma_avg] = benchmarker.summary(1);
+    spdlog::info(
+      "Size {}, inline median {} usec avg {} usec, DMA median {} usec avg {} usec",
+      size, inline_median, inline_avg, dma_median, dma_avg
+    );
+    if(inline_median < dma_median)
+      crossover = size;
+  }
+  spdlog::info("Inlining pays off up to {} bytes", crossover);
+
+  active.disconnect();
+  delete server_conn;
+
+  dev->max_inline_data = max_inline;
+  dev->inline_crossover = crossover;
+  std::ofstream out_dev{opts.output};
+  rfaas::devices::serialize(out_dev);
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+
+#ifndef __TESTS__INLINE_CALIBRATION_HPP__
+#define __TESTS__INLINE_CALIBRATION_HPP__
+
+#include <string>
+
+namespace inline_calibration {
+
+  struct Options {
+
+    std::string device_database;
+    std::string device;
+    std::string output;
+    int port;
+    int repetitions;
+    int step;
+    bool verbose;
+
+  };
+
+  Options options(int argc, char ** argv);
+
+}
+
+#endif
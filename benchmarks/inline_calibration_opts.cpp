@@ -0,0 +1,44 @@
+
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include "inline_calibration.hpp"
+
+namespace inline_calibration {
+
+  Options options(int argc, char ** argv)
+  {
+    cxxopts::Options options("inline-calibration", "Measure the inline data limit and latency crossover of a device.");
+    options.add_options()
+      ("device-database", "JSON configuration of devices.", cxxopts::value<std::string>())
+      ("device", "Name of the calibrated device.", cxxopts::value<std::string>())
+      ("output", "Output device database, by default the input database is updated.", cxxopts::value<std::string>()->default_value(""))
+      ("p,port", "Port of the loopback connection", cxxopts::value<int>()->default_value("0"))
+      ("r,repetitions", "Repetitions for each message size", cxxopts::value<int>()->default_value("1000"))
+      ("step", "Increment of message size", cxxopts::value<int>()->default_value("16"))
+      ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
+    ;
+    auto parsed_options = options.parse(argc, argv);
+    if(parsed_options.count("help"))
+    {
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+
+    Options result;
+    result.device_database = parsed_options["device-database"].as<std::string>();
+    result.device = parsed_options["device"].as<std::string>();
+    result.output = parsed_options["output"].as<std::string>();
+    result.port = parsed_options["port"].as<int>();
+    result.repetitions = parsed_options["repetitions"].as<int>();
+    result.step = parsed_options["step"].as<int>();
+    result.verbose = parsed_options["verbose"].as<bool>();
+    if(result.output.empty())
+      result.output = result.device_database;
+
+    return result;
+  }
+
+}
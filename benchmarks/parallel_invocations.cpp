@@ -7,6 +7,7 @@
 
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/statistics.hpp>
 #include <rdmalib/benchmarker.hpp>
 #include <rdmalib/functions.hpp>
 
@@ -25,6 +26,9 @@ int main(int argc, char ** argv)
   else
     spdlog::set_level(spdlog::level::info);
   spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  auto & stats = rdmalib::StatisticsRegistry::instance();
+  if(opts.connection_stats_period > 0)
+    stats.start_reporting(std::chrono::milliseconds{opts.connection_stats_period}, opts.connection_stats);
   spdlog::info("Executing serverless-rdma test parallel invocations!");
 
   // Read device details
@@ -54,8 +58,9 @@ int main(int argc, char ** argv)
     settings.device->ip_address,
     settings.rdma_device_port,
     settings.device->default_receive_buffer_size,
-    settings.device->max_inline_data
+    settings.device->inline_threshold()
   );
+  executor._threads_per_qp = opts.threads_per_qp;
   if(!executor.allocate(
     opts.flib,
     opts.numcores,
@@ -67,20 +72,18 @@ int main(int argc, char ** argv)
     return 1;
   }
 
-  // FIXME: move me to allocator
-  std::vector<rdmalib::Buffer<char>> in;
-  std::vector<rdmalib::Buffer<char>> out;
+  rdmalib::MemoryPool pool(executor._state.pd());
+  std::vector<rdmalib::PooledBuffer<char>> in;
+  std::vector<rdmalib::PooledBuffer<char>> out;
   for(int i = 0; i < opts.numcores; ++i) {
-    in.emplace_back(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE);
-    in.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    in.push_back(pool.allocate<char>(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE));
     memset(in.back().data(), 0, opts.input_size);
     for(int i = 0; i < opts.input_size; ++i) {
       ((char*)in.back().data())[i] = 1;
     }
   }
   for(int i = 0; i < opts.numcores; ++i) {
-    out.emplace_back(opts.input_size);
-    out.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    out.push_back(pool.allocate<char>(opts.input_size));
   }
 
   rdmalib::Benchmarker<1> benchmarker{settings.benchmark.repetitions};
@@ -120,5 +123,9 @@ int main(int argc, char ** argv)
     printf("\n");
   }
 
+  if(opts.connection_stats_period > 0)
+    stats.stop_reporting();
+  else
+    stats.report(opts.connection_stats);
   return 0;
 }
@@ -12,11 +12,16 @@ namespace parallel_invocations {
     std::string device_database;
     std::string executors_database;
     std::string output_stats;
+    // Connection statistics, written on exit and every period when it's positive.
+    std::string connection_stats;
+    int connection_stats_period;
     bool verbose;
     std::string fname;
     std::string flib;
     int input_size;
     int numcores;
+    // Executor threads multiplexed over one queue pair.
+    int threads_per_qp;
 
   };
 
@@ -18,10 +18,13 @@ namespace parallel_invocations {
       ("executors-database", "JSON configuration of executor servers.", cxxopts::value<std::string>()->default_value(""))
       ("output-stats", "Output file for benchmarking statistics.", cxxopts::value<std::string>()->default_value(""))
       ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("connection-stats", "Output JSON file for connection statistics, empty logs them", cxxopts::value<std::string>()->default_value(""))
+      ("connection-stats-period", "Period of connection statistics in ms, 0 reports only on exit", cxxopts::value<int>()->default_value("0"))
       ("name", "Function name", cxxopts::value<std::string>())
       ("functions", "Functions library", cxxopts::value<std::string>())
       ("s,size", "Packet size", cxxopts::value<int>()->default_value("1"))
       ("cores", "Number of cores", cxxopts::value<int>()->default_value("1"))
+      ("threads-per-qp", "Number of executor threads sharing a queue pair", cxxopts::value<int>()->default_value("1"))
       ("h,help", "Print usage", cxxopts::value<bool>()->default_value("false"))
     ;
     auto parsed_options = options.parse(argc, argv);
@@ -39,8 +42,11 @@ namespace parallel_invocations {
     result.flib = parsed_options["functions"].as<std::string>();
     result.input_size = parsed_options["size"].as<int>();
     result.output_stats = parsed_options["output-stats"].as<std::string>();
+    result.connection_stats = parsed_options["connection-stats"].as<std::string>();
+    result.connection_stats_period = parsed_options["connection-stats-period"].as<int>();
     result.executors_database = parsed_options["executors-database"].as<std::string>();
     result.numcores = parsed_options["cores"].as<int>();;
+    result.threads_per_qp = parsed_options["threads-per-qp"].as<int>();
 
     return result;
   }
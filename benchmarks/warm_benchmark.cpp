@@ -8,6 +8,7 @@
 
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/statistics.hpp>
 #include <rdmalib/benchmarker.hpp>
 #include <rdmalib/functions.hpp>
 
@@ -25,6 +26,9 @@ int main(int argc, char ** argv)
   else
     spdlog::set_level(spdlog::level::info);
   spdlog::set_pattern("[%H:%M:%S:%f] [T %t] [%l] %v ");
+  auto & stats = rdmalib::StatisticsRegistry::instance();
+  if(opts.connection_stats_period > 0)
+    stats.start_reporting(std::chrono::milliseconds{opts.connection_stats_period}, opts.connection_stats);
   spdlog::info("Executing serverless-rdma test warm_benchmarker!");
 
   // Read device details
@@ -54,8 +58,9 @@ int main(int argc, char ** argv)
     settings.device->ip_address,
     settings.rdma_device_port,
     settings.device->default_receive_buffer_size,
-    settings.device->max_inline_data
+    settings.device->inline_threshold()
   );
+  executor._memory_polling = opts.memory_polling;
   if(!executor.allocate(
     opts.flib,
     1,
@@ -67,10 +72,9 @@ int main(int argc, char ** argv)
     return 1;
   }
 
-  // FIXME: move me to a memory allocator
-  rdmalib::Buffer<char> in(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE), out(opts.input_size);
-  in.register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
-  out.register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  rdmalib::MemoryPool pool(executor._state.pd());
+  auto in = pool.allocate<char>(opts.input_size, rdmalib::functions::Submission::DATA_HEADER_SIZE);
+  auto out = pool.allocate<char>(opts.input_size);
   memset(in.data(), 0, opts.input_size);
   for(int i = 0; i < opts.input_size; ++i) {
     ((char*)in.data())[i] = 1;
@@ -111,5 +115,9 @@ int main(int argc, char ** argv)
     printf("%d ", ((char*)out.data())[i]);
   printf("\n");
 
+  if(opts.connection_stats_period > 0)
+    stats.stop_reporting();
+  else
+    stats.report(opts.connection_stats);
   return 0;
 }
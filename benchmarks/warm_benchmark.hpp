@@ -12,10 +12,15 @@ namespace warm_benchmarker {
     std::string device_database;
     std::string executors_database;
     std::string output_stats;
+    // Connection statistics, written on exit and every period when it's positive.
+    std::string connection_stats;
+    int connection_stats_period;
     bool verbose;
     std::string fname;
     std::string flib;
     int input_size;
+    // Executor and client poll memory flags instead of completions.
+    bool memory_polling;
 
   };
 
@@ -8,7 +8,10 @@ add_executable(warm_benchmarker benchmarks/warm_benchmark.cpp benchmarks/warm_be
 add_executable(parallel_invocations benchmarks/parallel_invocations.cpp benchmarks/parallel_invocations_opts.cpp)
 add_executable(cold_benchmarker benchmarks/cold_benchmark.cpp benchmarks/cold_benchmark_opts.cpp)
 add_executable(cpp_interface benchmarks/cpp_interface.cpp benchmarks/cpp_interface_opts.cpp)
-set(tests_targets "warm_benchmarker" "cold_benchmarker" "parallel_invocations" "cpp_interface")
+add_executable(inline_calibration benchmarks/inline_calibration.cpp benchmarks/inline_calibration_opts.cpp)
+# Awaited invocations of the benchmark need C++20 coroutines.
+target_compile_features(cpp_interface PRIVATE cxx_std_20)
+set(tests_targets "warm_benchmarker" "cold_benchmarker" "parallel_invocations" "cpp_interface" "inline_calibration")
 foreach(target ${tests_targets})
   add_dependencies(${target} cxxopts::cxxopts)
   add_dependencies(${target} rdmalib)
@@ -1,7 +1,35 @@
-
 enable_testing()
 include(GoogleTest)
 
+# Unit tests that need neither a configuration nor a running executor manager.
+# Tests using an RDMA device skip without one.
+set(rdmalib_tests_targets
+  "shm_transport_test" "tcp_transport_test" "statistics_test" "flag_ring_test" "stream_test"
+)
+foreach(target ${rdmalib_tests_targets})
+  add_executable(${target} tests/${target}.cpp)
+  add_dependencies(${target} rdmalib)
+  target_link_libraries(${target} PRIVATE rdmalib gtest_main)
+  set_target_properties(${target} PROPERTIES RUNTIME_OUTPUT_DIRECTORY tests)
+  gtest_discover_tests(${target})
+endforeach()
+
+# The shared device fixture reads the device database of the client library.
+set(rfaaslib_tests_targets
+  "dispatcher_test" "completion_slots_test" "memory_pool_test" "registration_cache_test"
+)
+foreach(target ${rfaaslib_tests_targets})
+  add_executable(${target} tests/${target}.cpp)
+  add_dependencies(${target} rfaaslib)
+  target_link_libraries(${target} PRIVATE rfaaslib gtest_main)
+  set_target_properties(${target} PROPERTIES RUNTIME_OUTPUT_DIRECTORY tests)
+  gtest_discover_tests(${target})
+endforeach()
+
+if(NOT ${RFAAS_WITH_DEVICE_TESTING})
+  return()
+endif()
+
 find_program(JQ NAMES jq)
 if(NOT JQ)
   message(FATAL_ERROR "jq not found, but necessary for testing!")
@@ -33,8 +61,14 @@ add_executable(
   basic_allocation_test
   tests/basic_allocation_test.cpp
 )
+add_executable(
+  coroutines_test
+  tests/coroutines_test.cpp
+)
+# Awaitable invocations need C++20 coroutines, the rest of the project is built as C++17.
+target_compile_features(coroutines_test PRIVATE cxx_std_20)
 
-set(tests_targets "basic_allocation_test")
+set(tests_targets "basic_allocation_test" "coroutines_test")
 foreach(target ${tests_targets})
   add_dependencies(${target} rfaaslib)
   target_include_directories(${target} PRIVATE $<TARGET_PROPERTY:rfaaslib,INTERFACE_INCLUDE_DIRECTORIES>)
@@ -48,4 +82,13 @@ foreach(target ${tests_targets})
   #set_tests_properties(${target} PROPERTIES FIXTURES_REQUIRED localserver)
 endforeach()
 
-
+# The device of the testing configuration is passed to the loopback tests as it is to the allocation tests,
+# without a running executor manager.
+set(device_tests_targets "warm_allocations_test" "multiplex_test")
+foreach(target ${device_tests_targets})
+  add_executable(${target} tests/${target}.cpp)
+  add_dependencies(${target} rfaaslib)
+  target_link_libraries(${target} PRIVATE rfaaslib gtest_main)
+  set_target_properties(${target} PROPERTIES RUNTIME_OUTPUT_DIRECTORY tests)
+  gtest_discover_tests(${target} EXTRA_ARGS ${TEST_DEVICE})
+endforeach()
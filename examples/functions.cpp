@@ -1,5 +1,9 @@
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+
+#include <rdmalib/functions.hpp>
 
 extern "C" uint32_t empty(void* args, uint32_t size, void* res)
 {
@@ -8,3 +12,20 @@ extern "C" uint32_t empty(void* args, uint32_t size, void* res)
   return size;
 }
 
+
+// Streaming entry point of "copy": copies the input chunk by chunk.
+extern "C" uint32_t copy_stream(rdmalib::functions::InputStream* in, rdmalib::functions::OutputStream* out)
+{
+  for(auto chunk : *in) {
+    uint32_t capacity = 0;
+    char* buf = out->buffer(capacity);
+    for(uint32_t offset = 0; offset < chunk.size; offset += capacity) {
+      uint32_t size = std::min(capacity, chunk.size - offset);
+      memcpy(buf, chunk.data + offset, size);
+      if(!out->commit(size))
+        return 1;
+      buf = out->buffer(capacity);
+    }
+  }
+  return 0;
+}
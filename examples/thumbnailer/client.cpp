@@ -39,10 +39,9 @@ int main(int argc, char ** argv)
   executor.allocate(opts.flib, opts.numcores, size, opts.hot_timeout, false);
 
 
-  // FIXME: move me to allocator
-  rdmalib::Buffer<char> in(size, rdmalib::functions::Submission::DATA_HEADER_SIZE), out(size);
-  in.register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
-  out.register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  rdmalib::MemoryPool pool(executor._state.pd());
+  auto in = pool.allocate<char>(size, rdmalib::functions::Submission::DATA_HEADER_SIZE);
+  auto out = pool.allocate<char>(size);
   if (!input.read(in.data(), size))
   {
     spdlog::error("Couldnt read file {}!", opts.image);
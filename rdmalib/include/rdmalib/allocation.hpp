@@ -14,6 +14,10 @@ namespace rdmalib {
     // < 0: client_id with negative sign, deallocation & disconnect request
     int16_t cores;
     int16_t input_buf_count;
+    // Worker threads sharing one queue pair to the client.
+    int16_t threads_per_qp;
+    // Executor polls memory instead of work completions, see server::Options::PollingType.
+    int16_t memory_polling;
     int32_t input_buf_size; 
     uint32_t func_buf_size;
     int32_t listen_port;
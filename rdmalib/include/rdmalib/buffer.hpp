@@ -2,19 +2,45 @@
 #ifndef __RDMALIB_BUFFER_HPP__
 #define __RDMALIB_BUFFER_HPP__
 
+#include <array>
 #include <cstdint>
 #include <utility>
 
-#include <cereal/cereal.hpp>
+#include <infiniband/verbs.h>
 
-struct ibv_pd;
-struct ibv_mr;
-struct ibv_sge;
+#include <cereal/cereal.hpp>
 
 namespace rdmalib {
 
   struct ScatterGatherElement;
 
+  // Backing memory of buffers allocated by rdmalib.
+  struct AllocationPolicy {
+    enum class PageSize {
+      DEFAULT = 0,
+      HUGE_2MB,
+      HUGE_1GB
+    };
+
+    // No NUMA binding.
+    static constexpr int ANY_NODE = -1;
+    // Node of the thread allocating the buffer.
+    static constexpr int LOCAL_NODE = -2;
+    // Node of the RDMA device, known only after resolve.
+    static constexpr int DEVICE_NODE = -3;
+
+    // Hugepages fall back to smaller pages when the system has none available.
+    PageSize page_size;
+    // Prefault the memory at allocation.
+    bool populate;
+    int numa_node;
+
+    AllocationPolicy(PageSize page_size = PageSize::DEFAULT, bool populate = false, int numa_node = ANY_NODE);
+    // Replace DEVICE_NODE with the NUMA node of the device.
+    AllocationPolicy resolve(ibv_context* ctx) const;
+    static int device_numa_node(ibv_context* ctx);
+  };
+
   namespace impl {
 
     // move non-template methods from header
@@ -26,11 +52,17 @@ namespace rdmalib {
       uint32_t _byte_size;
       void* _ptr;
       ibv_mr* _mr;
+      // Length of the mapping, rounded up to the page size.
+      size_t _mapped_bytes;
       bool _own_memory;
+      bool _own_mr;
 
       Buffer();
       Buffer(void* ptr, uint32_t size, uint32_t byte_size);
-      Buffer(uint32_t size, uint32_t byte_size, uint32_t header);
+      Buffer(uint32_t size, uint32_t byte_size, uint32_t header, const AllocationPolicy & policy);
+      // Memory that is already registered, e.g., a block of a memory pool.
+      // Does NOT free the memory and does NOT deregister the memory region.
+      Buffer(void* ptr, ibv_mr* mr, uint32_t size, uint32_t byte_size, uint32_t header);
       Buffer(Buffer &&);
       Buffer & operator=(Buffer && obj);
       ~Buffer();
@@ -84,8 +116,8 @@ namespace rdmalib {
       impl::Buffer(ptr, size, sizeof(T))
     {}
 
-    Buffer(size_t size, size_t header = 0):
-      impl::Buffer(size, sizeof(T), header)
+    Buffer(size_t size, size_t header = 0, const AllocationPolicy & policy = AllocationPolicy{}):
+      impl::Buffer(size, sizeof(T), header, policy)
     {}
 
     Buffer<T> & operator=(Buffer<T> && obj)
@@ -102,36 +134,47 @@ namespace rdmalib {
       // void pointer arithmetic is not allowed
       return reinterpret_cast<T*>(static_cast<char*>(this->_ptr) + this->_header);
     }
+
+  protected:
+    Buffer(void * ptr, ibv_mr* mr, uint32_t size, uint32_t header):
+      impl::Buffer(ptr, mr, size, sizeof(T), header)
+    {}
   };
 
   struct ScatterGatherElement {
-    // smallvector in practice
-    mutable std::vector<ibv_sge> _sges;
+    // Equal to max_send_sge and max_recv_sge of our queue pairs.
+    static constexpr int MAX_SGE = 5;
+
+    // Inline storage - creating and passing elements never allocates.
+    mutable std::array<ibv_sge, MAX_SGE> _sges;
+    int _size;
 
     ScatterGatherElement();
 
     ScatterGatherElement(uint64_t addr, uint32_t bytes, uint32_t lkey);
 
     template<typename T>
-    ScatterGatherElement(const Buffer<T> & buf)
+    ScatterGatherElement(const Buffer<T> & buf):
+      _size(0)
     {
       add(buf);
     }
 
+    // Returns false when the list is full - the entry is not added.
     template<typename T>
-    void add(const Buffer<T> & buf)
+    bool add(const Buffer<T> & buf)
     {
-      //emplace_back for structs will be supported in C++20
-      _sges.push_back({buf.address(), buf.bytes(), buf.lkey()});
+      return add(buf.address(), buf.bytes(), buf.lkey());
     }
 
     template<typename T>
-    void add(const Buffer<T> & buf, uint32_t size, size_t offset = 0)
+    bool add(const Buffer<T> & buf, uint32_t size, size_t offset = 0)
     {
-      //emplace_back for structs will be supported in C++20
-      _sges.push_back({buf.address() + offset, size, buf.lkey()});
+      return add(buf.address() + offset, size, buf.lkey());
     }
 
+    bool add(uint64_t addr, uint32_t bytes, uint32_t lkey);
+
     ibv_sge * array() const;
     size_t size() const;
   };
@@ -2,15 +2,22 @@
 #ifndef __RDMALIB_CONNECTION_HPP__
 #define __RDMALIB_CONNECTION_HPP__
 
+#include <array>
+#include <memory>
 #include <cstdint>
 #include <initializer_list>
 #include <vector>
 #include <optional>
+#include <type_traits>
+
+#include <arpa/inet.h>
 
 #include <infiniband/verbs.h>
 
 #include <rdma/rdma_cma.h>
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/poller.hpp>
+#include <rdmalib/statistics.hpp>
 
 namespace rdmalib {
 
@@ -19,12 +26,230 @@ namespace rdmalib {
     RECV
   };
 
+  // Immediate of an invocation message: the invocation id in the upper half, and
+  // the solicited bit with function index (submission) or the return value (result).
+  struct InvocationCompletion {
+    static constexpr uint32_t FUNCTION_MASK = 0x01FF;
+    // Submission carries a StreamDescriptor, the executor runs the streaming entry point.
+    static constexpr uint32_t STREAM_MASK = 0x0200;
+    // Thread of the executor when several threads share a queue pair.
+    static constexpr uint32_t LANE_MASK = 0x3C00;
+    static constexpr int LANE_SHIFT = 10;
+    // Submission carries a PullDescriptor, the executor reads the input.
+    static constexpr uint32_t PULL_MASK = 0x4000;
+    static constexpr uint32_t SOLICITED_MASK = 0x8000;
+    static constexpr uint32_t CODE_MASK = 0xFFFF;
+
+    uint32_t invocation_id;
+    uint32_t code;
+    uint32_t byte_len;
+    uint64_t wr_id;
+
+    int function() const
+    {
+      return code & FUNCTION_MASK;
+    }
+
+    int lane() const
+    {
+      return (code & LANE_MASK) >> LANE_SHIFT;
+    }
+
+    bool solicited() const
+    {
+      return code & SOLICITED_MASK;
+    }
+
+    bool pull() const
+    {
+      return code & PULL_MASK;
+    }
+
+    bool stream() const
+    {
+      return code & STREAM_MASK;
+    }
+
+    int return_value() const
+    {
+      return code;
+    }
+  };
+
+  // Default handler of failed work completions, logs the status.
+  struct LogCompletionErrors {
+    void operator()(const ibv_wc & wc) const;
+  };
+
+  // Status is not checked at all; for queues where errors are detected elsewhere.
+  struct IgnoreCompletionErrors {
+    void operator()(const ibv_wc &) const {}
+  };
+
+  // View of completions returned by a single poll.
+  // Completions are decoded while iterating, and failed ones are passed to the
+  // error handler and skipped - there's no separate pass over the array.
+  // Iterating twice reports errors twice.
+  template<typename ErrorHandler>
+  struct CompletionSpan {
+
+    struct iterator {
+      iterator(const ibv_wc* wc, const ibv_wc* end, const CompletionSpan* span):
+        _wc(wc), _end(end), _span(span)
+      {
+        _skip();
+      }
+
+      InvocationCompletion operator*() const
+      {
+        uint32_t imm = ntohl(_wc->imm_data);
+        return {imm >> 16, imm & InvocationCompletion::CODE_MASK, _wc->byte_len, _wc->wr_id};
+      }
+
+      iterator & operator++()
+      {
+        ++_wc;
+        _skip();
+        return *this;
+      }
+
+      bool operator!=(const iterator & other) const
+      {
+        return _wc != other._wc;
+      }
+
+      bool operator==(const iterator & other) const
+      {
+        return _wc == other._wc;
+      }
+
+    private:
+      const ibv_wc* _wc;
+      const ibv_wc* _end;
+      const CompletionSpan* _span;
+
+      void _skip()
+      {
+        if constexpr (!std::is_same_v<ErrorHandler, IgnoreCompletionErrors>) {
+          while(_wc != _end && __builtin_expect(_wc->status != IBV_WC_SUCCESS, 0)) {
+            _span->_error(*_wc);
+            ++_wc;
+          }
+        }
+      }
+    };
+
+    CompletionSpan(const ibv_wc* wcs, int size, ErrorHandler handler, QueueStatistics* stats = nullptr):
+      _wcs(wcs), _size(size), _handler(std::move(handler)), _stats(stats)
+    {}
+
+    iterator begin() const
+    {
+      return iterator{_wcs, _wcs + _size, this};
+    }
+
+    iterator end() const
+    {
+      return iterator{_wcs + _size, _wcs + _size, this};
+    }
+
+    // Number of polled completions, including failed ones.
+    int size() const
+    {
+      return _size;
+    }
+
+    bool empty() const
+    {
+      return _size == 0;
+    }
+
+    const ibv_wc* data() const
+    {
+      return _wcs;
+    }
+
+  private:
+    const ibv_wc* _wcs;
+    int _size;
+    ErrorHandler _handler;
+    QueueStatistics* _stats;
+
+    void _error(const ibv_wc & wc) const
+    {
+      if(_stats)
+        _stats->record_error(wc);
+      _handler(wc);
+    }
+  };
+
+  // Configuration of a reliable connection.
+  // Capacities are derived from the expected number of requests in flight
+  // and checked against the limits of the device before the QP is created.
   struct ConnectionConfiguration {
+    static constexpr int DEFAULT_PIPELINE_DEPTH = 24;
+    static constexpr int DEFAULT_RD_ATOMIC = 4;
+    // Request the largest inline size accepted by the device.
+    static constexpr int MAX_INLINE_DATA = -1;
+
     // Configuration of QP
     ibv_qp_init_attr attr;
     rdma_conn_param conn_param;
 
     ConnectionConfiguration();
+
+    // Send queue holds `depth` outstanding requests and a period of unsignaled ones,
+    // outstanding RDMA reads and atomics are limited to `depth`.
+    ConnectionConfiguration & pipeline_depth(int depth);
+    ConnectionConfiguration & recv_depth(int depth);
+    ConnectionConfiguration & inline_data(int bytes);
+    // Query device and port limits, adjust the RD atomic depth and inline size to them.
+    // Throws std::runtime_error when the device can't support the queue sizes.
+    void fit(ibv_context* ctx, uint8_t port_num);
+    // Largest inline size accepted when creating a QP on the device.
+    // The result is cached for each device context.
+    static int probe_max_inline(ibv_context* ctx);
+
+  private:
+    int _rd_atomic;
+    int _inline_data;
+  };
+
+  // Chain of send work requests submitted with a single ibv_post_send.
+  // Storage is preallocated - the batch can be cleared and reused without allocations.
+  struct WorkRequestBatch {
+    static constexpr int MAX_WORK_REQUESTS = 32;
+    std::array<ibv_send_wr, MAX_WORK_REQUESTS> _wrs;
+    std::array<ScatterGatherElement, MAX_WORK_REQUESTS> _sges;
+    int _size;
+    int _posted;
+
+    WorkRequestBatch();
+
+    // RDMA write
+    bool add_write(ScatterGatherElement && elems, const RemoteBuffer & buf, bool force_inline = false);
+    // RDMA write with immediate
+    bool add_write(ScatterGatherElement && elems, const RemoteBuffer & buf,
+      uint32_t immediate,
+      bool force_inline = false,
+      bool solicited = false
+    );
+    bool add_send(const ScatterGatherElement & elems, bool force_inline = false);
+    // RDMA read into local memory, the data is in place once this request
+    // or a later one completes.
+    bool add_read(ScatterGatherElement && elems, const RemoteBuffer & buf);
+    // Request a completion for the most recently added work request.
+    void signal_last();
+
+    int size() const;
+    // Requests from the front of the batch that reached the send queue in the last post;
+    // when posting fails, the index of the first request that wasn't posted.
+    int posted() const;
+    bool empty() const;
+    bool full() const;
+    void clear();
+  private:
+    ibv_send_wr* _next(ScatterGatherElement && elems);
   };
 
   enum class ConnectionStatus {
@@ -35,7 +260,9 @@ namespace rdmalib {
     // The connection has been established and can be used.
     ESTABLISHED,
     // The connection has been disconnected and mustn't be used.
-    DISCONNECTED
+    DISCONNECTED,
+    // The connection request has been rejected, e.g., the device can't support our configuration.
+    REJECTED
   };
 
   // State of a communication:
@@ -56,11 +283,26 @@ namespace rdmalib {
     std::array<ibv_wc, _wc_size> _rwc;
     std::array<ScatterGatherElement, _wc_size> _rwc_sges;
     int _send_flags;
+    // Selective signaling: only every _signal_period-th send request generates a completion.
+    // A signaled request carries in the upper half of wr_id the number of requests it retires.
+    int _signal_period;
+    int _sq_size;
+    int _sq_outstanding;
+    int _sq_unsignaled;
+    // Inline capacity of the QP, larger requests are never inlined.
+    uint32_t _max_inline_data;
+    WaitMode _wait_mode;
+    // Send and receive completions arrive with different latencies.
+    AdaptiveWait _send_wait;
+    AdaptiveWait _recv_wait;
+    std::shared_ptr<ConnectionStatistics> _stats;
 
     static const int _rbatch = 32; // 32 for faster division in the code
     struct ibv_recv_wr _batch_wrs[_rbatch]; // preallocated and prefilled batched recv.
 
   public:
+    static constexpr int DEFAULT_SIGNAL_PERIOD = 16;
+
     Connection(bool passive = false);
     ~Connection();
     Connection(const Connection&) = delete;
@@ -69,6 +311,9 @@ namespace rdmalib {
 
     void initialize_batched_recv(const rdmalib::impl::Buffer & sge, size_t offset);
     void inlining(bool enable);
+    // Request a send completion only for every period-th work request, DEFAULT_SIGNAL_PERIOD by default.
+    // Connections signal every request until this is called; a period of 1 restores that.
+    void selective_signaling(int period = DEFAULT_SIGNAL_PERIOD);
     void initialize(rdma_cm_id* id);
     void close();
     rdma_cm_id* id() const;
@@ -78,9 +323,20 @@ namespace rdmalib {
     ConnectionStatus status() const;
     void set_status(ConnectionStatus status);
     void set_private_data(uint32_t private_data);
+    uint32_t max_inline_data() const;
+    ConnectionStatistics & statistics();
+
+    // Adaptive waiting sleeps on the completion channels, which become non-blocking.
+    // Requires an initialized connection.
+    void wait_mode(WaitMode mode, uint32_t spin_budget = AdaptiveWait::DEFAULT_SPIN_BUDGET);
+    WaitMode wait_mode() const;
 
     // Blocking, no timeout
     std::tuple<ibv_wc*, int> poll_wc(QueueType, bool blocking = true, int count = -1);
+    // Specialized for the queue type, without debug output; completions are checked
+    // and decoded only while iterating the span. Polling failure returns an empty span.
+    template<QueueType Q, typename ErrorHandler = LogCompletionErrors>
+    CompletionSpan<ErrorHandler> poll(bool blocking = true, int count = -1, ErrorHandler handler = {});
     int32_t post_send(const ScatterGatherElement & elem, int32_t id = -1, bool force_inline = false);
     int32_t post_recv(ScatterGatherElement && elem, int32_t id = -1, int32_t count = 1);
 
@@ -95,14 +351,47 @@ namespace rdmalib {
     );
     int32_t post_cas(ScatterGatherElement && elems, const RemoteBuffer & buf, uint64_t compare, uint64_t swap);
     int32_t post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add);
+    // Always signaled - the data is in place after its send completion.
+    int32_t post_read(ScatterGatherElement && elems, const RemoteBuffer & rbuf);
+    // Post all work requests of the batch with a single doorbell.
+    // Returns the number of posted requests, or -1 on failure.
+    // A split batch can fail after its first part was posted, see WorkRequestBatch::posted.
+    int32_t post_batch(WorkRequestBatch & batch);
+    // Poll send completions and release the send queue slots of all requests retired by them.
+    // Returns the number of reclaimed slots, or -1 on failure.
+    int reclaim_send_queue(bool blocking = false);
+    // Number of work requests that can be posted without waiting for send completions.
+    int send_queue_credits() const;
+    // Block until all requests up to the last signaled one have completed.
+    // Returns false when polling fails or one of the completions carries an error.
+    bool drain_send_queue();
 
     // Register to be notified about all events, including unsolicited ones
     void notify_events(bool only_solicited = false);
     ibv_cq* wait_events();
     void ack_events(ibv_cq* cq, int len);
   private:
+    // Fill wcs without inspecting them, returns -1 on failure.
+    int _poll(QueueType type, bool blocking, int count, ibv_wc* wcs);
+    void _retire_sends(const ibv_wc* wcs, int count);
+    bool _acquire_send(ibv_send_wr & wr);
+    void _release_send(const ibv_send_wr & wr);
     int32_t _post_write(ScatterGatherElement && elems, ibv_send_wr wr, bool force_inline, bool force_solicited);
   };
+
+  template<QueueType Q, typename ErrorHandler>
+  CompletionSpan<ErrorHandler> Connection::poll(bool blocking, int count, ErrorHandler handler)
+  {
+    ibv_wc* wcs = Q == QueueType::RECV ? _rwc.data() : _swc.data();
+    int ret = _poll(Q, blocking, count == -1 ? _wc_size : count, wcs);
+    if(ret < 0)
+      ret = 0;
+    if constexpr (Q == QueueType::SEND) {
+      _retire_sends(wcs, ret);
+      return CompletionSpan<ErrorHandler>{wcs, ret, std::move(handler), &_stats->send};
+    } else
+      return CompletionSpan<ErrorHandler>{wcs, ret, std::move(handler), &_stats->recv};
+  }
 }
 
 #endif
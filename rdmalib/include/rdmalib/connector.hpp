@@ -0,0 +1,84 @@
+
+#ifndef __RDMALIB_CONNECTOR_HPP__
+#define __RDMALIB_CONNECTOR_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <rdma/rdma_cma.h>
+
+#include <rdmalib/connection.hpp>
+#include <rdmalib/rdmalib.hpp>
+
+namespace rdmalib {
+
+  // Asynchronous establishment of many connections to one address.
+  // The address is looked up once; every connection resolves its route and
+  // performs the handshake on a shared event channel, so handshakes overlap
+  // instead of running one after another as with RDMAActive.
+  // Events are processed by a background thread owned by the connector.
+  // Established connections are moved back to synchronous mode and behave
+  // like connections of RDMAActive.
+  struct AsyncConnector {
+    static constexpr int RESOLVE_TIMEOUT_MS = 2000;
+    // Period of checking for the shutdown of the event thread.
+    static constexpr int EVENT_POLL_TIMEOUT_MS = 100;
+
+    // Called on the event thread once the queue pair exists, before the connection
+    // request is sent - receives must be posted here.
+    using prepare_t = std::function<void(Connection &)>;
+    // Called on the event thread; the connection is nullptr when establishment failed.
+    using callback_t = std::function<void(std::unique_ptr<Connection>)>;
+
+    AsyncConnector(const std::string & ip, int port, int recv_buf = 1, int max_inline_data = 0);
+    ~AsyncConnector();
+
+    AsyncConnector(const AsyncConnector &) = delete;
+    AsyncConnector & operator=(const AsyncConnector &) = delete;
+
+    // Changes apply to connections started afterwards.
+    ConnectionConfiguration & configuration();
+    // Start a connection; safe to call from many threads.
+    // Returns false when the connection could not be started, the callback is not called then.
+    bool connect(uint32_t secret, prepare_t prepare, callback_t callback);
+    // Same as above; the future is empty on failure.
+    std::future<std::unique_ptr<Connection>> connect(uint32_t secret = 0, prepare_t prepare = prepare_t{});
+    // Connections that have not been established or failed yet.
+    int pending() const;
+
+  private:
+    struct Pending {
+      // Kept here, the private data must outlive rdma_connect.
+      uint32_t secret;
+      ConnectionConfiguration cfg;
+      prepare_t prepare;
+      callback_t callback;
+      std::unique_ptr<Connection> conn;
+    };
+
+    ConnectionConfiguration _cfg;
+    Address _addr;
+    rdma_event_channel* _ec;
+    mutable std::mutex _mutex;
+    std::unordered_map<rdma_cm_id*, std::unique_ptr<Pending>> _pending;
+    std::atomic<bool> _closing;
+    std::thread _events;
+
+    void _process_events();
+    void _handle(rdma_cm_id* id, rdma_cm_event_type event, int status);
+    bool _create_qp(rdma_cm_id* id, Pending & pending);
+    // Remove the connection from pending ones and deliver the result.
+    void _finish(rdma_cm_id* id, bool success);
+  };
+
+}
+
+#endif
+
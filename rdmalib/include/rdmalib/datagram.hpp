@@ -0,0 +1,198 @@
+
+#ifndef __RDMALIB_DATAGRAM_HPP__
+#define __RDMALIB_DATAGRAM_HPP__
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+
+#include <rdmalib/allocation.hpp>
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/statistics.hpp>
+
+// Control plane over a single unreliable datagram (UD) queue pair.
+// Clients resolve the queue pair of the server once, with a SIDR exchange of rdmacm -
+// the server creates neither a connection nor a queue pair for them.
+// Reliability is provided by requests: each carries a sequence number and is
+// retransmitted until the server acknowledges it; the server acknowledges
+// duplicates again without processing them.
+namespace rdmalib {
+
+  enum class DatagramType : uint16_t {
+    ALLOCATE = 1,
+    RELEASE,
+    HEARTBEAT,
+    ACK
+  };
+
+  enum class DatagramStatus : uint16_t {
+    SUCCESS = 0,
+    UNKNOWN_CLIENT,
+    FAILURE
+  };
+
+  struct DatagramMessage {
+    // Chosen by the client, identifies it across requests and endpoints.
+    uint64_t client;
+    // Acknowledgments repeat the sequence number of the request.
+    uint32_t seq;
+    DatagramType type;
+    DatagramStatus status;
+    // Only in ALLOCATE requests.
+    AllocationRequest request;
+  };
+
+  namespace impl {
+
+    // Queue pair, buffers and completion queues shared by both sides.
+    struct DatagramEndpoint {
+      static constexpr int WC_SIZE = 16;
+      // Receives are preceded by the global routing header.
+      static constexpr uint32_t SLOT_SIZE = sizeof(ibv_grh) + sizeof(DatagramMessage);
+
+      DatagramEndpoint(int recv_slots, int send_slots);
+      ~DatagramEndpoint();
+
+      DatagramEndpoint(const DatagramEndpoint &) = delete;
+      DatagramEndpoint & operator=(const DatagramEndpoint &) = delete;
+
+      ibv_qp* qp() const;
+      ibv_pd* pd() const;
+      ConnectionStatistics & statistics();
+
+    protected:
+      rdma_event_channel* _ec;
+      rdma_cm_id* _id;
+      int _recv_slots;
+      int _send_slots;
+      rdmalib::Buffer<char> _recv_buf;
+      rdmalib::Buffer<DatagramMessage> _send_buf;
+      int _send_idx;
+      int _send_outstanding;
+      std::array<ibv_wc, WC_SIZE> _wcs;
+      std::array<ibv_wc, WC_SIZE> _send_wcs;
+      std::shared_ptr<ConnectionStatistics> _stats;
+
+      // Create the queue pair and post all receives, the id must be bound to a device.
+      bool _initialize();
+      // Release the queue pair, its buffers and the id.
+      void _close();
+      bool _post_recv(int slot);
+      const DatagramMessage & _message(int slot) const;
+      // The message is copied to the next free send slot.
+      bool _post_send(const DatagramMessage & msg, ibv_ah* ah, uint32_t qp_num, uint32_t qkey);
+      int _poll_recv();
+      bool _reclaim_sends(bool blocking);
+    };
+
+  }
+
+  struct DatagramServer : impl::DatagramEndpoint {
+    static constexpr int DEFAULT_RECV_SLOTS = 256;
+    static constexpr int SEND_SLOTS = 64;
+
+    DatagramServer(const std::string & ip, int port, int recv_slots = DEFAULT_RECV_SLOTS);
+    ~DatagramServer();
+
+    // Answer address resolutions of new clients, non-blocking.
+    void process_events();
+    // Handler is called once for each new request and returns its status.
+    // Duplicates of processed requests are acknowledged with the stored status.
+    // Returns the number of new requests or -1 on failure.
+    template<typename Handler>
+    int poll(Handler && handler);
+    // Drop the address handle and sequence state of a client.
+    // Must not be called from the handler of poll.
+    void forget(uint64_t client);
+    int port() const;
+
+  private:
+    struct Peer {
+      ibv_ah* ah;
+      uint32_t qp_num;
+      uint32_t seq;
+      DatagramStatus status;
+    };
+    std::unordered_map<uint64_t, Peer> _peers;
+    int _port;
+
+    // Returns nullptr for stale retransmissions, and when the handle can't be created.
+    Peer* _peer(const ibv_wc & wc, const DatagramMessage & msg, bool & duplicate);
+    bool _acknowledge(const DatagramMessage & msg, const Peer & peer);
+  };
+
+  struct DatagramClient : impl::DatagramEndpoint {
+    static constexpr int RECV_SLOTS = 8;
+    static constexpr int SEND_SLOTS = 8;
+    static constexpr int RESOLVE_TIMEOUT_MS = 2000;
+    static constexpr std::chrono::milliseconds DEFAULT_RETRANSMIT_TIMEOUT{100};
+    static constexpr int DEFAULT_RETRIES = 10;
+
+    DatagramClient(const std::string & ip, int port);
+    ~DatagramClient();
+
+    // Resolve the queue pair of the server.
+    bool connect();
+    bool connected() const;
+    const std::string & address() const;
+    int port() const;
+    uint64_t id() const;
+    // Retransmit until acknowledged; returns false when all retries time out.
+    bool request(DatagramType type, DatagramStatus & status, const AllocationRequest* request = nullptr);
+    // Heartbeats are not retransmitted - a lost one is replaced by the next.
+    bool notify(DatagramType type);
+    void retransmission(std::chrono::milliseconds timeout, int retries);
+
+  private:
+    std::string _address;
+    int _port;
+    uint64_t _client;
+    uint32_t _seq;
+    ibv_ah* _ah;
+    uint32_t _remote_qpn;
+    uint32_t _remote_qkey;
+    std::chrono::milliseconds _timeout;
+    int _retries;
+
+    bool _expect_event(rdma_cm_event_type expected, rdma_cm_event* copy = nullptr);
+    bool _send(DatagramType type, const AllocationRequest* request);
+    // Acknowledgments of earlier requests and heartbeats are dropped.
+    int _acknowledged(uint32_t seq, DatagramStatus & status);
+  };
+
+  template<typename Handler>
+  int DatagramServer::poll(Handler && handler)
+  {
+    int count = _poll_recv();
+    if(count < 0)
+      return -1;
+    int processed = 0;
+    for(int i = 0; i < count; ++i) {
+      const ibv_wc & wc = _wcs[i];
+      int slot = wc.wr_id;
+      if(wc.status == IBV_WC_SUCCESS && wc.byte_len >= SLOT_SIZE) {
+        const DatagramMessage & msg = _message(slot);
+        bool duplicate = false;
+        Peer* peer = _peer(wc, msg, duplicate);
+        if(peer && !duplicate) {
+          peer->status = handler(msg);
+          ++processed;
+        }
+        if(peer)
+          _acknowledge(msg, *peer);
+      }
+      _post_recv(slot);
+    }
+    return processed;
+  }
+
+}
+
+#endif
+
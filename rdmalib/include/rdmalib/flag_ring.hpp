@@ -0,0 +1,165 @@
+
+#ifndef __RDMALIB_FLAG_RING_HPP__
+#define __RDMALIB_FLAG_RING_HPP__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/statistics.hpp>
+
+// Messages delivered with plain RDMA writes and detected by polling memory - the target
+// consumes no receive requests and generates no completions.
+//
+// A message is written into a slot of the ring with a single RDMA write:
+//   [FlagHeader][payload][padding][trailer]
+// Header and trailer carry the sequence number of the message, the trailer follows the
+// payload aligned to eight bytes. Packets of a write arrive in order and the adapter places
+// them with posted PCIe writes, which are not reordered; thus, the trailer is visible only
+// after the payload. Memory of rings must not be registered with relaxed ordering.
+// The receiver waits for the header, which gives the position of the trailer, then for the
+// trailer, and reads the payload after an acquire load of the trailer.
+// A trailer holds the sequence number and its complement - stale data in the slot is
+// unlikely to match the message that is being written.
+//
+// Sequence numbers count messages of the ring, starting with 1, and never repeat in
+// a slot, so slots are neither cleared nor acknowledged. Flow control is left to the
+// protocol: a slot must not be written before its previous message has been processed.
+namespace rdmalib {
+
+  struct FlagHeader {
+    uint32_t seq;
+    // Payload bytes, without the padding.
+    uint32_t size;
+    // Decoded like the immediate of a write with immediate.
+    uint32_t imm;
+    // Reported as the byte length of the completion.
+    uint32_t value;
+  };
+
+  // Receiving side, in memory registered by the user.
+  struct FlagRing {
+    static constexpr uint32_t HEADER_SIZE = sizeof(FlagHeader);
+    static constexpr uint32_t TRAILER_SIZE = sizeof(uint64_t);
+    // The largest padding and the trailer.
+    static constexpr uint32_t TRAILER_SPACE = 2 * TRAILER_SIZE;
+
+    static constexpr uint32_t padding(uint32_t size)
+    {
+      return (TRAILER_SIZE - size % TRAILER_SIZE) % TRAILER_SIZE;
+    }
+
+    static constexpr uint32_t message_size(uint32_t size)
+    {
+      return HEADER_SIZE + size + padding(size) + TRAILER_SIZE;
+    }
+
+    // Slot holding payloads of up to size bytes.
+    static constexpr uint32_t slot_size(uint32_t size)
+    {
+      return HEADER_SIZE + size + TRAILER_SPACE;
+    }
+
+    static constexpr uint64_t trailer(uint32_t seq)
+    {
+      return (static_cast<uint64_t>(~seq) << 32) | seq;
+    }
+
+    FlagRing();
+    // Memory must be aligned to eight bytes, as must be the slot size.
+    FlagRing(void* memory, uint32_t slot_size, int slots);
+
+    int slots() const;
+    uint32_t slot_size() const;
+    // The slot is the wr_id of the completion of its message.
+    FlagHeader* header(int slot) const;
+    char* payload(int slot) const;
+    // The next message has fully arrived.
+    bool pending() const;
+    // Non-blocking, returns completions of messages that have fully arrived.
+    int poll(ibv_wc* wcs, int count);
+
+  private:
+    char* _memory;
+    uint32_t _slot_size;
+    int _slots;
+    uint32_t _received;
+
+    bool _arrived(int slot, uint32_t seq) const;
+  };
+
+  // Writes messages into a remote FlagRing.
+  // Headers and trailers are staged in registered memory, one entry for each slot,
+  // and an entry is not modified before the message in its slot has been processed.
+  struct FlagSender {
+    // Header, padding and trailer.
+    static constexpr uint32_t ENTRY_SIZE = FlagRing::HEADER_SIZE + FlagRing::TRAILER_SPACE;
+
+    FlagSender();
+
+    void connect(ibv_pd* pd, const RemoteBuffer & ring, uint32_t slot_size, int slots);
+    bool connected() const;
+    // The payload can use at most ScatterGatherElement::MAX_SGE - 2 elements.
+    bool add_write(WorkRequestBatch & batch, const ScatterGatherElement & payload,
+      uint32_t imm, uint32_t value, bool force_inline = false);
+
+  private:
+    Buffer<char> _staging;
+    RemoteBuffer _ring;
+    uint32_t _slot_size;
+    int _slots;
+    uint32_t _sent;
+  };
+
+  // Rings polled together like a completion queue, e.g., results of all connections.
+  // There's no completion channel - waiting polls memory with a period.
+  struct FlagPoller {
+    static constexpr int WC_SIZE = 32;
+    static constexpr std::chrono::microseconds DEFAULT_WAIT_PERIOD{50};
+
+    FlagPoller();
+    FlagPoller(const FlagPoller &) = delete;
+    FlagPoller & operator=(const FlagPoller &) = delete;
+
+    // The ring must outlive the attachment.
+    void attach(FlagRing & ring);
+    void clear();
+    ConnectionStatistics & statistics();
+
+    // A thread polling while another one polls gets no completions.
+    template<typename ErrorHandler = LogCompletionErrors>
+    CompletionSpan<ErrorHandler> poll_completions(bool blocking = false, ErrorHandler handler = {});
+    // Block until a message is available, without consuming it.
+    void wait_events(std::chrono::microseconds period = DEFAULT_WAIT_PERIOD);
+
+  private:
+    std::vector<FlagRing*> _rings;
+    // Rings are polled round-robin, starting after the last one with a message.
+    size_t _next;
+    std::array<ibv_wc, WC_SIZE> _wcs;
+    std::atomic<bool> _polling;
+    std::shared_ptr<ConnectionStatistics> _stats;
+
+    int _poll();
+  };
+
+  template<typename ErrorHandler>
+  CompletionSpan<ErrorHandler> FlagPoller::poll_completions(bool blocking, ErrorHandler handler)
+  {
+    int count = _poll();
+    while(blocking && !count)
+      count = _poll();
+    return CompletionSpan<ErrorHandler>{_wcs.data(), count, std::move(handler), &_stats->recv};
+  }
+
+}
+
+#endif
+
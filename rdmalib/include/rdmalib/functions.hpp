@@ -2,6 +2,7 @@
 #ifndef __RDMALIB_FUNCTIONS_HPP__
 #define __RDMALIB_FUNCTIONS_HPP__
 
+#include <cstdint>
 #include <unordered_map>
 #include <string>
 
@@ -15,6 +16,96 @@ namespace rdmalib { namespace functions {
 
   constexpr int Submission::DATA_HEADER_SIZE;
 
+  // Follows the submission header when the input is pulled by the executor.
+  // The input must be registered with remote read access.
+  struct PullDescriptor {
+    uint64_t address;
+    uint32_t rkey;
+    uint32_t length;
+  };
+
+  // Follows the submission header of stream invocations, which are marked with
+  // InvocationCompletion::STREAM_MASK. The executor reads the input in chunks
+  // into a bounded ring, and writes output chunks behind a StreamResult at the address
+  // of the submission header.
+  struct StreamDescriptor {
+    uint64_t address;
+    uint64_t length;
+    uint32_t rkey;
+    // Zero selects the default of the executor.
+    uint32_t chunk_size;
+    // Output bytes the client accepts, without the StreamResult.
+    uint64_t output_capacity;
+  };
+
+  // Written with the result, after all output chunks.
+  struct StreamResult {
+    uint64_t length;
+  };
+
+  // Return values of invocations, beyond the ones of the functions.
+  enum class InvocationStatus : uint32_t {
+    SUCCESS = 0,
+    THREAD_BUSY = 1,
+    INPUT_TRANSFER_FAILED = 2,
+    // Output of a stream invocation exceeds the capacity or couldn't be written.
+    OUTPUT_TRANSFER_FAILED = 3,
+    // Stream functions report failures with a non-zero return value.
+    FUNCTION_FAILED = 4,
+    // Set by the client when the invocation couldn't be added to its batch, it was never sent.
+    SUBMISSION_FAILED = 5
+  };
+
+  // Streaming entry points are exported under the name of the function followed by this suffix,
+  // and only those are called by stream invocations.
+  static constexpr char STREAM_SUFFIX[] = "_stream";
+
+  // Chunks of the input of a stream invocation, the first argument of the streaming entry point:
+  //   extern "C" uint32_t fn_stream(rdmalib::functions::InputStream* in, rdmalib::functions::OutputStream* out);
+  // The function returns 0 on success. Members are function pointers provided by the executor,
+  // so functions don't link with it.
+  struct InputStream {
+    struct Chunk {
+      const char* data;
+      uint32_t size;
+    };
+
+    // Single-pass iteration over the chunks, e.g., for(auto chunk : *in).
+    struct iterator {
+      InputStream* stream;
+      Chunk chunk;
+
+      const Chunk & operator*() const { return chunk; }
+      iterator & operator++() { chunk = stream->next(); return *this; }
+      bool operator!=(const iterator & other) const { return chunk.data != other.chunk.data; }
+    };
+
+    void* context;
+    uint64_t length;
+    // Blocks until the next chunk has arrived; nullptr data after the last chunk or on failure.
+    // A chunk is valid until the next call.
+    Chunk (*next_chunk)(void* context);
+
+    Chunk next() { return next_chunk(context); }
+    iterator begin() { return iterator{this, next()}; }
+    iterator end() { return iterator{this, {nullptr, 0}}; }
+  };
+
+  // Output chunks are written to the client while the function continues.
+  struct OutputStream {
+    void* context;
+    // Memory for the next chunk, of the returned capacity.
+    char* (*chunk_buffer)(void* context, uint32_t* capacity);
+    // Send the first size bytes of the chunk; false when the output exceeds
+    // the capacity of the client or can't be written.
+    bool (*commit_chunk)(void* context, uint32_t size);
+
+    char* buffer(uint32_t & capacity) { return chunk_buffer(context, &capacity); }
+    bool commit(uint32_t size) { return commit_chunk(context, size); }
+  };
+
+  typedef uint32_t (*StreamFuncType)(InputStream*, OutputStream*);
+
 
   typedef void (*FuncType)(void*, void*);
 
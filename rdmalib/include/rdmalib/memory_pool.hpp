@@ -0,0 +1,162 @@
+
+#ifndef __RDMALIB_MEMORY_POOL_HPP__
+#define __RDMALIB_MEMORY_POOL_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/buffer.hpp>
+
+namespace rdmalib {
+
+  struct MemoryPool;
+
+  namespace impl {
+
+    struct MemoryBlock {
+      void* ptr;
+      ibv_mr* mr;
+      int size_class;
+    };
+
+  }
+
+  // Buffer carved out of a registered memory pool.
+  // It uses the memory region of the pool and returns its block on destruction.
+  template<typename T>
+  struct PooledBuffer : Buffer<T> {
+
+    PooledBuffer():
+      Buffer<T>(),
+      _pool(nullptr),
+      _size_class(0)
+    {}
+
+    PooledBuffer(MemoryPool* pool, const impl::MemoryBlock & block, uint32_t size, uint32_t header):
+      Buffer<T>(block.ptr, block.mr, size, header),
+      _pool(pool),
+      _size_class(block.size_class)
+    {}
+
+    PooledBuffer(const PooledBuffer<T> &) = delete;
+
+    PooledBuffer(PooledBuffer<T> && obj):
+      Buffer<T>(std::move(obj)),
+      _pool(obj._pool),
+      _size_class(obj._size_class)
+    {
+      obj._pool = nullptr;
+    }
+
+    PooledBuffer<T> & operator=(PooledBuffer<T> && obj)
+    {
+      release();
+      Buffer<T>::operator=(std::move(obj));
+      _pool = obj._pool;
+      _size_class = obj._size_class;
+      obj._pool = nullptr;
+      return *this;
+    }
+
+    ~PooledBuffer()
+    {
+      release();
+    }
+
+    // Return the memory to the pool, the buffer becomes empty.
+    void release();
+
+  private:
+    MemoryPool* _pool;
+    int _size_class;
+  };
+
+  // Allocator of buffers in registered memory.
+  // Memory is registered in large arenas, once for the protection domain of the pool,
+  // and handed out in blocks of power-of-two size classes. Each thread keeps a small
+  // cache of free blocks per size class; the rest is shared under a lock.
+  // All buffers use the access flags of the pool and must be released before it is destroyed.
+  struct MemoryPool {
+    static constexpr int MIN_SIZE_CLASS = 6;
+    static constexpr int MAX_SIZE_CLASS = 31;
+    static constexpr int SIZE_CLASSES = MAX_SIZE_CLASS - MIN_SIZE_CLASS + 1;
+    static constexpr int THREAD_CACHE_SIZE = 16;
+    static constexpr uint32_t DEFAULT_ARENA_SIZE = 8 * 1024 * 1024;
+
+    MemoryPool(
+      ibv_pd* pd,
+      int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE,
+      uint32_t arena_size = DEFAULT_ARENA_SIZE
+    );
+    ~MemoryPool();
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
+    // Buffer of size elements, preceded by header bytes.
+    // Returns an empty buffer when memory can't be registered or the size
+    // exceeds the largest size class.
+    template<typename T>
+    PooledBuffer<T> allocate(uint32_t size, uint32_t header = 0)
+    {
+      impl::MemoryBlock block = allocate_block(static_cast<size_t>(size) * sizeof(T) + header);
+      if(!block.ptr)
+        return PooledBuffer<T>{};
+      return PooledBuffer<T>{this, block, size, header};
+    }
+
+    impl::MemoryBlock allocate_block(size_t bytes);
+    void deallocate_block(const impl::MemoryBlock & block);
+
+    ibv_pd* pd() const;
+    // Total size of memory registered by the pool.
+    size_t registered_bytes() const;
+    // Size class of a block of bytes, -1 when it is larger than the largest class.
+    static int size_class(size_t bytes);
+
+  private:
+    struct ThreadCache {
+      std::array<std::array<impl::MemoryBlock, THREAD_CACHE_SIZE>, SIZE_CLASSES> blocks;
+      std::array<int, SIZE_CLASSES> counts;
+
+      ThreadCache();
+    };
+
+    ibv_pd* _pd;
+    int _access;
+    uint32_t _arena_size;
+    uint64_t _id;
+
+    std::mutex _lock;
+    std::vector<Buffer<char>> _arenas;
+    uint32_t _arena_offset;
+    size_t _registered_bytes;
+    std::array<std::vector<impl::MemoryBlock>, SIZE_CLASSES> _free;
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadCache>> _thread_caches;
+
+    static std::atomic<uint64_t> _pools_count;
+
+    ThreadCache & _thread_cache();
+    impl::MemoryBlock _carve(int size_class);
+  };
+
+  template<typename T>
+  void PooledBuffer<T>::release()
+  {
+    if(_pool && this->_ptr)
+      _pool->deallocate_block({this->_ptr, this->_mr, _size_class});
+    _pool = nullptr;
+    this->_ptr = nullptr;
+    this->_mr = nullptr;
+  }
+
+}
+
+#endif
@@ -0,0 +1,145 @@
+
+#ifndef __RDMALIB_MULTIPLEX_HPP__
+#define __RDMALIB_MULTIPLEX_HPP__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/connection.hpp>
+#include <rdmalib/statistics.hpp>
+
+namespace rdmalib {
+
+  struct SharedConnection;
+
+  // Part of a shared queue pair used by a single thread.
+  // The lane owns a slice of the send queue - its requests are retired by send completions
+  // polled by any lane, so posting needs no lock in rdmalib. Receive completions are
+  // dispatched to the lane named in their immediate, see InvocationCompletion::lane.
+  // All methods must be called by the owning thread.
+  struct Lane {
+    static constexpr int WC_SIZE = 32;
+    static constexpr int DEFAULT_REFILL_THRESHOLD = 8;
+    // Lanes can't sleep on the completion channel of the shared queue;
+    // waiting polls it with this period.
+    static constexpr std::chrono::microseconds DEFAULT_WAIT_PERIOD{50};
+
+    Lane(SharedConnection & shared, int index, int send_slots, int recv_depth, int ring_size);
+    Lane(const Lane &) = delete;
+    Lane & operator=(const Lane &) = delete;
+
+    int index() const;
+    uint32_t max_inline_data() const;
+    ConnectionStatistics & statistics();
+
+    // Requests are signaled every period-th request of the lane.
+    void selective_signaling(int period = Connection::DEFAULT_SIGNAL_PERIOD);
+    // Same semantics as Connection::post_batch.
+    int32_t post_batch(WorkRequestBatch & batch);
+    // Block until all requests of the lane up to the last signaled one have completed.
+    // Returns false when polling fails or one of the completions carries an error.
+    bool drain_send_queue();
+
+    // Completions dispatched to this lane; polls the shared queue when there are none.
+    template<typename ErrorHandler = LogCompletionErrors>
+    CompletionSpan<ErrorHandler> poll_completions(bool blocking = false, ErrorHandler handler = {});
+    // Replace receives consumed by completions of this lane.
+    bool refill();
+    // Block until a completion for this lane is available.
+    void wait_events(std::chrono::microseconds period = DEFAULT_WAIT_PERIOD);
+    // Nothing to request, waiting doesn't use the completion channel.
+    void notify_events() {}
+
+  private:
+    friend struct SharedConnection;
+
+    SharedConnection & _shared;
+    int _index;
+    int _sq_size;
+    int _signal_period;
+    int _sq_unsignaled;
+    uint32_t _sq_posted;
+    int32_t _req_count;
+    int _recv_depth;
+    int _refill_threshold;
+    int _consumed;
+    std::array<ibv_recv_wr, WC_SIZE> _recv_wrs;
+    std::array<ibv_wc, WC_SIZE> _wcs;
+    std::shared_ptr<ConnectionStatistics> _stats;
+
+    // Receive completions, written only by the lane holding the poll of the shared queue.
+    std::vector<ibv_wc> _ring;
+    uint32_t _ring_mask;
+    alignas(64) std::atomic<uint32_t> _ring_tail;
+    alignas(64) std::atomic<uint32_t> _ring_head;
+    // Updated by the lane polling send completions.
+    alignas(64) std::atomic<uint32_t> _sq_retired;
+    std::atomic<bool> _send_failed;
+
+    int _outstanding() const;
+    bool _acquire_send(ibv_send_wr & wr);
+    void _release_send(const ibv_send_wr & wr);
+    bool _post_receives(int count);
+    bool _push(const ibv_wc & wc);
+    int _take();
+  };
+
+  // Queue pair multiplexed between several threads, each using its own lane.
+  // The connection must not be used directly once lanes are created.
+  // Completion queues are polled by whichever lane needs progress; a lane that
+  // fails to take the poll simply retries, another lane delivers its completions.
+  struct SharedConnection {
+    static constexpr int MAX_LANES = (InvocationCompletion::LANE_MASK >> InvocationCompletion::LANE_SHIFT) + 1;
+
+    // The receive queue of the connection must hold recv_depth receives for each lane,
+    // they are posted here; the send queue is divided equally between lanes.
+    SharedConnection(Connection & conn, int lanes, int recv_depth);
+    SharedConnection(const SharedConnection &) = delete;
+    SharedConnection & operator=(const SharedConnection &) = delete;
+
+    int lanes() const;
+    Lane & lane(int idx);
+    Connection & connection();
+
+  private:
+    friend struct Lane;
+
+    Connection & _conn;
+    std::vector<std::unique_ptr<Lane>> _lanes;
+    alignas(64) std::atomic<bool> _recv_polling;
+    std::array<ibv_wc, Lane::WC_SIZE> _recv_wcs;
+    ibv_recv_wr _recv_wr;
+    alignas(64) std::atomic<bool> _send_polling;
+    std::array<ibv_wc, Lane::WC_SIZE> _send_wcs;
+
+    // Non-blocking, returns false only on a polling failure.
+    bool _poll_recv();
+    bool _poll_send();
+  };
+
+  template<typename ErrorHandler>
+  CompletionSpan<ErrorHandler> Lane::poll_completions(bool blocking, ErrorHandler handler)
+  {
+    int count = _take();
+    while(!count) {
+      if(!_shared._poll_recv())
+        break;
+      count = _take();
+      if(!blocking)
+        break;
+    }
+    _consumed += count;
+    _stats->recv.record_poll(count);
+    return CompletionSpan<ErrorHandler>{_wcs.data(), count, std::move(handler), &_stats->recv};
+  }
+
+}
+
+#endif
+
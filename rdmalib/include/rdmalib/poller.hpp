@@ -0,0 +1,52 @@
+
+#ifndef __RDMALIB_POLLER_HPP__
+#define __RDMALIB_POLLER_HPP__
+
+#include <cstdint>
+
+#include <infiniband/verbs.h>
+
+namespace rdmalib {
+
+  enum class WaitMode {
+    // Blocking polls spin on the completion queue.
+    SPIN = 0,
+    // Blocking polls spin for a budget, then sleep on the completion channel.
+    ADAPTIVE
+  };
+
+  // Spin-then-block wait for completions.
+  // The spin budget follows the observed completion latencies: when completions usually
+  // arrive within the budget range, we spin long enough to catch them; when they take longer,
+  // spinning only burns the core and we go to sleep early.
+  // Sleeping consumes events of the completion channel, which must be non-blocking.
+  struct AdaptiveWait {
+    // Microseconds.
+    static constexpr uint32_t DEFAULT_SPIN_BUDGET = 50;
+    static constexpr uint32_t MIN_SPIN_BUDGET = 2;
+    static constexpr uint32_t MAX_SPIN_BUDGET = 1000;
+    // Sleeps are bounded - another waiter on the channel might consume our event.
+    static constexpr int SLEEP_TIMEOUT_MS = 10;
+
+    AdaptiveWait(uint32_t spin_budget = DEFAULT_SPIN_BUDGET, bool tuning = true);
+
+    // Blocks until at least one completion is polled, returns the result of ibv_poll_cq.
+    int wait(ibv_cq* cq, ibv_comp_channel* channel, int count, ibv_wc* wcs);
+    uint32_t spin_budget() const;
+    // Moving average of completion latencies in microseconds.
+    uint32_t average_latency() const;
+
+    // Switch the channel to non-blocking mode.
+    static bool configure(ibv_comp_channel* channel);
+
+  private:
+    uint32_t _spin_budget;
+    bool _tuning;
+    uint32_t _avg_latency;
+
+    void _update(uint32_t latency);
+  };
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 
 #include <rdmalib/buffer.hpp>
 #include <rdmalib/connection.hpp>
+#include <rdmalib/shared_queue.hpp>
 
 namespace rdmalib {
 
@@ -40,10 +41,13 @@ namespace rdmalib {
     RDMAActive(const std::string & ip, int port, int recv_buf = 1, int max_inline_data = 0);
     RDMAActive & operator=(RDMAActive &&);
     ~RDMAActive();
-    void allocate();
+    // Creates the queue pair of the connection, false when the device can't support it.
+    bool allocate();
     bool connect(uint32_t secret = 0);
     void disconnect();
     ibv_pd* pd() const;
+    // Changes apply to connections allocated afterwards.
+    ConnectionConfiguration & configuration();
     Connection & connection();
     bool is_connected();
   };
@@ -56,21 +60,32 @@ namespace rdmalib {
     ibv_pd* _pd;
     // Set of connections that have been
     std::unordered_set<Connection*> _active_connections;
+    // When enabled, all new connections receive into this queue.
+    std::unique_ptr<SharedReceiveQueue> _srq;
 
     RDMAPassive(const std::string & ip, int port, int recv_buf = 1, bool initialize = true, int max_inline_data = 0);
+    // Without an address and a device, it never listens - for users of emulated transports.
+    RDMAPassive();
     ~RDMAPassive();
     void allocate();
     ibv_pd* pd() const;
+    // Changes apply to connections accepted afterwards.
+    ConnectionConfiguration & configuration();
     // Blocking poll for new rdmacm events.
     // Returns connection pointer and connection change status.
     // When connection is REQUESTED and ESTABLISHED, the pointer points to a valid connection.
     // When the status is DISCONNECTED, the pointer points to a closed connection.
     // User should deallocate the closed connection.
-    // When the status is UNKNOWN, the pointer is null.
-    std::tuple<Connection*, ConnectionStatus> poll_events(bool share_cqs = false);
+    // When the status is UNKNOWN or REJECTED, the pointer is null.
+    // When shared_cq is provided, the new connection delivers receive completions to it.
+    std::tuple<Connection*, ConnectionStatus> poll_events(SharedCompletionQueue* shared_cq = nullptr);
     bool nonblocking_poll_events(int timeout = 100);
     void accept(Connection* connection);
     void set_nonblocking_poll();
+    // Attach all connections created afterwards to one shared receive queue.
+    // Their receive completions are delivered to the completion queue of the SRQ.
+    SharedReceiveQueue & enable_srq(int slots, uint32_t slot_size);
+    SharedReceiveQueue* srq() const;
   };
 }
 
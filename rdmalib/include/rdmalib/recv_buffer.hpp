@@ -40,11 +40,20 @@ namespace rdmalib {
       return wc;
     }
 
+    template<typename ErrorHandler = LogCompletionErrors>
+    inline CompletionSpan<ErrorHandler> poll_completions(bool blocking = false, ErrorHandler handler = {})
+    {
+      auto wcs = this->_conn->template poll<QueueType::RECV>(blocking, -1, std::move(handler));
+      _requests -= wcs.size();
+      return wcs;
+    }
+
     inline bool refill()
     {
       if(_requests < _refill_threshold) {
         SPDLOG_DEBUG("Post {} requests to buffer at QP {}", _rcv_buf_size - _requests, fmt::ptr(_conn->qp()));
         this->_conn->post_batched_empty_recv(_rcv_buf_size - _requests);
+        this->_conn->statistics().recv.refills.add();
         //this->_conn->post_recv({}, -1, _rcv_buf_size - _requests);
         _requests = _rcv_buf_size;
         return true;
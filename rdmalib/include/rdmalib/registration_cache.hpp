@@ -0,0 +1,86 @@
+
+#ifndef __RDMALIB_REGISTRATION_CACHE_HPP__
+#define __RDMALIB_REGISTRATION_CACHE_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+#include <infiniband/verbs.h>
+
+namespace rdmalib {
+
+  // Lazy registration of user memory, e.g. std::vector storage or mmap'd files.
+  // Registered ranges are page-aligned and never overlap - a request overlapping
+  // cached ranges is served by a single registration covering all of them.
+  // Unused registrations are kept until the pinned memory exceeds the budget;
+  // then the least recently used ones are released.
+  // The cache is not thread-safe.
+  struct RegistrationCache {
+    static constexpr size_t DEFAULT_PINNED_BUDGET = 1024ul * 1024 * 1024;
+
+    // Registration of address ranges, ibv_reg_mr and ibv_dereg_mr when not set.
+    // Tests replace them to run without a device.
+    struct Hooks {
+      std::function<ibv_mr*(ibv_pd*, void*, size_t, int)> register_memory;
+      std::function<void(ibv_mr*)> deregister_memory;
+    };
+
+    RegistrationCache(
+      ibv_pd* pd, int access, size_t pinned_budget = DEFAULT_PINNED_BUDGET,
+      Hooks hooks = Hooks{}
+    );
+    ~RegistrationCache();
+
+    RegistrationCache(const RegistrationCache &) = delete;
+    RegistrationCache & operator=(const RegistrationCache &) = delete;
+
+    // Memory region covering [ptr, ptr + bytes), nullptr on failure.
+    // The region stays registered until the matching release.
+    ibv_mr* acquire(const void* ptr, size_t bytes);
+    void release(ibv_mr* mr);
+    // Drop registrations of a range before it's unmapped or freed.
+    // Regions still in use are deregistered on their last release.
+    void invalidate(const void* ptr, size_t bytes);
+
+    ibv_pd* pd() const;
+    size_t pinned_bytes() const;
+    size_t pinned_budget() const;
+    // Number of cached address ranges.
+    size_t size() const;
+
+  private:
+    struct Entry {
+      uintptr_t begin;
+      uintptr_t end;
+      ibv_mr* mr;
+      int references;
+      // Removed from the address map, deregistered once unused.
+      bool detached;
+      std::list<Entry*>::iterator lru;
+    };
+
+    ibv_pd* _pd;
+    int _access;
+    size_t _pinned_budget;
+    size_t _pinned_bytes;
+    uintptr_t _page_size;
+    Hooks _hooks;
+    // Non-overlapping ranges, ordered by their begin address.
+    std::map<uintptr_t, Entry*> _ranges;
+    std::unordered_map<ibv_mr*, std::unique_ptr<Entry>> _entries;
+    // Unused entries, the most recently released first.
+    std::list<Entry*> _unused;
+
+    void _detach(Entry* entry);
+    void _deregister(Entry* entry);
+    void _evict(size_t bytes);
+  };
+
+}
+
+#endif
+
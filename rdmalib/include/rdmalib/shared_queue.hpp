@@ -0,0 +1,107 @@
+
+#ifndef __RDMALIB_SHARED_QUEUE_HPP__
+#define __RDMALIB_SHARED_QUEUE_HPP__
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/poller.hpp>
+#include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/statistics.hpp>
+
+namespace rdmalib {
+
+  // Completion queue shared by the receive queues of many connections.
+  // Completions are routed by qp_num to the receive buffer of their connection,
+  // and receive queues are replenished when they drop below the refill threshold.
+  // Completions of connections that are not attached are returned without accounting.
+  struct SharedCompletionQueue {
+  private:
+    static const int _wc_size = 32;
+    ibv_comp_channel* _channel;
+    ibv_cq* _cq;
+    std::array<ibv_wc, _wc_size> _wcs;
+    std::unordered_map<uint32_t, RecvBuffer*> _receivers;
+    WaitMode _wait_mode;
+    AdaptiveWait _waiter;
+    std::shared_ptr<ConnectionStatistics> _stats;
+
+    int _poll(bool blocking);
+    // Account consumed receives of attached connections.
+    void _route(int count);
+
+  public:
+    // Size must cover all receive requests of the attached connections.
+    SharedCompletionQueue(ibv_context* ctx, int size);
+    ~SharedCompletionQueue();
+    SharedCompletionQueue(const SharedCompletionQueue&) = delete;
+    SharedCompletionQueue& operator=(const SharedCompletionQueue&) = delete;
+
+    ibv_cq* cq() const;
+    ibv_comp_channel* completion_channel() const;
+    // The receive buffer must be connected and must outlive the attachment.
+    void attach(RecvBuffer & rcv_buffer);
+    void detach(const Connection & conn);
+    // Adaptive waiting sleeps on the completion channel, which becomes non-blocking.
+    void wait_mode(WaitMode mode, uint32_t spin_budget = AdaptiveWait::DEFAULT_SPIN_BUDGET);
+    // Polls and errors of the shared queue; completions are also counted by their connection.
+    ConnectionStatistics & statistics();
+    std::tuple<ibv_wc*, int> poll(bool blocking = false);
+    // Completions are checked and decoded while iterating the span.
+    template<typename ErrorHandler = LogCompletionErrors>
+    CompletionSpan<ErrorHandler> poll_completions(bool blocking = false, ErrorHandler handler = {});
+
+    // Register to be notified about all events, including unsolicited ones
+    void notify_events(bool only_solicited = false);
+    // Non-blocking wait returns nullptr when there's no event, e.g., it was consumed by an adaptive wait.
+    ibv_cq* wait_events(bool blocking = true);
+    void ack_events(ibv_cq* cq, int len);
+  };
+
+  // Receive queue shared by many connections, with a ring of registered slots.
+  // Each slot receives a single message and is identified by the wr_id of its completion.
+  // Receive completions of all attached connections are delivered to one completion queue,
+  // and the sender can be found with the qp_num of a completion.
+  struct SharedReceiveQueue {
+  private:
+    ibv_srq* _srq;
+    SharedCompletionQueue _cq;
+    Buffer<char> _slots;
+    uint32_t _slot_size;
+    int _slots_count;
+
+  public:
+    SharedReceiveQueue(ibv_pd* pd, int slots, uint32_t slot_size);
+    ~SharedReceiveQueue();
+    SharedReceiveQueue(const SharedReceiveQueue&) = delete;
+    SharedReceiveQueue& operator=(const SharedReceiveQueue&) = delete;
+
+    ibv_srq* srq() const;
+    SharedCompletionQueue & completion_queue();
+    int slots() const;
+    // Memory of the slot that received the message with the given wr_id.
+    void* slot(uint64_t id) const;
+    // Return the slot to the queue once its message has been processed.
+    bool post(uint64_t id);
+    std::tuple<ibv_wc*, int> poll(bool blocking = false);
+  };
+
+  template<typename ErrorHandler>
+  CompletionSpan<ErrorHandler> SharedCompletionQueue::poll_completions(bool blocking, ErrorHandler handler)
+  {
+    int ret = _poll(blocking);
+    if(ret < 0)
+      ret = 0;
+    _route(ret);
+    return CompletionSpan<ErrorHandler>{_wcs.data(), ret, std::move(handler), &_stats->recv};
+  }
+
+}
+
+#endif
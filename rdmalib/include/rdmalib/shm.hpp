@@ -0,0 +1,189 @@
+
+#ifndef __RDMALIB_SHM_HPP__
+#define __RDMALIB_SHM_HPP__
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+
+// Shared-memory transport for processes on the same host.
+// It emulates the RDMA operations used by rdmalib - writes with immediate, send/recv,
+// atomics, completion queues and completion channels - with the same interface
+// as rdmalib::Connection, RDMAActive and RDMAPassive.
+// Memory accessed by peers is allocated from a ProtectionDomain backed by memfd,
+// queues live in a memfd shared by both sides and completion channels are eventfds.
+namespace rdmalib { namespace shm {
+
+  namespace impl {
+
+    struct Queues;
+
+  }
+
+  // Buffer in the shared arena, the memory is released with the domain.
+  template<typename T>
+  struct Buffer : rdmalib::Buffer<T> {
+
+    Buffer():
+      rdmalib::Buffer<T>()
+    {}
+
+    Buffer(void* ptr, ibv_mr* mr, uint32_t size, uint32_t header):
+      rdmalib::Buffer<T>(ptr, mr, size, header)
+    {}
+  };
+
+  // Emulates protection domain and registered memory.
+  // Buffers are carved out of one shared arena that is mapped by every connected peer.
+  struct ProtectionDomain {
+    static constexpr size_t DEFAULT_ARENA_SIZE = 64ul * 1024 * 1024;
+
+    ProtectionDomain(size_t arena_size = DEFAULT_ARENA_SIZE);
+    ~ProtectionDomain();
+
+    ProtectionDomain(const ProtectionDomain &) = delete;
+    ProtectionDomain & operator=(const ProtectionDomain &) = delete;
+
+    template<typename T>
+    Buffer<T> allocate(uint32_t size, uint32_t header = 0);
+
+    int fd() const;
+    uintptr_t address() const;
+    size_t bytes() const;
+    uint32_t rkey() const;
+
+  private:
+    int _fd;
+    void* _ptr;
+    size_t _bytes;
+    size_t _offset;
+    // Shared by all buffers, lkey and rkey identify the arena.
+    ibv_mr _mr;
+    static uint32_t _domains_count;
+
+    void* _allocate(size_t bytes);
+  };
+
+  template<typename T>
+  Buffer<T> ProtectionDomain::allocate(uint32_t size, uint32_t header)
+  {
+    return Buffer<T>{_allocate(size * sizeof(T) + header), &_mr, size, header};
+  }
+
+  struct Connection {
+    // Completions returned by a single poll, as in rdmalib::Connection.
+    static constexpr int WC_SIZE = 32;
+
+    Connection(ProtectionDomain & pd, int socket, bool passive);
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection & operator=(const Connection &) = delete;
+
+    // Exchange queues and memory with the peer; the active side creates the queues.
+    bool handshake(uint32_t private_data = 0);
+    void close();
+    uint32_t private_data() const;
+    ConnectionStatus status() const;
+
+    // Emulated operations complete before they return.
+    // Sends and writes with immediate consume a receive posted by the peer,
+    // and they wait until the peer posts one.
+    int32_t post_send(const ScatterGatherElement & elems, int32_t id = -1, bool force_inline = false);
+    int32_t post_recv(ScatterGatherElement && elem, int32_t id = -1, int32_t count = 1);
+    int32_t post_write(ScatterGatherElement && elems, const RemoteBuffer & buf, bool force_inline = false);
+    int32_t post_write(ScatterGatherElement && elems, const RemoteBuffer & buf,
+      uint32_t immediate,
+      bool force_inline = false,
+      bool solicited = false
+    );
+    int32_t post_cas(ScatterGatherElement && elems, const RemoteBuffer & buf, uint64_t compare, uint64_t swap);
+    int32_t post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add);
+    // Sends and writes of the batch; only the signaled ones generate send completions.
+    int32_t post_batch(WorkRequestBatch & batch);
+    // Operations have completed before they return, only their send completions are dropped.
+    bool drain_send_queue();
+    std::tuple<ibv_wc*, int> poll_wc(QueueType, bool blocking = true, int count = -1);
+
+    // Completion channel of receive completions.
+    void notify_events(bool only_solicited = false);
+    // Blocks until the peer delivers a completion after notify_events.
+    bool wait_events();
+    int completion_fd() const;
+
+  private:
+    ProtectionDomain & _pd;
+    int _socket;
+    bool _passive;
+    ConnectionStatus _status;
+    uint32_t _private_data;
+    int32_t _req_count;
+    // Mapping of the peer's arena.
+    void* _peer_arena;
+    uintptr_t _peer_address;
+    size_t _peer_bytes;
+    uint32_t _peer_rkey;
+    // Queues of both directions, indexed by the side that receives.
+    int _queues_fd;
+    impl::Queues* _queues;
+    std::array<int, 2> _event_fds;
+    // Local send completions are generated immediately.
+    std::array<ibv_wc, WC_SIZE> _swc;
+    int _swc_count;
+    std::array<ibv_wc, WC_SIZE> _rwc;
+
+    int _local() const;
+    int _remote() const;
+    // Address in the local mapping of the peer's arena, nullptr when out of bounds.
+    void* _translate(uint64_t addr, uint32_t bytes) const;
+    void* _translate(const RemoteBuffer & buf, uint32_t bytes) const;
+    int64_t _write(const ScatterGatherElement & elems, const RemoteBuffer & buf);
+    // Consume a receive of the peer and generate its completion.
+    bool _deliver(const ScatterGatherElement* elems, uint32_t bytes, ibv_wc_opcode opcode,
+      uint32_t imm_data, int wc_flags, bool solicited);
+    int32_t _complete_send(int32_t id, ibv_wc_opcode opcode);
+  };
+
+  // Path of the Unix socket of a passive side identified by the address and the port.
+  std::string endpoint(const std::string & address, int port);
+
+  struct RDMAActive {
+    RDMAActive(const std::string & path, ProtectionDomain & pd);
+    bool connect(uint32_t secret = 0);
+    void disconnect();
+    Connection & connection();
+    bool is_connected();
+
+  private:
+    std::string _path;
+    ProtectionDomain & _pd;
+    std::unique_ptr<Connection> _conn;
+  };
+
+  struct RDMAPassive {
+    // Listen on a Unix socket at path.
+    RDMAPassive(const std::string & path, ProtectionDomain & pd);
+    ~RDMAPassive();
+    // Blocking wait for the next connection, established after the handshake.
+    // Returns nullptr on failure; the user owns the connection.
+    Connection* poll_events();
+    // Waits at most timeout ms for a pending connection, poll_events doesn't block after it.
+    bool nonblocking_poll_events(int timeout = 100);
+
+  private:
+    std::string _path;
+    ProtectionDomain & _pd;
+    int _socket;
+  };
+
+}}
+
+#endif
+
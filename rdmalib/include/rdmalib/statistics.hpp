@@ -0,0 +1,116 @@
+
+#ifndef __RDMALIB_STATISTICS_HPP__
+#define __RDMALIB_STATISTICS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+namespace rdmalib {
+
+  // Monotonic counter with a single writer at a time.
+  // Updates are relaxed loads and stores without a locked instruction;
+  // readers from other threads see a recent value.
+  struct Counter {
+
+    inline void add(uint64_t value = 1)
+    {
+      _value.store(_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    inline uint64_t value() const
+    {
+      return _value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> _value{0};
+  };
+
+  // Counters of one queue, on their own cache line - send and receive queues
+  // are often driven by different threads.
+  struct alignas(64) QueueStatistics {
+    // Work requests accepted for posting.
+    Counter posted;
+    Counter inlined;
+    // Calls of ibv_post_send/ibv_post_recv.
+    Counter doorbells;
+    // Receive queue replenished by RecvBuffer.
+    Counter refills;
+    Counter polls;
+    Counter empty_polls;
+    Counter completions;
+    Counter errors;
+    Counter retry_errors;
+    Counter rnr_retry_errors;
+
+    inline void record_poll(int count)
+    {
+      polls.add();
+      if(count > 0)
+        completions.add(count);
+      else if(count == 0)
+        empty_polls.add();
+    }
+
+    void record_error(const ibv_wc & wc);
+    void write_json(std::ostream & out) const;
+    void accumulate(const QueueStatistics & other);
+  };
+
+  struct ConnectionStatistics {
+    std::string name;
+    std::atomic<uint32_t> qp_num;
+    QueueStatistics send;
+    QueueStatistics recv;
+
+    ConnectionStatistics(const std::string & name);
+    void write_json(std::ostream & out) const;
+  };
+
+  // Process-wide registry of connection counters.
+  // Counters outlive their connection until the next dump, which folds them into
+  // the totals of closed connections.
+  struct StatisticsRegistry {
+
+    static StatisticsRegistry & instance();
+
+    std::shared_ptr<ConnectionStatistics> create(const std::string & name);
+    void write_json(std::ostream & out);
+    std::string json();
+    // Write the JSON document every period, and once more when reporting stops.
+    // An empty path logs the document instead of overwriting the file.
+    void start_reporting(std::chrono::milliseconds period, const std::string & path = "");
+    void stop_reporting();
+    // Write the JSON document once, with the same destinations as reporting.
+    void report(const std::string & path = "");
+
+  private:
+    std::mutex _mutex;
+    std::vector<std::shared_ptr<ConnectionStatistics>> _connections;
+    uint64_t _closed_connections;
+    QueueStatistics _closed_send;
+    QueueStatistics _closed_recv;
+
+    std::thread _reporter;
+    std::mutex _reporter_mutex;
+    std::condition_variable _reporter_cv;
+    bool _reporting;
+
+    StatisticsRegistry();
+    ~StatisticsRegistry();
+  };
+
+}
+
+#endif
+
@@ -0,0 +1,290 @@
+
+#ifndef __RDMALIB_TCP_HPP__
+#define __RDMALIB_TCP_HPP__
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include <infiniband/verbs.h>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+
+// TCP transport for nodes without RDMA devices, with the interface of rdmalib::Connection,
+// RDMAActive and RDMAPassive.
+// Operations are framed messages - one-sided writes carry the target address and key,
+// immediates are carried in the header, atomics are executed by the target and answered.
+// The target processes messages when it polls its completions.
+// Each connection drives an io_uring: posted operations are gathered into a single sendmsg
+// without copies, and a batch of work requests is one submission. Messages are read into
+// a registered receive ring, and all frames of a read are processed with its completion;
+// large payloads are read directly into the registered arena.
+namespace rdmalib { namespace tcp {
+
+  namespace impl {
+
+    struct Ring;
+
+    // Wire format of a single operation.
+    struct Header {
+      uint8_t opcode;
+      uint8_t solicited;
+      uint16_t reserved;
+      // Network order, as in ibv_send_wr.
+      uint32_t imm_data;
+      uint32_t rkey;
+      uint32_t length;
+      uint64_t addr;
+      uint64_t wr_id;
+      // Atomics: add or compare and swap; the response carries the original value.
+      std::array<uint64_t, 2> operands;
+    };
+
+  }
+
+  // Buffer in the registered arena, the memory is released with the domain.
+  template<typename T>
+  struct Buffer : rdmalib::Buffer<T> {
+
+    Buffer():
+      rdmalib::Buffer<T>()
+    {}
+
+    Buffer(void* ptr, ibv_mr* mr, uint32_t size, uint32_t header):
+      rdmalib::Buffer<T>(ptr, mr, size, header)
+    {}
+  };
+
+  // Emulates protection domain and registered memory.
+  // Remote writes and receives must target the arena, which each connection
+  // registers as a fixed buffer of its io_uring.
+  struct ProtectionDomain {
+    static constexpr size_t DEFAULT_ARENA_SIZE = 64ul * 1024 * 1024;
+
+    ProtectionDomain(size_t arena_size = DEFAULT_ARENA_SIZE);
+    ~ProtectionDomain();
+
+    ProtectionDomain(const ProtectionDomain &) = delete;
+    ProtectionDomain & operator=(const ProtectionDomain &) = delete;
+
+    template<typename T>
+    Buffer<T> allocate(uint32_t size, uint32_t header = 0);
+
+    uintptr_t address() const;
+    size_t bytes() const;
+    uint32_t rkey() const;
+    // The range lies in the arena.
+    bool contains(uint64_t addr, uint32_t bytes) const;
+
+  private:
+    void* _ptr;
+    size_t _bytes;
+    size_t _offset;
+    // Shared by all buffers, lkey and rkey identify the arena.
+    ibv_mr _mr;
+    static uint32_t _domains_count;
+
+    void* _allocate(size_t bytes);
+  };
+
+  template<typename T>
+  Buffer<T> ProtectionDomain::allocate(uint32_t size, uint32_t header)
+  {
+    return Buffer<T>{_allocate(size * sizeof(T) + header), &_mr, size, header};
+  }
+
+  struct Connection {
+    // Completions returned by a single poll, as in rdmalib::Connection.
+    static constexpr int WC_SIZE = 32;
+    // Operations in flight, each owns its header and gather list.
+    static constexpr int SEND_SLOTS = 64;
+    static constexpr int RECV_QUEUE_SIZE = 256;
+    // Each read fills the free space of the ring.
+    static constexpr uint32_t RX_RING_SIZE = 64 * 1024;
+    // Larger remainders of payloads are not copied from the ring.
+    static constexpr uint32_t DIRECT_READ_SIZE = 16 * 1024;
+
+    Connection(ProtectionDomain & pd, int socket, bool passive);
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection & operator=(const Connection &) = delete;
+
+    // Exchange the private data and start receiving.
+    bool handshake(uint32_t private_data = 0);
+    void close();
+    uint32_t private_data() const;
+    ConnectionStatus status() const;
+
+    // Each post generates a send completion. Only one sendmsg is in flight to keep
+    // messages in order; posts issued meanwhile are sent by the next poll.
+    int32_t post_send(const ScatterGatherElement & elems, int32_t id = -1, bool force_inline = false);
+    int32_t post_recv(ScatterGatherElement && elem, int32_t id = -1, int32_t count = 1);
+    int32_t post_write(ScatterGatherElement && elems, const RemoteBuffer & buf, bool force_inline = false);
+    int32_t post_write(ScatterGatherElement && elems, const RemoteBuffer & buf,
+      uint32_t immediate,
+      bool force_inline = false,
+      bool solicited = false
+    );
+    int32_t post_cas(ScatterGatherElement && elems, const RemoteBuffer & buf, uint64_t compare, uint64_t swap);
+    int32_t post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add);
+    // All work requests are submitted with a single system call;
+    // only the signaled ones generate send completions.
+    int32_t post_batch(WorkRequestBatch & batch);
+    // Waits until all operations have been sent, their send completions are dropped.
+    bool drain_send_queue();
+    std::tuple<ibv_wc*, int> poll_wc(QueueType, bool blocking = true, int count = -1);
+
+    // Completion channel of receive completions.
+    void notify_events(bool only_solicited = false);
+    // Blocks until a receive completion matching notify_events arrives;
+    // the completion is returned by the next poll_wc.
+    bool wait_events();
+
+  private:
+    struct SendSlot {
+      impl::Header header;
+      // Header and the gathered payload.
+      std::array<iovec, ScatterGatherElement::MAX_SGE + 1> iov;
+      int iov_count;
+      uint32_t bytes;
+      uint64_t wr_id;
+      ibv_wc_opcode opcode;
+      bool signaled;
+      // Atomics complete with their response, which carries the original value.
+      uint64_t* result;
+      int references;
+    };
+
+    struct RecvRequest {
+      uint64_t wr_id;
+      int num_sge;
+      std::array<ibv_sge, ScatterGatherElement::MAX_SGE> sges;
+    };
+
+    enum class Phase {
+      HEADER,
+      // Copied from the ring, or read directly into the target.
+      PAYLOAD,
+      // Message received, waiting for a receive, completion entry or a send slot.
+      DISPATCH
+    };
+
+    ProtectionDomain & _pd;
+    int _socket;
+    bool _passive;
+    ConnectionStatus _status;
+    uint32_t _private_data;
+    int32_t _req_count;
+    std::unique_ptr<impl::Ring> _ring;
+    bool _fixed_buffers;
+
+    std::array<SendSlot, SEND_SLOTS> _slots;
+    std::array<int, SEND_SLOTS> _free_slots;
+    int _free_slots_count;
+    // Slots waiting for sendmsg, in order; at most one sendmsg is in flight
+    // to keep messages in order, and it carries all queued slots.
+    std::array<int, SEND_SLOTS> _send_queue;
+    int _send_queue_head;
+    int _send_queue_count;
+    int _send_in_flight;
+    std::array<iovec, SEND_SLOTS * (ScatterGatherElement::MAX_SGE + 1)> _send_iov;
+    msghdr _send_msg;
+    uint32_t _send_bytes;
+
+    std::array<RecvRequest, RECV_QUEUE_SIZE> _recv;
+    int _recv_head;
+    int _recv_count;
+
+    // Received bytes not processed yet are [_rx_begin, _rx_end).
+    std::unique_ptr<char[]> _rx_ring;
+    uint32_t _rx_begin;
+    uint32_t _rx_end;
+    bool _rx_in_flight;
+    // Read into the target instead of the ring.
+    bool _rx_direct;
+    char* _rx_target;
+    uint32_t _rx_target_bytes;
+    uint32_t _rx_offset;
+
+    // Receive state of the current message.
+    impl::Header _rx_header;
+    Phase _rx_phase;
+    uint32_t _rx_received;
+    // Receive consumed by the current message.
+    bool _rx_has_request;
+    RecvRequest _rx_request;
+    int _rx_sge;
+    uint32_t _rx_sge_offset;
+
+    int _notify;
+    bool _event;
+    std::array<ibv_wc, WC_SIZE> _swc;
+    int _swc_count;
+    std::array<ibv_wc, WC_SIZE> _rwc;
+    int _rwc_count;
+    // Completions returned by the last poll.
+    std::array<ibv_wc, WC_SIZE> _wc;
+
+    int32_t _post(const impl::Header & header, const ibv_sge* sges, int num_sge,
+      uint64_t wr_id, ibv_wc_opcode opcode, bool signaled, uint64_t* result = nullptr);
+    void _flush();
+    void _release_slot(int slot);
+    void _complete_send(uint64_t wr_id, ibv_wc_opcode opcode);
+    void _complete_recv(ibv_wc_opcode opcode, uint32_t bytes, int wc_flags);
+    bool _pop_recv();
+    // Submit queued operations and process completions of the ring.
+    bool _progress(bool blocking);
+    // Free space of the ring, after moving the unprocessed bytes to its beginning.
+    void _read_ring();
+    void _read_direct(char* target, uint32_t bytes);
+    void _submit_read();
+    // Remaining part of the payload target, in the current element of the receive.
+    std::tuple<char*, uint32_t> _rx_segment();
+    void _rx_advance(uint32_t bytes);
+    // Handle received messages as far as resources allow, and continue reading.
+    void _dispatch();
+    void _process();
+    void _fail(const char* reason);
+  };
+
+  struct RDMAActive {
+    RDMAActive(const std::string & ip, int port, ProtectionDomain & pd);
+    bool connect(uint32_t secret = 0);
+    void disconnect();
+    Connection & connection();
+    bool is_connected();
+
+  private:
+    std::string _ip;
+    int _port;
+    ProtectionDomain & _pd;
+    std::unique_ptr<Connection> _conn;
+  };
+
+  struct RDMAPassive {
+    // Port 0 selects an ephemeral port.
+    RDMAPassive(const std::string & ip, int port, ProtectionDomain & pd);
+    ~RDMAPassive();
+    int port() const;
+    // Blocking wait for the next connection, established after the handshake.
+    // Returns nullptr on failure; the user owns the connection.
+    Connection* poll_events();
+    // Waits at most timeout ms for a pending connection, poll_events doesn't block after it.
+    bool nonblocking_poll_events(int timeout = 100);
+
+  private:
+    ProtectionDomain & _pd;
+    int _socket;
+    int _port;
+  };
+
+}}
+
+#endif
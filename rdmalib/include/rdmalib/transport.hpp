@@ -0,0 +1,69 @@
+
+#ifndef __RDMALIB_TRANSPORT_HPP__
+#define __RDMALIB_TRANSPORT_HPP__
+
+#include <string>
+
+#include <rdmalib/shm.hpp>
+#include <rdmalib/tcp.hpp>
+
+namespace rdmalib {
+
+  // Transport of connections between clients and executors.
+  enum class Transport {
+    RDMA = 0,
+    // Processes on the same host, see rdmalib::shm.
+    SHM,
+    // Nodes without RDMA devices, see rdmalib::tcp.
+    TCP
+  };
+
+  // Returns false for unknown names.
+  bool parse_transport(const std::string & name, Transport & transport);
+  std::string transport_name(Transport transport);
+
+  // Transports emulating RDMA with the interface of Connection, RDMAActive and RDMAPassive.
+  // Passive sides are identified by the address and the port, as with RDMA.
+  template<Transport>
+  struct EmulatedTransport;
+
+  template<>
+  struct EmulatedTransport<Transport::SHM> {
+    typedef shm::ProtectionDomain ProtectionDomain;
+    typedef shm::Connection Connection;
+    typedef shm::RDMAActive RDMAActive;
+    typedef shm::RDMAPassive RDMAPassive;
+
+    static RDMAActive* active(const std::string & address, int port, ProtectionDomain & pd)
+    {
+      return new RDMAActive{shm::endpoint(address, port), pd};
+    }
+
+    static RDMAPassive* passive(const std::string & address, int port, ProtectionDomain & pd)
+    {
+      return new RDMAPassive{shm::endpoint(address, port), pd};
+    }
+  };
+
+  template<>
+  struct EmulatedTransport<Transport::TCP> {
+    typedef tcp::ProtectionDomain ProtectionDomain;
+    typedef tcp::Connection Connection;
+    typedef tcp::RDMAActive RDMAActive;
+    typedef tcp::RDMAPassive RDMAPassive;
+
+    static RDMAActive* active(const std::string & address, int port, ProtectionDomain & pd)
+    {
+      return new RDMAActive{address, port, pd};
+    }
+
+    static RDMAPassive* passive(const std::string & address, int port, ProtectionDomain & pd)
+    {
+      return new RDMAPassive{address, port, pd};
+    }
+  };
+
+}
+
+#endif
+
@@ -1,13 +1,138 @@
 
+#include <fstream>
+#include <tuple>
+
 // mmap
 #include <sys/mman.h>
+// mbind
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <infiniband/verbs.h>
 
 #include <rdmalib/buffer.hpp>
 #include <rdmalib/util.hpp>
 
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace rdmalib {
+
+  // Memory policies of mbind - numaif.h is part of libnuma, which we don't require.
+  constexpr int MEMORY_POLICY_BIND = 2;
+  constexpr int MEMORY_POLICY_LOCAL = 4;
+  constexpr int MAX_NUMA_NODES = 256;
+
+  AllocationPolicy::AllocationPolicy(PageSize page_size, bool populate, int numa_node):
+    page_size(page_size),
+    populate(populate),
+    numa_node(numa_node)
+  {}
+
+  AllocationPolicy AllocationPolicy::resolve(ibv_context* ctx) const
+  {
+    AllocationPolicy policy{*this};
+    if(numa_node == DEVICE_NODE) {
+      int node = device_numa_node(ctx);
+      policy.numa_node = node >= 0 ? node : ANY_NODE;
+    }
+    return policy;
+  }
+
+  int AllocationPolicy::device_numa_node(ibv_context* ctx)
+  {
+    // Devices without NUMA affinity report -1.
+    std::ifstream in{std::string{ctx->device->ibdev_path} + "/device/numa_node"};
+    int node = ANY_NODE;
+    if(!(in >> node)) {
+      spdlog::warn("Unknown NUMA node of device {}", ibv_get_device_name(ctx->device));
+      return ANY_NODE;
+    }
+    return node;
+  }
+
+}
+
 namespace rdmalib { namespace impl {
 
+  static size_t page_bytes(AllocationPolicy::PageSize page_size)
+  {
+    switch(page_size) {
+      case AllocationPolicy::PageSize::HUGE_1GB:
+        return 1ul << 30;
+      case AllocationPolicy::PageSize::HUGE_2MB:
+        return 1ul << 21;
+      default:
+        return sysconf(_SC_PAGESIZE);
+    }
+  }
+
+  // Returns the mapping and its length rounded up to the page size.
+  static std::tuple<void*, size_t> map_memory(size_t bytes, const AllocationPolicy & policy)
+  {
+    auto page_size = policy.page_size;
+    int node = policy.numa_node;
+    if(node == AllocationPolicy::DEVICE_NODE) {
+      spdlog::warn("Allocation policy not resolved for a device, NUMA binding is ignored");
+      node = AllocationPolicy::ANY_NODE;
+    } else if(node >= MAX_NUMA_NODES || (node < 0 && node != AllocationPolicy::ANY_NODE
+        && node != AllocationPolicy::LOCAL_NODE)) {
+      spdlog::warn("NUMA node {} not supported, binding is ignored", node);
+      node = AllocationPolicy::ANY_NODE;
+    }
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    // With a NUMA binding, the pages can be faulted in only after mbind.
+    if(policy.populate && node == AllocationPolicy::ANY_NODE)
+      flags |= MAP_POPULATE;
+
+    void* ptr = MAP_FAILED;
+    size_t length = 0;
+    while(ptr == MAP_FAILED) {
+      size_t page = page_bytes(page_size);
+      length = (bytes + page - 1) / page * page;
+      int page_flags = 0;
+      if(page_size == AllocationPolicy::PageSize::HUGE_1GB)
+        page_flags = MAP_HUGETLB | MAP_HUGE_1GB;
+      else if(page_size == AllocationPolicy::PageSize::HUGE_2MB)
+        page_flags = MAP_HUGETLB | MAP_HUGE_2MB;
+      ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags | page_flags, -1, 0);
+      if(ptr != MAP_FAILED)
+        break;
+      if(page_size == AllocationPolicy::PageSize::DEFAULT) {
+        spdlog::error("Allocation of {} bytes failed, errno {}", bytes, errno);
+        return std::make_tuple(nullptr, 0);
+      }
+      spdlog::warn("No hugepages of {} bytes available, falling back to smaller pages", page);
+      page_size = static_cast<AllocationPolicy::PageSize>(static_cast<int>(page_size) - 1);
+    }
+
+    if(node != AllocationPolicy::ANY_NODE) {
+      long ret;
+      if(node == AllocationPolicy::LOCAL_NODE) {
+        ret = syscall(SYS_mbind, ptr, length, MEMORY_POLICY_LOCAL, nullptr, 0, 0);
+      } else {
+        unsigned long nodemask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+        nodemask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+        ret = syscall(SYS_mbind, ptr, length, MEMORY_POLICY_BIND, nodemask, MAX_NUMA_NODES + 1, 0);
+      }
+      if(ret)
+        spdlog::warn("Binding {} bytes to NUMA node {} failed, errno {}", length, node, errno);
+      if(policy.populate) {
+        size_t page = page_bytes(page_size);
+        for(size_t offset = 0; offset < length; offset += page)
+          static_cast<volatile char*>(ptr)[offset] = 0;
+      }
+    }
+    return std::make_tuple(ptr, length);
+  }
+
   Buffer::Buffer():
     _size(0),
     _header(0),
@@ -15,7 +140,9 @@ namespace rdmalib { namespace impl {
     _byte_size(0),
     _ptr(nullptr),
     _mr(nullptr),
-    _own_memory(false)
+    _mapped_bytes(0),
+    _own_memory(false),
+    _own_mr(true)
   {}
 
   Buffer::Buffer(Buffer && obj):
@@ -25,7 +152,9 @@ namespace rdmalib { namespace impl {
     _byte_size(obj._byte_size),
     _ptr(obj._ptr),
     _mr(obj._mr),
-    _own_memory(obj._own_memory)
+    _mapped_bytes(obj._mapped_bytes),
+    _own_memory(obj._own_memory),
+    _own_mr(obj._own_mr)
   {
     obj._size = obj._bytes = obj._header = 0;
     obj._ptr = obj._mr = nullptr;
@@ -35,24 +164,27 @@ namespace rdmalib { namespace impl {
   {
     _size = obj._size;
     _bytes = obj._bytes;
-    _bytes = obj._byte_size;
+    _byte_size = obj._byte_size;
     _header = obj._header;
     _ptr = obj._ptr;
     _mr = obj._mr;
+    _mapped_bytes = obj._mapped_bytes;
     _own_memory = obj._own_memory;
+    _own_mr = obj._own_mr;
 
     obj._size = obj._bytes = 0;
     obj._ptr = obj._mr = nullptr;
     return *this;
   }
 
-  Buffer::Buffer(uint32_t size, uint32_t byte_size, uint32_t header):
+  Buffer::Buffer(uint32_t size, uint32_t byte_size, uint32_t header, const AllocationPolicy & policy):
     _size(size),
     _header(header),
     _bytes(size * byte_size + header),
     _byte_size(byte_size),
     _mr(nullptr),
-    _own_memory(true)
+    _own_memory(true),
+    _own_mr(true)
   {
     //size_t alloc = _bytes;
     //if(alloc < 4096) {
@@ -60,10 +192,10 @@ namespace rdmalib { namespace impl {
     //  spdlog::warn("Page too small, allocating {} bytes", alloc);
     //}
     // page-aligned address for maximum performance
-    _ptr = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+    std::tie(_ptr, _mapped_bytes) = map_memory(_bytes, policy);
     SPDLOG_DEBUG(
-      "Allocated {} bytes, address {}",
-      _bytes, fmt::ptr(_ptr)
+      "Allocated {} bytes, mapped {} bytes, address {}",
+      _bytes, _mapped_bytes, fmt::ptr(_ptr)
     );
   }
 
@@ -74,13 +206,28 @@ namespace rdmalib { namespace impl {
     _byte_size(byte_size),
     _ptr(ptr),
     _mr(nullptr),
-    _own_memory(false)
+    _mapped_bytes(0),
+    _own_memory(false),
+    _own_mr(true)
   {
     SPDLOG_DEBUG(
       "Allocated {} bytes, address {}",
       _bytes, fmt::ptr(_ptr)
     );
   }
+
+  Buffer::Buffer(void* ptr, ibv_mr* mr, uint32_t size, uint32_t byte_size, uint32_t header):
+    _size(size),
+    _header(header),
+    _bytes(size * byte_size + header),
+    _byte_size(byte_size),
+    _ptr(ptr),
+    _mr(mr),
+    _mapped_bytes(0),
+    _own_memory(false),
+    _own_mr(false)
+  {
+  }
   
   Buffer::~Buffer()
   {
@@ -88,15 +235,16 @@ namespace rdmalib { namespace impl {
       "Deallocate {} bytes, mr {}, ptr {}",
       _bytes, fmt::ptr(_mr), fmt::ptr(_ptr)
     );
-    if(_mr)
+    if(_mr && _own_mr)
       ibv_dereg_mr(_mr);
-    if(_own_memory)
-      munmap(_ptr, _bytes);
+    if(_own_memory && _ptr)
+      munmap(_ptr, _mapped_bytes);
   }
 
   void Buffer::register_memory(ibv_pd* pd, int access)
   {
     _mr = ibv_reg_mr(pd, _ptr, _bytes, access);
+    _own_mr = true;
     impl::expect_nonnull(_mr);
     SPDLOG_DEBUG(
       "Registered {} bytes, mr {}, address {}, lkey {}, rkey {}",
@@ -158,7 +306,8 @@ namespace rdmalib { namespace impl {
 
 namespace rdmalib {
 
-  ScatterGatherElement::ScatterGatherElement()
+  ScatterGatherElement::ScatterGatherElement():
+    _size(0)
   {
   }
 
@@ -169,12 +318,23 @@ namespace rdmalib {
 
   size_t ScatterGatherElement::size() const
   {
-    return _sges.size();
+    return _size;
+  }
+
+  ScatterGatherElement::ScatterGatherElement(uint64_t addr, uint32_t bytes, uint32_t lkey):
+    _size(0)
+  {
+    add(addr, bytes, lkey);
   }
 
-  ScatterGatherElement::ScatterGatherElement(uint64_t addr, uint32_t bytes, uint32_t lkey)
+  bool ScatterGatherElement::add(uint64_t addr, uint32_t bytes, uint32_t lkey)
   {
-    _sges.push_back({addr, bytes, lkey});
+    if(_size == MAX_SGE) {
+      spdlog::error("Scatter-gather list is full, capacity {}", MAX_SGE);
+      return false;
+    }
+    _sges[_size++] = {addr, bytes, lkey};
+    return true;
   }
 
   RemoteBuffer::RemoteBuffer():
@@ -1,7 +1,13 @@
 
+#include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <stdexcept>
 #include <spdlog/spdlog.h>
 #include <thread>
+// poll
+#include <poll.h>
 
 #include <rdmalib/connection.hpp>
 #include <rdmalib/util.hpp>
@@ -12,6 +18,236 @@ namespace rdmalib {
   {
     memset(&attr, 0, sizeof(attr));
     memset(&conn_param, 0 , sizeof(conn_param));
+
+    // Maximal number of scatter-gather requests in a work request
+    attr.cap.max_send_sge = ScatterGatherElement::MAX_SGE;
+    attr.cap.max_recv_sge = ScatterGatherElement::MAX_SGE;
+    attr.cap.max_recv_wr = 1;
+    // Reliable connection
+    attr.qp_type = IBV_QPT_RC;
+    // Requests are signaled selectively, see Connection::selective_signaling
+    attr.sq_sig_all = 0;
+    conn_param.retry_count = 3;
+    conn_param.rnr_retry_count = 3;
+    pipeline_depth(DEFAULT_PIPELINE_DEPTH);
+    inline_data(0);
+    _rd_atomic = DEFAULT_RD_ATOMIC;
+    conn_param.initiator_depth = DEFAULT_RD_ATOMIC;
+    conn_param.responder_resources = DEFAULT_RD_ATOMIC;
+  }
+
+  ConnectionConfiguration & ConnectionConfiguration::pipeline_depth(int depth)
+  {
+    attr.cap.max_send_wr = depth + Connection::DEFAULT_SIGNAL_PERIOD;
+    _rd_atomic = depth;
+    return *this;
+  }
+
+  ConnectionConfiguration & ConnectionConfiguration::recv_depth(int depth)
+  {
+    attr.cap.max_recv_wr = depth;
+    return *this;
+  }
+
+  ConnectionConfiguration & ConnectionConfiguration::inline_data(int bytes)
+  {
+    _inline_data = bytes;
+    attr.cap.max_inline_data = std::max(bytes, 0);
+    return *this;
+  }
+
+  int ConnectionConfiguration::probe_max_inline(ibv_context* ctx)
+  {
+    static std::mutex probes_lock;
+    static std::unordered_map<ibv_context*, int> probes;
+    std::lock_guard<std::mutex> g(probes_lock);
+    auto it = probes.find(ctx);
+    if(it != probes.end())
+      return it->second;
+
+    // The limit is not reported by ibv_query_device - try to create QPs,
+    // starting with the largest inline size we consider useful.
+    constexpr int MAX_PROBED_INLINE = 1024;
+    ibv_pd* pd = ibv_alloc_pd(ctx);
+    impl::expect_nonnull(pd);
+    ibv_cq* cq = ibv_create_cq(ctx, 1, nullptr, nullptr, 0);
+    impl::expect_nonnull(cq);
+    ibv_qp_init_attr init_attr;
+    memset(&init_attr, 0, sizeof(init_attr));
+    init_attr.send_cq = cq;
+    init_attr.recv_cq = cq;
+    init_attr.qp_type = IBV_QPT_RC;
+    init_attr.cap.max_send_wr = 1;
+    init_attr.cap.max_recv_wr = 1;
+    init_attr.cap.max_send_sge = ScatterGatherElement::MAX_SGE;
+    init_attr.cap.max_recv_sge = ScatterGatherElement::MAX_SGE;
+
+    int max_inline = 0;
+    for(int bytes = MAX_PROBED_INLINE; bytes > 0; bytes /= 2) {
+      init_attr.cap.max_inline_data = bytes;
+      ibv_qp* qp = ibv_create_qp(pd, &init_attr);
+      if(qp) {
+        // Created QP reports the actual capacity, which might be larger.
+        max_inline = init_attr.cap.max_inline_data;
+        ibv_destroy_qp(qp);
+        break;
+      }
+    }
+    ibv_destroy_cq(cq);
+    ibv_dealloc_pd(pd);
+    SPDLOG_DEBUG("Device {} accepts {} bytes of inline data", ibv_get_device_name(ctx->device), max_inline);
+    probes[ctx] = max_inline;
+    return max_inline;
+  }
+
+  void ConnectionConfiguration::fit(ibv_context* ctx, uint8_t port_num)
+  {
+    ibv_device_attr dev_attr;
+    ibv_port_attr port_attr;
+    impl::expect_zero(ibv_query_device(ctx, &dev_attr));
+    impl::expect_zero(ibv_query_port(ctx, port_num, &port_attr));
+    const char* name = ibv_get_device_name(ctx->device);
+
+    auto check = [name](const char* what, uint32_t requested, int limit) {
+      if(requested > static_cast<uint32_t>(limit))
+        throw std::runtime_error{fmt::format(
+          "Device {} supports {} {}, requested {}", name, limit, what, requested
+        )};
+    };
+    check("send requests", attr.cap.max_send_wr, dev_attr.max_qp_wr);
+    check("receive requests", attr.cap.max_recv_wr, dev_attr.max_qp_wr);
+    check("scatter-gather elements", attr.cap.max_send_sge, dev_attr.max_sge);
+    check("scatter-gather elements", attr.cap.max_recv_sge, dev_attr.max_sge);
+    check("completion queue entries", attr.cap.max_send_wr, dev_attr.max_cqe);
+    check("completion queue entries", attr.cap.max_recv_wr, dev_attr.max_cqe);
+    if(port_attr.state != IBV_PORT_ACTIVE)
+      throw std::runtime_error{fmt::format("Port {} of device {} is not active", port_num, name)};
+
+    // Too large inline size fails the creation of QP.
+    if(_inline_data) {
+      int max_inline = probe_max_inline(ctx);
+      if(_inline_data > max_inline)
+        spdlog::warn("Device {} supports up to {} bytes of inline data, requested {}", name, max_inline, _inline_data);
+      if(_inline_data < 0 || _inline_data > max_inline)
+        attr.cap.max_inline_data = max_inline;
+    }
+
+    // Fewer outstanding reads and atomics are not an error, requests wait in the send queue.
+    conn_param.initiator_depth = std::min(_rd_atomic, dev_attr.max_qp_init_rd_atom);
+    conn_param.responder_resources = std::min(_rd_atomic, dev_attr.max_qp_rd_atom);
+    SPDLOG_DEBUG(
+      "Configuration for device {} port {}: send {}, receive {}, inline {}, initiator depth {}, responder resources {}, MTU {}",
+      name, port_num, attr.cap.max_send_wr, attr.cap.max_recv_wr, attr.cap.max_inline_data,
+      conn_param.initiator_depth, conn_param.responder_resources, 128 << port_attr.active_mtu
+    );
+  }
+
+  WorkRequestBatch::WorkRequestBatch():
+    _size(0),
+    _posted(0)
+  {
+    memset(_wrs.data(), 0, sizeof(ibv_send_wr) * MAX_WORK_REQUESTS);
+  }
+
+  ibv_send_wr* WorkRequestBatch::_next(ScatterGatherElement && elems)
+  {
+    if(full()) {
+      spdlog::error("Batch of work requests is full, capacity {}", MAX_WORK_REQUESTS);
+      return nullptr;
+    }
+    ibv_send_wr* wr = &_wrs[_size];
+    _sges[_size] = std::move(elems);
+    memset(wr, 0, sizeof(ibv_send_wr));
+    wr->sg_list = _sges[_size].array();
+    wr->num_sge = _sges[_size].size();
+    if(wr->num_sge == 1 && wr->sg_list[0].length == 0)
+      wr->num_sge = 0;
+    // Chain is closed when posting.
+    if(_size > 0)
+      _wrs[_size - 1].next = wr;
+    ++_size;
+    return wr;
+  }
+
+  bool WorkRequestBatch::add_write(ScatterGatherElement && elems, const RemoteBuffer & rbuf, bool force_inline)
+  {
+    ibv_send_wr* wr = _next(std::forward<ScatterGatherElement>(elems));
+    if(!wr)
+      return false;
+    wr->opcode = IBV_WR_RDMA_WRITE;
+    wr->send_flags = force_inline ? IBV_SEND_INLINE : 0;
+    wr->wr.rdma.remote_addr = rbuf.addr;
+    wr->wr.rdma.rkey = rbuf.rkey;
+    return true;
+  }
+
+  bool WorkRequestBatch::add_write(ScatterGatherElement && elems, const RemoteBuffer & rbuf,
+      uint32_t immediate, bool force_inline, bool solicited)
+  {
+    ibv_send_wr* wr = _next(std::forward<ScatterGatherElement>(elems));
+    if(!wr)
+      return false;
+    wr->opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr->send_flags = force_inline ? IBV_SEND_INLINE : 0;
+    wr->send_flags |= solicited ? IBV_SEND_SOLICITED : 0;
+    wr->imm_data = htonl(immediate);
+    wr->wr.rdma.remote_addr = rbuf.addr;
+    wr->wr.rdma.rkey = rbuf.rkey;
+    return true;
+  }
+
+  bool WorkRequestBatch::add_send(const ScatterGatherElement & elems, bool force_inline)
+  {
+    ibv_send_wr* wr = _next(ScatterGatherElement{elems});
+    if(!wr)
+      return false;
+    wr->opcode = IBV_WR_SEND;
+    wr->send_flags = force_inline ? IBV_SEND_INLINE : 0;
+    return true;
+  }
+
+  bool WorkRequestBatch::add_read(ScatterGatherElement && elems, const RemoteBuffer & rbuf)
+  {
+    ibv_send_wr* wr = _next(std::forward<ScatterGatherElement>(elems));
+    if(!wr)
+      return false;
+    wr->opcode = IBV_WR_RDMA_READ;
+    wr->send_flags = 0;
+    wr->wr.rdma.remote_addr = rbuf.addr;
+    wr->wr.rdma.rkey = rbuf.rkey;
+    return true;
+  }
+
+  void WorkRequestBatch::signal_last()
+  {
+    if(_size > 0)
+      _wrs[_size - 1].send_flags |= IBV_SEND_SIGNALED;
+  }
+
+  int WorkRequestBatch::size() const
+  {
+    return _size;
+  }
+
+  int WorkRequestBatch::posted() const
+  {
+    return _posted;
+  }
+
+  bool WorkRequestBatch::empty() const
+  {
+    return _size == 0;
+  }
+
+  bool WorkRequestBatch::full() const
+  {
+    return _size == MAX_WORK_REQUESTS;
+  }
+
+  void WorkRequestBatch::clear()
+  {
+    _size = 0;
+    _posted = 0;
   }
 
   Connection::Connection(bool passive):
@@ -21,7 +257,14 @@ namespace rdmalib {
     _req_count(0),
     _private_data(0),
     _passive(passive),
-    _status(ConnectionStatus::UNKNOWN)
+    _status(ConnectionStatus::UNKNOWN),
+    _signal_period(1),
+    _sq_size(0),
+    _sq_outstanding(0),
+    _sq_unsignaled(0),
+    _max_inline_data(0),
+    _wait_mode(WaitMode::SPIN),
+    _stats(StatisticsRegistry::instance().create("connection"))
   {
     inlining(false);
 
@@ -49,11 +292,22 @@ namespace rdmalib {
     _private_data(obj._private_data),
     _passive(obj._passive),
     _status(obj._status),
-    _send_flags(obj._send_flags)
+    _send_flags(obj._send_flags),
+    _signal_period(obj._signal_period),
+    _sq_size(obj._sq_size),
+    _sq_outstanding(obj._sq_outstanding),
+    _sq_unsignaled(obj._sq_unsignaled),
+    _max_inline_data(obj._max_inline_data),
+    _wait_mode(obj._wait_mode),
+    _send_wait(obj._send_wait),
+    _recv_wait(obj._recv_wait),
+    _stats(obj._stats)
   {
     obj._id = nullptr;
     obj._qp = nullptr;
     obj._req_count = 0;
+    obj._sq_outstanding = 0;
+    obj._sq_unsignaled = 0;
 
     for(int i=0; i < _rbatch; i++){
       _batch_wrs[i].wr_id = i;
@@ -80,15 +334,125 @@ namespace rdmalib {
     this->_id = id;
     this->_channel = _id->recv_cq_channel;
     this->_qp = this->_id->qp;
-    SPDLOG_DEBUG("Initialize a connection with id {}", fmt::ptr(_id));
+
+    ibv_qp_attr attr;
+    ibv_qp_init_attr init_attr;
+    impl::expect_zero(ibv_query_qp(_qp, &attr, IBV_QP_CAP, &init_attr));
+    _sq_size = init_attr.cap.max_send_wr;
+    _sq_outstanding = 0;
+    _sq_unsignaled = 0;
+    // The device might support more inline data than requested.
+    _max_inline_data = init_attr.cap.max_inline_data;
+    _stats->qp_num.store(_qp->qp_num, std::memory_order_relaxed);
+    SPDLOG_DEBUG(
+      "Initialize a connection with id {}, send queue size {}, max inline data {}",
+      fmt::ptr(_id), _sq_size, _max_inline_data
+    );
+  }
+
+  void Connection::wait_mode(WaitMode mode, uint32_t spin_budget)
+  {
+    _wait_mode = mode;
+    if(mode != WaitMode::ADAPTIVE)
+      return;
+    _send_wait = AdaptiveWait{spin_budget};
+    _recv_wait = AdaptiveWait{spin_budget};
+    for(ibv_comp_channel* channel : {_channel, _id->send_cq_channel})
+      if(channel)
+        AdaptiveWait::configure(channel);
+  }
+
+  WaitMode Connection::wait_mode() const
+  {
+    return _wait_mode;
   }
 
   void Connection::inlining(bool enable)
   {
+    // Signaling is decided per request, see _acquire_send.
     if(enable)
-      _send_flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE;
+      _send_flags = IBV_SEND_INLINE;
+    else
+      _send_flags = 0;
+  }
+
+  void Connection::selective_signaling(int period)
+  {
+    // The request filling up the send queue is always signaled,
+    // a longer period would not change anything.
+    _signal_period = std::max(1, _sq_size > 0 ? std::min(period, _sq_size) : period);
+    SPDLOG_DEBUG("Connection {} signals every {} send request", fmt::ptr(_id), _signal_period);
+  }
+
+  bool Connection::_acquire_send(ibv_send_wr & wr)
+  {
+    // The queue is full only when the last request has been signaled,
+    // so a blocking poll is guaranteed to make progress.
+    while(_sq_outstanding >= _sq_size) {
+      if(reclaim_send_queue(true) < 0)
+        return false;
+    }
+
+    // Only requests that send local data can be inlined.
+    if(wr.opcode == IBV_WR_RDMA_READ)
+      wr.send_flags &= ~IBV_SEND_INLINE;
+    if(wr.send_flags & IBV_SEND_INLINE) {
+      uint32_t bytes = 0;
+      for(int i = 0; i < wr.num_sge; ++i)
+        bytes += wr.sg_list[i].length;
+      if(bytes > _max_inline_data) {
+        SPDLOG_DEBUG("Request of {} bytes exceeds inline capacity {}, not inlined", bytes, _max_inline_data);
+        wr.send_flags &= ~IBV_SEND_INLINE;
+      }
+    }
+    _stats->send.posted.add();
+    if(wr.send_flags & IBV_SEND_INLINE)
+      _stats->send.inlined.add();
+
+    ++_sq_outstanding;
+    ++_sq_unsignaled;
+    if((wr.send_flags & IBV_SEND_SIGNALED) || _sq_unsignaled >= _signal_period || _sq_outstanding == _sq_size) {
+      wr.send_flags |= IBV_SEND_SIGNALED;
+      wr.wr_id = (static_cast<uint64_t>(_sq_unsignaled) << 32) | static_cast<uint32_t>(wr.wr_id);
+      _sq_unsignaled = 0;
+    }
+    return true;
+  }
+
+  void Connection::_release_send(const ibv_send_wr & wr)
+  {
+    // Roll back a request rejected by ibv_post_send.
+    --_sq_outstanding;
+    if(wr.send_flags & IBV_SEND_SIGNALED)
+      _sq_unsignaled = (wr.wr_id >> 32) - 1;
     else
-      _send_flags = IBV_SEND_SIGNALED;
+      --_sq_unsignaled;
+  }
+
+  int Connection::reclaim_send_queue(bool blocking)
+  {
+    int outstanding = _sq_outstanding;
+    if(std::get<1>(poll_wc(QueueType::SEND, blocking)) < 0)
+      return -1;
+    return outstanding - _sq_outstanding;
+  }
+
+  int Connection::send_queue_credits() const
+  {
+    return _sq_size - _sq_outstanding;
+  }
+
+  bool Connection::drain_send_queue()
+  {
+    bool success = true;
+    while(_sq_outstanding > _sq_unsignaled) {
+      auto [wcs, count] = poll_wc(QueueType::SEND, true);
+      if(count < 0)
+        return false;
+      for(int i = 0; i < count; ++i)
+        success &= wcs[i].status == IBV_WC_SUCCESS;
+    }
+    return success;
   }
 
   void Connection::close()
@@ -150,6 +514,16 @@ namespace rdmalib {
     this->_private_data = private_data;
   }
 
+  uint32_t Connection::max_inline_data() const
+  {
+    return this->_max_inline_data;
+  }
+
+  ConnectionStatistics & Connection::statistics()
+  {
+    return *_stats;
+  }
+
   int32_t Connection::post_send(const ScatterGatherElement & elems, int32_t id, bool force_inline)
   {
     // FIXME: extend with multiple sges
@@ -159,10 +533,14 @@ namespace rdmalib {
     wr.sg_list = elems.array();
     wr.num_sge = elems.size();
     wr.opcode = IBV_WR_SEND;
-    wr.send_flags = force_inline ? IBV_SEND_SIGNALED | IBV_SEND_INLINE : _send_flags;
+    wr.send_flags = force_inline ? IBV_SEND_INLINE : _send_flags;
+    if(!_acquire_send(wr))
+      return -1;
     SPDLOG_DEBUG("Post send to local Local QPN {}",_qp->qp_num);
     int ret = ibv_post_send(_qp, &wr, &bad);
+    _stats->send.doorbells.add();
     if(ret) {
+      _release_send(wr);
       spdlog::error("Post send unsuccesful, reason {} {}, sges_count {}, wr_id {}, wr.send_flags {}",
         errno, strerror(errno), wr.num_sge, wr.wr_id, wr.send_flags
       );
@@ -193,6 +571,7 @@ namespace rdmalib {
         begin = begin->next;
       }
       ret = ibv_post_recv(_qp, &_batch_wrs[0], &bad);
+      _stats->recv.doorbells.add();
       if(ret)
         break;
     }
@@ -209,6 +588,7 @@ namespace rdmalib {
         begin = begin->next;
       }
       ret = ibv_post_recv(_qp, _batch_wrs, &bad);
+      _stats->recv.doorbells.add();
       _batch_wrs[reminder-1].next= &(_batch_wrs[reminder]);
     }
 
@@ -218,6 +598,7 @@ namespace rdmalib {
     }
 
     SPDLOG_DEBUG("Batched Post empty recv succesfull");
+    _stats->recv.posted.add(count);
     return count;
   }
 
@@ -238,10 +619,12 @@ namespace rdmalib {
       if(ret)
         break;
     }
+    _stats->recv.doorbells.add(count);
     if(ret) {
       spdlog::error("Post receive unsuccesful, reason {} {}", ret, strerror(ret));
       return -1;
     }
+    _stats->recv.posted.add(count);
     if(wr.num_sge > 0)
       SPDLOG_DEBUG(
         "Post recv succesfull, sges_count {}, sge[0].addr {}, sge[0].size {}, wr_id {}",
@@ -259,14 +642,18 @@ namespace rdmalib {
     wr.next = nullptr;
     wr.sg_list = elems.array();
     wr.num_sge = elems.size();
-    wr.send_flags = force_inline ? IBV_SEND_SIGNALED | IBV_SEND_INLINE : _send_flags;
+    wr.send_flags = force_inline ? IBV_SEND_INLINE : _send_flags;
     wr.send_flags = force_solicited ? IBV_SEND_SOLICITED | wr.send_flags : wr.send_flags;
 
     if(wr.num_sge == 1 && wr.sg_list[0].length == 0)
       wr.num_sge = 0;
 
+    if(!_acquire_send(wr))
+      return -1;
     int ret = ibv_post_send(_qp, &wr, &bad);
+    _stats->send.doorbells.add();
     if(ret) {
+      _release_send(wr);
       spdlog::error("Post write unsuccesful, reason {} {}, sges_count {}, wr_id {}, remote addr {}, remote rkey {}, imm data {}",
         ret, strerror(ret), wr.num_sge, wr.wr_id,  wr.wr.rdma.remote_addr, wr.wr.rdma.rkey, ntohl(wr.imm_data)
       );
@@ -325,8 +712,12 @@ namespace rdmalib {
     wr.wr.atomic.compare_add = compare;
     wr.wr.atomic.swap = swap;
 
+    if(!_acquire_send(wr))
+      return -1;
     int ret = ibv_post_send(_qp, &wr, &bad);
+    _stats->send.doorbells.add();
     if(ret) {
+      _release_send(wr);
       spdlog::error("Post write unsuccesful, reason {} {}", errno, strerror(errno));
       return -1;
     }
@@ -348,8 +739,12 @@ namespace rdmalib {
     wr.wr.atomic.rkey = rbuf.rkey;
     wr.wr.atomic.compare_add = add;
 
+    if(!_acquire_send(wr))
+      return -1;
     int ret = ibv_post_send(_qp, &wr, &bad);
+    _stats->send.doorbells.add();
     if(ret) {
+      _release_send(wr);
       spdlog::error("Post write unsuccesful, reason {} {}", errno, strerror(errno));
       return -1;
     }
@@ -359,35 +754,156 @@ namespace rdmalib {
     return _req_count - 1;
   }
 
-  std::tuple<ibv_wc*, int> Connection::poll_wc(QueueType type, bool blocking, int count)
+  int32_t Connection::post_read(ScatterGatherElement && elems, const RemoteBuffer & rbuf)
   {
-    int ret = 0;
-    ibv_wc* wcs = (type == QueueType::RECV ? _rwc.data() : _swc.data());
+    ibv_send_wr wr, *bad;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = _req_count++;
+    wr.next = nullptr;
+    wr.sg_list = elems.array();
+    wr.num_sge = elems.size();
+    wr.opcode = IBV_WR_RDMA_READ;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = rbuf.addr;
+    wr.wr.rdma.rkey = rbuf.rkey;
 
-    //spdlog::error("{} {} {}", fmt::ptr(_qp), fmt::ptr(_qp->recv_cq), fmt::ptr(wcs));
-    do {
-      ret = ibv_poll_cq(
-        type == QueueType::RECV ? _qp->recv_cq : _qp->send_cq,
-        count == -1 ? _wc_size : count,
-        wcs
+    if(!_acquire_send(wr))
+      return -1;
+    int ret = ibv_post_send(_qp, &wr, &bad);
+    _stats->send.doorbells.add();
+    if(ret) {
+      _release_send(wr);
+      spdlog::error("Post read unsuccesful, reason {} {}, remote addr {}, remote rkey {}",
+        ret, strerror(ret), wr.wr.rdma.remote_addr, wr.wr.rdma.rkey
       );
-    } while(blocking && ret == 0);
-
-    if(ret < 0) {
-      spdlog::error("Failure of polling events from: {} queue! Return value {}, errno {}", type == QueueType::RECV ? "recv" : "send", ret, errno);
-      return std::make_tuple(nullptr, -1);
+      return -1;
     }
-    if(ret)
-      for(int i = 0; i < ret; ++i) {
-        if(wcs[i].status != IBV_WC_SUCCESS) {
-          spdlog::error(
-            "Queue {} Work Completion {}/{} finished with an error {}, {}",
-            type == QueueType::RECV ? "recv" : "send",
-            i+1, ret, wcs[i].status, ibv_wc_status_str(wcs[i].status)
+    SPDLOG_DEBUG(
+      "Post read succesfull id: {}, sge size: {}, remote addr {}, remote rkey {}",
+      wr.wr_id, wr.num_sge, wr.wr.rdma.remote_addr, wr.wr.rdma.rkey
+    );
+    return _req_count - 1;
+  }
+
+  int32_t Connection::post_batch(WorkRequestBatch & batch)
+  {
+    if(batch.empty())
+      return 0;
+
+    // The batch is split when it does not fit into the free slots of the send queue.
+    int begin = 0;
+    batch._posted = 0;
+    while(begin < batch._size) {
+
+      while(_sq_outstanding >= _sq_size) {
+        if(reclaim_send_queue(true) < 0)
+          return -1;
+      }
+      int end = std::min(batch._size, begin + _sq_size - _sq_outstanding);
+
+      for(int i = begin; i < end; ++i) {
+        ibv_send_wr & wr = batch._wrs[i];
+        wr.wr_id = _req_count++;
+        wr.send_flags |= _send_flags;
+        _acquire_send(wr);
+      }
+      ibv_send_wr* next = batch._wrs[end - 1].next;
+      batch._wrs[end - 1].next = nullptr;
+
+      ibv_send_wr* bad = nullptr;
+      int ret = ibv_post_send(_qp, &batch._wrs[begin], &bad);
+      _stats->send.doorbells.add();
+      batch._wrs[end - 1].next = next;
+      if(ret) {
+        spdlog::error("Post batch unsuccesful, reason {} {}, batch size {}, failed wr_id {}",
+          ret, strerror(ret), batch._size, bad ? static_cast<int64_t>(bad->wr_id) : -1
+        );
+        if(bad && (IBV_SEND_INLINE & bad->send_flags))
+          spdlog::error("The request of size {} was inlined, is it supported by the device?",
+            bad->num_sge ? bad->sg_list[0].length : 0
           );
+        // Requests starting from the failed one were not posted, without it none of them was.
+        for(int i = end - 1; i >= begin; --i) {
+          _release_send(batch._wrs[i]);
+          if(&batch._wrs[i] == bad)
+            break;
         }
-        SPDLOG_DEBUG("Queue {} Ret {}/{} WC {} Status {}", type == QueueType::RECV ? "recv" : "send", i + 1, ret, wcs[i].wr_id, ibv_wc_status_str(wcs[i].status));
+        batch._posted = bad ? static_cast<int>(bad - batch._wrs.data()) : begin;
+        return -1;
       }
+      SPDLOG_DEBUG(
+        "Post batch succesfull, size {}, first wr_id {} to local QPN {}",
+        end - begin, batch._wrs[begin].wr_id, _qp->qp_num
+      );
+      begin = end;
+      batch._posted = end;
+    }
+    return batch._size;
+  }
+
+  [[gnu::cold]] void LogCompletionErrors::operator()(const ibv_wc & wc) const
+  {
+    spdlog::error(
+      "Work Completion {} finished with an error {}, {}",
+      wc.wr_id, wc.status, ibv_wc_status_str(wc.status)
+    );
+  }
+
+  int Connection::_poll(QueueType type, bool blocking, int count, ibv_wc* wcs)
+  {
+    int ret = 0;
+    ibv_cq* cq = type == QueueType::RECV ? _qp->recv_cq : _qp->send_cq;
+    ibv_comp_channel* channel = type == QueueType::RECV ? _channel : _id->send_cq_channel;
+    QueueStatistics & stats = type == QueueType::RECV ? _stats->recv : _stats->send;
+    if(blocking && _wait_mode == WaitMode::ADAPTIVE && channel) {
+      AdaptiveWait & waiter = type == QueueType::RECV ? _recv_wait : _send_wait;
+      ret = waiter.wait(cq, channel, count, wcs);
+    } else {
+      // Empty polls of a blocking spin are accumulated locally.
+      uint64_t empty = 0;
+      while((ret = ibv_poll_cq(cq, count, wcs)) == 0 && blocking)
+        ++empty;
+      if(empty) {
+        stats.polls.add(empty);
+        stats.empty_polls.add(empty);
+      }
+    }
+    stats.record_poll(ret);
+
+    if(__builtin_expect(ret < 0, 0)) {
+      spdlog::error("Failure of polling events from: {} queue! Return value {}, errno {}", type == QueueType::RECV ? "recv" : "send", ret, errno);
+      return -1;
+    }
+    return ret;
+  }
+
+  void Connection::_retire_sends(const ibv_wc* wcs, int count)
+  {
+    // Each signaled request retires itself and the unsignaled ones posted before it.
+    for(int i = 0; i < count; ++i)
+      if(wcs[i].qp_num == _qp->qp_num)
+        _sq_outstanding -= wcs[i].wr_id >> 32;
+  }
+
+  std::tuple<ibv_wc*, int> Connection::poll_wc(QueueType type, bool blocking, int count)
+  {
+    ibv_wc* wcs = (type == QueueType::RECV ? _rwc.data() : _swc.data());
+    int ret = _poll(type, blocking, count == -1 ? _wc_size : count, wcs);
+    if(ret < 0)
+      return std::make_tuple(nullptr, -1);
+    for(int i = 0; i < ret; ++i) {
+      if(wcs[i].status != IBV_WC_SUCCESS) {
+        (type == QueueType::RECV ? _stats->recv : _stats->send).record_error(wcs[i]);
+        spdlog::error(
+          "Queue {} Work Completion {}/{} finished with an error {}, {}",
+          type == QueueType::RECV ? "recv" : "send",
+          i+1, ret, wcs[i].status, ibv_wc_status_str(wcs[i].status)
+        );
+      }
+      SPDLOG_DEBUG("Queue {} Ret {}/{} WC {} Status {}", type == QueueType::RECV ? "recv" : "send", i + 1, ret, wcs[i].wr_id, ibv_wc_status_str(wcs[i].status));
+    }
+    if(type == QueueType::SEND)
+      _retire_sends(wcs, ret);
     return std::make_tuple(wcs, ret);
   }
 
@@ -400,7 +916,14 @@ namespace rdmalib {
   {
     ibv_cq* ev_cq = nullptr;
     void* ev_ctx = nullptr;
-    impl::expect_zero(ibv_get_cq_event(_channel, &ev_cq, &ev_ctx));
+    // The channel is non-blocking in the adaptive wait mode.
+    while(ibv_get_cq_event(_channel, &ev_cq, &ev_ctx)) {
+      pollfd fd{_channel->fd, POLLIN, 0};
+      if(errno != EAGAIN || ::poll(&fd, 1, -1) < 0) {
+        spdlog::error("Failed to get completion event, errno {}", errno);
+        return nullptr;
+      }
+    }
     return ev_cq;
   }
 
@@ -0,0 +1,220 @@
+
+#include <cstring>
+
+#include <poll.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/connector.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib {
+
+  AsyncConnector::AsyncConnector(const std::string & ip, int port, int recv_buf, int max_inline_data):
+    _addr(ip, port, false),
+    _ec(nullptr),
+    _closing(false)
+  {
+    _cfg.recv_depth(recv_buf).inline_data(max_inline_data);
+    impl::expect_nonzero(_ec = rdma_create_event_channel());
+    _events = std::thread{&AsyncConnector::_process_events, this};
+    SPDLOG_DEBUG("Create AsyncConnector to {}:{}", ip, port);
+  }
+
+  AsyncConnector::~AsyncConnector()
+  {
+    _closing = true;
+    _events.join();
+    // Connections still in progress are abandoned, their users are notified.
+    while(!_pending.empty())
+      _finish(_pending.begin()->first, false);
+    rdma_destroy_event_channel(_ec);
+    SPDLOG_DEBUG("Destroy AsyncConnector");
+  }
+
+  ConnectionConfiguration & AsyncConnector::configuration()
+  {
+    return _cfg;
+  }
+
+  bool AsyncConnector::connect(uint32_t secret, prepare_t prepare, callback_t callback)
+  {
+    std::unique_ptr<Pending> pending{new Pending{secret, _cfg, std::move(prepare), std::move(callback), nullptr}};
+    if(secret) {
+      pending->cfg.conn_param.private_data = &pending->secret;
+      pending->cfg.conn_param.private_data_len = sizeof(uint32_t);
+      SPDLOG_DEBUG("Setting connection secret {} of length {}", secret, sizeof(uint32_t));
+    }
+
+    rdma_cm_id* id;
+    if(rdma_create_id(_ec, &id, nullptr, RDMA_PS_TCP)) {
+      spdlog::error("Failed to create a connection id, reason {} {}", errno, strerror(errno));
+      return false;
+    }
+    // Registered before resolution starts - the event thread can see the id immediately.
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _pending.emplace(id, std::move(pending));
+    }
+    if(rdma_resolve_addr(id, _addr.addrinfo->ai_src_addr, _addr.addrinfo->ai_dst_addr, RESOLVE_TIMEOUT_MS)) {
+      spdlog::error("Address resolution failed, reason {} {}", errno, strerror(errno));
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _pending.erase(id);
+      }
+      rdma_destroy_id(id);
+      return false;
+    }
+    return true;
+  }
+
+  std::future<std::unique_ptr<Connection>> AsyncConnector::connect(uint32_t secret, prepare_t prepare)
+  {
+    auto promise = std::make_shared<std::promise<std::unique_ptr<Connection>>>();
+    auto future = promise->get_future();
+    bool started = connect(secret, std::move(prepare),
+      [promise](std::unique_ptr<Connection> conn) {
+        promise->set_value(std::move(conn));
+      }
+    );
+    if(!started)
+      promise->set_value(nullptr);
+    return future;
+  }
+
+  int AsyncConnector::pending() const
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _pending.size();
+  }
+
+  void AsyncConnector::_process_events()
+  {
+    pollfd pfd{_ec->fd, POLLIN, 0};
+    while(!_closing) {
+
+      int ret = ::poll(&pfd, 1, EVENT_POLL_TIMEOUT_MS);
+      if(ret < 0 && errno != EINTR) {
+        spdlog::error("Polling of connection events failed, reason {} {}", errno, strerror(errno));
+        return;
+      }
+      if(ret <= 0)
+        continue;
+
+      rdma_cm_event* event;
+      if(rdma_get_cm_event(_ec, &event)) {
+        spdlog::error("Failed to get a connection event, reason {} {}", errno, strerror(errno));
+        continue;
+      }
+      rdma_cm_id* id = event->id;
+      rdma_cm_event_type type = event->event;
+      int status = event->status;
+      SPDLOG_DEBUG("[AsyncConnector] Event {} for id {} status {}", rdma_event_str(type), fmt::ptr(id), status);
+      // Acknowledge first, the id is migrated or destroyed while handling the event.
+      rdma_ack_cm_event(event);
+      _handle(id, type, status);
+    }
+  }
+
+  void AsyncConnector::_handle(rdma_cm_id* id, rdma_cm_event_type event, int status)
+  {
+    Pending* pending;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      auto it = _pending.find(id);
+      if(it == _pending.end()) {
+        SPDLOG_DEBUG("[AsyncConnector] Ignore event {} of an unknown id", rdma_event_str(event));
+        return;
+      }
+      // Entries are removed only by this thread.
+      pending = it->second.get();
+    }
+
+    switch(event) {
+      case RDMA_CM_EVENT_ADDR_RESOLVED:
+        if(!_create_qp(id, *pending))
+          _finish(id, false);
+        else if(rdma_resolve_route(id, RESOLVE_TIMEOUT_MS)) {
+          spdlog::error("Route resolution failed, reason {} {}", errno, strerror(errno));
+          _finish(id, false);
+        }
+        break;
+      case RDMA_CM_EVENT_ROUTE_RESOLVED:
+        if(rdma_connect(id, &pending->cfg.conn_param)) {
+          spdlog::error("Connection unsuccesful, reason {} {}", errno, strerror(errno));
+          _finish(id, false);
+        }
+        break;
+      case RDMA_CM_EVENT_ESTABLISHED:
+        _finish(id, true);
+        break;
+      case RDMA_CM_EVENT_ADDR_ERROR:
+      case RDMA_CM_EVENT_ROUTE_ERROR:
+      case RDMA_CM_EVENT_CONNECT_ERROR:
+      case RDMA_CM_EVENT_UNREACHABLE:
+      case RDMA_CM_EVENT_REJECTED:
+        spdlog::error("Connection unsuccesful, event {} status {}", rdma_event_str(event), status);
+        _finish(id, false);
+        break;
+      default:
+        SPDLOG_DEBUG("[AsyncConnector] Ignore event {}", rdma_event_str(event));
+        break;
+    }
+  }
+
+  bool AsyncConnector::_create_qp(rdma_cm_id* id, Pending & pending)
+  {
+    // The device is known only after address resolution.
+    try {
+      pending.cfg.fit(id->verbs, id->port_num);
+    } catch(const std::runtime_error & e) {
+      spdlog::error("[AsyncConnector] Connection unsuccesful: {}", e.what());
+      return false;
+    }
+    if(rdma_create_qp(id, nullptr, &pending.cfg.attr)) {
+      spdlog::error("Failed to create a queue pair, reason {} {}", errno, strerror(errno));
+      return false;
+    }
+    pending.conn.reset(new Connection());
+    pending.conn->initialize(id);
+    if(pending.prepare)
+      pending.prepare(*pending.conn);
+    return true;
+  }
+
+  void AsyncConnector::_finish(rdma_cm_id* id, bool success)
+  {
+    std::unique_ptr<Pending> pending;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      auto it = _pending.find(id);
+      pending = std::move(it->second);
+      _pending.erase(it);
+    }
+
+    // Further events of the connection are delivered to its own channel,
+    // as for connections created with rdma_create_ep.
+    if(success && rdma_migrate_id(id, nullptr)) {
+      spdlog::error("Failed to migrate the connection id, reason {} {}", errno, strerror(errno));
+      success = false;
+    }
+
+    if(success) {
+      spdlog::debug(
+        "[AsyncConnector] Connection succesful to {}, on device {}",
+        _addr._port, ibv_get_device_name(id->verbs->device)
+      );
+      pending->callback(std::move(pending->conn));
+      return;
+    }
+
+    // The connection owns the id once the queue pair has been created.
+    if(pending->conn)
+      pending->conn.reset();
+    else
+      rdma_destroy_id(id);
+    pending->callback(nullptr);
+  }
+
+}
+
@@ -0,0 +1,474 @@
+
+#include <cstring>
+#include <random>
+
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/datagram.hpp>
+#include <rdmalib/rdmalib.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib { namespace impl {
+
+  DatagramEndpoint::DatagramEndpoint(int recv_slots, int send_slots):
+    _ec(nullptr),
+    _id(nullptr),
+    _recv_slots(recv_slots),
+    _send_slots(send_slots),
+    _send_idx(0),
+    _send_outstanding(0),
+    _stats(StatisticsRegistry::instance().create("datagram"))
+  {
+    impl::expect_nonzero(_ec = rdma_create_event_channel());
+  }
+
+  DatagramEndpoint::~DatagramEndpoint()
+  {
+    _close();
+    rdma_destroy_event_channel(_ec);
+  }
+
+  ibv_qp* DatagramEndpoint::qp() const
+  {
+    return _id->qp;
+  }
+
+  ibv_pd* DatagramEndpoint::pd() const
+  {
+    return _id->qp->pd;
+  }
+
+  ConnectionStatistics & DatagramEndpoint::statistics()
+  {
+    return *_stats;
+  }
+
+  bool DatagramEndpoint::_initialize()
+  {
+    ibv_qp_init_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_type = IBV_QPT_UD;
+    attr.sq_sig_all = 1;
+    attr.cap.max_send_wr = _send_slots;
+    attr.cap.max_recv_wr = _recv_slots;
+    attr.cap.max_send_sge = 1;
+    attr.cap.max_recv_sge = 1;
+    // The queue pair of an UDP id is moved to RTS by rdmacm.
+    if(rdma_create_qp(_id, nullptr, &attr)) {
+      spdlog::error("Failed to create a datagram queue pair, reason {} {}", errno, strerror(errno));
+      return false;
+    }
+    _stats->qp_num.store(_id->qp->qp_num, std::memory_order_relaxed);
+
+    _recv_buf = rdmalib::Buffer<char>(_recv_slots * SLOT_SIZE);
+    _recv_buf.register_memory(pd(), IBV_ACCESS_LOCAL_WRITE);
+    _send_buf = rdmalib::Buffer<DatagramMessage>(_send_slots);
+    _send_buf.register_memory(pd(), IBV_ACCESS_LOCAL_WRITE);
+    for(int i = 0; i < _recv_slots; ++i) {
+      if(!_post_recv(i))
+        return false;
+    }
+    return true;
+  }
+
+  void DatagramEndpoint::_close()
+  {
+    if(!_id)
+      return;
+    if(_id->qp) {
+      // Registrations are released before the protection domain of rdmacm.
+      _recv_buf = rdmalib::Buffer<char>();
+      _send_buf = rdmalib::Buffer<DatagramMessage>();
+      rdma_destroy_qp(_id);
+    }
+    rdma_destroy_id(_id);
+    _id = nullptr;
+  }
+
+  bool DatagramEndpoint::_post_recv(int slot)
+  {
+    ibv_sge sge;
+    sge.addr = _recv_buf.address() + slot * SLOT_SIZE;
+    sge.length = SLOT_SIZE;
+    sge.lkey = _recv_buf.lkey();
+    ibv_recv_wr wr, *bad;
+    wr.wr_id = slot;
+    wr.next = nullptr;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    int ret = ibv_post_recv(_id->qp, &wr, &bad);
+    _stats->recv.doorbells.add();
+    _stats->recv.posted.add();
+    if(ret) {
+      spdlog::error("Post datagram receive unsuccesful, reason {} {}", ret, strerror(ret));
+      return false;
+    }
+    return true;
+  }
+
+  const DatagramMessage & DatagramEndpoint::_message(int slot) const
+  {
+    return *reinterpret_cast<const DatagramMessage*>(_recv_buf.data() + slot * SLOT_SIZE + sizeof(ibv_grh));
+  }
+
+  bool DatagramEndpoint::_post_send(const DatagramMessage & msg, ibv_ah* ah, uint32_t qp_num, uint32_t qkey)
+  {
+    if(_send_outstanding == _send_slots && !_reclaim_sends(true))
+      return false;
+
+    DatagramMessage* slot = _send_buf.data() + _send_idx;
+    *slot = msg;
+    ibv_sge sge;
+    sge.addr = reinterpret_cast<uint64_t>(slot);
+    sge.length = sizeof(DatagramMessage);
+    sge.lkey = _send_buf.lkey();
+    ibv_send_wr wr, *bad;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = _send_idx;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.ud.ah = ah;
+    wr.wr.ud.remote_qpn = qp_num;
+    wr.wr.ud.remote_qkey = qkey;
+    int ret = ibv_post_send(_id->qp, &wr, &bad);
+    _stats->send.doorbells.add();
+    _stats->send.posted.add();
+    if(ret) {
+      spdlog::error("Post datagram send unsuccesful, reason {} {}", ret, strerror(ret));
+      return false;
+    }
+    _send_idx = (_send_idx + 1) % _send_slots;
+    ++_send_outstanding;
+    return true;
+  }
+
+  int DatagramEndpoint::_poll_recv()
+  {
+    int ret = ibv_poll_cq(_id->qp->recv_cq, WC_SIZE, _wcs.data());
+    _stats->recv.record_poll(ret);
+    if(ret < 0) {
+      spdlog::error("Failure of polling datagram receives! Return value {}, errno {}", ret, errno);
+      return -1;
+    }
+    for(int i = 0; i < ret; ++i) {
+      if(_wcs[i].status != IBV_WC_SUCCESS)
+        _stats->recv.record_error(_wcs[i]);
+    }
+    return ret;
+  }
+
+  bool DatagramEndpoint::_reclaim_sends(bool blocking)
+  {
+    int ret = 0;
+    do {
+      ret = ibv_poll_cq(_id->qp->send_cq, WC_SIZE, _send_wcs.data());
+    } while(blocking && ret == 0);
+    _stats->send.record_poll(ret);
+    if(ret < 0) {
+      spdlog::error("Failure of polling datagram sends! Return value {}, errno {}", ret, errno);
+      return false;
+    }
+    for(int i = 0; i < ret; ++i) {
+      // Lost datagrams are recovered by retransmissions of the client.
+      if(_send_wcs[i].status != IBV_WC_SUCCESS) {
+        _stats->send.record_error(_send_wcs[i]);
+        spdlog::error(
+          "Datagram send finished with an error {}, {}",
+          _send_wcs[i].status, ibv_wc_status_str(_send_wcs[i].status)
+        );
+      }
+    }
+    _send_outstanding -= ret;
+    return true;
+  }
+
+}}
+
+namespace rdmalib {
+
+  DatagramServer::DatagramServer(const std::string & ip, int port, int recv_slots):
+    DatagramEndpoint(recv_slots, SEND_SLOTS),
+    _port(port)
+  {
+    // UDP port space of rdmacm is separate from the one of connections.
+    Address addr{ip, port, true};
+    impl::expect_zero(rdma_create_id(_ec, &_id, nullptr, RDMA_PS_UDP));
+    impl::expect_zero(rdma_bind_addr(_id, addr.addrinfo->ai_src_addr));
+    impl::expect_true(_initialize(), false, "Couldn't initialize the datagram queue pair");
+    impl::expect_zero(rdma_listen(_id, 10));
+    _port = ntohs(rdma_get_src_port(_id));
+    // Resolutions are answered between polls for requests.
+    int flags = fcntl(_ec->fd, F_GETFL);
+    impl::expect_zero(fcntl(_ec->fd, F_SETFL, flags | O_NONBLOCK));
+    spdlog::info("Datagram control plane listening on port {}, QPN {}", _port, qp()->qp_num);
+  }
+
+  DatagramServer::~DatagramServer()
+  {
+    for(auto & peer : _peers)
+      ibv_destroy_ah(peer.second.ah);
+  }
+
+  int DatagramServer::port() const
+  {
+    return _port;
+  }
+
+  void DatagramServer::process_events()
+  {
+    rdma_cm_event* event;
+    while(!rdma_get_cm_event(_ec, &event)) {
+      rdma_cm_id* id = event->id;
+      rdma_cm_event_type type = event->event;
+      rdma_ack_cm_event(event);
+      if(type != RDMA_CM_EVENT_CONNECT_REQUEST) {
+        SPDLOG_DEBUG("[DatagramServer] Ignore event {}", rdma_event_str(type));
+        continue;
+      }
+      // The client learns our queue pair and its qkey; the resolution needs no state.
+      rdma_conn_param param;
+      memset(&param, 0, sizeof(param));
+      param.qp_num = qp()->qp_num;
+      if(rdma_accept(id, &param))
+        spdlog::error("Failed to answer datagram address resolution, reason {} {}", errno, strerror(errno));
+      rdma_destroy_id(id);
+    }
+  }
+
+  void DatagramServer::forget(uint64_t client)
+  {
+    auto it = _peers.find(client);
+    if(it == _peers.end())
+      return;
+    ibv_destroy_ah(it->second.ah);
+    _peers.erase(it);
+  }
+
+  DatagramServer::Peer* DatagramServer::_peer(const ibv_wc & wc, const DatagramMessage & msg, bool & duplicate)
+  {
+    auto it = _peers.find(msg.client);
+    // Address handles are created once for each client.
+    if(it == _peers.end() || it->second.qp_num != wc.src_qp) {
+      ibv_grh* grh = reinterpret_cast<ibv_grh*>(_recv_buf.data() + wc.wr_id * SLOT_SIZE);
+      ibv_ah* ah = ibv_create_ah_from_wc(pd(), const_cast<ibv_wc*>(&wc), grh, _id->port_num);
+      if(!ah) {
+        spdlog::error("Failed to create address handle of client {}, reason {} {}", msg.client, errno, strerror(errno));
+        return nullptr;
+      }
+      if(it != _peers.end())
+        ibv_destroy_ah(it->second.ah);
+      it = _peers.insert_or_assign(msg.client, Peer{ah, wc.src_qp, 0, DatagramStatus::SUCCESS}).first;
+    }
+
+    Peer & peer = it->second;
+    // The client has already received the acknowledgment.
+    if(msg.seq < peer.seq)
+      return nullptr;
+    duplicate = msg.seq == peer.seq;
+    peer.seq = msg.seq;
+    return &peer;
+  }
+
+  bool DatagramServer::_acknowledge(const DatagramMessage & msg, const Peer & peer)
+  {
+    DatagramMessage ack;
+    memset(&ack, 0, sizeof(ack));
+    ack.client = msg.client;
+    ack.seq = msg.seq;
+    ack.type = DatagramType::ACK;
+    ack.status = peer.status;
+    if(!_reclaim_sends(false))
+      return false;
+    return _post_send(ack, peer.ah, peer.qp_num, RDMA_UDP_QKEY);
+  }
+
+  DatagramClient::DatagramClient(const std::string & ip, int port):
+    DatagramEndpoint(RECV_SLOTS, SEND_SLOTS),
+    _address(ip),
+    _port(port),
+    _seq(0),
+    _ah(nullptr),
+    _remote_qpn(0),
+    _remote_qkey(0),
+    _timeout(DEFAULT_RETRANSMIT_TIMEOUT),
+    _retries(DEFAULT_RETRIES)
+  {
+    std::random_device rd;
+    _client = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+
+  DatagramClient::~DatagramClient()
+  {
+    if(_ah)
+      ibv_destroy_ah(_ah);
+  }
+
+  bool DatagramClient::connected() const
+  {
+    return _ah;
+  }
+
+  const std::string & DatagramClient::address() const
+  {
+    return _address;
+  }
+
+  int DatagramClient::port() const
+  {
+    return _port;
+  }
+
+  uint64_t DatagramClient::id() const
+  {
+    return _client;
+  }
+
+  void DatagramClient::retransmission(std::chrono::milliseconds timeout, int retries)
+  {
+    _timeout = timeout;
+    _retries = retries;
+  }
+
+  bool DatagramClient::_expect_event(rdma_cm_event_type expected, rdma_cm_event* copy)
+  {
+    rdma_cm_event* event;
+    if(rdma_get_cm_event(_ec, &event)) {
+      spdlog::error("Failed to get a connection event, reason {} {}", errno, strerror(errno));
+      return false;
+    }
+    bool success = event->event == expected;
+    if(!success)
+      spdlog::error(
+        "Datagram address resolution failed, event {} status {}",
+        rdma_event_str(event->event), event->status
+      );
+    else if(copy)
+      *copy = *event;
+    rdma_ack_cm_event(event);
+    return success;
+  }
+
+  bool DatagramClient::connect()
+  {
+    if(_ah)
+      return true;
+
+    Address addr{_address, _port, false};
+    if(rdma_create_id(_ec, &_id, nullptr, RDMA_PS_UDP)) {
+      spdlog::error("Failed to create a datagram id, reason {} {}", errno, strerror(errno));
+      _id = nullptr;
+      return false;
+    }
+    bool success =
+      !rdma_resolve_addr(_id, nullptr, addr.addrinfo->ai_dst_addr, RESOLVE_TIMEOUT_MS) &&
+      _expect_event(RDMA_CM_EVENT_ADDR_RESOLVED) &&
+      _initialize() &&
+      !rdma_resolve_route(_id, RESOLVE_TIMEOUT_MS) &&
+      _expect_event(RDMA_CM_EVENT_ROUTE_RESOLVED);
+
+    rdma_cm_event event;
+    if(success) {
+      rdma_conn_param param;
+      memset(&param, 0, sizeof(param));
+      success = !rdma_connect(_id, &param) && _expect_event(RDMA_CM_EVENT_ESTABLISHED, &event);
+    }
+    if(success) {
+      _ah = ibv_create_ah(pd(), &event.param.ud.ah_attr);
+      if(!_ah)
+        spdlog::error("Failed to create address handle of the server, reason {} {}", errno, strerror(errno));
+      _remote_qpn = event.param.ud.qp_num;
+      _remote_qkey = event.param.ud.qkey;
+    }
+    if(!_ah) {
+      spdlog::error("Couldn't resolve datagram queue pair at {}:{}", _address, _port);
+      _close();
+      return false;
+    }
+    SPDLOG_DEBUG(
+      "Resolved datagram queue pair at {}:{}, QPN {}, client id {}",
+      _address, _port, _remote_qpn, _client
+    );
+    return true;
+  }
+
+  bool DatagramClient::_send(DatagramType type, const AllocationRequest* request)
+  {
+    DatagramMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.client = _client;
+    msg.seq = _seq;
+    msg.type = type;
+    if(request)
+      msg.request = *request;
+    if(!_reclaim_sends(false))
+      return false;
+    return _post_send(msg, _ah, _remote_qpn, _remote_qkey);
+  }
+
+  int DatagramClient::_acknowledged(uint32_t seq, DatagramStatus & status)
+  {
+    int count = _poll_recv();
+    if(count < 0)
+      return -1;
+    int found = 0;
+    for(int i = 0; i < count; ++i) {
+      const ibv_wc & wc = _wcs[i];
+      int slot = wc.wr_id;
+      if(wc.status == IBV_WC_SUCCESS && wc.byte_len >= SLOT_SIZE) {
+        const DatagramMessage & msg = _message(slot);
+        if(msg.type == DatagramType::ACK && msg.client == _client && msg.seq == seq) {
+          status = msg.status;
+          found = 1;
+        }
+      }
+      if(!_post_recv(slot))
+        return -1;
+    }
+    return found;
+  }
+
+  bool DatagramClient::request(DatagramType type, DatagramStatus & status, const AllocationRequest* request)
+  {
+    if(!_ah) {
+      spdlog::error("Datagram request to {}:{} before resolving the server", _address, _port);
+      return false;
+    }
+
+    uint32_t seq = ++_seq;
+    for(int attempt = 0; attempt <= _retries; ++attempt) {
+      if(!_send(type, request))
+        return false;
+      auto deadline = std::chrono::steady_clock::now() + _timeout;
+      while(std::chrono::steady_clock::now() < deadline) {
+        int ret = _acknowledged(seq, status);
+        if(ret < 0)
+          return false;
+        if(ret)
+          return true;
+      }
+      SPDLOG_DEBUG("Retransmit datagram request {} of type {}", seq, static_cast<int>(type));
+    }
+    spdlog::error(
+      "Datagram request {} to {}:{} was not acknowledged after {} retransmissions",
+      seq, _address, _port, _retries
+    );
+    return false;
+  }
+
+  bool DatagramClient::notify(DatagramType type)
+  {
+    if(!_ah)
+      return false;
+    ++_seq;
+    DatagramStatus status;
+    // Drop acknowledgments of earlier notifications.
+    return _send(type, nullptr) && _acknowledged(0, status) >= 0;
+  }
+
+}
+
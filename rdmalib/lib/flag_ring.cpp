@@ -0,0 +1,216 @@
+
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/flag_ring.hpp>
+
+namespace rdmalib {
+
+  FlagRing::FlagRing():
+    _memory(nullptr),
+    _slot_size(0),
+    _slots(0),
+    _received(0)
+  {}
+
+  FlagRing::FlagRing(void* memory, uint32_t slot_size, int slots):
+    _memory(static_cast<char*>(memory)),
+    _slot_size(slot_size),
+    _slots(slots),
+    _received(0)
+  {}
+
+  int FlagRing::slots() const
+  {
+    return _slots;
+  }
+
+  uint32_t FlagRing::slot_size() const
+  {
+    return _slot_size;
+  }
+
+  FlagHeader* FlagRing::header(int slot) const
+  {
+    return reinterpret_cast<FlagHeader*>(_memory + static_cast<size_t>(slot) * _slot_size);
+  }
+
+  char* FlagRing::payload(int slot) const
+  {
+    return reinterpret_cast<char*>(header(slot)) + HEADER_SIZE;
+  }
+
+  bool FlagRing::_arrived(int slot, uint32_t seq) const
+  {
+    FlagHeader* hdr = header(slot);
+    if(__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) != seq)
+      return false;
+    // A size that does not fit belongs to a header that is still being written.
+    uint32_t size = __atomic_load_n(&hdr->size, __ATOMIC_RELAXED);
+    if(message_size(size) > _slot_size)
+      return false;
+    auto trailer_ptr = reinterpret_cast<uint64_t*>(payload(slot) + size + padding(size));
+    // Payload reads can't be moved before the trailer.
+    return __atomic_load_n(trailer_ptr, __ATOMIC_ACQUIRE) == trailer(seq);
+  }
+
+  bool FlagRing::pending() const
+  {
+    return _slots && _arrived(_received % _slots, _received + 1);
+  }
+
+  int FlagRing::poll(ibv_wc* wcs, int count)
+  {
+    int polled = 0;
+    while(polled < count && _slots) {
+      int slot = _received % _slots;
+      if(!_arrived(slot, _received + 1))
+        break;
+      const FlagHeader* hdr = header(slot);
+      ibv_wc & wc = wcs[polled++];
+      memset(&wc, 0, sizeof(wc));
+      wc.wr_id = slot;
+      wc.status = IBV_WC_SUCCESS;
+      wc.opcode = IBV_WC_RECV_RDMA_WITH_IMM;
+      wc.wc_flags = IBV_WC_WITH_IMM;
+      // Completions carry the immediate in network order.
+      wc.imm_data = htonl(hdr->imm);
+      wc.byte_len = hdr->value;
+      ++_received;
+    }
+    return polled;
+  }
+
+  FlagSender::FlagSender():
+    _slot_size(0),
+    _slots(0),
+    _sent(0)
+  {}
+
+  void FlagSender::connect(ibv_pd* pd, const RemoteBuffer & ring, uint32_t slot_size, int slots)
+  {
+    _staging = Buffer<char>(slots * ENTRY_SIZE);
+    _staging.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+    memset(_staging.data(), 0, _staging.bytes());
+    _ring = ring;
+    _slot_size = slot_size;
+    _slots = slots;
+    _sent = 0;
+    SPDLOG_DEBUG(
+      "Flag sender to the ring at {} rkey {} with {} slots of {} bytes",
+      ring.addr, ring.rkey, slots, slot_size
+    );
+  }
+
+  bool FlagSender::connected() const
+  {
+    return _slots > 0;
+  }
+
+  bool FlagSender::add_write(WorkRequestBatch & batch, const ScatterGatherElement & payload,
+      uint32_t imm, uint32_t value, bool force_inline)
+  {
+    if(payload.size() > ScatterGatherElement::MAX_SGE - 2) {
+      spdlog::error("Flag message with {} payload elements, at most {} are supported",
+        payload.size(), ScatterGatherElement::MAX_SGE - 2
+      );
+      return false;
+    }
+    uint32_t size = 0;
+    for(size_t i = 0; i < payload.size(); ++i)
+      size += payload.array()[i].length;
+    if(FlagRing::message_size(size) > _slot_size) {
+      spdlog::error("Flag message with {} bytes of payload exceeds the slot of {} bytes", size, _slot_size);
+      return false;
+    }
+    // Checked before the message takes a sequence number, the receiver expects them without gaps.
+    if(batch.full()) {
+      spdlog::error("Flag message doesn't fit the full batch");
+      return false;
+    }
+
+    int slot = _sent % _slots;
+    uint32_t seq = ++_sent;
+    // Entry: header, padding of zeros and the trailer.
+    char* entry = _staging.data() + slot * ENTRY_SIZE;
+    auto hdr = reinterpret_cast<FlagHeader*>(entry);
+    hdr->seq = seq;
+    hdr->size = size;
+    hdr->imm = imm;
+    hdr->value = value;
+    uint32_t trailer_offset = FlagRing::HEADER_SIZE + FlagRing::TRAILER_SIZE;
+    *reinterpret_cast<uint64_t*>(entry + trailer_offset) = FlagRing::trailer(seq);
+
+    uint32_t pad = FlagRing::padding(size);
+    uintptr_t entry_addr = _staging.address() + slot * ENTRY_SIZE;
+    ScatterGatherElement sge{entry_addr, FlagRing::HEADER_SIZE, _staging.lkey()};
+    for(size_t i = 0; i < payload.size(); ++i) {
+      const ibv_sge & elem = payload.array()[i];
+      sge.add(elem.addr, elem.length, elem.lkey);
+    }
+    sge.add(entry_addr + trailer_offset - pad, pad + FlagRing::TRAILER_SIZE, _staging.lkey());
+    return batch.add_write(
+      std::move(sge),
+      {_ring.addr + static_cast<uint64_t>(slot) * _slot_size, _ring.rkey},
+      force_inline
+    );
+  }
+
+  FlagPoller::FlagPoller():
+    _next(0),
+    _polling(false),
+    _stats(StatisticsRegistry::instance().create("flags"))
+  {}
+
+  void FlagPoller::attach(FlagRing & ring)
+  {
+    _rings.push_back(&ring);
+  }
+
+  void FlagPoller::clear()
+  {
+    _rings.clear();
+    _next = 0;
+  }
+
+  ConnectionStatistics & FlagPoller::statistics()
+  {
+    return *_stats;
+  }
+
+  int FlagPoller::_poll()
+  {
+    if(_polling.load(std::memory_order_relaxed) || _polling.exchange(true, std::memory_order_acquire))
+      return 0;
+    int count = 0;
+    size_t rings = _rings.size();
+    size_t first = _next;
+    for(size_t i = 0; i < rings && count < WC_SIZE; ++i) {
+      size_t idx = (first + i) % rings;
+      int polled = _rings[idx]->poll(_wcs.data() + count, WC_SIZE - count);
+      if(polled) {
+        count += polled;
+        _next = idx + 1;
+      }
+    }
+    _polling.store(false, std::memory_order_release);
+    _stats->recv.record_poll(count);
+    return count;
+  }
+
+  void FlagPoller::wait_events(std::chrono::microseconds period)
+  {
+    while(!_rings.empty()) {
+      for(FlagRing* ring : _rings)
+        if(ring->pending())
+          return;
+      std::this_thread::sleep_for(period);
+    }
+  }
+
+}
+
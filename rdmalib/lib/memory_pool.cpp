@@ -0,0 +1,147 @@
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/memory_pool.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib {
+
+  std::atomic<uint64_t> MemoryPool::_pools_count{0};
+
+  MemoryPool::ThreadCache::ThreadCache()
+  {
+    counts.fill(0);
+  }
+
+  MemoryPool::MemoryPool(ibv_pd* pd, int access, uint32_t arena_size):
+    _pd(pd),
+    _access(access),
+    _arena_size(arena_size),
+    // Identifiers are never reused - a thread can't match the cache of a destroyed pool.
+    _id(++_pools_count),
+    _arena_offset(0),
+    _registered_bytes(0)
+  {
+  }
+
+  MemoryPool::~MemoryPool()
+  {
+    SPDLOG_DEBUG("Release memory pool with {} arenas, {} bytes", _arenas.size(), _registered_bytes);
+  }
+
+  ibv_pd* MemoryPool::pd() const
+  {
+    return _pd;
+  }
+
+  size_t MemoryPool::registered_bytes() const
+  {
+    return _registered_bytes;
+  }
+
+  int MemoryPool::size_class(size_t bytes)
+  {
+    if(bytes <= (1u << MIN_SIZE_CLASS))
+      return MIN_SIZE_CLASS;
+    if(bytes > (1u << MAX_SIZE_CLASS))
+      return -1;
+    return 32 - __builtin_clz(static_cast<uint32_t>(bytes - 1));
+  }
+
+  MemoryPool::ThreadCache & MemoryPool::_thread_cache()
+  {
+    static constexpr int MAX_POOLS = 4;
+    // Pools recently used by this thread.
+    static thread_local std::array<std::pair<uint64_t, ThreadCache*>, MAX_POOLS> caches{};
+    static thread_local int next_entry = 0;
+
+    for(auto & entry : caches)
+      if(entry.first == _id)
+        return *entry.second;
+
+    ThreadCache* cache = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      auto & ptr = _thread_caches[std::this_thread::get_id()];
+      if(!ptr)
+        ptr.reset(new ThreadCache{});
+      cache = ptr.get();
+    }
+    caches[next_entry] = std::make_pair(_id, cache);
+    next_entry = (next_entry + 1) % MAX_POOLS;
+    return *cache;
+  }
+
+  impl::MemoryBlock MemoryPool::_carve(int size_class)
+  {
+    uint32_t bytes = 1u << size_class;
+    // Blocks are aligned to their size, up to a page.
+    uint32_t alignment = std::min(bytes, 4096u);
+    uint32_t offset = (_arena_offset + alignment - 1) & ~(alignment - 1);
+
+    if(_arenas.empty() || static_cast<uint64_t>(offset) + bytes > _arenas.back().bytes()) {
+      uint32_t arena_bytes = std::max(bytes, _arena_size);
+      _arenas.emplace_back(arena_bytes);
+      if(!_arenas.back().ptr()) {
+        spdlog::error("Couldn't allocate an arena of {} bytes for the memory pool", arena_bytes);
+        _arenas.pop_back();
+        return {nullptr, nullptr, size_class};
+      }
+      _arenas.back().register_memory(_pd, _access);
+      if(!_arenas.back().mr()) {
+        spdlog::error("Couldn't register an arena of {} bytes for the memory pool", arena_bytes);
+        _arenas.pop_back();
+        return {nullptr, nullptr, size_class};
+      }
+      _registered_bytes += arena_bytes;
+      SPDLOG_DEBUG("Memory pool registered new arena of {} bytes", arena_bytes);
+      offset = 0;
+    }
+
+    Buffer<char> & arena = _arenas.back();
+    _arena_offset = offset + bytes;
+    return {static_cast<char*>(arena.ptr()) + offset, arena.mr(), size_class};
+  }
+
+  impl::MemoryBlock MemoryPool::allocate_block(size_t bytes)
+  {
+    int cls = size_class(bytes);
+    if(cls < 0) {
+      spdlog::error("Block of {} bytes exceeds the largest size class of the memory pool", bytes);
+      return {nullptr, nullptr, cls};
+    }
+    int idx = cls - MIN_SIZE_CLASS;
+
+    ThreadCache & cache = _thread_cache();
+    if(cache.counts[idx] > 0)
+      return cache.blocks[idx][--cache.counts[idx]];
+
+    std::lock_guard<std::mutex> lock(_lock);
+    auto & free = _free[idx];
+    if(!free.empty()) {
+      impl::MemoryBlock block = free.back();
+      free.pop_back();
+      return block;
+    }
+    return _carve(cls);
+  }
+
+  void MemoryPool::deallocate_block(const impl::MemoryBlock & block)
+  {
+    int idx = block.size_class - MIN_SIZE_CLASS;
+
+    ThreadCache & cache = _thread_cache();
+    if(cache.counts[idx] < THREAD_CACHE_SIZE) {
+      cache.blocks[idx][cache.counts[idx]++] = block;
+      return;
+    }
+
+    // Return half of the cache, other threads can use the blocks again.
+    std::lock_guard<std::mutex> lock(_lock);
+    auto & free = _free[idx];
+    int count = THREAD_CACHE_SIZE / 2;
+    free.insert(free.end(), cache.blocks[idx].end() - count, cache.blocks[idx].end());
+    cache.counts[idx] -= count;
+    free.push_back(block);
+  }
+
+}
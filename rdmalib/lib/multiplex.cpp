@@ -0,0 +1,321 @@
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/multiplex.hpp>
+
+namespace rdmalib {
+
+  Lane::Lane(SharedConnection & shared, int index, int send_slots, int recv_depth, int ring_size):
+    _shared(shared),
+    _index(index),
+    _sq_size(send_slots),
+    _signal_period(1),
+    _sq_unsignaled(0),
+    _sq_posted(0),
+    _req_count(0),
+    _recv_depth(recv_depth),
+    _refill_threshold(std::min(recv_depth, DEFAULT_REFILL_THRESHOLD)),
+    _consumed(0),
+    _stats(StatisticsRegistry::instance().create("lane")),
+    _ring(ring_size),
+    _ring_mask(ring_size - 1),
+    _ring_tail(0),
+    _ring_head(0),
+    _sq_retired(0),
+    _send_failed(false)
+  {
+    _stats->qp_num.store(shared._conn.qp()->qp_num, std::memory_order_relaxed);
+    // Receives carry the lane in wr_id, failed completions are returned to the lane that posted them.
+    for(int i = 0; i < WC_SIZE; ++i) {
+      _recv_wrs[i].wr_id = index;
+      _recv_wrs[i].sg_list = nullptr;
+      _recv_wrs[i].num_sge = 0;
+      _recv_wrs[i].next = i + 1 < WC_SIZE ? &_recv_wrs[i + 1] : nullptr;
+    }
+  }
+
+  int Lane::index() const
+  {
+    return _index;
+  }
+
+  uint32_t Lane::max_inline_data() const
+  {
+    return _shared._conn.max_inline_data();
+  }
+
+  ConnectionStatistics & Lane::statistics()
+  {
+    return *_stats;
+  }
+
+  void Lane::selective_signaling(int period)
+  {
+    _signal_period = std::max(1, std::min(period, _sq_size));
+  }
+
+  int Lane::_outstanding() const
+  {
+    return static_cast<int>(_sq_posted - _sq_retired.load(std::memory_order_acquire));
+  }
+
+  bool Lane::_acquire_send(ibv_send_wr & wr)
+  {
+    if(wr.opcode == IBV_WR_RDMA_READ)
+      wr.send_flags &= ~IBV_SEND_INLINE;
+    if(wr.send_flags & IBV_SEND_INLINE) {
+      uint32_t bytes = 0;
+      for(int i = 0; i < wr.num_sge; ++i)
+        bytes += wr.sg_list[i].length;
+      if(bytes > max_inline_data())
+        wr.send_flags &= ~IBV_SEND_INLINE;
+    }
+    _stats->send.posted.add();
+    if(wr.send_flags & IBV_SEND_INLINE)
+      _stats->send.inlined.add();
+
+    ++_sq_posted;
+    ++_sq_unsignaled;
+    // wr_id: retired requests in the upper half, then the lane and the request counter.
+    wr.wr_id = (static_cast<uint64_t>(_index) << 24) | (wr.wr_id & 0xFFFFFF);
+    if((wr.send_flags & IBV_SEND_SIGNALED) || _sq_unsignaled >= _signal_period || _outstanding() == _sq_size) {
+      wr.send_flags |= IBV_SEND_SIGNALED;
+      wr.wr_id |= static_cast<uint64_t>(_sq_unsignaled) << 32;
+      _sq_unsignaled = 0;
+    }
+    return true;
+  }
+
+  void Lane::_release_send(const ibv_send_wr & wr)
+  {
+    --_sq_posted;
+    if(wr.send_flags & IBV_SEND_SIGNALED)
+      _sq_unsignaled = (wr.wr_id >> 32) - 1;
+    else
+      --_sq_unsignaled;
+  }
+
+  int32_t Lane::post_batch(WorkRequestBatch & batch)
+  {
+    if(batch.empty())
+      return 0;
+
+    int begin = 0;
+    batch._posted = 0;
+    while(begin < batch._size) {
+
+      while(_outstanding() >= _sq_size) {
+        if(!_shared._poll_send())
+          return -1;
+      }
+      int end = std::min(batch._size, begin + _sq_size - _outstanding());
+
+      for(int i = begin; i < end; ++i) {
+        ibv_send_wr & wr = batch._wrs[i];
+        wr.wr_id = _req_count++;
+        _acquire_send(wr);
+      }
+      ibv_send_wr* next = batch._wrs[end - 1].next;
+      batch._wrs[end - 1].next = nullptr;
+
+      // Posting to one QP from many threads is serialized by the provider.
+      ibv_send_wr* bad = nullptr;
+      int ret = ibv_post_send(_shared._conn.qp(), &batch._wrs[begin], &bad);
+      _stats->send.doorbells.add();
+      batch._wrs[end - 1].next = next;
+      if(ret) {
+        spdlog::error("Lane {} post batch unsuccesful, reason {} {}, batch size {}", _index, ret, strerror(ret), batch._size);
+        // Requests starting from the failed one were not posted, without it none of them was.
+        for(int i = end - 1; i >= begin; --i) {
+          _release_send(batch._wrs[i]);
+          if(&batch._wrs[i] == bad)
+            break;
+        }
+        batch._posted = bad ? static_cast<int>(bad - batch._wrs.data()) : begin;
+        return -1;
+      }
+      begin = end;
+      batch._posted = end;
+    }
+    return batch._size;
+  }
+
+  bool Lane::drain_send_queue()
+  {
+    while(_outstanding() > _sq_unsignaled) {
+      if(!_shared._poll_send())
+        return false;
+    }
+    return !_send_failed.exchange(false, std::memory_order_relaxed);
+  }
+
+  bool Lane::_post_receives(int count)
+  {
+    while(count > 0) {
+      int batch = std::min(count, WC_SIZE);
+      _recv_wrs[batch - 1].next = nullptr;
+      ibv_recv_wr* bad = nullptr;
+      int ret = ibv_post_recv(_shared._conn.qp(), &_recv_wrs[0], &bad);
+      _stats->recv.doorbells.add();
+      _stats->recv.posted.add(batch);
+      if(batch < WC_SIZE)
+        _recv_wrs[batch - 1].next = &_recv_wrs[batch];
+      if(ret) {
+        spdlog::error("Lane {} post receive unsuccesful, reason {} {}", _index, ret, strerror(ret));
+        return false;
+      }
+      count -= batch;
+    }
+    return true;
+  }
+
+  bool Lane::refill()
+  {
+    if(_consumed < _refill_threshold)
+      return false;
+    SPDLOG_DEBUG("Lane {} posts {} receives", _index, _consumed);
+    _post_receives(_consumed);
+    _stats->recv.refills.add();
+    _consumed = 0;
+    return true;
+  }
+
+  void Lane::wait_events(std::chrono::microseconds period)
+  {
+    while(_ring_tail.load(std::memory_order_acquire) == _ring_head.load(std::memory_order_relaxed)) {
+      if(!_shared._poll_recv())
+        return;
+      if(_ring_tail.load(std::memory_order_acquire) == _ring_head.load(std::memory_order_relaxed))
+        std::this_thread::sleep_for(period);
+    }
+  }
+
+  bool Lane::_push(const ibv_wc & wc)
+  {
+    uint32_t tail = _ring_tail.load(std::memory_order_relaxed);
+    // Can't happen while the ring holds all receives of the connection.
+    if(tail - _ring_head.load(std::memory_order_acquire) > _ring_mask) {
+      spdlog::error("Lane {} dropped a completion, the ring is full", _index);
+      return false;
+    }
+    _ring[tail & _ring_mask] = wc;
+    _ring_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  int Lane::_take()
+  {
+    uint32_t head = _ring_head.load(std::memory_order_relaxed);
+    uint32_t count = std::min<uint32_t>(_ring_tail.load(std::memory_order_acquire) - head, WC_SIZE);
+    for(uint32_t i = 0; i < count; ++i)
+      _wcs[i] = _ring[(head + i) & _ring_mask];
+    _ring_head.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  SharedConnection::SharedConnection(Connection & conn, int lanes, int recv_depth):
+    _conn(conn),
+    _recv_polling(false),
+    _send_polling(false)
+  {
+    lanes = std::min(lanes, MAX_LANES);
+    // The ring of each lane can hold every receive of the connection.
+    int ring_size = 1;
+    while(ring_size < lanes * recv_depth)
+      ring_size <<= 1;
+    int send_slots = std::max(1, conn.send_queue_credits() / lanes);
+    _lanes.reserve(lanes);
+    for(int i = 0; i < lanes; ++i) {
+      _lanes.emplace_back(new Lane{*this, i, send_slots, recv_depth, ring_size});
+      _lanes.back()->_post_receives(recv_depth);
+    }
+
+    memset(&_recv_wr, 0, sizeof(_recv_wr));
+    SPDLOG_DEBUG(
+      "Shared connection of QPN {} with {} lanes, {} send slots and {} receives per lane",
+      conn.qp()->qp_num, lanes, send_slots, recv_depth
+    );
+  }
+
+  int SharedConnection::lanes() const
+  {
+    return _lanes.size();
+  }
+
+  Lane & SharedConnection::lane(int idx)
+  {
+    return *_lanes[idx];
+  }
+
+  Connection & SharedConnection::connection()
+  {
+    return _conn;
+  }
+
+  bool SharedConnection::_poll_recv()
+  {
+    // Another lane is polling and delivers our completions.
+    if(_recv_polling.load(std::memory_order_relaxed) || _recv_polling.exchange(true, std::memory_order_acquire))
+      return true;
+
+    int ret = ibv_poll_cq(_conn.qp()->recv_cq, Lane::WC_SIZE, _recv_wcs.data());
+    for(int i = 0; i < ret; ++i) {
+      const ibv_wc & wc = _recv_wcs[i];
+      // Failed completions don't carry the immediate, they go to the lane which posted the receive.
+      uint32_t lane = wc.status == IBV_WC_SUCCESS ?
+        (ntohl(wc.imm_data) & InvocationCompletion::LANE_MASK) >> InvocationCompletion::LANE_SHIFT :
+        wc.wr_id;
+      if(lane < _lanes.size() && _lanes[lane]->_push(wc))
+        continue;
+      // The consumed receive is replaced right away.
+      spdlog::error("Receive completion for lane {} of a connection with {} lanes", lane, _lanes.size());
+      ibv_recv_wr* bad = nullptr;
+      ibv_post_recv(_conn.qp(), &_recv_wr, &bad);
+    }
+    _recv_polling.store(false, std::memory_order_release);
+
+    if(ret < 0) {
+      spdlog::error("Failure of polling events from shared recv queue! Return value {}, errno {}", ret, errno);
+      return false;
+    }
+    return true;
+  }
+
+  bool SharedConnection::_poll_send()
+  {
+    if(_send_polling.load(std::memory_order_relaxed) || _send_polling.exchange(true, std::memory_order_acquire))
+      return true;
+
+    int ret = ibv_poll_cq(_conn.qp()->send_cq, Lane::WC_SIZE, _send_wcs.data());
+    for(int i = 0; i < ret; ++i) {
+      const ibv_wc & wc = _send_wcs[i];
+      uint32_t lane = (wc.wr_id >> 24) & 0xFF;
+      if(lane >= _lanes.size())
+        continue;
+      if(wc.status != IBV_WC_SUCCESS) {
+        spdlog::error(
+          "Lane {} send Work Completion finished with an error {}, {}",
+          lane, wc.status, ibv_wc_status_str(wc.status)
+        );
+        _lanes[lane]->_send_failed.store(true, std::memory_order_relaxed);
+      }
+      // Each signaled request retires itself and the unsignaled ones of its lane posted before it.
+      _lanes[lane]->_sq_retired.fetch_add(wc.wr_id >> 32, std::memory_order_release);
+    }
+    _send_polling.store(false, std::memory_order_release);
+
+    if(ret < 0) {
+      spdlog::error("Failure of polling events from shared send queue! Return value {}, errno {}", ret, errno);
+      return false;
+    }
+    return true;
+  }
+
+}
+
@@ -0,0 +1,114 @@
+
+#include <algorithm>
+#include <chrono>
+
+#include <fcntl.h>
+#include <poll.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/poller.hpp>
+
+namespace rdmalib {
+
+  namespace impl {
+
+    // Spin-wait hint, lowers the power and memory traffic of the polling core.
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      _mm_pause();
+#elif defined(__aarch64__)
+      asm volatile("yield");
+#endif
+    }
+
+  }
+
+  AdaptiveWait::AdaptiveWait(uint32_t spin_budget, bool tuning):
+    _spin_budget(std::clamp(spin_budget, MIN_SPIN_BUDGET, MAX_SPIN_BUDGET)),
+    _tuning(tuning),
+    _avg_latency(_spin_budget / 2)
+  {
+  }
+
+  uint32_t AdaptiveWait::spin_budget() const
+  {
+    return _spin_budget;
+  }
+
+  uint32_t AdaptiveWait::average_latency() const
+  {
+    return _avg_latency;
+  }
+
+  bool AdaptiveWait::configure(ibv_comp_channel* channel)
+  {
+    int flags = fcntl(channel->fd, F_GETFL);
+    if(flags < 0 || fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+      spdlog::error("Failed to change file descriptor of completion event channel, errno {}", errno);
+      return false;
+    }
+    return true;
+  }
+
+  void AdaptiveWait::_update(uint32_t latency)
+  {
+    _avg_latency = (7 * static_cast<uint64_t>(_avg_latency) + latency) / 8;
+    if(!_tuning)
+      return;
+    uint32_t budget = 2 * _avg_latency;
+    _spin_budget = budget > MAX_SPIN_BUDGET ? MIN_SPIN_BUDGET : std::max(budget, MIN_SPIN_BUDGET);
+  }
+
+  int AdaptiveWait::wait(ibv_cq* cq, ibv_comp_channel* channel, int count, ibv_wc* wcs)
+  {
+    using clock = std::chrono::steady_clock;
+    auto begin = clock::now();
+    auto elapsed = [begin]() -> uint32_t {
+      return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - begin).count();
+    };
+
+    // Spin with exponential backoff.
+    int ret = 0;
+    int backoff = 1;
+    while(!(ret = ibv_poll_cq(cq, count, wcs))) {
+      if(elapsed() >= _spin_budget)
+        break;
+      for(int i = 0; i < backoff; ++i)
+        impl::cpu_relax();
+      backoff = std::min(2 * backoff, 16);
+    }
+
+    while(!ret) {
+      // Completions arriving before the notification is armed are caught by the next poll.
+      if(ibv_req_notify_cq(cq, 0)) {
+        spdlog::error("Failed to request completion notification, errno {}", errno);
+        return -1;
+      }
+      if((ret = ibv_poll_cq(cq, count, wcs)))
+        break;
+
+      pollfd fd{channel->fd, POLLIN, 0};
+      if(poll(&fd, 1, SLEEP_TIMEOUT_MS) > 0) {
+        ibv_cq* ev_cq = nullptr;
+        void* ev_ctx = nullptr;
+        if(!ibv_get_cq_event(channel, &ev_cq, &ev_ctx))
+          ibv_ack_cq_events(ev_cq, 1);
+      }
+      ret = ibv_poll_cq(cq, count, wcs);
+    }
+
+    if(ret > 0) {
+      uint32_t latency = elapsed();
+      _update(latency);
+      SPDLOG_DEBUG("Adaptive wait finished after {} usec, spin budget {} usec", latency, _spin_budget);
+    }
+    return ret;
+  }
+
+}
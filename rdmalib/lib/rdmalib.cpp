@@ -83,27 +83,7 @@ namespace rdmalib {
     _ec(nullptr),
     _pd(nullptr)
   {
-    // Size of Queue Pair
-    // Maximum requests in send queue
-    // FIXME: configurable -> parallel workers
-    _cfg.attr.cap.max_send_wr = 40;
-    // Maximum requests in receive queue
-    _cfg.attr.cap.max_recv_wr = recv_buf;
-    // Maximal number of scatter-gather requests in a work request in send queue
-    _cfg.attr.cap.max_send_sge = 5;
-    // Maximal number of scatter-gather requests in a work request in receive queue
-    _cfg.attr.cap.max_recv_sge = 5;
-    // Max inlined message size
-    _cfg.attr.cap.max_inline_data = max_inline_data;
-    // Reliable connection
-    _cfg.attr.qp_type = IBV_QPT_RC;
-    _cfg.attr.sq_sig_all = 1;
-
-    // FIXME: make dependent on the number of parallel workers
-    _cfg.conn_param.responder_resources = 4;
-    _cfg.conn_param.initiator_depth =  4;
-    _cfg.conn_param.retry_count = 3;
-    _cfg.conn_param.rnr_retry_count = 3;
+    _cfg.recv_depth(recv_buf).inline_data(max_inline_data);
     SPDLOG_DEBUG("Create RDMAActive");
   }
 
@@ -124,12 +104,20 @@ namespace rdmalib {
     SPDLOG_DEBUG("Destroy RDMAActive");
   }
 
-  void RDMAActive::allocate()
+  bool RDMAActive::allocate()
   {
     if(!_conn) {
       _conn = std::unique_ptr<Connection>(new Connection());
       rdma_cm_id* id;
       impl::expect_zero(rdma_create_ep(&id, _addr.addrinfo, nullptr, nullptr));
+      try {
+        _cfg.fit(id->verbs, id->port_num);
+      } catch(const std::runtime_error & e) {
+        spdlog::error("[RDMAActive] Connection unsuccesful: {}", e.what());
+        rdma_destroy_ep(id);
+        _conn.reset();
+        return false;
+      }
       impl::expect_zero(rdma_create_qp(id, _pd, &_cfg.attr));
       _conn->initialize(id);
       _pd = _conn->id()->pd;
@@ -182,11 +170,13 @@ namespace rdmalib {
     ////
     //ret = rdma_resolve_route(_conn._id, 2000);
     //spdlog::info("{} {} {} {} {} {}", ret, errno, conn != nullptr, conn->verbs != nullptr, conn->pd != nullptr, conn->qp != nullptr);
+    return true;
   }
 
   bool RDMAActive::connect(uint32_t secret)
   {
-    allocate();
+    if(!allocate())
+      return false;
     if(secret) {
       _cfg.conn_param.private_data = &secret;
       _cfg.conn_param.private_data_len = sizeof(uint32_t);
@@ -225,6 +215,11 @@ namespace rdmalib {
     return this->_pd;
   }
 
+  ConnectionConfiguration & RDMAActive::configuration()
+  {
+    return this->_cfg;
+  }
+
   Connection & RDMAActive::connection()
   {
     return *this->_conn;
@@ -241,30 +236,27 @@ namespace rdmalib {
     _listen_id(nullptr),
     _pd(nullptr)
   {
-    // Size of Queue Pair
-    // FIXME: configurable -> parallel workers
-    _cfg.attr.cap.max_send_wr = 40;
-    _cfg.attr.cap.max_recv_wr = recv_buf;
-    _cfg.attr.cap.max_send_sge = 5;
-    _cfg.attr.cap.max_recv_sge = 5;
-    _cfg.attr.cap.max_inline_data = max_inline_data;
-    _cfg.attr.qp_type = IBV_QPT_RC;
-    _cfg.attr.sq_sig_all = 1;
-
-    // FIXME: make dependent on the number of parallel workers
-    _cfg.conn_param.responder_resources = 4;
-    _cfg.conn_param.initiator_depth = 4;
-    _cfg.conn_param.retry_count = 3; 
-    _cfg.conn_param.rnr_retry_count = 3;
+    _cfg.recv_depth(recv_buf).inline_data(max_inline_data);
 
     if(initialize)
       this->allocate();
   }
 
+  RDMAPassive::RDMAPassive():
+    _ec(nullptr),
+    _listen_id(nullptr),
+    _pd(nullptr)
+  {
+  }
+
   RDMAPassive::~RDMAPassive()
   {
-    rdma_destroy_id(this->_listen_id);
-    rdma_destroy_event_channel(this->_ec);
+    // Resources of the SRQ must be released before the protection domain.
+    _srq.reset();
+    if(this->_listen_id)
+      rdma_destroy_id(this->_listen_id);
+    if(this->_ec)
+      rdma_destroy_event_channel(this->_ec);
   }
 
   void RDMAPassive::allocate()
@@ -276,6 +268,10 @@ namespace rdmalib {
     impl::expect_zero(rdma_listen(this->_listen_id, 10));
     this->_addr._port = ntohs(rdma_get_src_port(this->_listen_id));
     this->_pd = _listen_id->pd;
+    // Reject unsupported configurations before clients connect.
+    // Without a device, i.e., when listening on all interfaces, we check at connection.
+    if(_listen_id->verbs)
+      _cfg.fit(_listen_id->verbs, _listen_id->port_num);
     spdlog::info(
       "Listening on device {}, port {}",
       ibv_get_device_name(this->_listen_id->verbs->device), this->_addr._port
@@ -291,6 +287,23 @@ namespace rdmalib {
     return this->_pd;
   }
 
+  ConnectionConfiguration & RDMAPassive::configuration()
+  {
+    return this->_cfg;
+  }
+
+  SharedReceiveQueue & RDMAPassive::enable_srq(int slots, uint32_t slot_size)
+  {
+    _srq.reset(new SharedReceiveQueue{_pd, slots, slot_size});
+    spdlog::info("Enabled shared receive queue with {} slots of size {}", slots, slot_size);
+    return *_srq;
+  }
+
+  SharedReceiveQueue* RDMAPassive::srq() const
+  {
+    return _srq.get();
+  }
+
   void RDMAPassive::set_nonblocking_poll()
   {
     int fd = this->_ec->fd;
@@ -316,10 +329,12 @@ namespace rdmalib {
     return rc > 0;
   }
 
-  std::tuple<Connection*, ConnectionStatus> RDMAPassive::poll_events(bool share_cqs)
+  std::tuple<Connection*, ConnectionStatus> RDMAPassive::poll_events(SharedCompletionQueue* shared_cq)
   {
     rdma_cm_event* event = nullptr;
 		Connection* connection = nullptr;
+    // The identifier of a rejected request is ours to release.
+    rdma_cm_id* rejected = nullptr;
     ConnectionStatus status = ConnectionStatus::UNKNOWN;
 
     // Poll rdma cm events.
@@ -334,6 +349,17 @@ namespace rdmalib {
 
     switch (event->event) { 
       case RDMA_CM_EVENT_CONNECT_REQUEST:
+        // A request from a device with lower limits is rejected, other clients are still served.
+        try {
+          _cfg.fit(event->id->verbs, event->id->port_num);
+        } catch(const std::runtime_error & e) {
+          spdlog::error("[RDMAPassive] Rejecting connection request: {}", e.what());
+          if(rdma_reject(event->id, nullptr, 0))
+            spdlog::error("Connection reject unsuccesful, reason {} {}", errno, strerror(errno));
+          rejected = event->id;
+          status = ConnectionStatus::REJECTED;
+          break;
+        }
         connection = new Connection{true};
         if(event->param.conn.private_data_len != 0) {
           uint32_t data = *reinterpret_cast<const uint32_t*>(event->param.conn.private_data);
@@ -351,8 +377,16 @@ namespace rdmalib {
         );
 
         // Make sure to allocate new completion queue when they're not reused.
-        if(!share_cqs)
-          _cfg.attr.send_cq = _cfg.attr.recv_cq = nullptr;
+        // Send queue is never shared - the send credits of each connection
+        // are reclaimed by polling its own send completions.
+        _cfg.attr.send_cq = nullptr;
+        if(_srq) {
+          _cfg.attr.srq = _srq->srq();
+          _cfg.attr.recv_cq = _srq->completion_queue().cq();
+        } else if(shared_cq)
+          _cfg.attr.recv_cq = shared_cq->cq();
+        else
+          _cfg.attr.recv_cq = nullptr;
         SPDLOG_DEBUG(
           "[RDMAPassive] Using CQ for creating a QP: send {} recv {}",
           fmt::ptr(_cfg.attr.send_cq),fmt::ptr(_cfg.attr.recv_cq)
@@ -408,6 +442,8 @@ namespace rdmalib {
         break;
     }
     rdma_ack_cm_event(event);
+    if(rejected)
+      rdma_destroy_id(rejected);
 
     return std::make_tuple(connection, status);
   }
@@ -0,0 +1,185 @@
+
+#include <algorithm>
+
+// sysconf
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/registration_cache.hpp>
+
+namespace rdmalib {
+
+  RegistrationCache::RegistrationCache(ibv_pd* pd, int access, size_t pinned_budget, Hooks hooks):
+    _pd(pd),
+    _access(access),
+    _pinned_budget(pinned_budget),
+    _pinned_bytes(0),
+    _page_size(sysconf(_SC_PAGESIZE)),
+    _hooks(std::move(hooks))
+  {
+    // ibv_reg_mr is a macro in recent versions of verbs, it can't be stored directly.
+    if(!_hooks.register_memory)
+      _hooks.register_memory = [](ibv_pd* pd, void* ptr, size_t bytes, int access) {
+        return ibv_reg_mr(pd, ptr, bytes, access);
+      };
+    if(!_hooks.deregister_memory)
+      _hooks.deregister_memory = [](ibv_mr* mr) {
+        ibv_dereg_mr(mr);
+      };
+  }
+
+  RegistrationCache::~RegistrationCache()
+  {
+    SPDLOG_DEBUG(
+      "Release registration cache with {} regions, {} pinned bytes",
+      _entries.size(), _pinned_bytes
+    );
+    for(auto & entry : _entries)
+      _hooks.deregister_memory(entry.second->mr);
+  }
+
+  ibv_pd* RegistrationCache::pd() const
+  {
+    return _pd;
+  }
+
+  size_t RegistrationCache::pinned_bytes() const
+  {
+    return _pinned_bytes;
+  }
+
+  size_t RegistrationCache::pinned_budget() const
+  {
+    return _pinned_budget;
+  }
+
+  size_t RegistrationCache::size() const
+  {
+    return _ranges.size();
+  }
+
+  ibv_mr* RegistrationCache::acquire(const void* ptr, size_t bytes)
+  {
+    if(!ptr || !bytes) {
+      spdlog::error("Can't register an empty memory range");
+      return nullptr;
+    }
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr) & ~(_page_size - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + bytes + _page_size - 1) & ~(_page_size - 1);
+
+    // The last range starting at or before our begin is the only one that can cover us.
+    auto it = _ranges.upper_bound(begin);
+    if(it != _ranges.begin()) {
+      --it;
+      Entry* entry = it->second;
+      if(entry->end >= end) {
+        if(!entry->references++)
+          _unused.erase(entry->lru);
+        return entry->mr;
+      }
+      if(entry->end <= begin)
+        ++it;
+    }
+
+    // Replace all overlapping ranges with a single registration.
+    while(it != _ranges.end() && it->first < end) {
+      Entry* entry = it->second;
+      ++it;
+      begin = std::min(begin, entry->begin);
+      end = std::max(end, entry->end);
+      _detach(entry);
+    }
+
+    _evict(end - begin);
+    ibv_mr* mr = _hooks.register_memory(_pd, reinterpret_cast<void*>(begin), end - begin, _access);
+    if(!mr) {
+      spdlog::error("Memory registration of {} bytes failed, errno {}", end - begin, errno);
+      return nullptr;
+    }
+    _pinned_bytes += end - begin;
+    if(_pinned_bytes > _pinned_budget)
+      spdlog::warn(
+        "Pinned memory {} exceeds the registration cache budget {}",
+        _pinned_bytes, _pinned_budget
+      );
+    SPDLOG_DEBUG(
+      "Registered range [{:x}, {:x}), lkey {}, rkey {}",
+      begin, end, mr->lkey, mr->rkey
+    );
+
+    Entry* entry = new Entry{begin, end, mr, 1, false, _unused.end()};
+    _entries.emplace(mr, std::unique_ptr<Entry>{entry});
+    _ranges.emplace(begin, entry);
+    return mr;
+  }
+
+  void RegistrationCache::release(ibv_mr* mr)
+  {
+    auto it = _entries.find(mr);
+    if(it == _entries.end()) {
+      spdlog::error("Releasing memory region not owned by the registration cache");
+      return;
+    }
+    Entry* entry = it->second.get();
+    if(--entry->references)
+      return;
+    if(entry->detached) {
+      _deregister(entry);
+    } else {
+      entry->lru = _unused.insert(_unused.begin(), entry);
+      _evict(0);
+    }
+  }
+
+  void RegistrationCache::invalidate(const void* ptr, size_t bytes)
+  {
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t end = begin + bytes;
+
+    auto it = _ranges.upper_bound(begin);
+    if(it != _ranges.begin() && std::prev(it)->second->end > begin)
+      --it;
+    while(it != _ranges.end() && it->first < end) {
+      Entry* entry = it->second;
+      ++it;
+      if(entry->references)
+        spdlog::warn(
+          "Invalidating range [{:x}, {:x}) with {} active users",
+          entry->begin, entry->end, entry->references
+        );
+      _detach(entry);
+    }
+  }
+
+  void RegistrationCache::_detach(Entry* entry)
+  {
+    _ranges.erase(entry->begin);
+    if(entry->references) {
+      entry->detached = true;
+    } else {
+      _unused.erase(entry->lru);
+      _deregister(entry);
+    }
+  }
+
+  void RegistrationCache::_deregister(Entry* entry)
+  {
+    SPDLOG_DEBUG("Deregister range [{:x}, {:x})", entry->begin, entry->end);
+    _pinned_bytes -= entry->end - entry->begin;
+    _hooks.deregister_memory(entry->mr);
+    _entries.erase(entry->mr);
+  }
+
+  void RegistrationCache::_evict(size_t bytes)
+  {
+    while(!_unused.empty() && _pinned_bytes + bytes > _pinned_budget) {
+      Entry* entry = _unused.back();
+      _unused.pop_back();
+      _ranges.erase(entry->begin);
+      _deregister(entry);
+    }
+  }
+
+}
+
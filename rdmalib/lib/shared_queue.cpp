@@ -0,0 +1,218 @@
+
+// poll
+#include <poll.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/shared_queue.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib {
+
+  SharedCompletionQueue::SharedCompletionQueue(ibv_context* ctx, int size):
+    _channel(nullptr),
+    _cq(nullptr),
+    _wait_mode(WaitMode::SPIN),
+    _stats(StatisticsRegistry::instance().create("shared_cq"))
+  {
+    impl::expect_nonnull(_channel = ibv_create_comp_channel(ctx));
+    impl::expect_nonnull(_cq = ibv_create_cq(ctx, size, nullptr, _channel, 0));
+    SPDLOG_DEBUG("Allocated shared completion queue {} of size {}", fmt::ptr(_cq), size);
+  }
+
+  SharedCompletionQueue::~SharedCompletionQueue()
+  {
+    if(_cq && ibv_destroy_cq(_cq))
+      spdlog::error("Couldn't destroy completion queue, reason {} {}", errno, strerror(errno));
+    if(_channel && ibv_destroy_comp_channel(_channel))
+      spdlog::error("Couldn't destroy completion channel, reason {} {}", errno, strerror(errno));
+  }
+
+  ibv_cq* SharedCompletionQueue::cq() const
+  {
+    return _cq;
+  }
+
+  ibv_comp_channel* SharedCompletionQueue::completion_channel() const
+  {
+    return _channel;
+  }
+
+  void SharedCompletionQueue::attach(RecvBuffer & rcv_buffer)
+  {
+    _receivers[rcv_buffer._conn->qp()->qp_num] = &rcv_buffer;
+  }
+
+  void SharedCompletionQueue::detach(const Connection & conn)
+  {
+    _receivers.erase(conn.qp()->qp_num);
+  }
+
+  ConnectionStatistics & SharedCompletionQueue::statistics()
+  {
+    return *_stats;
+  }
+
+  void SharedCompletionQueue::wait_mode(WaitMode mode, uint32_t spin_budget)
+  {
+    _wait_mode = mode;
+    if(mode == WaitMode::ADAPTIVE) {
+      _waiter = AdaptiveWait{spin_budget};
+      AdaptiveWait::configure(_channel);
+    }
+  }
+
+  int SharedCompletionQueue::_poll(bool blocking)
+  {
+    int ret = 0;
+    if(blocking && _wait_mode == WaitMode::ADAPTIVE) {
+      ret = _waiter.wait(_cq, _channel, _wc_size, _wcs.data());
+    } else {
+      // Empty polls of a blocking spin are accumulated locally.
+      uint64_t empty = 0;
+      while((ret = ibv_poll_cq(_cq, _wc_size, _wcs.data())) == 0 && blocking)
+        ++empty;
+      if(empty) {
+        _stats->recv.polls.add(empty);
+        _stats->recv.empty_polls.add(empty);
+      }
+    }
+    _stats->recv.record_poll(ret);
+
+    if(ret < 0) {
+      spdlog::error("Failure of polling events from shared completion queue! Return value {}, errno {}", ret, errno);
+      return -1;
+    }
+    return ret;
+  }
+
+  void SharedCompletionQueue::_route(int count)
+  {
+    for(int i = 0; i < count; ++i) {
+      auto it = _receivers.find(_wcs[i].qp_num);
+      if(it != _receivers.end()) {
+        // Each completion consumed one receive of its own queue pair.
+        it->second->_conn->statistics().recv.completions.add();
+        it->second->_requests--;
+        it->second->refill();
+      }
+    }
+  }
+
+  std::tuple<ibv_wc*, int> SharedCompletionQueue::poll(bool blocking)
+  {
+    int ret = _poll(blocking);
+    if(ret < 0)
+      return std::make_tuple(nullptr, -1);
+    for(int i = 0; i < ret; ++i) {
+      if(_wcs[i].status != IBV_WC_SUCCESS) {
+        _stats->recv.record_error(_wcs[i]);
+        spdlog::error(
+          "Shared queue Work Completion {}/{} finished with an error {}, {}",
+          i+1, ret, _wcs[i].status, ibv_wc_status_str(_wcs[i].status)
+        );
+      }
+      SPDLOG_DEBUG("Shared queue Ret {}/{} WC {} QPN {}", i + 1, ret, _wcs[i].wr_id, _wcs[i].qp_num);
+    }
+    _route(ret);
+    return std::make_tuple(_wcs.data(), ret);
+  }
+
+  void SharedCompletionQueue::notify_events(bool only_solicited)
+  {
+    impl::expect_zero(ibv_req_notify_cq(_cq, only_solicited));
+  }
+
+  ibv_cq* SharedCompletionQueue::wait_events(bool blocking)
+  {
+    ibv_cq* ev_cq = nullptr;
+    void* ev_ctx = nullptr;
+    while(ibv_get_cq_event(_channel, &ev_cq, &ev_ctx)) {
+      pollfd fd{_channel->fd, POLLIN, 0};
+      if(errno != EAGAIN || !blocking || ::poll(&fd, 1, -1) < 0) {
+        if(errno != EAGAIN)
+          spdlog::error("Failed to get completion event, errno {}", errno);
+        return nullptr;
+      }
+    }
+    return ev_cq;
+  }
+
+  void SharedCompletionQueue::ack_events(ibv_cq* cq, int len)
+  {
+    ibv_ack_cq_events(cq, len);
+  }
+
+  SharedReceiveQueue::SharedReceiveQueue(ibv_pd* pd, int slots, uint32_t slot_size):
+    _srq(nullptr),
+    // Each slot generates at most one completion before it is posted again.
+    _cq(pd->context, slots),
+    _slots(slots * slot_size),
+    _slot_size(slot_size),
+    _slots_count(slots)
+  {
+    ibv_srq_init_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.attr.max_wr = slots;
+    attr.attr.max_sge = 1;
+    impl::expect_nonnull(_srq = ibv_create_srq(pd, &attr));
+    _slots.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+
+    for(int i = 0; i < slots; ++i)
+      impl::expect_true(post(i));
+    SPDLOG_DEBUG(
+      "Allocated shared receive queue {} with {} slots of size {}, cq {}",
+      fmt::ptr(_srq), slots, slot_size, fmt::ptr(_cq.cq())
+    );
+  }
+
+  SharedReceiveQueue::~SharedReceiveQueue()
+  {
+    // Fails while queue pairs are still attached.
+    if(_srq && ibv_destroy_srq(_srq))
+      spdlog::error("Couldn't destroy shared receive queue, reason {} {}", errno, strerror(errno));
+  }
+
+  ibv_srq* SharedReceiveQueue::srq() const
+  {
+    return _srq;
+  }
+
+  SharedCompletionQueue & SharedReceiveQueue::completion_queue()
+  {
+    return _cq;
+  }
+
+  int SharedReceiveQueue::slots() const
+  {
+    return _slots_count;
+  }
+
+  void* SharedReceiveQueue::slot(uint64_t id) const
+  {
+    return _slots.data() + id * _slot_size;
+  }
+
+  bool SharedReceiveQueue::post(uint64_t id)
+  {
+    ScatterGatherElement sge = _slots.sge(_slot_size, id * _slot_size);
+    ibv_recv_wr wr, *bad;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = id;
+    wr.sg_list = sge.array();
+    wr.num_sge = sge.size();
+
+    int ret = ibv_post_srq_recv(_srq, &wr, &bad);
+    if(ret) {
+      spdlog::error("Post shared receive unsuccesful, reason {} {}, slot {}", ret, strerror(ret), id);
+      return false;
+    }
+    return true;
+  }
+
+  std::tuple<ibv_wc*, int> SharedReceiveQueue::poll(bool blocking)
+  {
+    return _cq.poll(blocking);
+  }
+
+}
@@ -0,0 +1,683 @@
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <thread>
+
+// memfd, mmap, eventfd, Unix sockets
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+// htonl
+#include <arpa/inet.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/shm.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib { namespace shm {
+
+  namespace impl {
+
+    constexpr int QUEUE_SIZE = 256;
+    constexpr int ACTIVE_SIDE = 0;
+    constexpr int PASSIVE_SIDE = 1;
+
+    enum Notification {
+      NOTIFY_NONE = 0,
+      NOTIFY_ALL,
+      NOTIFY_SOLICITED
+    };
+
+    // Receive posted by a side, addresses are in its own address space.
+    struct RecvRequest {
+      uint64_t wr_id;
+      int num_sge;
+      std::array<ibv_sge, ScatterGatherElement::MAX_SGE> sges;
+    };
+
+    struct Completion {
+      uint64_t wr_id;
+      ibv_wc_opcode opcode;
+      uint32_t byte_len;
+      uint32_t imm_data;
+      int wc_flags;
+    };
+
+    // Single producer, single consumer.
+    template<typename T>
+    struct Ring {
+      std::atomic<uint64_t> head;
+      std::atomic<uint64_t> tail;
+      std::array<T, QUEUE_SIZE> entries;
+
+      bool push(const T & entry)
+      {
+        uint64_t tail_pos = tail.load(std::memory_order_relaxed);
+        if(tail_pos - head.load(std::memory_order_acquire) == QUEUE_SIZE)
+          return false;
+        entries[tail_pos % QUEUE_SIZE] = entry;
+        tail.store(tail_pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      bool pop(T & entry)
+      {
+        uint64_t head_pos = head.load(std::memory_order_relaxed);
+        if(head_pos == tail.load(std::memory_order_acquire))
+          return false;
+        entry = entries[head_pos % QUEUE_SIZE];
+        head.store(head_pos + 1, std::memory_order_release);
+        return true;
+      }
+    };
+
+    // Queues of the receiving side: its posted receives and its receive completions.
+    struct Side {
+      Ring<RecvRequest> recv;
+      Ring<Completion> completions;
+      std::atomic<int> notify;
+      std::atomic<bool> closed;
+    };
+
+    struct Queues {
+      std::array<Side, 2> sides;
+    };
+
+    struct HandshakeMessage {
+      uint64_t arena_address;
+      uint64_t arena_bytes;
+      uint32_t arena_rkey;
+      uint32_t private_data;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared atomics must be lock-free");
+
+    bool send_message(int socket, const HandshakeMessage & msg, const int* fds, int fds_count)
+    {
+      iovec iov{const_cast<HandshakeMessage*>(&msg), sizeof(msg)};
+      char control[CMSG_SPACE(sizeof(int) * 4)];
+      memset(control, 0, sizeof(control));
+      msghdr hdr;
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_iov = &iov;
+      hdr.msg_iovlen = 1;
+      hdr.msg_control = control;
+      hdr.msg_controllen = CMSG_SPACE(sizeof(int) * fds_count);
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds_count);
+      memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_count);
+      return sendmsg(socket, &hdr, 0) == sizeof(msg);
+    }
+
+    bool recv_message(int socket, HandshakeMessage & msg, int* fds, int fds_count)
+    {
+      iovec iov{&msg, sizeof(msg)};
+      char control[CMSG_SPACE(sizeof(int) * 4)];
+      msghdr hdr;
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_iov = &iov;
+      hdr.msg_iovlen = 1;
+      hdr.msg_control = control;
+      hdr.msg_controllen = CMSG_SPACE(sizeof(int) * fds_count);
+      if(recvmsg(socket, &hdr, MSG_WAITALL) != sizeof(msg))
+        return false;
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+      if(!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * fds_count))
+        return false;
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * fds_count);
+      return true;
+    }
+
+  }
+
+  uint32_t ProtectionDomain::_domains_count = 0;
+
+  ProtectionDomain::ProtectionDomain(size_t arena_size):
+    _bytes(arena_size),
+    _offset(0)
+  {
+    _fd = memfd_create("rdmalib-shm", MFD_CLOEXEC);
+    rdmalib::impl::expect_nonnegative(_fd);
+    rdmalib::impl::expect_zero(ftruncate(_fd, _bytes));
+    _ptr = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    rdmalib::impl::expect_true(_ptr != MAP_FAILED);
+
+    memset(&_mr, 0, sizeof(_mr));
+    _mr.addr = _ptr;
+    _mr.length = _bytes;
+    _mr.lkey = _mr.rkey = ++_domains_count;
+    SPDLOG_DEBUG("Allocated shared arena of {} bytes at {}, key {}", _bytes, fmt::ptr(_ptr), _mr.rkey);
+  }
+
+  ProtectionDomain::~ProtectionDomain()
+  {
+    munmap(_ptr, _bytes);
+    ::close(_fd);
+  }
+
+  int ProtectionDomain::fd() const
+  {
+    return _fd;
+  }
+
+  uintptr_t ProtectionDomain::address() const
+  {
+    return reinterpret_cast<uintptr_t>(_ptr);
+  }
+
+  size_t ProtectionDomain::bytes() const
+  {
+    return _bytes;
+  }
+
+  uint32_t ProtectionDomain::rkey() const
+  {
+    return _mr.rkey;
+  }
+
+  void* ProtectionDomain::_allocate(size_t bytes)
+  {
+    // Cache line alignment, the arena is never compacted.
+    constexpr size_t ALIGNMENT = 64;
+    size_t offset = (_offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if(offset + bytes > _bytes) {
+      spdlog::error("Shared arena of {} bytes exhausted, requested {} bytes", _bytes, bytes);
+      return nullptr;
+    }
+    _offset = offset + bytes;
+    return static_cast<char*>(_ptr) + offset;
+  }
+
+  Connection::Connection(ProtectionDomain & pd, int socket, bool passive):
+    _pd(pd),
+    _socket(socket),
+    _passive(passive),
+    _status(ConnectionStatus::UNKNOWN),
+    _private_data(0),
+    _req_count(0),
+    _peer_arena(nullptr),
+    _peer_address(0),
+    _peer_bytes(0),
+    _peer_rkey(0),
+    _queues_fd(-1),
+    _queues(nullptr),
+    _event_fds{-1, -1},
+    _swc_count(0)
+  {
+  }
+
+  Connection::~Connection()
+  {
+    close();
+  }
+
+  int Connection::_local() const
+  {
+    return _passive ? impl::PASSIVE_SIDE : impl::ACTIVE_SIDE;
+  }
+
+  int Connection::_remote() const
+  {
+    return _passive ? impl::ACTIVE_SIDE : impl::PASSIVE_SIDE;
+  }
+
+  bool Connection::handshake(uint32_t private_data)
+  {
+    impl::HandshakeMessage msg{_pd.address(), _pd.bytes(), _pd.rkey(), private_data};
+    impl::HandshakeMessage peer;
+    int arena_fd = -1;
+
+    if(!_passive) {
+      // Queues of both sides and their completion channels.
+      _queues_fd = memfd_create("rdmalib-shm-queues", MFD_CLOEXEC);
+      rdmalib::impl::expect_nonnegative(_queues_fd);
+      rdmalib::impl::expect_zero(ftruncate(_queues_fd, sizeof(impl::Queues)));
+      void* ptr = mmap(nullptr, sizeof(impl::Queues), PROT_READ | PROT_WRITE, MAP_SHARED, _queues_fd, 0);
+      rdmalib::impl::expect_true(ptr != MAP_FAILED);
+      _queues = new (ptr) impl::Queues{};
+      _event_fds[0] = eventfd(0, EFD_CLOEXEC);
+      _event_fds[1] = eventfd(0, EFD_CLOEXEC);
+
+      int fds[4] = {_pd.fd(), _queues_fd, _event_fds[0], _event_fds[1]};
+      if(!impl::send_message(_socket, msg, fds, 4) || !impl::recv_message(_socket, peer, &arena_fd, 1)) {
+        spdlog::error("Shared memory handshake failed, errno {}", errno);
+        return false;
+      }
+    } else {
+      int fds[4];
+      if(!impl::recv_message(_socket, peer, fds, 4)) {
+        spdlog::error("Shared memory handshake failed, errno {}", errno);
+        return false;
+      }
+      arena_fd = fds[0];
+      _queues_fd = fds[1];
+      _event_fds[0] = fds[2];
+      _event_fds[1] = fds[3];
+      void* ptr = mmap(nullptr, sizeof(impl::Queues), PROT_READ | PROT_WRITE, MAP_SHARED, _queues_fd, 0);
+      rdmalib::impl::expect_true(ptr != MAP_FAILED);
+      _queues = static_cast<impl::Queues*>(ptr);
+      _private_data = peer.private_data;
+
+      int fd = _pd.fd();
+      if(!impl::send_message(_socket, msg, &fd, 1)) {
+        spdlog::error("Shared memory handshake failed, errno {}", errno);
+        ::close(arena_fd);
+        return false;
+      }
+    }
+
+    _peer_address = peer.arena_address;
+    _peer_bytes = peer.arena_bytes;
+    _peer_rkey = peer.arena_rkey;
+    _peer_arena = mmap(nullptr, _peer_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, arena_fd, 0);
+    ::close(arena_fd);
+    rdmalib::impl::expect_true(_peer_arena != MAP_FAILED);
+    _status = ConnectionStatus::ESTABLISHED;
+    SPDLOG_DEBUG(
+      "[shm] Connection established, passive {}, peer arena of {} bytes at {:x}, key {}",
+      _passive, _peer_bytes, _peer_address, _peer_rkey
+    );
+    return true;
+  }
+
+  void Connection::close()
+  {
+    if(_queues) {
+      // Wake up the peer waiting for our receives.
+      _queues->sides[_local()].closed.store(true);
+      munmap(_queues, sizeof(impl::Queues));
+      _queues = nullptr;
+    }
+    if(_peer_arena && _peer_arena != MAP_FAILED)
+      munmap(_peer_arena, _peer_bytes);
+    _peer_arena = nullptr;
+    for(int* fd : {&_queues_fd, &_event_fds[0], &_event_fds[1], &_socket}) {
+      if(*fd >= 0)
+        ::close(*fd);
+      *fd = -1;
+    }
+    if(_status == ConnectionStatus::ESTABLISHED)
+      SPDLOG_DEBUG("[shm] Connection closed, passive {}", _passive);
+    _status = ConnectionStatus::DISCONNECTED;
+  }
+
+  uint32_t Connection::private_data() const
+  {
+    return _private_data;
+  }
+
+  ConnectionStatus Connection::status() const
+  {
+    return _status;
+  }
+
+  void* Connection::_translate(uint64_t addr, uint32_t bytes) const
+  {
+    if(addr < _peer_address || addr + bytes > _peer_address + _peer_bytes)
+      return nullptr;
+    return static_cast<char*>(_peer_arena) + (addr - _peer_address);
+  }
+
+  void* Connection::_translate(const RemoteBuffer & buf, uint32_t bytes) const
+  {
+    void* ptr = buf.rkey == _peer_rkey ? _translate(buf.addr, bytes) : nullptr;
+    if(!ptr)
+      spdlog::error(
+        "[shm] Remote access to [{:x}, {:x}) with key {} outside of the peer's memory",
+        buf.addr, buf.addr + bytes, buf.rkey
+      );
+    return ptr;
+  }
+
+  int64_t Connection::_write(const ScatterGatherElement & elems, const RemoteBuffer & buf)
+  {
+    uint32_t bytes = 0;
+    for(size_t i = 0; i < elems.size(); ++i)
+      bytes += elems.array()[i].length;
+    char* dest = static_cast<char*>(_translate(buf, bytes));
+    if(!dest)
+      return -1;
+    // Gather local elements into consecutive remote memory.
+    for(size_t i = 0; i < elems.size(); ++i) {
+      ibv_sge & sge = elems.array()[i];
+      memcpy(dest, reinterpret_cast<void*>(sge.addr), sge.length);
+      dest += sge.length;
+    }
+    return bytes;
+  }
+
+  bool Connection::_deliver(const ScatterGatherElement* elems, uint32_t bytes, ibv_wc_opcode opcode,
+      uint32_t imm_data, int wc_flags, bool solicited)
+  {
+    impl::Side & peer = _queues->sides[_remote()];
+    impl::RecvRequest request;
+    // Like an infinite RNR retry - wait until the peer posts a receive.
+    while(!peer.recv.pop(request)) {
+      if(peer.closed.load()) {
+        spdlog::error("[shm] Peer closed the connection");
+        return false;
+      }
+      std::this_thread::yield();
+    }
+
+    // Scatter the payload of a send into the posted receive.
+    if(elems) {
+      int target = 0;
+      uint32_t target_offset = 0;
+      for(size_t i = 0; i < elems->size(); ++i) {
+        ibv_sge & sge = elems->array()[i];
+        uint32_t copied = 0;
+        while(copied < sge.length) {
+          if(target >= request.num_sge) {
+            spdlog::error("[shm] Message does not fit into the receive buffer of {} elements", request.num_sge);
+            return false;
+          }
+          ibv_sge & dest = request.sges[target];
+          uint32_t len = std::min(sge.length - copied, dest.length - target_offset);
+          void* ptr = _translate(dest.addr + target_offset, len);
+          if(!ptr) {
+            spdlog::error("[shm] Receive buffer at {:x} outside of the peer's memory", dest.addr);
+            return false;
+          }
+          memcpy(ptr, reinterpret_cast<char*>(sge.addr) + copied, len);
+          copied += len;
+          bytes += len;
+          target_offset += len;
+          if(target_offset == dest.length) {
+            ++target;
+            target_offset = 0;
+          }
+        }
+      }
+    }
+
+    impl::Completion completion{request.wr_id, opcode, bytes, imm_data, wc_flags};
+    while(!peer.completions.push(completion))
+      std::this_thread::yield();
+
+    // Completion channel is armed for a single event.
+    int notify = peer.notify.load();
+    if(notify == impl::NOTIFY_ALL || (notify == impl::NOTIFY_SOLICITED && solicited)) {
+      if(peer.notify.exchange(impl::NOTIFY_NONE) != impl::NOTIFY_NONE) {
+        uint64_t event = 1;
+        rdmalib::impl::expect_true(write(_event_fds[_remote()], &event, sizeof(event)) == sizeof(event));
+      }
+    }
+    return true;
+  }
+
+  int32_t Connection::_complete_send(int32_t id, ibv_wc_opcode opcode)
+  {
+    int32_t wr_id = id == -1 ? _req_count++ : id;
+    if(_swc_count < WC_SIZE) {
+      ibv_wc & wc = _swc[_swc_count++];
+      memset(&wc, 0, sizeof(wc));
+      wc.wr_id = wr_id;
+      wc.status = IBV_WC_SUCCESS;
+      wc.opcode = opcode;
+    } else
+      spdlog::warn("[shm] Send completion queue overflow, completion of {} dropped", wr_id);
+    return wr_id;
+  }
+
+  int32_t Connection::post_send(const ScatterGatherElement & elems, int32_t id, bool)
+  {
+    if(!_deliver(&elems, 0, IBV_WC_RECV, 0, 0, false))
+      return -1;
+    return _complete_send(id, IBV_WC_SEND);
+  }
+
+  int32_t Connection::post_recv(ScatterGatherElement && elem, int32_t id, int32_t count)
+  {
+    impl::RecvRequest request;
+    request.wr_id = id == -1 ? _req_count++ : id;
+    request.num_sge = elem.size();
+    std::copy_n(elem.array(), elem.size(), request.sges.begin());
+
+    impl::Ring<impl::RecvRequest> & queue = _queues->sides[_local()].recv;
+    for(int i = 0; i < count; ++i) {
+      if(!queue.push(request)) {
+        spdlog::error("[shm] Post receive unsuccesful, receive queue of {} is full", impl::QUEUE_SIZE);
+        return -1;
+      }
+    }
+    SPDLOG_DEBUG("[shm] Post recv succesfull, sges_count {}, wr_id {}, count {}", request.num_sge, request.wr_id, count);
+    return request.wr_id;
+  }
+
+  int32_t Connection::post_write(ScatterGatherElement && elems, const RemoteBuffer & buf, bool)
+  {
+    if(_write(elems, buf) < 0)
+      return -1;
+    return _complete_send(-1, IBV_WC_RDMA_WRITE);
+  }
+
+  int32_t Connection::post_write(ScatterGatherElement && elems, const RemoteBuffer & buf,
+    uint32_t immediate,
+    bool,
+    bool solicited
+  )
+  {
+    int64_t bytes = _write(elems, buf);
+    if(bytes < 0)
+      return -1;
+    // Immediate is delivered in network order, as by the device.
+    if(!_deliver(nullptr, bytes, IBV_WC_RECV_RDMA_WITH_IMM, htonl(immediate), IBV_WC_WITH_IMM, solicited))
+      return -1;
+    return _complete_send(-1, IBV_WC_RDMA_WRITE);
+  }
+
+  int32_t Connection::post_cas(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t compare, uint64_t swap)
+  {
+    uint64_t* ptr = static_cast<uint64_t*>(_translate(rbuf, sizeof(uint64_t)));
+    if(!ptr)
+      return -1;
+    // On failure, compare is updated with the current value.
+    __atomic_compare_exchange_n(ptr, &compare, swap, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    *reinterpret_cast<uint64_t*>(elems.array()[0].addr) = compare;
+    return _complete_send(-1, IBV_WC_COMP_SWAP);
+  }
+
+  int32_t Connection::post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add)
+  {
+    uint64_t* ptr = static_cast<uint64_t*>(_translate(rbuf, sizeof(uint64_t)));
+    if(!ptr)
+      return -1;
+    *reinterpret_cast<uint64_t*>(elems.array()[0].addr) = __atomic_fetch_add(ptr, add, __ATOMIC_SEQ_CST);
+    return _complete_send(-1, IBV_WC_FETCH_ADD);
+  }
+
+  int32_t Connection::post_batch(WorkRequestBatch & batch)
+  {
+    batch._posted = 0;
+    for(int i = 0; i < batch.size(); ++i) {
+      const ibv_send_wr & wr = batch._wrs[i];
+      const ScatterGatherElement & elems = batch._sges[i];
+      ibv_wc_opcode opcode = IBV_WC_RDMA_WRITE;
+      if(wr.opcode == IBV_WR_SEND) {
+        if(!_deliver(&elems, 0, IBV_WC_RECV, 0, 0, false))
+          return -1;
+        opcode = IBV_WC_SEND;
+      } else if(wr.opcode == IBV_WR_RDMA_WRITE || wr.opcode == IBV_WR_RDMA_WRITE_WITH_IMM) {
+        int64_t bytes = _write(elems, {wr.wr.rdma.remote_addr, wr.wr.rdma.rkey});
+        if(bytes < 0)
+          return -1;
+        bool solicited = wr.send_flags & IBV_SEND_SOLICITED;
+        if(wr.opcode == IBV_WR_RDMA_WRITE_WITH_IMM &&
+            !_deliver(nullptr, bytes, IBV_WC_RECV_RDMA_WITH_IMM, wr.imm_data, IBV_WC_WITH_IMM, solicited))
+          return -1;
+      } else {
+        spdlog::error("[shm] Work request with unsupported opcode {}", wr.opcode);
+        return -1;
+      }
+      if(wr.send_flags & IBV_SEND_SIGNALED)
+        _complete_send(wr.wr_id, opcode);
+      batch._posted = i + 1;
+    }
+    return batch.size();
+  }
+
+  bool Connection::drain_send_queue()
+  {
+    _swc_count = 0;
+    return _status == ConnectionStatus::ESTABLISHED;
+  }
+
+  std::tuple<ibv_wc*, int> Connection::poll_wc(QueueType type, bool blocking, int count)
+  {
+    // All send operations have already completed.
+    if(type == QueueType::SEND) {
+      int ret = _swc_count;
+      _swc_count = 0;
+      return std::make_tuple(_swc.data(), ret);
+    }
+
+    int limit = count < 0 || count > WC_SIZE ? WC_SIZE : count;
+    impl::Side & side = _queues->sides[_local()];
+    impl::Completion completion;
+    int ret = 0;
+    do {
+      while(ret < limit && side.completions.pop(completion)) {
+        ibv_wc & wc = _rwc[ret++];
+        memset(&wc, 0, sizeof(wc));
+        wc.wr_id = completion.wr_id;
+        wc.status = IBV_WC_SUCCESS;
+        wc.opcode = completion.opcode;
+        wc.byte_len = completion.byte_len;
+        wc.imm_data = completion.imm_data;
+        wc.wc_flags = completion.wc_flags;
+      }
+      if(ret || !blocking || _queues->sides[_remote()].closed.load())
+        break;
+      std::this_thread::yield();
+    } while(true);
+    if(ret)
+      SPDLOG_DEBUG("[shm] Polled {} receive completions", ret);
+    return std::make_tuple(_rwc.data(), ret);
+  }
+
+  void Connection::notify_events(bool only_solicited)
+  {
+    _queues->sides[_local()].notify.store(
+      only_solicited ? impl::NOTIFY_SOLICITED : impl::NOTIFY_ALL
+    );
+  }
+
+  bool Connection::wait_events()
+  {
+    uint64_t events;
+    return read(_event_fds[_local()], &events, sizeof(events)) == sizeof(events);
+  }
+
+  int Connection::completion_fd() const
+  {
+    return _event_fds[_local()];
+  }
+
+  std::string endpoint(const std::string & address, int port)
+  {
+    return "/tmp/rdmalib-shm-" + address + "-" + std::to_string(port);
+  }
+
+  RDMAActive::RDMAActive(const std::string & path, ProtectionDomain & pd):
+    _path(path),
+    _pd(pd)
+  {
+  }
+
+  bool RDMAActive::connect(uint32_t secret)
+  {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, _path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    rdmalib::impl::expect_nonnegative(fd);
+    if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+      spdlog::error("[shm] Connection to {} failed, errno {}", _path, errno);
+      ::close(fd);
+      return false;
+    }
+    _conn.reset(new Connection(_pd, fd, false));
+    return _conn->handshake(secret);
+  }
+
+  void RDMAActive::disconnect()
+  {
+    if(_conn)
+      _conn->close();
+  }
+
+  Connection & RDMAActive::connection()
+  {
+    return *_conn;
+  }
+
+  bool RDMAActive::is_connected()
+  {
+    return _conn && _conn->status() == ConnectionStatus::ESTABLISHED;
+  }
+
+  RDMAPassive::RDMAPassive(const std::string & path, ProtectionDomain & pd):
+    _path(path),
+    _pd(pd)
+  {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, _path.c_str(), sizeof(addr.sun_path) - 1);
+
+    _socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    rdmalib::impl::expect_nonnegative(_socket);
+    unlink(_path.c_str());
+    rdmalib::impl::expect_zero(bind(_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    rdmalib::impl::expect_zero(listen(_socket, 10));
+    SPDLOG_DEBUG("[shm] Listening on {}", _path);
+  }
+
+  RDMAPassive::~RDMAPassive()
+  {
+    ::close(_socket);
+    unlink(_path.c_str());
+  }
+
+  bool RDMAPassive::nonblocking_poll_events(int timeout)
+  {
+    pollfd my_pollfd;
+    my_pollfd.fd      = _socket;
+    my_pollfd.events  = POLLIN;
+    my_pollfd.revents = 0;
+    int rc = poll(&my_pollfd, 1, timeout);
+    if (rc < 0) {
+      spdlog::error("[shm] Polling connections on {} failed, errno {}", _path, errno);
+      return false;
+    }
+    return rc > 0;
+  }
+
+  Connection* RDMAPassive::poll_events()
+  {
+    int fd = accept4(_socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd < 0) {
+      spdlog::error("[shm] Accepting connection on {} failed, errno {}", _path, errno);
+      return nullptr;
+    }
+    Connection* conn = new Connection(_pd, fd, true);
+    if(!conn->handshake()) {
+      delete conn;
+      return nullptr;
+    }
+    return conn;
+  }
+
+}}
+
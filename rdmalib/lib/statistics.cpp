@@ -0,0 +1,167 @@
+
+#include <fstream>
+#include <sstream>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/statistics.hpp>
+
+namespace rdmalib {
+
+  void QueueStatistics::record_error(const ibv_wc & wc)
+  {
+    errors.add();
+    if(wc.status == IBV_WC_RETRY_EXC_ERR)
+      retry_errors.add();
+    else if(wc.status == IBV_WC_RNR_RETRY_EXC_ERR)
+      rnr_retry_errors.add();
+  }
+
+  void QueueStatistics::write_json(std::ostream & out) const
+  {
+    out << "{\"posted\": " << posted.value()
+      << ", \"inlined\": " << inlined.value()
+      << ", \"doorbells\": " << doorbells.value()
+      << ", \"refills\": " << refills.value()
+      << ", \"polls\": " << polls.value()
+      << ", \"empty_polls\": " << empty_polls.value()
+      << ", \"completions\": " << completions.value()
+      << ", \"errors\": " << errors.value()
+      << ", \"retry_errors\": " << retry_errors.value()
+      << ", \"rnr_retry_errors\": " << rnr_retry_errors.value()
+      << "}";
+  }
+
+  void QueueStatistics::accumulate(const QueueStatistics & other)
+  {
+    posted.add(other.posted.value());
+    inlined.add(other.inlined.value());
+    doorbells.add(other.doorbells.value());
+    refills.add(other.refills.value());
+    polls.add(other.polls.value());
+    empty_polls.add(other.empty_polls.value());
+    completions.add(other.completions.value());
+    errors.add(other.errors.value());
+    retry_errors.add(other.retry_errors.value());
+    rnr_retry_errors.add(other.rnr_retry_errors.value());
+  }
+
+  ConnectionStatistics::ConnectionStatistics(const std::string & name):
+    name(name),
+    qp_num(0)
+  {}
+
+  void ConnectionStatistics::write_json(std::ostream & out) const
+  {
+    out << "{\"name\": \"" << name << "\", \"qp_num\": " << qp_num.load(std::memory_order_relaxed);
+    out << ", \"send\": ";
+    send.write_json(out);
+    out << ", \"recv\": ";
+    recv.write_json(out);
+    out << "}";
+  }
+
+  StatisticsRegistry::StatisticsRegistry():
+    _closed_connections(0),
+    _reporting(false)
+  {}
+
+  StatisticsRegistry::~StatisticsRegistry()
+  {
+    stop_reporting();
+  }
+
+  StatisticsRegistry & StatisticsRegistry::instance()
+  {
+    static StatisticsRegistry registry;
+    return registry;
+  }
+
+  std::shared_ptr<ConnectionStatistics> StatisticsRegistry::create(const std::string & name)
+  {
+    auto stats = std::make_shared<ConnectionStatistics>(name);
+    std::lock_guard<std::mutex> lock{_mutex};
+    _connections.push_back(stats);
+    return stats;
+  }
+
+  void StatisticsRegistry::write_json(std::ostream & out)
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    out << "{\"connections\": [";
+    bool first = true;
+    for(auto & conn : _connections) {
+      // Connection is gone, only the registry holds the counters.
+      if(conn.use_count() == 1)
+        continue;
+      out << (first ? "" : ", ");
+      conn->write_json(out);
+      first = false;
+    }
+    out << "]";
+
+    for(auto it = _connections.begin(); it != _connections.end();) {
+      if(it->use_count() == 1) {
+        _closed_send.accumulate((*it)->send);
+        _closed_recv.accumulate((*it)->recv);
+        ++_closed_connections;
+        it = _connections.erase(it);
+      } else
+        ++it;
+    }
+    out << ", \"closed\": {\"connections\": " << _closed_connections << ", \"send\": ";
+    _closed_send.write_json(out);
+    out << ", \"recv\": ";
+    _closed_recv.write_json(out);
+    out << "}}";
+  }
+
+  std::string StatisticsRegistry::json()
+  {
+    std::stringstream out;
+    write_json(out);
+    return out.str();
+  }
+
+  void StatisticsRegistry::report(const std::string & path)
+  {
+    if(path.empty()) {
+      spdlog::info("Connection statistics: {}", json());
+      return;
+    }
+    std::ofstream out{path, std::ios::trunc};
+    if(!out) {
+      spdlog::error("Couldn't open statistics file {}", path);
+      return;
+    }
+    write_json(out);
+    out << '\n';
+  }
+
+  void StatisticsRegistry::start_reporting(std::chrono::milliseconds period, const std::string & path)
+  {
+    stop_reporting();
+    _reporting = true;
+    _reporter = std::thread{
+      [this, period, path]() {
+        std::unique_lock<std::mutex> lock{_reporter_mutex};
+        while(!_reporter_cv.wait_for(lock, period, [this]() { return !_reporting; }))
+          report(path);
+        report(path);
+      }
+    };
+  }
+
+  void StatisticsRegistry::stop_reporting()
+  {
+    {
+      std::lock_guard<std::mutex> lock{_reporter_mutex};
+      _reporting = false;
+    }
+    _reporter_cv.notify_all();
+    if(_reporter.joinable())
+      _reporter.join();
+  }
+
+}
+
@@ -0,0 +1,994 @@
+
+#include <algorithm>
+#include <cstring>
+
+// io_uring
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+// mmap, sockets
+#include <poll.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/tcp.hpp>
+#include <rdmalib/util.hpp>
+
+namespace rdmalib { namespace tcp {
+
+  namespace impl {
+
+    constexpr unsigned RING_ENTRIES = 128;
+    constexpr uint32_t HANDSHAKE_MAGIC = 0x72444d41;
+    // User data of ring operations.
+    constexpr uint64_t SEND_TAG = 1;
+    constexpr uint64_t RECV_TAG = 2;
+    // Registered buffers.
+    constexpr int ARENA_BUFFER = 0;
+    constexpr int RING_BUFFER = 1;
+
+    enum Opcode {
+      SEND = 0,
+      WRITE,
+      WRITE_WITH_IMM,
+      FETCH_ADD,
+      COMPARE_SWAP,
+      ATOMIC_RESPONSE
+    };
+
+    enum Notification {
+      NOTIFY_NONE = 0,
+      NOTIFY_ALL,
+      NOTIFY_SOLICITED
+    };
+
+    struct Handshake {
+      uint32_t magic;
+      uint32_t private_data;
+    };
+
+    // Minimal io_uring without liburing: one submission and one completion ring.
+    struct Ring {
+      int fd;
+      void* sq_ptr;
+      size_t sq_bytes;
+      void* cq_ptr;
+      size_t cq_bytes;
+      io_uring_sqe* sqes;
+      size_t sqes_bytes;
+      unsigned* sq_head;
+      unsigned* sq_tail;
+      unsigned* sq_mask;
+      unsigned* sq_array;
+      unsigned sq_entries;
+      unsigned* cq_head;
+      unsigned* cq_tail;
+      unsigned* cq_mask;
+      io_uring_cqe* cqes;
+      // Entries added but not submitted yet.
+      unsigned tail;
+      unsigned queued;
+
+      Ring():
+        fd(-1),
+        sq_ptr(MAP_FAILED),
+        cq_ptr(MAP_FAILED),
+        sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+        tail(0),
+        queued(0)
+      {}
+
+      ~Ring()
+      {
+        if(sqes != MAP_FAILED)
+          munmap(sqes, sqes_bytes);
+        if(cq_ptr != MAP_FAILED)
+          munmap(cq_ptr, cq_bytes);
+        if(sq_ptr != MAP_FAILED)
+          munmap(sq_ptr, sq_bytes);
+        if(fd >= 0)
+          ::close(fd);
+      }
+
+      bool initialize(unsigned entries)
+      {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if(fd < 0)
+          return false;
+
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        sq_ptr = mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        cq_ptr = mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(
+          mmap(nullptr, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)
+        );
+        if(sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+          return false;
+
+        char* sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        char* cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        tail = *sq_tail;
+        return true;
+      }
+
+      bool register_buffers(const iovec* iov, unsigned count)
+      {
+        return !syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, count);
+      }
+
+      // Next submission entry, submits the queued ones when the ring is full.
+      io_uring_sqe* next()
+      {
+        if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries && submit(0) < 0)
+          return nullptr;
+        unsigned idx = tail & *sq_mask;
+        sq_array[idx] = idx;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        ++tail;
+        ++queued;
+        return sqe;
+      }
+
+      // Single system call submitting all queued entries and waiting for wait completions.
+      int submit(unsigned wait)
+      {
+        if(!queued && !wait)
+          return 0;
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        int ret = syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if(ret < 0)
+          return errno == EINTR || errno == EAGAIN || errno == EBUSY ? 0 : -1;
+        queued -= ret;
+        return ret;
+      }
+
+      bool pop(io_uring_cqe & cqe)
+      {
+        unsigned head = *cq_head;
+        if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+          return false;
+        cqe = cqes[head & *cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    };
+
+    bool configure_socket(int fd)
+    {
+      int flag = 1;
+      return !setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+
+    bool address(const std::string & ip, int port, sockaddr_in & addr)
+    {
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      return inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) == 1;
+    }
+
+  }
+
+  uint32_t ProtectionDomain::_domains_count = 0;
+
+  ProtectionDomain::ProtectionDomain(size_t arena_size):
+    _bytes(arena_size),
+    _offset(0)
+  {
+    _ptr = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    rdmalib::impl::expect_true(_ptr != MAP_FAILED);
+
+    memset(&_mr, 0, sizeof(_mr));
+    _mr.addr = _ptr;
+    _mr.length = _bytes;
+    _mr.lkey = _mr.rkey = ++_domains_count;
+    SPDLOG_DEBUG("Allocated TCP arena of {} bytes at {}, key {}", _bytes, fmt::ptr(_ptr), _mr.rkey);
+  }
+
+  ProtectionDomain::~ProtectionDomain()
+  {
+    munmap(_ptr, _bytes);
+  }
+
+  uintptr_t ProtectionDomain::address() const
+  {
+    return reinterpret_cast<uintptr_t>(_ptr);
+  }
+
+  size_t ProtectionDomain::bytes() const
+  {
+    return _bytes;
+  }
+
+  uint32_t ProtectionDomain::rkey() const
+  {
+    return _mr.rkey;
+  }
+
+  bool ProtectionDomain::contains(uint64_t addr, uint32_t bytes) const
+  {
+    return addr >= address() && addr + bytes <= address() + _bytes;
+  }
+
+  void* ProtectionDomain::_allocate(size_t bytes)
+  {
+    // Cache line alignment, the arena is never compacted.
+    constexpr size_t ALIGNMENT = 64;
+    size_t offset = (_offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if(offset + bytes > _bytes) {
+      spdlog::error("TCP arena of {} bytes exhausted, requested {} bytes", _bytes, bytes);
+      return nullptr;
+    }
+    _offset = offset + bytes;
+    return static_cast<char*>(_ptr) + offset;
+  }
+
+  Connection::Connection(ProtectionDomain & pd, int socket, bool passive):
+    _pd(pd),
+    _socket(socket),
+    _passive(passive),
+    _status(ConnectionStatus::UNKNOWN),
+    _private_data(0),
+    _req_count(0),
+    _fixed_buffers(false),
+    _free_slots_count(0),
+    _send_queue_head(0),
+    _send_queue_count(0),
+    _send_in_flight(0),
+    _send_bytes(0),
+    _recv_head(0),
+    _recv_count(0),
+    _rx_ring(new char[RX_RING_SIZE]),
+    _rx_begin(0),
+    _rx_end(0),
+    _rx_in_flight(false),
+    _rx_direct(false),
+    _rx_phase(Phase::HEADER),
+    _rx_received(0),
+    _rx_has_request(false),
+    _notify(impl::NOTIFY_NONE),
+    _event(false),
+    _swc_count(0),
+    _rwc_count(0)
+  {
+    for(int i = SEND_SLOTS - 1; i >= 0; --i)
+      _free_slots[_free_slots_count++] = i;
+  }
+
+  Connection::~Connection()
+  {
+    close();
+  }
+
+  bool Connection::handshake(uint32_t private_data)
+  {
+    impl::Handshake msg{impl::HANDSHAKE_MAGIC, private_data};
+    impl::Handshake peer;
+    bool success = impl::configure_socket(_socket);
+    if(!_passive)
+      success = success && send(_socket, &msg, sizeof(msg), 0) == sizeof(msg);
+    success = success && recv(_socket, &peer, sizeof(peer), MSG_WAITALL) == sizeof(peer);
+    if(_passive)
+      success = success && send(_socket, &msg, sizeof(msg), 0) == sizeof(msg);
+    if(!success || peer.magic != impl::HANDSHAKE_MAGIC) {
+      spdlog::error("[tcp] Handshake failed, errno {}", errno);
+      return false;
+    }
+    if(_passive)
+      _private_data = peer.private_data;
+
+    _ring.reset(new impl::Ring{});
+    if(!_ring->initialize(impl::RING_ENTRIES)) {
+      spdlog::error("[tcp] Initialization of io_uring failed, errno {}", errno);
+      return false;
+    }
+    // Without registered buffers, e.g. when locked memory is limited, we fall back to plain reads.
+    iovec buffers[2] = {
+      {reinterpret_cast<void*>(_pd.address()), _pd.bytes()},
+      {_rx_ring.get(), RX_RING_SIZE}
+    };
+    _fixed_buffers = _ring->register_buffers(buffers, 2);
+    if(!_fixed_buffers)
+      spdlog::warn("[tcp] Registration of io_uring buffers failed, errno {}", errno);
+
+    _status = ConnectionStatus::ESTABLISHED;
+    // Requests are cancelled when their submitting thread exits,
+    // the read is submitted by the first poll.
+    _read_ring();
+    SPDLOG_DEBUG("[tcp] Connection established, passive {}, fixed buffers {}", _passive, _fixed_buffers);
+    return true;
+  }
+
+  void Connection::close()
+  {
+    // Closing the ring cancels operations in flight.
+    _ring.reset();
+    if(_socket >= 0)
+      ::close(_socket);
+    _socket = -1;
+    if(_status == ConnectionStatus::ESTABLISHED)
+      SPDLOG_DEBUG("[tcp] Connection closed, passive {}", _passive);
+    _status = ConnectionStatus::DISCONNECTED;
+  }
+
+  uint32_t Connection::private_data() const
+  {
+    return _private_data;
+  }
+
+  ConnectionStatus Connection::status() const
+  {
+    return _status;
+  }
+
+  void Connection::_fail(const char* reason)
+  {
+    if(_status == ConnectionStatus::ESTABLISHED)
+      spdlog::error("[tcp] Connection failed: {}", reason);
+    _status = ConnectionStatus::DISCONNECTED;
+  }
+
+  int32_t Connection::_post(const impl::Header & header, const ibv_sge* sges, int num_sge,
+      uint64_t wr_id, ibv_wc_opcode opcode, bool signaled, uint64_t* result)
+  {
+    if(_status != ConnectionStatus::ESTABLISHED)
+      return -1;
+    while(!_free_slots_count)
+      if(!_progress(true))
+        return -1;
+
+    int idx = _free_slots[--_free_slots_count];
+    SendSlot & slot = _slots[idx];
+    slot.header = header;
+    slot.header.length = 0;
+    slot.iov[0] = {&slot.header, sizeof(impl::Header)};
+    slot.iov_count = 1;
+    for(int i = 0; i < num_sge; ++i) {
+      slot.iov[slot.iov_count++] = {reinterpret_cast<void*>(sges[i].addr), sges[i].length};
+      slot.header.length += sges[i].length;
+    }
+    slot.bytes = sizeof(impl::Header) + slot.header.length;
+    slot.wr_id = wr_id;
+    slot.opcode = opcode;
+    slot.signaled = signaled;
+    slot.result = result;
+    slot.references = result ? 2 : 1;
+    // The response identifies the atomic by its slot.
+    if(result)
+      slot.header.wr_id = idx;
+
+    _send_queue[(_send_queue_head + _send_queue_count++) % SEND_SLOTS] = idx;
+    return wr_id;
+  }
+
+  void Connection::_flush()
+  {
+    if(_send_in_flight || !_send_queue_count || _status != ConnectionStatus::ESTABLISHED)
+      return;
+    io_uring_sqe* sqe = _ring->next();
+    if(!sqe) {
+      _fail("submission of send failed");
+      return;
+    }
+
+    // All queued messages are sent with one sendmsg.
+    int iov_count = 0;
+    _send_bytes = 0;
+    for(int i = 0; i < _send_queue_count; ++i) {
+      SendSlot & slot = _slots[_send_queue[(_send_queue_head + i) % SEND_SLOTS]];
+      std::copy_n(slot.iov.begin(), slot.iov_count, _send_iov.begin() + iov_count);
+      iov_count += slot.iov_count;
+      _send_bytes += slot.bytes;
+    }
+    _send_in_flight = _send_queue_count;
+    memset(&_send_msg, 0, sizeof(_send_msg));
+    _send_msg.msg_iov = _send_iov.data();
+    _send_msg.msg_iovlen = iov_count;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = _socket;
+    sqe->addr = reinterpret_cast<uint64_t>(&_send_msg);
+    sqe->len = 1;
+    // Stream sockets - retry partial sends in the kernel.
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = impl::SEND_TAG;
+  }
+
+  void Connection::_release_slot(int slot)
+  {
+    if(!--_slots[slot].references)
+      _free_slots[_free_slots_count++] = slot;
+  }
+
+  void Connection::_complete_send(uint64_t wr_id, ibv_wc_opcode opcode)
+  {
+    if(_swc_count == WC_SIZE) {
+      spdlog::warn("[tcp] Send completion queue overflow, completion of {} dropped", wr_id);
+      return;
+    }
+    ibv_wc & wc = _swc[_swc_count++];
+    memset(&wc, 0, sizeof(wc));
+    wc.wr_id = wr_id;
+    wc.status = IBV_WC_SUCCESS;
+    wc.opcode = opcode;
+  }
+
+  void Connection::_complete_recv(ibv_wc_opcode opcode, uint32_t bytes, int wc_flags)
+  {
+    ibv_wc & wc = _rwc[_rwc_count++];
+    memset(&wc, 0, sizeof(wc));
+    wc.wr_id = _rx_request.wr_id;
+    wc.status = IBV_WC_SUCCESS;
+    wc.opcode = opcode;
+    wc.byte_len = bytes;
+    wc.imm_data = _rx_header.imm_data;
+    wc.wc_flags = wc_flags;
+    _rx_has_request = false;
+
+    // Completion channel is armed for a single event.
+    if(_notify == impl::NOTIFY_ALL || (_notify == impl::NOTIFY_SOLICITED && _rx_header.solicited)) {
+      _notify = impl::NOTIFY_NONE;
+      _event = true;
+    }
+  }
+
+  bool Connection::_pop_recv()
+  {
+    if(_rx_has_request)
+      return true;
+    if(!_recv_count)
+      return false;
+    _rx_request = _recv[_recv_head];
+    _recv_head = (_recv_head + 1) % RECV_QUEUE_SIZE;
+    --_recv_count;
+    _rx_has_request = true;
+    return true;
+  }
+
+  void Connection::_read_ring()
+  {
+    if(_rx_begin == _rx_end) {
+      _rx_begin = _rx_end = 0;
+    } else if(_rx_begin) {
+      // Usually only a part of a header remains.
+      memmove(_rx_ring.get(), _rx_ring.get() + _rx_begin, _rx_end - _rx_begin);
+      _rx_end -= _rx_begin;
+      _rx_begin = 0;
+    }
+    // Ring is full of messages stalled on receives or completion entries.
+    if(_rx_end == RX_RING_SIZE)
+      return;
+    _rx_direct = false;
+    _submit_read();
+  }
+
+  void Connection::_read_direct(char* target, uint32_t bytes)
+  {
+    _rx_direct = true;
+    _rx_target = target;
+    _rx_target_bytes = bytes;
+    _rx_offset = 0;
+    _submit_read();
+  }
+
+  void Connection::_submit_read()
+  {
+    io_uring_sqe* sqe = _ring->next();
+    if(!sqe) {
+      _fail("submission of read failed");
+      return;
+    }
+    sqe->opcode = _fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = _socket;
+    if(_rx_direct) {
+      sqe->addr = reinterpret_cast<uint64_t>(_rx_target + _rx_offset);
+      sqe->len = _rx_target_bytes - _rx_offset;
+      sqe->buf_index = impl::ARENA_BUFFER;
+    } else {
+      sqe->addr = reinterpret_cast<uint64_t>(_rx_ring.get() + _rx_end);
+      sqe->len = RX_RING_SIZE - _rx_end;
+      sqe->buf_index = impl::RING_BUFFER;
+    }
+    // Sockets are not seekable, read from the current position.
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = impl::RECV_TAG;
+    _rx_in_flight = true;
+  }
+
+  std::tuple<char*, uint32_t> Connection::_rx_segment()
+  {
+    uint32_t remaining = _rx_header.length - _rx_received;
+    if(_rx_header.opcode != impl::SEND)
+      return std::make_tuple(reinterpret_cast<char*>(_rx_header.addr) + _rx_received, remaining);
+    // The receive can hold the message, it was verified with the header.
+    while(_rx_sge_offset == _rx_request.sges[_rx_sge].length) {
+      ++_rx_sge;
+      _rx_sge_offset = 0;
+    }
+    const ibv_sge & sge = _rx_request.sges[_rx_sge];
+    return std::make_tuple(
+      reinterpret_cast<char*>(sge.addr) + _rx_sge_offset,
+      std::min(sge.length - _rx_sge_offset, remaining)
+    );
+  }
+
+  void Connection::_rx_advance(uint32_t bytes)
+  {
+    _rx_received += bytes;
+    _rx_sge_offset += bytes;
+  }
+
+  void Connection::_dispatch()
+  {
+    _process();
+    // Reading continues while messages are stalled, until the ring is full.
+    if(!_rx_in_flight && _status == ConnectionStatus::ESTABLISHED)
+      _read_ring();
+  }
+
+  void Connection::_process()
+  {
+    while(_status == ConnectionStatus::ESTABLISHED) {
+      impl::Header & header = _rx_header;
+
+      if(_rx_phase == Phase::HEADER) {
+        if(_rx_end - _rx_begin < sizeof(impl::Header))
+          return;
+        memcpy(&header, _rx_ring.get() + _rx_begin, sizeof(impl::Header));
+        switch(header.opcode) {
+        case impl::WRITE:
+        case impl::WRITE_WITH_IMM:
+          if(header.rkey != _pd.rkey() || !_pd.contains(header.addr, header.length)) {
+            spdlog::error(
+              "[tcp] Remote write to [{:x}, {:x}) with key {} outside of the arena",
+              header.addr, header.addr + header.length, header.rkey
+            );
+            _fail("invalid remote write");
+            return;
+          }
+          _rx_phase = Phase::PAYLOAD;
+          break;
+        case impl::SEND: {
+          // As with RNR retries, the message waits for a posted receive.
+          if(!_pop_recv())
+            return;
+          uint32_t capacity = 0;
+          for(int i = 0; i < _rx_request.num_sge; ++i)
+            capacity += _rx_request.sges[i].length;
+          if(capacity < header.length) {
+            _fail("message does not fit into the receive buffer");
+            return;
+          }
+          _rx_sge = 0;
+          _rx_sge_offset = 0;
+          _rx_phase = Phase::PAYLOAD;
+          break;
+        }
+        case impl::FETCH_ADD:
+        case impl::COMPARE_SWAP:
+          _rx_phase = Phase::DISPATCH;
+          break;
+        case impl::ATOMIC_RESPONSE: {
+          SendSlot & slot = _slots[header.wr_id % SEND_SLOTS];
+          *slot.result = header.operands[0];
+          _complete_send(slot.wr_id, slot.opcode);
+          _release_slot(header.wr_id % SEND_SLOTS);
+          break;
+        }
+        default:
+          _fail("unknown message");
+          return;
+        }
+        _rx_begin += sizeof(impl::Header);
+        _rx_received = 0;
+      } else if(_rx_phase == Phase::PAYLOAD) {
+        // Direct reads and reads of the ring can't be in flight together.
+        if(_rx_in_flight && (_rx_direct || _rx_begin == _rx_end))
+          return;
+        while(_rx_received < header.length && _rx_begin < _rx_end) {
+          auto [target, bytes] = _rx_segment();
+          uint32_t copied = std::min(bytes, _rx_end - _rx_begin);
+          memcpy(target, _rx_ring.get() + _rx_begin, copied);
+          _rx_begin += copied;
+          _rx_advance(copied);
+        }
+        if(_rx_received < header.length) {
+          // Small remainders arrive in the ring with the following messages.
+          if(!_rx_in_flight && header.length - _rx_received > DIRECT_READ_SIZE) {
+            auto [target, bytes] = _rx_segment();
+            _read_direct(target, bytes);
+          }
+          return;
+        }
+        _rx_phase = Phase::DISPATCH;
+      } else {
+        switch(header.opcode) {
+        case impl::SEND:
+        case impl::WRITE_WITH_IMM:
+          if(_rwc_count == WC_SIZE || !_pop_recv())
+            return;
+          if(header.opcode == impl::SEND)
+            _complete_recv(IBV_WC_RECV, header.length, 0);
+          else
+            _complete_recv(IBV_WC_RECV_RDMA_WITH_IMM, header.length, IBV_WC_WITH_IMM);
+          break;
+        case impl::FETCH_ADD:
+        case impl::COMPARE_SWAP: {
+          if(!_free_slots_count)
+            return;
+          if(header.rkey != _pd.rkey() || !_pd.contains(header.addr, sizeof(uint64_t))) {
+            _fail("invalid remote atomic");
+            return;
+          }
+          uint64_t* ptr = reinterpret_cast<uint64_t*>(header.addr);
+          impl::Header response;
+          memset(&response, 0, sizeof(response));
+          response.opcode = impl::ATOMIC_RESPONSE;
+          response.wr_id = header.wr_id;
+          if(header.opcode == impl::FETCH_ADD) {
+            response.operands[0] = __atomic_fetch_add(ptr, header.operands[0], __ATOMIC_SEQ_CST);
+          } else {
+            // On failure, compare is updated with the current value.
+            uint64_t compare = header.operands[0];
+            __atomic_compare_exchange_n(ptr, &compare, header.operands[1], false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            response.operands[0] = compare;
+          }
+          _post(response, nullptr, 0, 0, IBV_WC_SEND, false);
+          break;
+        }
+        default:
+          break;
+        }
+        _rx_phase = Phase::HEADER;
+      }
+    }
+  }
+
+  bool Connection::_progress(bool blocking)
+  {
+    if(_status != ConnectionStatus::ESTABLISHED)
+      return false;
+    _flush();
+    if(_ring->submit(blocking ? 1 : 0) < 0) {
+      _fail("io_uring_enter failed");
+      return false;
+    }
+
+    io_uring_cqe cqe;
+    bool processed = false;
+    while(_ring->pop(cqe)) {
+      processed = true;
+      if(cqe.user_data == impl::SEND_TAG) {
+        if(cqe.res != static_cast<int>(_send_bytes)) {
+          spdlog::error("[tcp] Sent {} out of {} bytes", cqe.res, _send_bytes);
+          _fail("send failed");
+          return false;
+        }
+        for(; _send_in_flight; --_send_in_flight) {
+          int idx = _send_queue[_send_queue_head];
+          _send_queue_head = (_send_queue_head + 1) % SEND_SLOTS;
+          --_send_queue_count;
+          if(_slots[idx].signaled && !_slots[idx].result)
+            _complete_send(_slots[idx].wr_id, _slots[idx].opcode);
+          _release_slot(idx);
+        }
+        _flush();
+      } else {
+        _rx_in_flight = false;
+        // Threads exiting cancel their reads, e.g. when another thread takes over polling.
+        if(cqe.res == -EINTR || cqe.res == -EAGAIN || cqe.res == -ECANCELED) {
+          _submit_read();
+          continue;
+        } else if(cqe.res <= 0) {
+          _fail(cqe.res ? strerror(-cqe.res) : "peer closed the connection");
+          return false;
+        }
+        if(!_rx_direct) {
+          _rx_end += cqe.res;
+        } else if((_rx_offset += cqe.res) < _rx_target_bytes) {
+          _submit_read();
+        } else {
+          _rx_advance(_rx_target_bytes);
+          _rx_direct = false;
+        }
+      }
+    }
+    // All messages of the read are processed, and stalled ones might continue
+    // after completions were polled.
+    _dispatch();
+    _flush();
+    // New operations are submitted once per batch of completions.
+    if(processed && _ring->submit(0) < 0) {
+      _fail("io_uring_enter failed");
+      return false;
+    }
+    return _status == ConnectionStatus::ESTABLISHED;
+  }
+
+  int32_t Connection::post_send(const ScatterGatherElement & elems, int32_t id, bool)
+  {
+    impl::Header header;
+    memset(&header, 0, sizeof(header));
+    header.opcode = impl::SEND;
+    int32_t ret = _post(header, elems.array(), elems.size(), id == -1 ? _req_count++ : id, IBV_WC_SEND, true);
+    _progress(false);
+    return ret;
+  }
+
+  int32_t Connection::post_recv(ScatterGatherElement && elem, int32_t id, int32_t count)
+  {
+    RecvRequest request;
+    request.wr_id = id == -1 ? _req_count++ : id;
+    request.num_sge = elem.size();
+    for(int i = 0; i < request.num_sge; ++i) {
+      request.sges[i] = elem.array()[i];
+      // Payloads are read directly into the receive buffers.
+      if(!_pd.contains(request.sges[i].addr, request.sges[i].length)) {
+        spdlog::error("[tcp] Receive buffer at {:x} outside of the arena", request.sges[i].addr);
+        return -1;
+      }
+    }
+    for(int i = 0; i < count; ++i) {
+      if(_recv_count == RECV_QUEUE_SIZE) {
+        spdlog::error("[tcp] Post receive unsuccesful, receive queue of {} is full", RECV_QUEUE_SIZE);
+        return -1;
+      }
+      _recv[(_recv_head + _recv_count++) % RECV_QUEUE_SIZE] = request;
+    }
+    SPDLOG_DEBUG("[tcp] Post recv succesfull, sges_count {}, wr_id {}, count {}", request.num_sge, request.wr_id, count);
+    return request.wr_id;
+  }
+
+  int32_t Connection::post_write(ScatterGatherElement && elems, const RemoteBuffer & rbuf, bool)
+  {
+    impl::Header header;
+    memset(&header, 0, sizeof(header));
+    header.opcode = impl::WRITE;
+    header.addr = rbuf.addr;
+    header.rkey = rbuf.rkey;
+    int32_t ret = _post(header, elems.array(), elems.size(), _req_count++, IBV_WC_RDMA_WRITE, true);
+    _progress(false);
+    return ret;
+  }
+
+  int32_t Connection::post_write(ScatterGatherElement && elems, const RemoteBuffer & rbuf,
+    uint32_t immediate,
+    bool,
+    bool solicited
+  )
+  {
+    impl::Header header;
+    memset(&header, 0, sizeof(header));
+    header.opcode = impl::WRITE_WITH_IMM;
+    header.solicited = solicited;
+    header.imm_data = htonl(immediate);
+    header.addr = rbuf.addr;
+    header.rkey = rbuf.rkey;
+    int32_t ret = _post(header, elems.array(), elems.size(), _req_count++, IBV_WC_RDMA_WRITE, true);
+    _progress(false);
+    return ret;
+  }
+
+  int32_t Connection::post_cas(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t compare, uint64_t swap)
+  {
+    impl::Header header;
+    memset(&header, 0, sizeof(header));
+    header.opcode = impl::COMPARE_SWAP;
+    header.addr = rbuf.addr;
+    header.rkey = rbuf.rkey;
+    header.operands = {compare, swap};
+    uint64_t* result = reinterpret_cast<uint64_t*>(elems.array()[0].addr);
+    int32_t ret = _post(header, nullptr, 0, _req_count++, IBV_WC_COMP_SWAP, true, result);
+    _progress(false);
+    return ret;
+  }
+
+  int32_t Connection::post_atomic_fadd(ScatterGatherElement && elems, const RemoteBuffer & rbuf, uint64_t add)
+  {
+    impl::Header header;
+    memset(&header, 0, sizeof(header));
+    header.opcode = impl::FETCH_ADD;
+    header.addr = rbuf.addr;
+    header.rkey = rbuf.rkey;
+    header.operands = {add, 0};
+    uint64_t* result = reinterpret_cast<uint64_t*>(elems.array()[0].addr);
+    int32_t ret = _post(header, nullptr, 0, _req_count++, IBV_WC_FETCH_ADD, true, result);
+    _progress(false);
+    return ret;
+  }
+
+  int32_t Connection::post_batch(WorkRequestBatch & batch)
+  {
+    batch._posted = 0;
+    for(int i = 0; i < batch.size(); ++i) {
+      const ibv_send_wr & wr = batch._wrs[i];
+      impl::Header header;
+      memset(&header, 0, sizeof(header));
+      ibv_wc_opcode opcode = IBV_WC_RDMA_WRITE;
+      if(wr.opcode == IBV_WR_SEND) {
+        header.opcode = impl::SEND;
+        opcode = IBV_WC_SEND;
+      } else if(wr.opcode == IBV_WR_RDMA_WRITE || wr.opcode == IBV_WR_RDMA_WRITE_WITH_IMM) {
+        header.opcode = wr.opcode == IBV_WR_RDMA_WRITE ? impl::WRITE : impl::WRITE_WITH_IMM;
+        header.addr = wr.wr.rdma.remote_addr;
+        header.rkey = wr.wr.rdma.rkey;
+        header.imm_data = wr.imm_data;
+        header.solicited = (wr.send_flags & IBV_SEND_SOLICITED) != 0;
+      } else {
+        spdlog::error("[tcp] Work request with unsupported opcode {}", static_cast<int>(wr.opcode));
+        return -1;
+      }
+      if(_post(header, wr.sg_list, wr.num_sge, wr.wr_id, opcode, wr.send_flags & IBV_SEND_SIGNALED) < 0)
+        return -1;
+      batch._posted = i + 1;
+    }
+    _progress(false);
+    return batch.size();
+  }
+
+  bool Connection::drain_send_queue()
+  {
+    // Slots of atomics are released with their response.
+    while(_free_slots_count < SEND_SLOTS && _status == ConnectionStatus::ESTABLISHED)
+      _progress(true);
+    _swc_count = 0;
+    return _status == ConnectionStatus::ESTABLISHED;
+  }
+
+  std::tuple<ibv_wc*, int> Connection::poll_wc(QueueType type, bool blocking, int count)
+  {
+    int limit = count < 0 || count > WC_SIZE ? WC_SIZE : count;
+    std::array<ibv_wc, WC_SIZE> & queue = type == QueueType::SEND ? _swc : _rwc;
+    int & queue_count = type == QueueType::SEND ? _swc_count : _rwc_count;
+
+    _progress(false);
+    // Send completions can only arrive while sends or atomics are in flight.
+    while(blocking && !queue_count && _status == ConnectionStatus::ESTABLISHED) {
+      if(type == QueueType::SEND && _free_slots_count == SEND_SLOTS)
+        break;
+      _progress(true);
+    }
+
+    int ret = std::min(limit, queue_count);
+    std::copy_n(queue.begin(), ret, _wc.begin());
+    std::copy(queue.begin() + ret, queue.begin() + queue_count, queue.begin());
+    queue_count -= ret;
+    // Receives stalled on a full completion queue can continue.
+    if(ret && type == QueueType::RECV)
+      _dispatch();
+    return std::make_tuple(_wc.data(), ret);
+  }
+
+  void Connection::notify_events(bool only_solicited)
+  {
+    _notify = only_solicited ? impl::NOTIFY_SOLICITED : impl::NOTIFY_ALL;
+  }
+
+  bool Connection::wait_events()
+  {
+    while(!_event)
+      if(!_progress(true))
+        return false;
+    _event = false;
+    return true;
+  }
+
+  RDMAActive::RDMAActive(const std::string & ip, int port, ProtectionDomain & pd):
+    _ip(ip),
+    _port(port),
+    _pd(pd)
+  {
+  }
+
+  bool RDMAActive::connect(uint32_t secret)
+  {
+    sockaddr_in addr;
+    if(!impl::address(_ip, _port, addr)) {
+      spdlog::error("[tcp] Incorrect address {}", _ip);
+      return false;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    rdmalib::impl::expect_nonnegative(fd);
+    if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+      spdlog::error("[tcp] Connection to {}:{} failed, errno {}", _ip, _port, errno);
+      ::close(fd);
+      return false;
+    }
+    _conn.reset(new Connection(_pd, fd, false));
+    return _conn->handshake(secret);
+  }
+
+  void RDMAActive::disconnect()
+  {
+    if(_conn)
+      _conn->close();
+  }
+
+  Connection & RDMAActive::connection()
+  {
+    return *_conn;
+  }
+
+  bool RDMAActive::is_connected()
+  {
+    return _conn && _conn->status() == ConnectionStatus::ESTABLISHED;
+  }
+
+  RDMAPassive::RDMAPassive(const std::string & ip, int port, ProtectionDomain & pd):
+    _pd(pd),
+    _port(port)
+  {
+    sockaddr_in addr;
+    rdmalib::impl::expect_true(impl::address(ip, port, addr));
+    _socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    rdmalib::impl::expect_nonnegative(_socket);
+    int flag = 1;
+    setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    rdmalib::impl::expect_zero(bind(_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    rdmalib::impl::expect_zero(listen(_socket, 10));
+
+    socklen_t len = sizeof(addr);
+    rdmalib::impl::expect_zero(getsockname(_socket, reinterpret_cast<sockaddr*>(&addr), &len));
+    _port = ntohs(addr.sin_port);
+    SPDLOG_DEBUG("[tcp] Listening on {}:{}", ip, _port);
+  }
+
+  RDMAPassive::~RDMAPassive()
+  {
+    ::close(_socket);
+  }
+
+  int RDMAPassive::port() const
+  {
+    return _port;
+  }
+
+  bool RDMAPassive::nonblocking_poll_events(int timeout)
+  {
+    pollfd my_pollfd;
+    my_pollfd.fd      = _socket;
+    my_pollfd.events  = POLLIN;
+    my_pollfd.revents = 0;
+    int rc = poll(&my_pollfd, 1, timeout);
+    if (rc < 0) {
+      spdlog::error("[tcp] Polling connections failed, errno {}", errno);
+      return false;
+    }
+    return rc > 0;
+  }
+
+  Connection* RDMAPassive::poll_events()
+  {
+    int fd = accept4(_socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd < 0) {
+      spdlog::error("[tcp] Accepting connection failed, errno {}", errno);
+      return nullptr;
+    }
+    Connection* conn = new Connection(_pd, fd, true);
+    if(!conn->handshake()) {
+      delete conn;
+      return nullptr;
+    }
+    return conn;
+  }
+
+}}
+
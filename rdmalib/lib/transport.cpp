@@ -0,0 +1,31 @@
+
+#include <rdmalib/transport.hpp>
+
+namespace rdmalib {
+
+  bool parse_transport(const std::string & name, Transport & transport)
+  {
+    if(name == "rdma")
+      transport = Transport::RDMA;
+    else if(name == "shm")
+      transport = Transport::SHM;
+    else if(name == "tcp")
+      transport = Transport::TCP;
+    else
+      return false;
+    return true;
+  }
+
+  std::string transport_name(Transport transport)
+  {
+    switch(transport) {
+      case Transport::SHM:
+        return "shm";
+      case Transport::TCP:
+        return "tcp";
+      default:
+        return "rdma";
+    }
+  }
+
+}
@@ -0,0 +1,97 @@
+
+#ifndef __RFAAS_COMPLETION_SLOTS_HPP__
+#define __RFAAS_COMPLETION_SLOTS_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace rfaas {
+
+  struct completion_slots;
+
+  // Result of an asynchronous invocation, resolved by whichever thread polls its completion.
+  // Move-only; the slot is returned to the table by get() or by the destructor.
+  // The table, i.e., the executor, must outlive the future.
+  struct future {
+    future();
+    future(completion_slots* slots, uint32_t slot, int invoc_id);
+    future(future && obj);
+    future & operator=(future && obj);
+    future(const future &) = delete;
+    future & operator=(const future &) = delete;
+    ~future();
+
+    bool valid() const;
+    bool ready() const;
+    void wait() const;
+    // Length of the last result, once the future is ready.
+    uint32_t bytes() const;
+    // Returns the first non-zero status of the invocation's results, or zero.
+    // Invalidates the future.
+    int get();
+
+  private:
+    completion_slots* _slots;
+    uint32_t _slot;
+    int _invoc_id;
+
+    void _release();
+  };
+
+  // Fixed ring of completion slots indexed by the invocation id - nothing is allocated per invocation.
+  // One thread acquires slots; completions can be recorded concurrently by other threads.
+  // Results carry only the lower 16 bits of the invocation id; thus, the capacity is a power of two
+  // up to 2^16, and ids that are a multiple of it apart share a slot - the older one must be
+  // resolved and released before the newer is acquired.
+  struct completion_slots {
+    static constexpr uint32_t DEFAULT_CAPACITY = 1024;
+    static constexpr uint32_t MAX_CAPACITY = 1 << 16;
+
+    // The capacity is rounded up to a power of two.
+    completion_slots(uint32_t capacity = DEFAULT_CAPACITY);
+
+    uint32_t capacity() const;
+    // The slot of the invocation can be acquired.
+    bool available(int invoc_id) const;
+    // Expect the given number of results for the invocation.
+    // A result carries the id of the invocation, or the id of its i-th lane, see lane_id.
+    // Returns an invalid future when the slot is still in use.
+    future acquire(int invoc_id, int results = 1);
+    // Lanes of one invocation share its slot, their ids are distinct in the lower 16 bits
+    // as long as results * capacity() doesn't exceed 2^16.
+    int lane_id(int invoc_id, int lane) const;
+    // Returns false when no future waits for the invocation.
+    bool complete(int invoc_id, int return_val, uint32_t bytes = 0);
+
+  private:
+    friend struct future;
+
+    enum State : uint32_t {
+      FREE = 0,
+      PENDING,
+      READY,
+      // The future was dropped before its results arrived.
+      ABANDONED
+    };
+
+    struct alignas(64) Slot {
+      std::atomic<uint32_t> state;
+      std::atomic<int32_t> id;
+      std::atomic<int32_t> remaining;
+      std::atomic<int32_t> lanes;
+      std::atomic<int32_t> value;
+      std::atomic<uint32_t> bytes;
+    };
+
+    uint32_t _capacity;
+    uint32_t _mask;
+    std::unique_ptr<Slot[]> _slots;
+
+    Slot & _slot(uint32_t idx) const;
+  };
+
+}
+
+#endif
+
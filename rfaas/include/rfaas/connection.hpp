@@ -2,6 +2,7 @@
 #ifndef __RFAAS_CONNECTION_HPP__
 #define __RFAAS_CONNECTION_HPP__
 
+#include <chrono>
 #include <vector>
 #include <fstream>
 
@@ -10,10 +11,16 @@
 #include <rdmalib/server.hpp>
 #include <rdmalib/recv_buffer.hpp>
 #include <rdmalib/allocation.hpp>
+#include <rdmalib/datagram.hpp>
+
+#include <rfaas/transport.hpp>
 
 namespace rfaas {
 
   struct manager_connection {
+    // Must be shorter than the client lease of the manager.
+    static constexpr std::chrono::milliseconds HEARTBEAT_PERIOD{1000};
+
     std::string _address;
     int _port;
     rdmalib::Buffer<char> _submit_buffer;
@@ -21,14 +28,21 @@ namespace rfaas {
     rdmalib::RecvBuffer _rcv_buffer;
     rdmalib::Buffer<rdmalib::AllocationRequest> _allocation_buffer;
     int _max_inline_data;
+    // When set, requests are datagrams and there's no connection to the manager.
+    rdmalib::DatagramClient* _control;
+    // When set, requests are sent over the emulated transport of the executor.
+    transport* _transport;
 
-    manager_connection(std::string address, int port, int rcv_buf, int max_inline_data);
+    manager_connection(std::string address, int port, int rcv_buf, int max_inline_data,
+        rdmalib::DatagramClient* control = nullptr, transport* emulated = nullptr);
 
     rdmalib::Connection & connection();
     rdmalib::AllocationRequest & request();
     bool connect();
     void disconnect();
     bool submit();
+    // Keeps the allocation of a datagram client alive; connections need no heartbeats.
+    bool heartbeat();
   };
 
 }
@@ -0,0 +1,235 @@
+
+#ifndef __RFAAS_COROUTINES_HPP__
+#define __RFAAS_COROUTINES_HPP__
+
+// Awaitable invocations require C++20 coroutines, and this header is empty for compilers without
+// coroutine support. The library itself is built as C++17; cpp_interface and coroutines_test are C++20.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <rfaas/executor.hpp>
+
+#define RFAAS_HAS_COROUTINES 1
+
+namespace rfaas {
+
+  struct invocation_loop;
+
+  // Started eagerly, and the frame is released when the coroutine finishes.
+  struct task {
+    struct promise_type {
+      task get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  // co_await returns the status of the invocation - zero on success.
+  // The awaitable lives in the frame of the suspended coroutine and is linked into the queues of the loop.
+  struct invocation {
+    invocation(invocation_loop* loop, int func_idx, rdmalib::ScatterGatherElement && sge, uint32_t size):
+      _loop(loop),
+      _func_idx(func_idx),
+      _sge(std::move(sge)),
+      _size(size),
+      _return_value(-1),
+      _next(nullptr)
+    {}
+
+    // Unknown functions are not submitted.
+    bool await_ready() const noexcept
+    {
+      return _func_idx < 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+    int await_resume() const noexcept
+    {
+      return _return_value;
+    }
+
+  private:
+    friend struct invocation_loop;
+
+    invocation_loop* _loop;
+    int _func_idx;
+    rdmalib::ScatterGatherElement _sge;
+    uint32_t _size;
+    int _return_value;
+    future _result;
+    std::coroutine_handle<> _handle;
+    invocation* _next;
+  };
+
+  // Submits awaited invocations as threads become available, and resumes coroutines when their results arrive.
+  // Invocations beyond the capacity of the dispatcher wait in the loop, without holding a thread of ours.
+  // Not thread-safe - invocations are awaited and polled by one client thread;
+  // coroutines resumed by a scheduler elsewhere must not use the loop concurrently with it.
+  // The loop owns result polling of the executor while it exists, and it must be destroyed by the same thread.
+  // The background thread doesn't poll in the meantime - results of other asynchronous invocations
+  // are completed by poll(), and other threads invoking synchronously block until the loop is gone.
+  struct invocation_loop {
+    // Resumes a coroutine, e.g., by posting it to a thread pool. By default, coroutines are resumed inline.
+    using scheduler_t = std::function<void(std::coroutine_handle<>)>;
+
+    invocation_loop(executor & exec, scheduler_t scheduler = {}):
+      _executor(exec),
+      _polling(exec),
+      _scheduler(std::move(scheduler)),
+      _waiting_head(nullptr),
+      _waiting_tail(nullptr),
+      _running(nullptr),
+      _waiting(0),
+      _in_flight(0)
+    {}
+
+    invocation_loop(const invocation_loop &) = delete;
+    invocation_loop & operator=(const invocation_loop &) = delete;
+
+    // The input is not copied - it must not be modified before the invocation completes.
+    template<typename T, typename U>
+    invocation invoke(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out, int64_t size = -1)
+    {
+      auto it = std::find(_executor._func_names.begin(), _executor._func_names.end(), fname);
+      if(it == _executor._func_names.end()) {
+        spdlog::error("Function {} not found in the deployed library!", fname);
+        return invocation{this, -1, {}, 0};
+      }
+      char* data = static_cast<char*>(in.ptr());
+      *reinterpret_cast<uint64_t*>(data) = out.address();
+      *reinterpret_cast<uint32_t*>(data + 8) = out.rkey();
+
+      rdmalib::ScatterGatherElement sge;
+      uint32_t bytes = size != -1 ? size : in.bytes();
+      sge.add(in, bytes, 0);
+      return invocation{this, static_cast<int>(std::distance(_executor._func_names.begin(), it)), std::move(sge), bytes};
+    }
+
+    // Complete arrived results, submit waiting invocations and resume finished coroutines.
+    // Non-blocking, returns the number of resumed coroutines. Must not be called from a coroutine.
+    int poll()
+    {
+      _executor.poll_invocations();
+      _ready.clear();
+      invocation** prev = &_running;
+      while(invocation* inv = *prev) {
+        if(inv->_result.ready()) {
+          inv->_return_value = inv->_result.get();
+          *prev = inv->_next;
+          --_in_flight;
+          _ready.push_back(inv->_handle);
+        } else
+          prev = &inv->_next;
+      }
+      // Threads released by the results are taken before coroutines add more invocations.
+      _submit_waiting();
+      // Resumed coroutines destroy their awaitables.
+      for(auto handle : _ready) {
+        if(_scheduler)
+          _scheduler(handle);
+        else
+          handle.resume();
+      }
+      return _ready.size();
+    }
+
+    // Poll until all invocations have completed.
+    void run()
+    {
+      while(_in_flight || _waiting)
+        if(!poll())
+          std::this_thread::yield();
+    }
+
+    size_t in_flight() const
+    {
+      return _in_flight;
+    }
+
+    size_t waiting() const
+    {
+      return _waiting;
+    }
+
+  private:
+    friend struct invocation;
+
+    executor & _executor;
+    polling_guard _polling;
+    scheduler_t _scheduler;
+    // Not yet submitted, in order of arrival.
+    invocation* _waiting_head;
+    invocation* _waiting_tail;
+    // Submitted, each one has a thread of the executor.
+    invocation* _running;
+    size_t _waiting;
+    size_t _in_flight;
+    std::vector<std::coroutine_handle<>> _ready;
+
+    void _enqueue(invocation* inv)
+    {
+      inv->_next = nullptr;
+      if(_waiting_tail)
+        _waiting_tail->_next = inv;
+      else
+        _waiting_head = inv;
+      _waiting_tail = inv;
+      ++_waiting;
+      _submit_waiting();
+    }
+
+    void _submit_waiting()
+    {
+      while(_waiting_head) {
+        int invoc_id = _executor._invoc_id;
+        // Ids with a pending future wait for its release.
+        if(!_executor._futures.available(invoc_id))
+          break;
+        executor_state* conn = _executor.try_dispatch(invoc_id);
+        if(!conn)
+          break;
+        ++_executor._invoc_id;
+
+        invocation* inv = _waiting_head;
+        _waiting_head = inv->_next;
+        if(!_waiting_head)
+          _waiting_tail = nullptr;
+        --_waiting;
+
+        inv->_result = _executor._futures.acquire(invoc_id);
+        // Results are not solicited, the loop polls them as the owner of result polling.
+        uint32_t submission_id = conn->submission_id(invoc_id, inv->_func_idx);
+        SPDLOG_DEBUG(
+          "Invoke function {} with invocation id {}, submission id {}, awaited",
+          inv->_func_idx, invoc_id, submission_id
+        );
+        if(!conn->add_submission(std::move(inv->_sge), submission_id, inv->_size <= _executor._max_inlined_msg))
+          _executor.fail_submission(invoc_id);
+        _executor.post_batch(*conn);
+        inv->_next = _running;
+        _running = inv;
+        ++_in_flight;
+      }
+    }
+  };
+
+  inline void invocation::await_suspend(std::coroutine_handle<> handle)
+  {
+    _handle = handle;
+    _loop->_enqueue(this);
+  }
+
+}
+
+#endif
+
+#endif
+
@@ -11,6 +11,8 @@
 #include <cereal/types/vector.hpp> 
 #include <cereal/types/string.hpp>
 
+#include <rdmalib/transport.hpp>
+
 namespace rfaas {
 
   struct device_data
@@ -18,14 +20,24 @@ namespace rfaas {
     std::string name;
     std::string ip_address;
     int port;
+    // Negative value uses the maximum accepted by the device.
     int16_t max_inline_data;
     int16_t default_receive_buffer_size;
+    // Largest payload for which inlining is faster, measured by inline_calibration.
+    // Negative when not calibrated.
+    int16_t inline_crossover = -1;
+    // Connections to executors, emulated transports don't use the device.
+    rdmalib::Transport transport = rdmalib::Transport::RDMA;
+
+    // Inline size to request for connections.
+    int inline_threshold() const;
 
     template <class Archive>
     void save(Archive & ar) const
     {
       ar( CEREAL_NVP(name), CEREAL_NVP(ip_address), CEREAL_NVP(port),
-          CEREAL_NVP(max_inline_data), CEREAL_NVP(default_receive_buffer_size));
+          CEREAL_NVP(max_inline_data), CEREAL_NVP(default_receive_buffer_size),
+          CEREAL_NVP(inline_crossover), cereal::make_nvp("transport", rdmalib::transport_name(transport)));
     }
 
     template <class Archive>
@@ -33,6 +45,20 @@ namespace rfaas {
     {
       ar( CEREAL_NVP(name), CEREAL_NVP(ip_address), CEREAL_NVP(port),
           CEREAL_NVP(max_inline_data), CEREAL_NVP(default_receive_buffer_size));
+      // Optional, missing in databases written before calibration.
+      try {
+        ar(CEREAL_NVP(inline_crossover));
+      } catch(const cereal::Exception &) {
+        inline_crossover = -1;
+      }
+      // Optional, RDMA when missing.
+      std::string transport_type = rdmalib::transport_name(rdmalib::Transport::RDMA);
+      try {
+        ar(cereal::make_nvp("transport", transport_type));
+      } catch(const cereal::Exception &) {
+      }
+      if(!rdmalib::parse_transport(transport_type, transport))
+        throw cereal::Exception("Unknown transport " + transport_type);
     }
   };
 
@@ -44,6 +70,7 @@ namespace rfaas {
     device_data * device (std::string name) noexcept;
     static devices & instance();
     static void deserialize(std::istream & in);
+    static void serialize(std::ostream & out);
   private:
     devices() {}
   };
@@ -0,0 +1,79 @@
+
+#ifndef __RFAAS_DISPATCHER_HPP__
+#define __RFAAS_DISPATCHER_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace rfaas {
+
+  enum class DispatchPolicy {
+    ROUND_ROBIN = 0,
+    // Fewest invocations in flight.
+    LEAST_OUTSTANDING,
+    // Shortest expected wait - invocations in flight times the average latency.
+    LATENCY_EWMA
+  };
+
+  // Chooses executor threads for invocations that don't name one.
+  // Selection and submission happen on the submitting thread; completions can be
+  // recorded concurrently by the background thread. Results carry only the lower
+  // 16 bits of the invocation id, and invocations are matched by them.
+  struct dispatcher {
+    // A thread has a single input buffer - the next input overwrites the one being processed.
+    static constexpr int DEFAULT_MAX_OUTSTANDING = 1;
+    // A new latency sample has the weight of 1 / 2^EWMA_SHIFT.
+    static constexpr int EWMA_SHIFT = 3;
+
+    dispatcher(DispatchPolicy policy = DispatchPolicy::ROUND_ROBIN,
+        int max_outstanding = DEFAULT_MAX_OUTSTANDING);
+
+    // Drop the state of previous workers.
+    void reset(int workers);
+    int workers() const;
+    DispatchPolicy policy() const;
+    void policy(DispatchPolicy policy);
+    int max_outstanding() const;
+    // Applied by the next reset.
+    void max_outstanding(int max_outstanding);
+
+    // Returns -1 when all workers have the maximum of invocations in flight.
+    int select();
+    void submitted(int worker, int invoc_id);
+    // Returns false for invocations that were not dispatched.
+    bool completed(int invoc_id);
+    int outstanding(int worker) const;
+    // Average latency in microseconds, zero before the first completion.
+    double latency(int worker) const;
+
+  private:
+    static constexpr int32_t FREE_SLOT = -1;
+    static constexpr int32_t ID_MASK = 0xFFFF;
+
+    struct Worker {
+      std::atomic<int> outstanding;
+      std::atomic<int64_t> latency_ns;
+    };
+    // Slots of invocations in flight, max_outstanding for each worker.
+    struct Invocation {
+      std::atomic<int32_t> id;
+      std::atomic<int64_t> start_ns;
+    };
+
+    DispatchPolicy _policy;
+    int _max_outstanding;
+    int _workers_count;
+    int _slots;
+    // Ties are resolved round-robin, starting after the last selection.
+    int _next;
+    std::unique_ptr<Worker[]> _workers;
+    std::unique_ptr<Invocation[]> _invocations;
+
+    static int64_t _now();
+  };
+
+}
+
+#endif
+
@@ -3,18 +3,27 @@
 #define __RFAAS_EXECUTOR_HPP__
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <iterator>
-#include <future>
+#include <mutex>
 #include <fcntl.h>
 
 #include <rdmalib/benchmarker.hpp>
 #include <rdmalib/connection.hpp>
+#include <rdmalib/flag_ring.hpp>
+#include <rdmalib/functions.hpp>
 #include <rdmalib/recv_buffer.hpp>
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/memory_pool.hpp>
 #include <rdmalib/rdmalib.hpp>
+#include <rdmalib/registration_cache.hpp>
 
+#include <rfaas/completion_slots.hpp>
 #include <rfaas/connection.hpp>
 #include <rfaas/devices.hpp>
+#include <rfaas/dispatcher.hpp>
+#include <rfaas/transport.hpp>
 
 #include <spdlog/spdlog.h>
 
@@ -42,10 +51,92 @@ namespace rfaas {
   };
 
   struct executor_state {
-    std::unique_ptr<rdmalib::Connection> conn;
+    // Shared by executor threads multiplexed over one queue pair.
+    std::shared_ptr<rdmalib::Connection> conn;
     rdmalib::RemoteBuffer remote_input;
+    // Results of all threads of the queue pair arrive at the buffer of the first one.
     rdmalib::RecvBuffer _rcv_buffer;
-    executor_state(rdmalib::Connection*, int rcv_buf_size);
+    // Thread of the queue pair, encoded in submissions.
+    uint32_t _lane;
+    // Invocations prepared for this connection, submitted together
+    rdmalib::WorkRequestBatch _batch;
+    // Invocations in the batch, with the number of requests up to and including theirs.
+    std::array<std::pair<int, int>, rdmalib::WorkRequestBatch::MAX_WORK_REQUESTS> _batch_invocations;
+    int _batch_invocations_count;
+    // Invocations of the last failed post that didn't reach the thread.
+    std::array<int, rdmalib::WorkRequestBatch::MAX_WORK_REQUESTS> _unposted;
+    int _unposted_count;
+    // With memory polling, invocations are flag messages written to the input buffer of the thread,
+    // and results are announced by messages in a ring of ours.
+    rdmalib::FlagSender _inputs;
+    rdmalib::FlagRing _results;
+    // Threads connected over an emulated transport don't have conn.
+    transport* _transport;
+    int _transport_idx;
+    executor_state(std::shared_ptr<rdmalib::Connection> conn, int rcv_buf_size, uint32_t lane = 0);
+    executor_state(transport & emulated, int idx);
+
+    // Add the invocation to the batch; flag messages carry the submission id in their header.
+    bool add_submission(rdmalib::ScatterGatherElement && elems, uint32_t submission_id,
+        bool force_inline = false, bool solicited = false);
+    // Returns -1 when posting fails, see _unposted.
+    int32_t post_batch();
+
+    uint32_t submission_id(int invoc_id, int func_idx, uint32_t flags = 0) const
+    {
+      return (invoc_id << 16) | flags | (_lane << rdmalib::InvocationCompletion::LANE_SHIFT) | func_idx;
+    }
+  };
+
+  struct executor;
+
+  // Ownership of result polling for the scope, can be nested by the owning thread.
+  // Its owner completes the results of all invocations, and it's the only thread submitting -
+  // synchronous invocations take it to submit, then wait for their completion slot.
+  struct polling_guard {
+    polling_guard(executor & exec);
+    // Waits at most the timeout, see owns().
+    polling_guard(executor & exec, std::chrono::microseconds timeout);
+    ~polling_guard();
+    polling_guard(const polling_guard &) = delete;
+    polling_guard & operator=(const polling_guard &) = delete;
+
+    bool owns() const;
+
+  private:
+    executor & _executor;
+    bool _owns;
+  };
+
+  // Invocations of one function on many inputs, started by executor::map.
+  // Inputs are submitted as threads become available, and progress is made only
+  // while the handle is polled or waited on. Waiting owns result polling, see polling_guard. Buffers must outlive the handle;
+  // inputs that were not submitted before the handle is dropped are never invoked.
+  struct map_handle {
+    map_handle();
+    map_handle(executor* exec, int func_idx, std::vector<ibv_sge> && inputs);
+
+    bool valid() const;
+    size_t size() const;
+    size_t completed() const;
+    size_t failed() const;
+    bool done() const;
+    // Non-blocking, returns true when all invocations have completed.
+    bool poll();
+    // Returns true when all invocations have succeeded.
+    bool wait();
+
+  private:
+    executor* _executor;
+    int _func_idx;
+    std::vector<ibv_sge> _inputs;
+    size_t _submitted;
+    size_t _completed;
+    size_t _failed;
+    // One for each invocation the dispatcher can have in flight.
+    std::vector<future> _in_flight;
+
+    void _submit();
   };
 
   struct executor {
@@ -54,43 +145,149 @@ namespace rfaas {
     rdmalib::RDMAPassive _state;
     rdmalib::RecvBuffer _rcv_buffer;
     rdmalib::Buffer<rdmalib::BufferInformation> _execs_buf;
+    rdmalib::RegistrationCache _input_registrations;
+    rdmalib::RegistrationCache _output_registrations;
     std::string _address;
     int _port;
     int _rcv_buf_size;
     int _executions;
     int _invoc_id;
-    // FIXME: global settings
+    // Input capacity of executor threads, larger inputs are pulled by the executor.
+    int _max_input_size;
+    // Payloads up to this size are inlined.
+    // Negative values in the constructor select the inline capacity of connections.
     size_t _max_inlined_msg;
+    // Receive completions of all connections, routed to their receive buffers.
+    std::unique_ptr<rdmalib::SharedCompletionQueue> _completion_queue;
+    // With adaptive waits, foreground waits for results spin only for a budget tuned to their latency,
+    // then sleep on the completion channel while they own result polling.
+    // Must be set before allocation.
+    rdmalib::WaitMode _wait_mode;
+    // Executor threads sharing a queue pair, up to rdmalib::SharedConnection::MAX_LANES.
+    // Must be set before allocation.
+    int _threads_per_qp;
+    // Allocation requests are datagrams, without a connection to the manager.
+    // Must be set before allocation.
+    bool _datagram_control;
+    // Resolved once, reused by allocations on the same manager.
+    std::unique_ptr<rdmalib::DatagramClient> _control;
+    // Executor threads poll memory instead of completions, and so do we for results.
+    // Requires dedicated queue pairs; each thread has one invocation in flight.
+    // Must be set before allocation.
+    bool _memory_polling;
+    rdmalib::Buffer<char> _result_flags;
+    rdmalib::Buffer<rdmalib::RemoteBuffer> _result_rings;
+    rdmalib::FlagPoller _result_poller;
     std::vector<executor_state> _connections;
+    // Connections of an emulated transport selected by the device, replacing RDMA.
+    // Only invocations on buffers allocated by allocate_buffer are supported.
+    std::unique_ptr<transport> _transport;
     std::unique_ptr<manager_connection> _exec_manager;
     std::vector<std::string> _func_names;
 
     // manage async executions
     std::atomic<bool> _end_requested;
-    std::atomic<bool> _active_polling;
-    //std::unordered_map<int, std::promise<int>> _futures;
-    std::unordered_map<int, std::tuple<int, std::promise<int>>> _futures;
+    // Results are polled by one thread at a time, see polling_guard.
+    // The background thread polls only when no other thread owns the results, and in the meantime
+    // the owner completes all invocations, including synchronous ones waiting for their slot.
+    std::recursive_timed_mutex _poller;
+    int _poller_depth;
+    // Results of invocations, resolved by the background thread or by foreground polling.
+    completion_slots _futures;
+    // Submission headers sent ahead of user memory registered on demand,
+    // followed by the descriptor of pulled or streamed input.
+    // One for each completion slot - it's reused only after the result of the invocation has arrived.
+    rdmalib::Buffer<char> _submission_headers;
+    static constexpr uint32_t SUBMISSION_HEADER_SIZE = 64;
+    // Threads of single-buffer invocations. The policy can be changed at any time,
+    // the limit of invocations in flight must be set before allocation.
+    dispatcher _dispatcher;
     std::unique_ptr<std::thread> _background_thread;
     int events;
 
-    executor(std::string address, int port, int rcv_buf_size, int max_inlined_msg);
+    executor(std::string address, int port, int rcv_buf_size, int max_inlined_msg,
+        rdmalib::Transport type = rdmalib::Transport::RDMA);
     executor(device_data & dev);
     ~executor();
 
     // Skipping managers is useful for benchmarking
     bool allocate(std::string functions_path, int numcores, int max_input_size, int hot_timeout,
         bool skip_manager = false, rdmalib::Benchmarker<5> * benchmarker = nullptr);
+    // Threads of an emulated transport connect to it, spawned by the manager or started directly.
+    bool allocate_emulated(const rdmalib::Buffer<char> & functions, int numcores);
     void deallocate();
     rdmalib::Buffer<char> load_library(std::string path);
+    // The background thread waits this long for the owner of result polling between heartbeats.
+    static constexpr std::chrono::milliseconds POLLER_HANDOFF_TIMEOUT{100};
+    // Synchronous waits check their result this often while another thread polls.
+    static constexpr std::chrono::microseconds RESULT_WAIT_SLICE{100};
     void poll_queue();
+    // Background polling without completion events to wait for - with memory polling,
+    // and with emulated transports.
+    void poll_periodically();
+    // Submit invocations accumulated in per-connection batches.
+    void post_batches();
+    // Invocations of the batch that couldn't be posted are failed, their slots are released.
+    int32_t post_batch(executor_state & conn);
+    // Send the output location and the input descriptor to a dispatched thread, which reads the input.
+    // Returns the future of the invocation, invalid for inputs that don't fit the descriptor,
+    // which are not dispatched.
+    future post_pull(int invoc_id, int func_idx, const rdmalib::RemoteBuffer & in, uint64_t in_size,
+        const rdmalib::RemoteBuffer & out);
+    // Block until the result of the invocation arrives, returns its status and length.
+    // Results are polled only while no other thread does - its owner completes our result too.
+    std::tuple<bool, int> wait_result(int invoc_id, future & result);
+    // Offset of the submission header of the invocation in _submission_headers.
+    uint32_t submission_header(int invoc_id) const;
+    // Connection chosen by the dispatcher for a single-buffer invocation.
+    // While all threads are busy, results are polled here.
+    executor_state & dispatch(int invoc_id);
+    // Non-blocking, returns nullptr while all threads are busy.
+    executor_state* try_dispatch(int invoc_id);
+    // Complete results that have arrived, without blocking; returns their number.
+    // Blocks only while another thread owns result polling.
+    int poll_invocations();
+    // Release the thread of the invocation and resolve its future.
+    void complete_invocation(int invoc_id, int return_val, uint32_t bytes = 0);
+    // Complete a dispatched invocation that couldn't be added to the batch, it's never sent.
+    void fail_submission(int invoc_id);
+    // Registrations of user memory must be dropped before it's unmapped or freed.
+    void invalidate_memory(const void* ptr, size_t size);
+
+    // Results of all connections, from the completion queue or from result rings.
+    template<typename ErrorHandler = rdmalib::LogCompletionErrors>
+    rdmalib::CompletionSpan<ErrorHandler> poll_results(bool blocking = false, ErrorHandler handler = {})
+    {
+      if(_memory_polling)
+        return _result_poller.poll_completions(blocking, std::move(handler));
+      if(_transport) {
+        auto [wcs, count] = _transport->poll(blocking);
+        return rdmalib::CompletionSpan<ErrorHandler>{wcs, count, std::move(handler)};
+      }
+      return _completion_queue->poll_completions(blocking, std::move(handler));
+    }
+
+    // Memory for inputs and outputs of invocations, registered with the device,
+    // or allocated from the transport which releases it.
+    template<typename T>
+    rdmalib::Buffer<T> allocate_buffer(uint32_t size, uint32_t header = 0)
+    {
+      if(_transport) {
+        auto [ptr, mr] = _transport->allocate(size * sizeof(T) + header);
+        return impl::arena_buffer<T>{ptr, mr, size, header};
+      }
+      rdmalib::Buffer<T> buf(size, header);
+      buf.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+      return buf;
+    }
 
     template<typename T, typename U>
-    std::future<int> async(std::string fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out, int64_t size = -1)
+    future async(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out, int64_t size = -1)
     {
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
-        return std::future<int>{};
+        return future{};
       }
       int func_idx = std::distance(_func_names.begin(), it);
 
@@ -101,92 +298,142 @@ namespace rfaas {
       *reinterpret_cast<uint32_t*>(data + 8) = out.rkey();
 
       int invoc_id = this->_invoc_id++;
-      //_futures[invoc_id] = std::move(std::promise<int>{});
-      _futures[invoc_id] = std::make_tuple(1, std::promise<int>{});
-      uint32_t submission_id = (invoc_id << 16) | (1 << 15) | func_idx;
+      future result = _futures.acquire(invoc_id);
+      if(!result.valid())
+        return result;
+      executor_state & conn = dispatch(invoc_id);
+      uint32_t submission_id = conn.submission_id(invoc_id, func_idx, rdmalib::InvocationCompletion::SOLICITED_MASK);
       SPDLOG_DEBUG(
         "Invoke function {} with invocation id {}, submission id {}",
         func_idx, invoc_id, submission_id
       );
+      bool added;
       if(size != -1) {
         rdmalib::ScatterGatherElement sge;
         sge.add(in, size, 0);
-        _connections[0].conn->post_write(
+        added = conn.add_submission(
           std::move(sge),
-          _connections[0].remote_input,
           submission_id,
           size <= _max_inlined_msg,
           true
         );
       } else {
-        _connections[0].conn->post_write(
+        added = conn.add_submission(
           in,
-          _connections[0].remote_input,
           submission_id,
           in.bytes() <= _max_inlined_msg,
           true
         );
       }
-      _connections[0]._rcv_buffer.refill();
-      return std::get<1>(_futures[invoc_id]).get_future();
+      if(!added)
+        fail_submission(invoc_id);
+      post_batch(conn);
+      return result;
     }
 
-    template<typename T,typename U>
-    std::future<int> async(std::string fname, const std::vector<rdmalib::Buffer<T>> & in, std::vector<rdmalib::Buffer<U>> & out)
+    // Buffers can be rdmalib::Buffer or rdmalib::PooledBuffer.
+    template<typename BufferIn, typename BufferOut>
+    future async(const std::string & fname, const std::vector<BufferIn> & in, std::vector<BufferOut> & out)
     {
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
-        return std::future<int>{};
+        return future{};
       }
       int func_idx = std::distance(_func_names.begin(), it);
 
-      int invoc_id = this->_invoc_id++;
-      //_futures[invoc_id] = std::move(std::promise<int>{});
       int numcores = _connections.size();
-      _futures[invoc_id] = std::make_tuple(numcores, std::promise<int>{});
-      uint32_t submission_id = (invoc_id << 16) | (1 << 15) | func_idx;
+      // Each input is dispatched on its own, results of lanes are told apart by their ids.
+      if(static_cast<uint32_t>(numcores) * _futures.capacity() > completion_slots::MAX_CAPACITY) {
+        spdlog::error("Vector invocations support at most {} threads", completion_slots::MAX_CAPACITY / _futures.capacity());
+        return future{};
+      }
+      int invoc_id = this->_invoc_id++;
+      future result = _futures.acquire(invoc_id, numcores);
+      if(!result.valid())
+        return result;
       for(int i = 0; i < numcores; ++i) {
-        // FIXME: here get a future for async
         char* data = static_cast<char*>(in[i].ptr());
         // TODO: we assume here uintptr_t is 8 bytes
         *reinterpret_cast<uint64_t*>(data) = out[i].address();
         *reinterpret_cast<uint32_t*>(data + 8) = out[i].rkey();
 
-        SPDLOG_DEBUG("Invoke function {} with invocation id {}", func_idx, _invoc_id);
-        _connections[i].conn->post_write(
+        int lane_id = _futures.lane_id(invoc_id, i);
+        executor_state* conn = try_dispatch(lane_id);
+        // Threads busy with our lanes are released only once they're posted.
+        if(!conn) {
+          post_batches();
+          conn = &dispatch(lane_id);
+        }
+        SPDLOG_DEBUG("Invoke function {} with invocation id {}, lane {}", func_idx, invoc_id, i);
+        if(!conn->add_submission(
           in[i],
-          _connections[i].remote_input,
-          submission_id,
+          conn->submission_id(lane_id, func_idx, rdmalib::InvocationCompletion::SOLICITED_MASK),
           in[i].bytes() <= _max_inlined_msg,
           true
-        );
+        ))
+          fail_submission(lane_id);
       }
+      post_batches();
+      return result;
+    }
 
-      for(int i = 0; i < numcores; ++i) {
-        _connections[i]._rcv_buffer.refill();
+    // Invoke the function on each input, the result is written to the output of the same index.
+    // Headers of all inputs are written here, and each round of submissions is posted
+    // with a single chain of work requests for each connection.
+    template<typename BufferIn, typename BufferOut>
+    map_handle map(const std::string & fname, const std::vector<BufferIn> & in, std::vector<BufferOut> & out)
+    {
+      auto it = std::find(_func_names.begin(), _func_names.end(), fname);
+      if(it == _func_names.end()) {
+        spdlog::error("Function {} not found in the deployed library!", fname);
+        return map_handle{};
+      }
+      if(in.size() != out.size()) {
+        spdlog::error("Map over {} inputs with {} outputs", in.size(), out.size());
+        return map_handle{};
+      }
+      if(_connections.empty()) {
+        spdlog::error("Map of function {} without allocated executors", fname);
+        return map_handle{};
       }
-      return std::get<1>(_futures[invoc_id]).get_future();
+      int func_idx = std::distance(_func_names.begin(), it);
+
+      std::vector<ibv_sge> inputs;
+      inputs.reserve(in.size());
+      for(size_t i = 0; i < in.size(); ++i) {
+        char* data = static_cast<char*>(in[i].ptr());
+        *reinterpret_cast<uint64_t*>(data) = out[i].address();
+        *reinterpret_cast<uint32_t*>(data + 8) = out[i].rkey();
+        inputs.push_back({in[i].address(), in[i].bytes(), in[i].lkey()});
+      }
+      map_handle handle{this, func_idx, std::move(inputs)};
+      handle.poll();
+      return handle;
     }
 
+    // Wait until results arrive, and complete them like poll_invocations.
+    // Returns false when one of them failed. Prefer future::get to wait for a specific invocation.
     bool block()
     {
-      _connections[0].conn->poll_wc(rdmalib::QueueType::SEND, true);
-
-      auto wc = _connections[0]._rcv_buffer.poll(true);
-      uint32_t val = ntohl(std::get<0>(wc)[0].imm_data);
-      int return_val = val & 0x0000FFFF;
-      int finished_invoc_id = val >> 16;
-      if(return_val == 0) {
-        SPDLOG_DEBUG("Finished invocation {} succesfully", finished_invoc_id);
-        return true;
-      } else {
-        if(val == 1)
-          spdlog::error("Invocation: {}, Thread busy, cannot post work", finished_invoc_id);
-        else
-          spdlog::error("Invocation: {}, Unknown error {}", finished_invoc_id, val);
-        return false;
+      polling_guard polling{*this};
+      auto wcs = poll_results(true);
+      bool correct = wcs.begin() != wcs.end();
+      for(auto wc : wcs) {
+        int return_val = wc.return_value();
+        int finished_invoc_id = wc.invocation_id;
+        complete_invocation(finished_invoc_id, return_val, wc.byte_len);
+        if(return_val == 0) {
+          SPDLOG_DEBUG("Finished invocation {} succesfully", finished_invoc_id);
+        } else {
+          if(return_val == 1)
+            spdlog::error("Invocation: {}, Thread busy, cannot post work", finished_invoc_id);
+          else
+            spdlog::error("Invocation: {}, Unknown error {}", finished_invoc_id, return_val);
+          correct = false;
+        }
       }
+      return correct;
     }
 
     // FIXME: irange for cores
@@ -194,7 +441,7 @@ namespace rfaas {
     //template<class... Args>
     //void execute(int numcores, std::string fname, Args &&... args)
     template<typename T, typename U>
-    std::tuple<bool, int> execute(std::string fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out)
+    std::tuple<bool, int> execute(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out)
     {
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
@@ -209,139 +456,127 @@ namespace rfaas {
       *reinterpret_cast<uint64_t*>(data) = out.address();
       *reinterpret_cast<uint32_t*>(data + 8) = out.rkey();
 
-      int invoc_id = this->_invoc_id++;
-      SPDLOG_DEBUG(
-        "Invoke function {} with invocation id {}, submission id {}",
-        func_idx, invoc_id, (invoc_id << 16) | func_idx
-      );
-      _connections[0].conn->post_write(
-        in,
-        _connections[0].remote_input,
-        (invoc_id << 16) | func_idx,
-        in.bytes() <= _max_inlined_msg
-      );
-      _active_polling = true;
-      _connections[0]._rcv_buffer.refill();
-
-      bool found_result = false;
-      int return_value = 0;
-      int out_size = 0;
-      while(!found_result) {
-        auto wc = _connections[0]._rcv_buffer.poll(true);
-        for(int i = 0; i < std::get<1>(wc); ++i) {
-          uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
-          int return_val = val & 0x0000FFFF;
-          int finished_invoc_id = val >> 16;
-
-          if(finished_invoc_id == invoc_id) {
-            found_result = true;
-            return_value = return_val;
-            out_size = std::get<0>(wc)[i].byte_len;
-            //spdlog::info("Result for id {}", finished_invoc_id);
-          } else {
-            auto it = _futures.find(finished_invoc_id);
-            //spdlog::info("Poll Future for id {}", finished_invoc_id);
-            // if it == end -> we have a bug, should never appear
-            //(*it).second.set_value(return_val);
-            if(!--std::get<0>(it->second))
-              std::get<1>(it->second).set_value(return_val);
-          }
-        }
-        if(found_result) {
-          _active_polling = false;
-          auto wc = _connections[0]._rcv_buffer.poll(false);
-          // Catch very unlikely interleaving
-          // Event arrives after we poll while the background thread is skipping
-          // because we still hold the atomic
-          // Thus, we later unset the variable since we're done
-          for(int i = 0; i < std::get<1>(wc); ++i) {
-            uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
-            int return_val = val & 0x0000FFFF;
-            int finished_invoc_id = val >> 16;
-            auto it = _futures.find(finished_invoc_id);
-            //spdlog::info("Poll Future for id {}", finished_invoc_id);
-            // if it == end -> we have a bug, should never appear
-            //(*it).second.set_value(return_val);
-            if(!--std::get<0>(it->second))
-              std::get<1>(it->second).set_value(return_val);
-          }
-        }
-      }
-      _connections[0].conn->poll_wc(rdmalib::QueueType::SEND, false);
-      if(return_value == 0) {
-        SPDLOG_DEBUG("Finished invocation {} succesfully", invoc_id);
-        return std::make_tuple(true, out_size);
-      } else {
-        if(return_value == 1)
-          spdlog::error("Invocation: {}, Thread busy, cannot post work", invoc_id);
-        else
-          spdlog::error("Invocation: {}, Unknown error {}", invoc_id, return_value);
-        return std::make_tuple(false, 0);
+      int invoc_id;
+      future result;
+      {
+        polling_guard polling{*this};
+        invoc_id = this->_invoc_id++;
+        result = _futures.acquire(invoc_id);
+        if(!result.valid())
+          return std::make_tuple(false, 0);
+        executor_state & conn = dispatch(invoc_id);
+        SPDLOG_DEBUG(
+          "Invoke function {} with invocation id {}, submission id {}",
+          func_idx, invoc_id, conn.submission_id(invoc_id, func_idx)
+        );
+        if(!conn.add_submission(
+          in,
+          conn.submission_id(invoc_id, func_idx),
+          in.bytes() <= _max_inlined_msg
+        ))
+          fail_submission(invoc_id);
+        post_batch(conn);
       }
+      return wait_result(invoc_id, result);
     }
 
-    template<typename T>
-    bool execute(std::string fname, const std::vector<rdmalib::Buffer<T>> & in, std::vector<rdmalib::Buffer<T>> & out)
+    // The executor reads the input in chunks while the function runs its streaming entry point,
+    // exported as fname followed by rdmalib::functions::STREAM_SUFFIX, keeping a few chunks in memory,
+    // and writes output chunks as the function produces them.
+    // The output begins with a rdmalib::functions::StreamResult followed by up to out_capacity bytes.
+    // Memory is registered on first use, like in execute on user memory.
+    // Returns the number of output bytes; a chunk size of zero selects the default of the executor.
+    std::tuple<bool, uint64_t> execute_stream(const std::string & fname, const void* in, uint64_t in_size,
+        void* out, uint64_t out_capacity, uint32_t chunk_size = 0);
+
+    // Invoke on user memory without a staging copy - input and output are
+    // registered on first use and the registrations are cached.
+    // Inputs larger than the allocated input size are pulled by the executor.
+    std::tuple<bool, int> execute(const std::string & fname, const void* in, size_t in_size, void* out, size_t out_size);
+
+    // The executor reads the input with RDMA reads, in chunks, into a buffer of its memory pool.
+    // Only the descriptor is sent - the input is not limited by the allocated input size,
+    // and it must be registered with IBV_ACCESS_REMOTE_READ. The header space of the buffer is not used.
+    template<typename T, typename U>
+    std::tuple<bool, int> execute_pull(const std::string & fname, const rdmalib::Buffer<T> & in, rdmalib::Buffer<U> & out)
     {
       auto it = std::find(_func_names.begin(), _func_names.end(), fname);
       if(it == _func_names.end()) {
         spdlog::error("Function {} not found in the deployed library!", fname);
-        return false;
+        return std::make_tuple(false, 0);
       }
       int func_idx = std::distance(_func_names.begin(), it);
+      if(_transport) {
+        spdlog::error("Executors can't read inputs over an emulated transport");
+        return std::make_tuple(false, 0);
+      }
 
-      int numcores = _connections.size();
-      for(int i = 0; i < numcores; ++i) {
-        // FIXME: here get a future for async
-        char* data = static_cast<char*>(in[i].ptr());
-        // TODO: we assume here uintptr_t is 8 bytes
-        *reinterpret_cast<uint64_t*>(data) = out[i].address();
-        *reinterpret_cast<uint32_t*>(data + 8) = out[i].rkey();
-
-        SPDLOG_DEBUG("Invoke function {} with invocation id {}", func_idx, _invoc_id);
-        _connections[i].conn->post_write(
-          in[i],
-          _connections[i].remote_input,
-          (_invoc_id++ << 16) | func_idx,
-          in[i].bytes() <= _max_inlined_msg
+      int invoc_id;
+      future result;
+      {
+        polling_guard polling{*this};
+        invoc_id = this->_invoc_id++;
+        result = post_pull(
+          invoc_id, func_idx,
+          {reinterpret_cast<uintptr_t>(in.data()), in.rkey()}, static_cast<uint64_t>(in.data_size()) * sizeof(T),
+          {out.address(), out.rkey()}
         );
+        if(!result.valid())
+          return std::make_tuple(false, 0);
       }
+      return wait_result(invoc_id, result);
+    }
 
-      for(int i = 0; i < numcores; ++i) {
-        _connections[i]._rcv_buffer.refill();
-      }
-      int expected = numcores;
-      while(expected) {
-        auto wc = _connections[0].conn->poll_wc(rdmalib::QueueType::SEND, true);
-        expected -= std::get<1>(wc);
+    // One invocation for each thread, dispatched like single-buffer invocations.
+    // Results of other invocations polled while we wait are completed too.
+    template<typename BufferIn, typename BufferOut>
+    bool execute(const std::string & fname, const std::vector<BufferIn> & in, std::vector<BufferOut> & out)
+    {
+      auto it = std::find(_func_names.begin(), _func_names.end(), fname);
+      if(it == _func_names.end()) {
+        spdlog::error("Function {} not found in the deployed library!", fname);
+        return false;
       }
+      int func_idx = std::distance(_func_names.begin(), it);
 
-      expected = numcores;
+      int numcores = _connections.size();
+      std::vector<std::pair<int, future>> results;
+      results.reserve(numcores);
       bool correct = true;
-      _active_polling = true;
-      while(expected) {
-        auto wc = _connections[0]._rcv_buffer.poll(true);
-        expected -= std::get<1>(wc);
-        for(int i = 0; i < std::get<1>(wc); ++i) {
-          uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
-          int return_val = val & 0x0000FFFF;
-          int finished_invoc_id = val >> 16;
-          if(return_val == 0) {
-            SPDLOG_DEBUG("Finished invocation {} succesfully", finished_invoc_id);
-          } else {
-            if(val == 1)
-              spdlog::error("Invocation: {}, Thread busy, cannot post work", finished_invoc_id);
-            else
-              spdlog::error("Invocation: {}, Unknown error {}", finished_invoc_id, val);
+      {
+        polling_guard polling{*this};
+        for(int i = 0; i < numcores; ++i) {
+          // FIXME: here get a future for async
+          char* data = static_cast<char*>(in[i].ptr());
+          // TODO: we assume here uintptr_t is 8 bytes
+          *reinterpret_cast<uint64_t*>(data) = out[i].address();
+          *reinterpret_cast<uint32_t*>(data + 8) = out[i].rkey();
+
+          int invoc_id = this->_invoc_id++;
+          future result = _futures.acquire(invoc_id);
+          if(!result.valid()) {
+            correct = false;
+            break;
           }
-          correct &= return_val == 0;
+          executor_state* conn = try_dispatch(invoc_id);
+          // Threads busy with our invocations are released only once they're posted.
+          if(!conn) {
+            post_batches();
+            conn = &dispatch(invoc_id);
+          }
+          SPDLOG_DEBUG("Invoke function {} with invocation id {}", func_idx, invoc_id);
+          if(!conn->add_submission(
+            in[i],
+            conn->submission_id(invoc_id, func_idx),
+            in[i].bytes() <= _max_inlined_msg
+          ))
+            fail_submission(invoc_id);
+          results.emplace_back(invoc_id, std::move(result));
         }
+        post_batches();
       }
-      _active_polling = false;
-
-      _connections[0]._rcv_buffer._requests += numcores - 1;
-      for(int i = 1; i < numcores; ++i)
-        _connections[i]._rcv_buffer._requests--;
+      for(auto & [invoc_id, result] : results)
+        correct &= std::get<0>(wait_result(invoc_id, result));
       return correct;
     }
   };
@@ -0,0 +1,63 @@
+#ifndef __RFAAS_TRANSPORT_HPP__
+#define __RFAAS_TRANSPORT_HPP__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <rdmalib/allocation.hpp>
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/transport.hpp>
+
+namespace rfaas {
+
+  namespace impl {
+
+    // Block of the transport arena, released with the transport.
+    template<typename T>
+    struct arena_buffer : rdmalib::Buffer<T> {
+      arena_buffer(void* ptr, ibv_mr* mr, uint32_t size, uint32_t header):
+        rdmalib::Buffer<T>(ptr, mr, size, header)
+      {}
+    };
+
+  }
+
+  // Connections to executor threads over an emulated transport, used by the executor
+  // instead of RDMA connections. Allocation requests are sent to the manager over the
+  // same transport; executors started directly don't need it.
+  // Inputs, outputs and the library are allocated from the transport.
+  // Connections are not thread-safe - posting and polling are serialized here.
+  struct transport {
+    // Threads with a connection each.
+    static constexpr int MAX_CONNECTIONS = 64;
+
+    virtual ~transport() = default;
+
+    // Block of memory accessible to executors.
+    virtual std::tuple<void*, ibv_mr*> allocate(size_t bytes) = 0;
+    // Accept connections of threads, send them the library and learn their input buffers.
+    virtual bool connect(const rdmalib::Buffer<char> & functions, int numcores, int rcv_buf_size,
+        std::vector<rdmalib::RemoteBuffer> & inputs) = 0;
+    virtual void disconnect() = 0;
+    // Manager listening at the address and the port, see rfaas::manager_connection.
+    virtual bool connect_manager(const std::string & address, int port) = 0;
+    // Send returns once the manager has posted a receive.
+    virtual bool submit(const rdmalib::AllocationRequest & request) = 0;
+    virtual void disconnect_manager() = 0;
+    virtual int32_t post_batch(int idx, rdmalib::WorkRequestBatch & batch) = 0;
+    // Results of all connections, their receives are posted again.
+    // Completions are valid until the next poll, which must be done by the same owner of result polling.
+    virtual std::tuple<ibv_wc*, int> poll(bool blocking) = 0;
+
+    // Listens at the address and the port; RDMA is not an emulated transport.
+    static std::unique_ptr<transport> create(rdmalib::Transport type, const std::string & address, int port);
+  };
+
+}
+
+#endif
+
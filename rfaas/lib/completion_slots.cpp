@@ -0,0 +1,186 @@
+
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include <rfaas/completion_slots.hpp>
+
+namespace rfaas {
+
+  // Lower bits of the invocation id that are carried by results.
+  static constexpr uint32_t RESULT_ID_MASK = 0xFFFF;
+
+  future::future():
+    _slots(nullptr),
+    _slot(0),
+    _invoc_id(0)
+  {}
+
+  future::future(completion_slots* slots, uint32_t slot, int invoc_id):
+    _slots(slots),
+    _slot(slot),
+    _invoc_id(invoc_id)
+  {}
+
+  future::future(future && obj):
+    _slots(obj._slots),
+    _slot(obj._slot),
+    _invoc_id(obj._invoc_id)
+  {
+    obj._slots = nullptr;
+  }
+
+  future & future::operator=(future && obj)
+  {
+    if(this != &obj) {
+      _release();
+      _slots = obj._slots;
+      _slot = obj._slot;
+      _invoc_id = obj._invoc_id;
+      obj._slots = nullptr;
+    }
+    return *this;
+  }
+
+  future::~future()
+  {
+    _release();
+  }
+
+  bool future::valid() const
+  {
+    return _slots != nullptr;
+  }
+
+  bool future::ready() const
+  {
+    return valid() &&
+      _slots->_slot(_slot).state.load(std::memory_order_acquire) == completion_slots::READY;
+  }
+
+  void future::wait() const
+  {
+    if(!valid())
+      return;
+    while(!ready())
+      std::this_thread::yield();
+  }
+
+  uint32_t future::bytes() const
+  {
+    if(!valid())
+      return 0;
+    return _slots->_slot(_slot).bytes.load(std::memory_order_relaxed);
+  }
+
+  int future::get()
+  {
+    if(!valid()) {
+      spdlog::error("Waiting for an invalid future");
+      return -1;
+    }
+    wait();
+    auto & slot = _slots->_slot(_slot);
+    int value = slot.value.load(std::memory_order_relaxed);
+    slot.state.store(completion_slots::FREE, std::memory_order_release);
+    _slots = nullptr;
+    return value;
+  }
+
+  void future::_release()
+  {
+    if(!valid())
+      return;
+    auto & slot = _slots->_slot(_slot);
+    uint32_t expected = completion_slots::PENDING;
+    // Results still in flight release the slot when they arrive.
+    if(!slot.state.compare_exchange_strong(expected, completion_slots::ABANDONED, std::memory_order_acq_rel))
+      slot.state.store(completion_slots::FREE, std::memory_order_release);
+    _slots = nullptr;
+  }
+
+  completion_slots::completion_slots(uint32_t capacity):
+    _capacity(1)
+  {
+    while(_capacity < capacity && _capacity < MAX_CAPACITY)
+      _capacity <<= 1;
+    _mask = _capacity - 1;
+    _slots.reset(new Slot[_capacity]);
+    for(uint32_t i = 0; i < _capacity; ++i) {
+      _slots[i].state.store(FREE, std::memory_order_relaxed);
+      _slots[i].id.store(-1, std::memory_order_relaxed);
+      _slots[i].remaining.store(0, std::memory_order_relaxed);
+      _slots[i].lanes.store(0, std::memory_order_relaxed);
+      _slots[i].value.store(0, std::memory_order_relaxed);
+      _slots[i].bytes.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  uint32_t completion_slots::capacity() const
+  {
+    return _capacity;
+  }
+
+  bool completion_slots::available(int invoc_id) const
+  {
+    return _slots[invoc_id & _mask].state.load(std::memory_order_acquire) == FREE;
+  }
+
+  int completion_slots::lane_id(int invoc_id, int lane) const
+  {
+    return invoc_id + lane * static_cast<int>(_capacity);
+  }
+
+  completion_slots::Slot & completion_slots::_slot(uint32_t idx) const
+  {
+    return _slots[idx];
+  }
+
+  future completion_slots::acquire(int invoc_id, int results)
+  {
+    uint32_t idx = invoc_id & _mask;
+    Slot & slot = _slots[idx];
+    if(slot.state.load(std::memory_order_acquire) != FREE) {
+      spdlog::error(
+        "Invocation {} can't be tracked, invocation {} still uses its slot",
+        invoc_id, slot.id.load(std::memory_order_relaxed)
+      );
+      return future{};
+    }
+    slot.id.store(invoc_id, std::memory_order_relaxed);
+    slot.remaining.store(results, std::memory_order_relaxed);
+    slot.lanes.store(results, std::memory_order_relaxed);
+    slot.value.store(0, std::memory_order_relaxed);
+    slot.bytes.store(0, std::memory_order_relaxed);
+    slot.state.store(PENDING, std::memory_order_release);
+    return future{this, idx, invoc_id};
+  }
+
+  bool completion_slots::complete(int invoc_id, int return_val, uint32_t bytes)
+  {
+    uint32_t id = invoc_id & RESULT_ID_MASK;
+    Slot & slot = _slots[id & _mask];
+    uint32_t state = slot.state.load(std::memory_order_acquire);
+    if(state != PENDING && state != ABANDONED)
+      return false;
+    // Same slot, thus the distance is a multiple of the capacity - it must name one of our lanes.
+    uint32_t lane = ((id - static_cast<uint32_t>(slot.id.load(std::memory_order_relaxed))) & RESULT_ID_MASK) / _capacity;
+    if(lane >= static_cast<uint32_t>(slot.lanes.load(std::memory_order_relaxed)))
+      return false;
+
+    if(return_val) {
+      int32_t expected = 0;
+      slot.value.compare_exchange_strong(expected, return_val, std::memory_order_relaxed);
+    }
+    slot.bytes.store(bytes, std::memory_order_relaxed);
+    // The last result publishes the value of all of them.
+    if(slot.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      uint32_t expected = PENDING;
+      if(!slot.state.compare_exchange_strong(expected, READY, std::memory_order_acq_rel))
+        slot.state.store(FREE, std::memory_order_release);
+    }
+    return true;
+  }
+
+}
+
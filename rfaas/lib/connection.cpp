@@ -10,20 +10,30 @@
 namespace rfaas {
 
   manager_connection::manager_connection(std::string address, int port,
-      int rcv_buf, int max_inline_data):
+      int rcv_buf, int max_inline_data, rdmalib::DatagramClient* control, transport* emulated):
     _address(address),
     _port(port),
-    _active(_address, _port, rcv_buf),
     _rcv_buffer(rcv_buf),
     _allocation_buffer(rcv_buf + 1),
-    _max_inline_data(max_inline_data)
+    _max_inline_data(max_inline_data),
+    _control(control),
+    _transport(emulated)
   {
-    _active.allocate();
+    // Emulated transports run on machines without RDMA devices.
+    if(!_transport)
+      _active = rdmalib::RDMAActive{_address, _port, rcv_buf};
+    if(!_control && !_transport)
+      _active.allocate();
   }
 
   bool manager_connection::connect()
   {
     SPDLOG_DEBUG("Connecting to manager at {}:{}", _address, _port);
+    // The queue pair of the manager is resolved once for all allocations.
+    if(_control)
+      return _control->connect();
+    if(_transport)
+      return _transport->connect_manager(_address, _port);
     bool ret = _active.connect();
     if(!ret) {
       spdlog::error("Couldn't connect to manager at {}:{}", _address, _port);
@@ -39,9 +49,21 @@ namespace rfaas {
   void manager_connection::disconnect()
   {
     SPDLOG_DEBUG("Disconnecting from manager at {}:{}", _address, _port);
+    if(_control) {
+      rdmalib::DatagramStatus status;
+      if(!_control->request(rdmalib::DatagramType::RELEASE, status))
+        spdlog::error("Manager at {}:{} didn't acknowledge the release", _address, _port);
+      return;
+    }
+    if(_transport) {
+      request() = (rdmalib::AllocationRequest) {-1, 0, 0, 0, 0, 0, 0, 0, 0, ""};
+      _transport->submit(request());
+      _transport->disconnect_manager();
+      return;
+    }
     // Send deallocation request only if we're connected
     if(_active.is_connected()) {
-      request() = (rdmalib::AllocationRequest) {-1, 0, 0, 0, 0, 0, 0, ""};
+      request() = (rdmalib::AllocationRequest) {-1, 0, 0, 0, 0, 0, 0, 0, 0, ""};
       rdmalib::ScatterGatherElement sge;
       size_t obj_size = sizeof(rdmalib::AllocationRequest);
       sge.add(_allocation_buffer, obj_size, obj_size*_rcv_buffer._rcv_buf_size);
@@ -63,6 +85,15 @@ namespace rfaas {
 
   bool manager_connection::submit()
   {
+    if(_control) {
+      rdmalib::DatagramStatus status;
+      bool ret = _control->request(rdmalib::DatagramType::ALLOCATE, status, &request());
+      if(ret && status != rdmalib::DatagramStatus::SUCCESS)
+        spdlog::error("Manager at {}:{} rejected the allocation, status {}", _address, _port, static_cast<int>(status));
+      return ret && status == rdmalib::DatagramStatus::SUCCESS;
+    }
+    if(_transport)
+      return _transport->submit(request());
     rdmalib::ScatterGatherElement sge;
     size_t obj_size = sizeof(rdmalib::AllocationRequest);
     sge.add(_allocation_buffer, obj_size, obj_size*_rcv_buffer._rcv_buf_size);
@@ -72,5 +103,10 @@ namespace rfaas {
     return true;
   }
 
+  bool manager_connection::heartbeat()
+  {
+    return !_control || _control->notify(rdmalib::DatagramType::HEARTBEAT);
+  }
+
 }
 
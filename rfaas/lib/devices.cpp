@@ -7,6 +7,15 @@ namespace rfaas {
 
   std::unique_ptr<devices> devices::_instance = nullptr;
 
+  int device_data::inline_threshold() const
+  {
+    if(inline_crossover < 0)
+      return max_inline_data;
+    if(max_inline_data < 0)
+      return inline_crossover;
+    return std::min(inline_crossover, max_inline_data);
+  }
+
   device_data * devices::device(std::string name) noexcept
   {
     auto it = std::find_if(_data.begin(), _data.end(),
@@ -29,6 +38,12 @@ namespace rfaas {
     //archive_in(cereal::make_nvp("devices", *devices::_instance.get()));
     archive_in(cereal::make_nvp("devices", devices::_instance.get()->_data));
   }
+
+  void devices::serialize(std::ostream & out)
+  {
+    cereal::JSONOutputArchive archive_out(out);
+    archive_out(cereal::make_nvp("devices", devices::_instance.get()->_data));
+  }
 //    void epilogue(cereal::JSONInputArchive& ar, const device_data&) {
 //    std::cout << "test " << ar.getNodeName() << std::endl;
 //  }
@@ -0,0 +1,146 @@
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include <spdlog/spdlog.h>
+
+#include <rfaas/dispatcher.hpp>
+
+namespace rfaas {
+
+  dispatcher::dispatcher(DispatchPolicy policy, int max_outstanding):
+    _policy(policy),
+    _max_outstanding(std::max(1, max_outstanding)),
+    _workers_count(0),
+    _slots(_max_outstanding),
+    _next(0)
+  {}
+
+  void dispatcher::reset(int workers)
+  {
+    _workers_count = workers;
+    _slots = _max_outstanding;
+    _next = 0;
+    _workers.reset(workers ? new Worker[workers] : nullptr);
+    _invocations.reset(workers ? new Invocation[workers * _slots] : nullptr);
+    for(int i = 0; i < workers; ++i) {
+      _workers[i].outstanding.store(0, std::memory_order_relaxed);
+      _workers[i].latency_ns.store(0, std::memory_order_relaxed);
+    }
+    for(int i = 0; i < workers * _slots; ++i) {
+      _invocations[i].id.store(FREE_SLOT, std::memory_order_relaxed);
+      _invocations[i].start_ns.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  int dispatcher::workers() const
+  {
+    return _workers_count;
+  }
+
+  DispatchPolicy dispatcher::policy() const
+  {
+    return _policy;
+  }
+
+  void dispatcher::policy(DispatchPolicy policy)
+  {
+    _policy = policy;
+  }
+
+  int dispatcher::max_outstanding() const
+  {
+    return _max_outstanding;
+  }
+
+  void dispatcher::max_outstanding(int max_outstanding)
+  {
+    _max_outstanding = std::max(1, max_outstanding);
+  }
+
+  int64_t dispatcher::_now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+  }
+
+  int dispatcher::select()
+  {
+    int selected = -1;
+    int64_t best = std::numeric_limits<int64_t>::max();
+    for(int i = 0; i < _workers_count; ++i) {
+      int idx = (_next + i) % _workers_count;
+      int outstanding = _workers[idx].outstanding.load(std::memory_order_acquire);
+      if(outstanding >= _slots)
+        continue;
+      if(_policy == DispatchPolicy::ROUND_ROBIN) {
+        selected = idx;
+        break;
+      }
+      int64_t cost = outstanding;
+      // Workers without a sample yet are tried first.
+      if(_policy == DispatchPolicy::LATENCY_EWMA)
+        cost = (outstanding + 1) * _workers[idx].latency_ns.load(std::memory_order_relaxed);
+      if(cost < best) {
+        best = cost;
+        selected = idx;
+      }
+    }
+    if(selected != -1)
+      _next = (selected + 1) % _workers_count;
+    return selected;
+  }
+
+  void dispatcher::submitted(int worker, int invoc_id)
+  {
+    Invocation* slots = _invocations.get() + worker * _slots;
+    for(int i = 0; i < _slots; ++i) {
+      if(slots[i].id.load(std::memory_order_relaxed) != FREE_SLOT)
+        continue;
+      slots[i].start_ns.store(_now(), std::memory_order_relaxed);
+      slots[i].id.store(invoc_id & ID_MASK, std::memory_order_release);
+      _workers[worker].outstanding.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    spdlog::error("Invocation {} submitted to worker {} without a free slot", invoc_id, worker);
+  }
+
+  bool dispatcher::completed(int invoc_id)
+  {
+    int32_t id = invoc_id & ID_MASK;
+    int64_t now = _now();
+    for(int i = 0; i < _workers_count * _slots; ++i) {
+      Invocation & slot = _invocations[i];
+      if(slot.id.load(std::memory_order_acquire) != id)
+        continue;
+      // The start is read before the slot is released and reused.
+      int64_t start = slot.start_ns.load(std::memory_order_relaxed);
+      int32_t expected = id;
+      if(!slot.id.compare_exchange_strong(expected, FREE_SLOT, std::memory_order_acq_rel))
+        continue;
+
+      Worker & worker = _workers[i / _slots];
+      int64_t sample = now - start;
+      int64_t avg = worker.latency_ns.load(std::memory_order_relaxed);
+      avg = avg ? avg + (sample - avg) / (1 << EWMA_SHIFT) : sample;
+      worker.latency_ns.store(std::max<int64_t>(avg, 1), std::memory_order_relaxed);
+      worker.outstanding.fetch_sub(1, std::memory_order_release);
+      return true;
+    }
+    return false;
+  }
+
+  int dispatcher::outstanding(int worker) const
+  {
+    return _workers[worker].outstanding.load(std::memory_order_acquire);
+  }
+
+  double dispatcher::latency(int worker) const
+  {
+    return _workers[worker].latency_ns.load(std::memory_order_relaxed) / 1000.0;
+  }
+
+}
+
@@ -1,10 +1,13 @@
 
+#include <limits>
+
 #include "rdmalib/rdmalib.hpp"
 #include <spdlog/spdlog.h>
 
 #include <rdmalib/allocation.hpp>
 #include <rdmalib/connection.hpp>
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/functions.hpp>
 #include <rdmalib/util.hpp>
 
 #include <rfaas/connection.hpp>
@@ -32,31 +35,241 @@ namespace rfaas {
     return _timeout;
   }
 
-  executor_state::executor_state(rdmalib::Connection* conn, int rcv_buf_size):
-    conn(conn),
-    _rcv_buffer(rcv_buf_size)
+  executor_state::executor_state(std::shared_ptr<rdmalib::Connection> conn, int rcv_buf_size, uint32_t lane):
+    conn(std::move(conn)),
+    _rcv_buffer(rcv_buf_size),
+    _lane(lane),
+    _batch_invocations_count(0),
+    _unposted_count(0),
+    _transport(nullptr),
+    _transport_idx(0)
+  {
+  }
+
+  executor_state::executor_state(transport & emulated, int idx):
+    _rcv_buffer(0),
+    _lane(0),
+    _batch_invocations_count(0),
+    _unposted_count(0),
+    _transport(&emulated),
+    _transport_idx(idx)
+  {
+  }
+
+  bool executor_state::add_submission(rdmalib::ScatterGatherElement && elems, uint32_t submission_id,
+      bool force_inline, bool solicited)
+  {
+    bool added;
+    if(_inputs.connected()) {
+      // Reported to the executor like the length of a write with immediate.
+      uint32_t bytes = 0;
+      for(size_t i = 0; i < elems.size(); ++i)
+        bytes += elems.array()[i].length;
+      added = _inputs.add_write(_batch, elems, submission_id, bytes, force_inline);
+    } else
+      added = _batch.add_write(std::move(elems), remote_input, submission_id, force_inline, solicited);
+    // Results carry the same 16 bits of the invocation id.
+    if(added)
+      _batch_invocations[_batch_invocations_count++] = std::make_pair(submission_id >> 16, _batch.size());
+    return added;
+  }
+
+  int32_t executor_state::post_batch()
+  {
+    _unposted_count = 0;
+    if(_batch.empty())
+      return 0;
+    int32_t ret = _transport ? _transport->post_batch(_transport_idx, _batch) : conn->post_batch(_batch);
+    // A split batch fails after its first part was posted, invocations with a request past it are lost.
+    if(ret < 0) {
+      for(int i = 0; i < _batch_invocations_count; ++i)
+        if(_batch_invocations[i].second > _batch.posted())
+          _unposted[_unposted_count++] = _batch_invocations[i].first;
+    }
+    _batch_invocations_count = 0;
+    _batch.clear();
+    return ret;
+  }
+
+  polling_guard::polling_guard(executor & exec):
+    _executor(exec),
+    _owns(true)
+  {
+    _executor._poller.lock();
+    ++_executor._poller_depth;
+  }
+
+  polling_guard::polling_guard(executor & exec, std::chrono::microseconds timeout):
+    _executor(exec),
+    _owns(exec._poller.try_lock_for(timeout))
+  {
+    if(_owns)
+      ++_executor._poller_depth;
+  }
+
+  bool polling_guard::owns() const
+  {
+    return _owns;
+  }
+
+  polling_guard::~polling_guard()
+  {
+    if(!_owns)
+      return;
+    // Adaptive waits request notifications about all completions,
+    // the background thread waits only for solicited ones.
+    if(!--_executor._poller_depth && _executor._wait_mode == rdmalib::WaitMode::ADAPTIVE &&
+        !_executor._memory_polling && _executor._completion_queue)
+      _executor._completion_queue->notify_events(true);
+    _executor._poller.unlock();
+  }
+
+  map_handle::map_handle():
+    _executor(nullptr),
+    _func_idx(-1),
+    _submitted(0),
+    _completed(0),
+    _failed(0)
+  {}
+
+  map_handle::map_handle(executor* exec, int func_idx, std::vector<ibv_sge> && inputs):
+    _executor(exec),
+    _func_idx(func_idx),
+    _inputs(std::move(inputs)),
+    _submitted(0),
+    _completed(0),
+    _failed(0),
+    _in_flight(exec->_dispatcher.workers() * exec->_dispatcher.max_outstanding())
+  {}
+
+  bool map_handle::valid() const
+  {
+    return _executor != nullptr;
+  }
+
+  size_t map_handle::size() const
+  {
+    return _inputs.size();
+  }
+
+  size_t map_handle::completed() const
+  {
+    return _completed;
+  }
+
+  size_t map_handle::failed() const
+  {
+    return _failed;
+  }
+
+  bool map_handle::done() const
+  {
+    return _completed == _inputs.size();
+  }
+
+  void map_handle::_submit()
+  {
+    size_t slot = 0;
+    while(_submitted < _inputs.size()) {
+      while(slot < _in_flight.size() && _in_flight[slot].valid())
+        ++slot;
+      int invoc_id = _executor->_invoc_id;
+      if(slot == _in_flight.size() || !_executor->_futures.available(invoc_id))
+        break;
+      executor_state* conn = _executor->try_dispatch(invoc_id);
+      if(!conn)
+        break;
+      ++_executor->_invoc_id;
+
+      _in_flight[slot] = _executor->_futures.acquire(invoc_id);
+      const ibv_sge & in = _inputs[_submitted++];
+      // Results are not solicited - they're collected by the owner of result polling, usually the handle.
+      if(!conn->add_submission(
+        {in.addr, in.length, in.lkey},
+        conn->submission_id(invoc_id, _func_idx),
+        in.length <= _executor->_max_inlined_msg
+      ))
+        _executor->fail_submission(invoc_id);
+    }
+    _executor->post_batches();
+  }
+
+  bool map_handle::poll()
+  {
+    if(!valid())
+      return true;
+    _executor->poll_invocations();
+    for(future & result : _in_flight) {
+      if(!result.ready())
+        continue;
+      int return_val = result.get();
+      if(return_val) {
+        spdlog::error("Map of function {}: invocation failed with status {}", _func_idx, return_val);
+        ++_failed;
+      }
+      ++_completed;
+    }
+    _submit();
+    return done();
+  }
+
+  bool map_handle::wait()
   {
+    if(!valid())
+      return false;
+    polling_guard polling{*_executor};
+    while(!poll())
+      ;
+    return _failed == 0;
   }
 
-  executor::executor(std::string address, int port, int rcv_buf_size, int max_inlined_msg):
-    _state(address, port, rcv_buf_size + 1),
+  executor::executor(std::string address, int port, int rcv_buf_size, int max_inlined_msg,
+      rdmalib::Transport type):
+    // Emulated transports don't need a device.
+    _state(
+      type == rdmalib::Transport::RDMA ?
+        rdmalib::RDMAPassive{address, port, rcv_buf_size + 1, true, max_inlined_msg} :
+        rdmalib::RDMAPassive{}
+    ),
     _rcv_buffer(rcv_buf_size),
     _execs_buf(MAX_REMOTE_WORKERS),
+    // Inputs are only read, by us or by the executor pulling them - read-only mappings can be registered too.
+    _input_registrations(_state.pd(), IBV_ACCESS_REMOTE_READ),
+    _output_registrations(_state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE),
     _address(address),
     _port(port),
     _rcv_buf_size(rcv_buf_size),
     _executions(0),
     _invoc_id(0),
-    _max_inlined_msg(max_inlined_msg)
+    _max_input_size(0),
+    _max_inlined_msg(max_inlined_msg),
+    _wait_mode(rdmalib::WaitMode::SPIN),
+    _threads_per_qp(1),
+    _datagram_control(false),
+    _memory_polling(false),
+    _submission_headers(_futures.capacity() * SUBMISSION_HEADER_SIZE)
   {
-    _execs_buf.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    static_assert(
+      rdmalib::functions::Submission::DATA_HEADER_SIZE + std::max(
+        sizeof(rdmalib::functions::PullDescriptor), sizeof(rdmalib::functions::StreamDescriptor)
+      ) <= SUBMISSION_HEADER_SIZE,
+      "Descriptors must fit the submission header"
+    );
+    if(type != rdmalib::Transport::RDMA) {
+      _transport = transport::create(type, address, port);
+    } else {
+      _execs_buf.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+      _submission_headers.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    }
+    // Invocations in flight are bounded by the receive buffer for their results.
+    _state.configuration().pipeline_depth(rcv_buf_size);
     events = 0;
-    _active_polling = false;
+    _poller_depth = 0;
     _end_requested = false;
   }
 
   executor::executor(device_data & dev):
-    executor(dev.ip_address, dev.port, dev.default_receive_buffer_size, dev.max_inline_data)
+    executor(dev.ip_address, dev.port, dev.default_receive_buffer_size, dev.inline_threshold(), dev.transport)
   {}
 
   executor::~executor()
@@ -72,9 +285,11 @@ namespace rfaas {
     fseek (file, 0 , SEEK_END);
     size_t len = ftell(file);
     rewind(file);
-    rdmalib::Buffer<char> functions(len);
+    // Emulated transports send from their arena.
+    rdmalib::Buffer<char> functions = _transport ? allocate_buffer<char>(len) : rdmalib::Buffer<char>(len);
     rdmalib::impl::expect_true(fread(functions.data(), 1, len, file) == len);
-    functions.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    if(!_transport)
+      functions.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
     fclose(file);
 
     // FIXME: same function as in server/functions.cpp - merge?
@@ -136,31 +351,347 @@ namespace rfaas {
       }
       _exec_manager->disconnect();
       _exec_manager.reset(nullptr);
-      _state._cfg.attr.send_cq = _state._cfg.attr.recv_cq = 0;
 
       // Clear up old connections
+      _result_poller.clear();
+      _dispatcher.reset(0);
+      _connections.clear();
+      _completion_queue.reset();
+      if(_transport)
+        _transport->disconnect();
+    } else if(_transport && _background_thread) {
+      _end_requested = true;
+      _background_thread->join();
+      _background_thread.reset();
+      _dispatcher.reset(0);
       _connections.clear();
+      _transport->disconnect();
+    }
+  }
+
+  void executor::post_batches()
+  {
+    for(auto & conn : _connections)
+      post_batch(conn);
+  }
+
+  int32_t executor::post_batch(executor_state & conn)
+  {
+    int32_t ret = conn.post_batch();
+    if(ret < 0) {
+      for(int i = 0; i < conn._unposted_count; ++i)
+        fail_submission(conn._unposted[i]);
+    }
+    return ret;
+  }
+
+  std::tuple<bool, int> executor::wait_result(int invoc_id, future & result)
+  {
+    while(!result.ready()) {
+      polling_guard polling{*this, RESULT_WAIT_SLICE};
+      // The result might have been completed while we waited for the ownership.
+      if(!polling.owns() || result.ready())
+        continue;
+      for(auto wc : poll_results(true))
+        complete_invocation(wc.invocation_id, wc.return_value(), wc.byte_len);
+    }
+    int out_size = result.bytes();
+    int return_value = result.get();
+    if(return_value == 0) {
+      SPDLOG_DEBUG("Finished invocation {} succesfully", invoc_id);
+      return std::make_tuple(true, out_size);
+    } else {
+      if(return_value == static_cast<int>(rdmalib::functions::InvocationStatus::THREAD_BUSY))
+        spdlog::error("Invocation: {}, Thread busy, cannot post work", invoc_id);
+      else if(return_value == static_cast<int>(rdmalib::functions::InvocationStatus::INPUT_TRANSFER_FAILED))
+        spdlog::error("Invocation: {}, Executor couldn't read the input", invoc_id);
+      else if(return_value == static_cast<int>(rdmalib::functions::InvocationStatus::OUTPUT_TRANSFER_FAILED))
+        spdlog::error("Invocation: {}, Executor couldn't write the output", invoc_id);
+      else if(return_value == static_cast<int>(rdmalib::functions::InvocationStatus::FUNCTION_FAILED))
+        spdlog::error("Invocation: {}, Function failed", invoc_id);
+      else if(return_value == static_cast<int>(rdmalib::functions::InvocationStatus::SUBMISSION_FAILED))
+        spdlog::error("Invocation: {}, Couldn't submit the invocation", invoc_id);
+      else
+        spdlog::error("Invocation: {}, Unknown error {}", invoc_id, return_value);
+      return std::make_tuple(false, 0);
+    }
+  }
+
+  executor_state* executor::try_dispatch(int invoc_id)
+  {
+    int idx = _dispatcher.select();
+    if(idx == -1)
+      return nullptr;
+    _dispatcher.submitted(idx, invoc_id);
+    SPDLOG_DEBUG("Invocation {} dispatched to thread {}", invoc_id, idx);
+    return &_connections[idx];
+  }
+
+  executor_state & executor::dispatch(int invoc_id)
+  {
+    executor_state* conn = try_dispatch(invoc_id);
+    if(!conn) {
+      // Threads are released by results of any invocation, the background thread doesn't poll meanwhile.
+      polling_guard polling{*this};
+      while(!(conn = try_dispatch(invoc_id)))
+        poll_invocations();
+    }
+    return *conn;
+  }
+
+  int executor::poll_invocations()
+  {
+    polling_guard polling{*this};
+    int count = 0;
+    for(auto wc : poll_results(false)) {
+      complete_invocation(wc.invocation_id, wc.return_value(), wc.byte_len);
+      ++count;
+    }
+    return count;
+  }
+
+  void executor::complete_invocation(int invoc_id, int return_val, uint32_t bytes)
+  {
+    _dispatcher.completed(invoc_id);
+    _futures.complete(invoc_id, return_val, bytes);
+  }
+
+  void executor::fail_submission(int invoc_id)
+  {
+    spdlog::error("Invocation {} couldn't be added to the batch of its connection", invoc_id);
+    complete_invocation(invoc_id, static_cast<int>(rdmalib::functions::InvocationStatus::SUBMISSION_FAILED));
+  }
+
+  uint32_t executor::submission_header(int invoc_id) const
+  {
+    return (invoc_id & (_futures.capacity() - 1)) * SUBMISSION_HEADER_SIZE;
+  }
+
+  std::tuple<bool, int> executor::execute(
+    const std::string & fname, const void* in, size_t in_size, void* out, size_t out_size
+  )
+  {
+    auto it = std::find(_func_names.begin(), _func_names.end(), fname);
+    if(it == _func_names.end()) {
+      spdlog::error("Function {} not found in the deployed library!", fname);
+      return std::make_tuple(false, 0);
+    }
+    int func_idx = std::distance(_func_names.begin(), it);
+    // User memory can't be registered with emulated transports.
+    if(_transport) {
+      spdlog::error("Invocations on user memory require RDMA, use buffers of allocate_buffer");
+      return std::make_tuple(false, 0);
+    }
+
+    ibv_mr* in_mr = _input_registrations.acquire(in, in_size);
+    ibv_mr* out_mr = _output_registrations.acquire(out, out_size);
+    if(!in_mr || !out_mr) {
+      if(in_mr)
+        _input_registrations.release(in_mr);
+      if(out_mr)
+        _output_registrations.release(out_mr);
+      return std::make_tuple(false, 0);
     }
+
+    int invoc_id;
+    future result;
+    {
+      polling_guard polling{*this};
+      invoc_id = this->_invoc_id++;
+      if(in_size > static_cast<size_t>(_max_input_size)) {
+        SPDLOG_DEBUG(
+          "Invoke function {} with invocation id {}, executor pulls {} bytes of user memory",
+          func_idx, invoc_id, in_size
+        );
+        result = post_pull(
+          invoc_id, func_idx,
+          {reinterpret_cast<uint64_t>(in), in_mr->rkey}, in_size,
+          {reinterpret_cast<uint64_t>(out), out_mr->rkey}
+        );
+      } else if((result = _futures.acquire(invoc_id)).valid()) {
+        // The header is written from its own buffer, user data follows in the next SGE.
+        uint32_t offset = submission_header(invoc_id);
+        char* data = _submission_headers.data() + offset;
+        *reinterpret_cast<uint64_t*>(data) = reinterpret_cast<uint64_t>(out);
+        *reinterpret_cast<uint32_t*>(data + 8) = out_mr->rkey;
+        uint32_t header_size = rdmalib::functions::Submission::DATA_HEADER_SIZE;
+        rdmalib::ScatterGatherElement sge{
+          _submission_headers.address() + offset, header_size, _submission_headers.lkey()
+        };
+        bool prepared = sge.add(reinterpret_cast<uint64_t>(in), in_size, in_mr->lkey);
+
+        executor_state & conn = dispatch(invoc_id);
+        SPDLOG_DEBUG(
+          "Invoke function {} with invocation id {}, submission id {}, {} bytes of user memory",
+          func_idx, invoc_id, conn.submission_id(invoc_id, func_idx), in_size
+        );
+        if(!prepared || !conn.add_submission(
+          std::move(sge),
+          conn.submission_id(invoc_id, func_idx),
+          header_size + in_size <= _max_inlined_msg
+        ))
+          fail_submission(invoc_id);
+        post_batch(conn);
+      }
+    }
+    auto ret = result.valid() ? wait_result(invoc_id, result) : std::make_tuple(false, 0);
+
+    _input_registrations.release(in_mr);
+    _output_registrations.release(out_mr);
+    return ret;
+  }
+
+  future executor::post_pull(int invoc_id, int func_idx, const rdmalib::RemoteBuffer & in, uint64_t in_size,
+      const rdmalib::RemoteBuffer & out)
+  {
+    // Functions receive the size of their input as 32 bits, larger inputs must be streamed.
+    if(in_size > std::numeric_limits<uint32_t>::max()) {
+      spdlog::error(
+        "Invocation {}: input of {} bytes exceeds the limit of pulled inputs, use execute_stream",
+        invoc_id, in_size
+      );
+      return future{};
+    }
+    future result = _futures.acquire(invoc_id);
+    if(!result.valid())
+      return result;
+    uint32_t offset = submission_header(invoc_id);
+    char* data = _submission_headers.data() + offset;
+    *reinterpret_cast<uint64_t*>(data) = out.addr;
+    *reinterpret_cast<uint32_t*>(data + 8) = out.rkey;
+    auto desc = reinterpret_cast<rdmalib::functions::PullDescriptor*>(
+      data + rdmalib::functions::Submission::DATA_HEADER_SIZE
+    );
+    desc->address = in.addr;
+    desc->rkey = in.rkey;
+    desc->length = in_size;
+
+    executor_state & conn = dispatch(invoc_id);
+    uint32_t submission_id = conn.submission_id(invoc_id, func_idx, rdmalib::InvocationCompletion::PULL_MASK);
+    SPDLOG_DEBUG(
+      "Invoke function {} with invocation id {}, submission id {}, executor pulls {} bytes",
+      func_idx, invoc_id, submission_id, in_size
+    );
+    uint32_t bytes = rdmalib::functions::Submission::DATA_HEADER_SIZE + sizeof(rdmalib::functions::PullDescriptor);
+    if(!conn.add_submission(
+      {_submission_headers.address() + offset, bytes, _submission_headers.lkey()},
+      submission_id,
+      bytes <= _max_inlined_msg
+    ))
+      fail_submission(invoc_id);
+    post_batch(conn);
+    return result;
+  }
+
+  std::tuple<bool, uint64_t> executor::execute_stream(const std::string & fname, const void* in, uint64_t in_size,
+      void* out, uint64_t out_capacity, uint32_t chunk_size)
+  {
+    std::string entry_point = fname + rdmalib::functions::STREAM_SUFFIX;
+    auto it = std::find(_func_names.begin(), _func_names.end(), entry_point);
+    if(it == _func_names.end()) {
+      spdlog::error("Streaming entry point {} not found in the deployed library!", entry_point);
+      return std::make_tuple(false, 0);
+    }
+    int func_idx = std::distance(_func_names.begin(), it);
+    // User memory can't be registered with emulated transports.
+    if(_transport) {
+      spdlog::error("Invocations on user memory require RDMA, use buffers of allocate_buffer");
+      return std::make_tuple(false, 0);
+    }
+
+    size_t out_size = sizeof(rdmalib::functions::StreamResult) + out_capacity;
+    ibv_mr* in_mr = _input_registrations.acquire(in, in_size);
+    ibv_mr* out_mr = _output_registrations.acquire(out, out_size);
+    if(!in_mr || !out_mr) {
+      if(in_mr)
+        _input_registrations.release(in_mr);
+      if(out_mr)
+        _output_registrations.release(out_mr);
+      return std::make_tuple(false, 0);
+    }
+
+    int invoc_id;
+    future result;
+    {
+      polling_guard polling{*this};
+      invoc_id = this->_invoc_id++;
+      result = _futures.acquire(invoc_id);
+      if(result.valid()) {
+        // The header of the invocation is reused only after its slot is released.
+        uint32_t offset = submission_header(invoc_id);
+        char* data = _submission_headers.data() + offset;
+        *reinterpret_cast<uint64_t*>(data) = reinterpret_cast<uint64_t>(out);
+        *reinterpret_cast<uint32_t*>(data + 8) = out_mr->rkey;
+        auto desc = reinterpret_cast<rdmalib::functions::StreamDescriptor*>(
+          data + rdmalib::functions::Submission::DATA_HEADER_SIZE
+        );
+        desc->address = reinterpret_cast<uint64_t>(in);
+        desc->length = in_size;
+        desc->rkey = in_mr->rkey;
+        desc->chunk_size = chunk_size;
+        desc->output_capacity = out_capacity;
+
+        executor_state & conn = dispatch(invoc_id);
+        uint32_t submission_id = conn.submission_id(invoc_id, func_idx, rdmalib::InvocationCompletion::STREAM_MASK);
+        SPDLOG_DEBUG(
+          "Invoke function {} with invocation id {}, submission id {}, executor streams {} bytes",
+          func_idx, invoc_id, submission_id, in_size
+        );
+        uint32_t bytes = rdmalib::functions::Submission::DATA_HEADER_SIZE + sizeof(rdmalib::functions::StreamDescriptor);
+        if(!conn.add_submission(
+          {_submission_headers.address() + offset, bytes, _submission_headers.lkey()},
+          submission_id,
+          bytes <= _max_inlined_msg
+        ))
+          fail_submission(invoc_id);
+        post_batch(conn);
+      }
+    }
+    bool success = result.valid() && std::get<0>(wait_result(invoc_id, result));
+
+    _input_registrations.release(in_mr);
+    _output_registrations.release(out_mr);
+    if(!success)
+      return std::make_tuple(false, 0);
+    return std::make_tuple(true, reinterpret_cast<rdmalib::functions::StreamResult*>(out)->length);
+  }
+
+  void executor::invalidate_memory(const void* ptr, size_t size)
+  {
+    _input_registrations.invalidate(ptr, size);
+    _output_registrations.invalidate(ptr, size);
   }
 
   void executor::poll_queue()
   {
+    if(_memory_polling || _transport) {
+      poll_periodically();
+      return;
+    }
+
     // FIXME: hide the details in rdmalib
     spdlog::info("Background thread starts waiting for events");
-    _connections[0].conn->notify_events(true);
-    int flags = fcntl(_connections[0].conn->completion_channel()->fd, F_GETFL);
-    int rc = fcntl(_connections[0].conn->completion_channel()->fd, F_SETFL, flags | O_NONBLOCK);
+    _completion_queue->notify_events(true);
+    int flags = fcntl(_completion_queue->completion_channel()->fd, F_GETFL);
+    int rc = fcntl(_completion_queue->completion_channel()->fd, F_SETFL, flags | O_NONBLOCK);
     if (rc < 0) {
       fprintf(stderr, "Failed to change file descriptor of completion event channel\n");
       return;
     }
 
+    auto last_heartbeat = std::chrono::steady_clock::now();
     while(!_end_requested && _connections.size()) {
       pollfd my_pollfd;
-      my_pollfd.fd      = _connections[0].conn->completion_channel()->fd;
+      my_pollfd.fd      = _completion_queue->completion_channel()->fd;
       my_pollfd.events  = POLLIN;
       my_pollfd.revents = 0;
       do {
+        // Datagram clients keep their allocation alive.
+        auto now = std::chrono::steady_clock::now();
+        if(_exec_manager && now - last_heartbeat >= manager_connection::HEARTBEAT_PERIOD) {
+          _exec_manager->heartbeat();
+          last_heartbeat = now;
+        }
         rc = poll(&my_pollfd, 1, 100);
         if(_end_requested) {
           spdlog::info("Background thread stops waiting for events");
@@ -171,32 +702,22 @@ namespace rfaas {
         fprintf(stderr, "poll failed\n");
         return;
       }
+      // The owner of result polling handles the events, including results of asynchronous invocations.
+      // We wait for the handoff instead of the channel, which stays readable until the event is consumed.
+      std::unique_lock<std::recursive_timed_mutex> polling{_poller, std::defer_lock};
+      if(!polling.try_lock_for(POLLER_HANDOFF_TIMEOUT))
+        continue;
       if(!_end_requested) {
-        auto cq = _connections[0].conn->wait_events();
-        _connections[0].conn->notify_events(true);
-        _connections[0].conn->ack_events(cq, 1);
-        auto wc = _connections[0]._rcv_buffer.poll(false);
-        for(int i = 0; i < std::get<1>(wc); ++i) {
-          uint32_t val = ntohl(std::get<0>(wc)[i].imm_data);
-          int return_val = val & 0x0000FFFF;
-          int finished_invoc_id = val >> 16;
-          auto it = _futures.find(finished_invoc_id);
-          // if it == end -> we have a bug, should never appear
-          //spdlog::info("Future for id {}", finished_invoc_id);
-          //(*it).second.set_value(return_val);
-          // FIXME: handle error
-          if(!--std::get<0>(it->second)) {
-            std::get<1>(it->second).set_value(return_val);
-            // FIXME
-            //
-            _connections[0]._rcv_buffer._requests += _connections.size() - 1;
-            for(size_t i = 1; i < _connections.size(); ++i)
-              _connections[i]._rcv_buffer._requests--;
-          }
-        }
-        // Poll completions from past sends
-        for(auto & conn : _connections)
-          conn.conn->poll_wc(rdmalib::QueueType::SEND, false);
+        // Adaptive waits in the foreground might have consumed the event.
+        auto cq = _completion_queue->wait_events(false);
+        _completion_queue->notify_events(true);
+        if(cq)
+          _completion_queue->ack_events(cq, 1);
+        // FIXME: handle error
+        for(auto wc : _completion_queue->poll_completions(false))
+          complete_invocation(wc.invocation_id, wc.return_value(), wc.byte_len);
+        // Send completions are reclaimed by the submitting thread,
+        // see Connection::selective_signaling.
       }
     }
     spdlog::info("Background thread stops waiting for events");
@@ -236,21 +757,103 @@ namespace rfaas {
     //spdlog::info("Background thread stops waiting for events");
   }
 
+  void executor::poll_periodically()
+  {
+    spdlog::info("Background thread starts polling results");
+    auto last_heartbeat = std::chrono::steady_clock::now();
+    while(!_end_requested && _connections.size()) {
+      auto now = std::chrono::steady_clock::now();
+      if(_exec_manager && now - last_heartbeat >= manager_connection::HEARTBEAT_PERIOD) {
+        _exec_manager->heartbeat();
+        last_heartbeat = now;
+      }
+      // The owner of result polling completes results while it waits for its own.
+      int count = 0;
+      std::unique_lock<std::recursive_timed_mutex> polling{_poller, std::try_to_lock};
+      if(polling.owns_lock()) {
+        for(auto wc : poll_results(false)) {
+          complete_invocation(wc.invocation_id, wc.return_value(), wc.byte_len);
+          ++count;
+        }
+      }
+      if(!count)
+        std::this_thread::sleep_for(rdmalib::FlagPoller::DEFAULT_WAIT_PERIOD);
+    }
+    spdlog::info("Background thread stops polling results");
+  }
+
+  bool executor::allocate_emulated(const rdmalib::Buffer<char> & functions, int numcores)
+  {
+    std::vector<rdmalib::RemoteBuffer> inputs;
+    if(!_transport->connect(functions, numcores, _rcv_buf_size, inputs))
+      return false;
+    _connections.reserve(numcores);
+    for(int i = 0; i < numcores; ++i) {
+      _connections.emplace_back(*_transport, i);
+      _connections.back().remote_input = inputs[i];
+    }
+    _dispatcher.reset(numcores);
+    _end_requested = false;
+    _background_thread.reset(
+      new std::thread{
+        &executor::poll_queue,
+        this
+      }
+    );
+    SPDLOG_DEBUG("Code submission for all threads is finished");
+    return true;
+  }
+
   bool executor::allocate(std::string functions_path, int numcores, int max_input_size,
       int hot_timeout, bool skip_manager, rdmalib::Benchmarker<5> * benchmarker)
   {
     rdmalib::Buffer<char> functions = load_library(functions_path);
+    // Submissions encode the function index next to the thread of a shared queue pair.
+    if(_func_names.size() > rdmalib::InvocationCompletion::FUNCTION_MASK + 1) {
+      spdlog::error(
+        "Library exports {} functions, at most {} are supported",
+        _func_names.size(), rdmalib::InvocationCompletion::FUNCTION_MASK + 1
+      );
+      return false;
+    }
+    if(_memory_polling && _threads_per_qp > 1) {
+      spdlog::error("Memory polling requires dedicated queue pairs, requested {} threads per queue pair", _threads_per_qp);
+      return false;
+    }
+    if(_memory_polling && _dispatcher.max_outstanding() > 1) {
+      spdlog::error("Memory polling allows one invocation in flight per thread, requested {}", _dispatcher.max_outstanding());
+      return false;
+    }
+    _max_input_size = max_input_size;
+    if(_transport && (_threads_per_qp > 1 || _memory_polling)) {
+      spdlog::error("Emulated transports support only dedicated connections polling completions");
+      return false;
+    }
+    if(_transport && _datagram_control) {
+      spdlog::error("Datagram requests to the manager require RDMA, emulated transports connect to it");
+      return false;
+    }
+    int threads_per_qp = std::max(1, _threads_per_qp);
+    // Receive queue of a shared connection holds results of all its threads.
+    _state.configuration()
+      .recv_depth(threads_per_qp * _rcv_buf_size + 1)
+      .pipeline_depth(threads_per_qp * _rcv_buf_size);
     if(!skip_manager) {
       // FIXME: handle more than one manager
       servers & instance = servers::instance();
       auto selected_servers = instance.select(numcores);
 
+      auto & server = instance.server(selected_servers[0]);
+      if(_datagram_control && (!_control || _control->address() != server.address || _control->port() != server.port))
+        _control.reset(new rdmalib::DatagramClient{server.address, server.port});
       _exec_manager.reset(
         new manager_connection(
-          instance.server(selected_servers[0]).address,
-          instance.server(selected_servers[0]).port,
+          server.address,
+          server.port,
           _rcv_buf_size,
-          _max_inlined_msg
+          _max_inlined_msg,
+          _datagram_control ? _control.get() : nullptr,
+          _transport.get()
         )
       );
       // Measure connection time
@@ -271,19 +874,24 @@ namespace rfaas {
         static_cast<int16_t>(numcores),
         // FIXME: variable number of inputs
         1,
+        static_cast<int16_t>(_threads_per_qp),
+        static_cast<int16_t>(_memory_polling),
         max_input_size,
         functions.data_size(),
         _port,
         ""
       };
       strcpy(_exec_manager->request().listen_address, _address.c_str());
-      _exec_manager->submit();
+      if(!_exec_manager->submit())
+        return false;
       // Measure submission time
       if(benchmarker) {
         benchmarker->end(1);
         benchmarker->start();
       }
     }
+    if(_transport)
+      return allocate_emulated(functions, numcores);
 
     SPDLOG_DEBUG("Allocating {} threads on a remote executor", numcores);
     // Now receive the connections from executors
@@ -292,33 +900,77 @@ namespace rfaas {
     // Accept connect requests, fill receive buffers and accept them.
     // When the connection is established, then send data.
     this->_connections.reserve(numcores);
+    // Each connection posts its receive buffer and one receive for buffer information.
+    _completion_queue.reset(
+      new rdmalib::SharedCompletionQueue{_state.pd()->context, numcores * (_rcv_buf_size + 1)}
+    );
+    _completion_queue->wait_mode(_wait_mode);
+    // Each thread has a ring for its results, the location is sent after the library.
+    uint32_t flag_slot_size = rdmalib::FlagRing::slot_size(0);
+    uint32_t ring_bytes = _rcv_buf_size * flag_slot_size;
+    if(_memory_polling) {
+      _result_flags = rdmalib::Buffer<char>(numcores * ring_bytes);
+      memset(_result_flags.data(), 0, _result_flags.bytes());
+      _result_flags.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+      _result_rings = rdmalib::Buffer<rdmalib::RemoteBuffer>(numcores);
+      _result_rings.register_memory(_state.pd(), IBV_ACCESS_LOCAL_WRITE);
+      _result_poller.clear();
+    }
     int requested = 0, established = 0;
-    while(established < numcores) {
+    while(established < requested || static_cast<int>(_connections.size()) < numcores) {
 
       //while(conn_status != rdmalib::ConnectionStatus::REQUESTED)
-      auto [conn, conn_status] = _state.poll_events(true);
+      auto [conn, conn_status] = _state.poll_events(_completion_queue.get());
       if(conn_status == rdmalib::ConnectionStatus::REQUESTED) {
+        // Executor threads sharing the queue pair are announced in the private data.
+        int lanes = std::max<int>(1, conn->private_data());
+        int first = _connections.size();
+        if(lanes > threads_per_qp || first + lanes > numcores) {
+          spdlog::error("Executor connection shared by {} threads, expected at most {}", lanes, threads_per_qp);
+          delete conn;
+          return false;
+        }
         SPDLOG_DEBUG(
-          "[Executor] Requested connection from executor {}, connection {}",
-          requested + 1, fmt::ptr(conn)
+          "[Executor] Requested connection from executor {}, connection {}, threads {}",
+          requested + 1, fmt::ptr(conn), lanes
         );
-        this->_connections.emplace_back(
-          conn,
-          _rcv_buf_size
-        );
-        this->_connections.back().conn->post_recv(_execs_buf.sge(obj_size, requested*obj_size), requested);
-        // FIXME: this should be in a function
-        // FIXME: here it won't work if rcv_bufer_size < numcores
-        this->_connections.back()._rcv_buffer.connect(this->_connections.back().conn.get());
-        _state.accept(this->_connections.back().conn.get());
+        std::shared_ptr<rdmalib::Connection> shared{conn};
+        for(int lane = 0; lane < lanes; ++lane)
+          this->_connections.emplace_back(shared, lane ? 0 : lanes * _rcv_buf_size, lane);
+        // Buffers of all threads arrive in a single message.
+        shared->post_recv(_execs_buf.sge(lanes*obj_size, first*obj_size), first);
+        if(_memory_polling) {
+          executor_state & state = this->_connections[first];
+          state._results = rdmalib::FlagRing{_result_flags.data() + first * ring_bytes, flag_slot_size, _rcv_buf_size};
+          _result_rings.data()[first] = rdmalib::RemoteBuffer{
+            _result_flags.address() + first * ring_bytes, _result_flags.rkey(), ring_bytes
+          };
+          _result_poller.attach(state._results);
+        } else {
+          // FIXME: this should be in a function
+          this->_connections[first]._rcv_buffer.connect(shared.get());
+          _completion_queue->attach(this->_connections[first]._rcv_buffer);
+        }
+        _state.accept(shared.get());
         ++requested;
       } else if(conn_status == rdmalib::ConnectionStatus::ESTABLISHED) {
+        int lanes = std::max<int>(1, conn->private_data());
         SPDLOG_DEBUG(
           "[Executor] Established connection to executor {}, connection {}",
           established + 1, fmt::ptr(conn)
         );
-        conn->post_send(functions);
-        SPDLOG_DEBUG("Connected thread {}/{} and submitted function code.", established + 1, numcores);
+        // Each thread of the queue pair receives the library.
+        for(int lane = 0; lane < lanes; ++lane)
+          conn->post_send(functions);
+        if(_memory_polling) {
+          // Memory polling doesn't share queue pairs - the connection belongs to a single thread.
+          auto it = std::find_if(_connections.begin(), _connections.end(),
+            [conn](const executor_state & state) { return state.conn.get() == conn; }
+          );
+          uint32_t offset = std::distance(_connections.begin(), it) * sizeof(rdmalib::RemoteBuffer);
+          conn->post_send(_result_rings.sge(sizeof(rdmalib::RemoteBuffer), offset));
+        }
+        SPDLOG_DEBUG("Connected executor {}/{} and submitted function code.", established + 1, requested);
         ++established;
       }
       // FIXME: fix handling of disconnection
@@ -338,34 +990,47 @@ namespace rfaas {
     while(received < numcores) {
       auto wcs = this->_connections[0].conn->poll_wc(rdmalib::QueueType::RECV, true); 
       for(int i = 0; i < std::get<1>(wcs); ++i) {
-        int id = std::get<0>(wcs)[i].wr_id;
-        SPDLOG_DEBUG(
-          "Received buffer details for thread, addr {}, rkey {}",
-          _execs_buf.data()[id].r_addr, _execs_buf.data()[id].r_key
-        );
-        _connections[id].remote_input = rdmalib::RemoteBuffer(
-          _execs_buf.data()[id].r_addr,
-          _execs_buf.data()[id].r_key
-        );
+        int first = std::get<0>(wcs)[i].wr_id;
+        int count = std::get<0>(wcs)[i].byte_len / obj_size;
+        for(int id = first; id < first + count; ++id) {
+          SPDLOG_DEBUG(
+            "Received buffer details for thread, addr {}, rkey {}",
+            _execs_buf.data()[id].r_addr, _execs_buf.data()[id].r_key
+          );
+          _connections[id].remote_input = rdmalib::RemoteBuffer(
+            _execs_buf.data()[id].r_addr,
+            _execs_buf.data()[id].r_key
+          );
+          // The input buffer of the thread is a ring with a single slot.
+          if(_memory_polling)
+            _connections[id]._inputs.connect(
+              _state.pd(), _connections[id].remote_input,
+              rdmalib::FlagRing::slot_size(rdmalib::functions::Submission::DATA_HEADER_SIZE + _max_input_size), 1
+            );
+        }
+        received += count;
       }
-      received += std::get<1>(wcs);
     }
 
-    received = 0;
-    _active_polling = false;
+    _dispatcher.reset(numcores);
     // Ensure that we are able to process asynchronous replies
     // before we start any submissionk.
-    _connections[0].conn->notify_events(true);
-    // FIXME: extend to multiple connections
+    _completion_queue->notify_events(true);
     _background_thread.reset(
       new std::thread{
         &executor::poll_queue,
         this
       }
     );
-    while(received < numcores) {
-      auto wcs = this->_connections[0].conn->poll_wc(rdmalib::QueueType::SEND, true);
-      received += std::get<1>(wcs);
+    // Code submissions are signaled, later invocations are signaled selectively.
+    for(auto & conn : _connections) {
+      // Threads sharing a queue pair share its send queue too.
+      if(conn._lane)
+        continue;
+      conn.conn->drain_send_queue();
+      conn.conn->selective_signaling();
+      // Never inline more than the queue pairs accept.
+      _max_inlined_msg = std::min<size_t>(_max_inlined_msg, conn.conn->max_inline_data());
     }
     // Measure initial configuration submission
     if(benchmarker) {
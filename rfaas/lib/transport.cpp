@@ -0,0 +1,169 @@
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include <rdmalib/allocation.hpp>
+
+#include <rfaas/transport.hpp>
+
+namespace rfaas {
+
+  template<rdmalib::Transport T>
+  struct emulated_transport : transport {
+    typedef rdmalib::EmulatedTransport<T> Traits;
+    typedef typename Traits::Connection Connection;
+
+    emulated_transport(const std::string & address, int port):
+      _passive(Traits::passive(address, port, _pd)),
+      _infos(_pd.template allocate<rdmalib::BufferInformation>(MAX_CONNECTIONS)),
+      _request(_pd.template allocate<rdmalib::AllocationRequest>(1)),
+      _next(0)
+    {}
+
+    std::tuple<void*, ibv_mr*> allocate(size_t bytes) override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      auto buf = _pd.template allocate<char>(bytes);
+      return std::make_tuple(buf.ptr(), buf.mr());
+    }
+
+    bool connect(const rdmalib::Buffer<char> & functions, int numcores, int rcv_buf_size,
+        std::vector<rdmalib::RemoteBuffer> & inputs) override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if(numcores > MAX_CONNECTIONS) {
+        spdlog::error("Emulated transport supports at most {} threads, requested {}", MAX_CONNECTIONS, numcores);
+        return false;
+      }
+      uint32_t obj_size = sizeof(rdmalib::BufferInformation);
+      for(int i = 0; i < numcores; ++i) {
+        std::unique_ptr<Connection> conn{_passive->poll_events()};
+        if(!conn)
+          return false;
+        // The location of the input buffer arrives first, results follow.
+        if(conn->post_recv(_infos.sge(obj_size, i * obj_size), i) < 0 || conn->post_recv({}, -1, rcv_buf_size) < 0)
+          return false;
+        _connections.push_back(std::move(conn));
+      }
+      SPDLOG_DEBUG("Accepted {} threads over the {} transport", numcores, rdmalib::transport_name(T));
+
+      // Threads receive the library after they have sent their buffer.
+      inputs.clear();
+      for(int i = 0; i < numcores; ++i) {
+        Connection & conn = *_connections[i];
+        auto [wcs, count] = conn.poll_wc(rdmalib::QueueType::RECV, true, 1);
+        if(count != 1 || wcs[0].status != IBV_WC_SUCCESS) {
+          spdlog::error("Thread {} didn't send the location of its input", i);
+          return false;
+        }
+        inputs.emplace_back(_infos.data()[i].r_addr, _infos.data()[i].r_key);
+        if(conn.post_send(functions) < 0)
+          return false;
+        // The library is sent from the memory of the caller.
+        conn.poll_wc(rdmalib::QueueType::SEND, true);
+      }
+      return true;
+    }
+
+    void disconnect() override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      for(auto & conn : _connections)
+        conn->close();
+      _connections.clear();
+      _next = 0;
+    }
+
+    bool connect_manager(const std::string & address, int port) override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _manager.reset(Traits::active(address, port, _pd));
+      if(!_manager->connect()) {
+        spdlog::error("Couldn't connect to manager at {}:{} over the {} transport", address, port, rdmalib::transport_name(T));
+        _manager.reset();
+        return false;
+      }
+      return true;
+    }
+
+    bool submit(const rdmalib::AllocationRequest & request) override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if(!_manager)
+        return false;
+      _request.data()[0] = request;
+      Connection & conn = _manager->connection();
+      if(conn.post_send(_request) < 0)
+        return false;
+      auto [wcs, count] = conn.poll_wc(rdmalib::QueueType::SEND, true);
+      return count > 0 && wcs[count - 1].status == IBV_WC_SUCCESS;
+    }
+
+    void disconnect_manager() override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if(_manager)
+        _manager->disconnect();
+      _manager.reset();
+    }
+
+    int32_t post_batch(int idx, rdmalib::WorkRequestBatch & batch) override
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      return _connections[idx]->post_batch(batch);
+    }
+
+    std::tuple<ibv_wc*, int> poll(bool blocking) override
+    {
+      while(true) {
+        {
+          std::lock_guard<std::mutex> lock{_mutex};
+          int count = 0;
+          for(size_t i = 0; i < _connections.size() && !count; ++i) {
+            Connection & conn = *_connections[_next];
+            _next = (_next + 1) % _connections.size();
+            auto [wcs, polled] = conn.poll_wc(rdmalib::QueueType::RECV, false);
+            if(polled > 0) {
+              std::copy_n(wcs, polled, _wcs.begin());
+              conn.post_recv({}, -1, polled);
+              count = polled;
+            }
+          }
+          if(count || !blocking || _connections.empty())
+            return std::make_tuple(_wcs.data(), count);
+        }
+        std::this_thread::yield();
+      }
+    }
+
+  private:
+    std::mutex _mutex;
+    typename Traits::ProtectionDomain _pd;
+    std::unique_ptr<typename Traits::RDMAPassive> _passive;
+    rdmalib::Buffer<rdmalib::BufferInformation> _infos;
+    std::unique_ptr<typename Traits::RDMAActive> _manager;
+    rdmalib::Buffer<rdmalib::AllocationRequest> _request;
+    std::vector<std::unique_ptr<Connection>> _connections;
+    // Connections are polled in turns.
+    size_t _next;
+    std::array<ibv_wc, Connection::WC_SIZE> _wcs;
+  };
+
+  std::unique_ptr<transport> transport::create(rdmalib::Transport type, const std::string & address, int port)
+  {
+    switch(type) {
+      case rdmalib::Transport::SHM:
+        return std::unique_ptr<transport>{new emulated_transport<rdmalib::Transport::SHM>{address, port}};
+      case rdmalib::Transport::TCP:
+        return std::unique_ptr<transport>{new emulated_transport<rdmalib::Transport::TCP>{address, port}};
+      default:
+        spdlog::error("Transport {} is not emulated", rdmalib::transport_name(type));
+        return nullptr;
+    }
+  }
+
+}
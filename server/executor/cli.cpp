@@ -11,6 +11,7 @@
 
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/server.hpp>
+#include <rdmalib/statistics.hpp>
 #include "rdmalib/connection.hpp"
 #include "server.hpp"
 #include "fast_executor.hpp"
@@ -40,6 +41,10 @@ int main(int argc, char ** argv)
     opts.accounting_buffer_addr, opts.accounting_buffer_rkey
   );
 
+  auto & stats = rdmalib::StatisticsRegistry::instance();
+  if(opts.stats_period > 0)
+    stats.start_reporting(std::chrono::milliseconds{opts.stats_period}, opts.stats_file);
+
   executor::ManagerConnection mgr{
     opts.mgr_address,
     opts.mgr_port,
@@ -55,11 +60,19 @@ int main(int argc, char ** argv)
     opts.recv_buffer_size,
     opts.max_inline_data,
     opts.pin_threads,
-    mgr
+    opts.buffer_policy,
+    mgr,
+    opts.threads_per_qp,
+    opts.polling_type == server::Options::PollingType::DRAM,
+    opts.transport
   );
 
   executor.allocate_threads(opts.timeout, opts.repetitions + opts.warmup_iters);
 
   executor.close();
+  if(opts.stats_period > 0)
+    stats.stop_reporting();
+  else
+    stats.report(opts.stats_file);
   return 0;
 }
@@ -2,6 +2,7 @@
 #include <chrono>
 #include <atomic>
 #include <ostream>
+#include <type_traits>
 #include <sys/time.h>
 #include <sys/time.h>
 
@@ -24,39 +25,323 @@
 
 namespace server {
 
-  Accounting::timepoint_t Thread::work(int invoc_id, int func_id, bool solicited, uint32_t in_size)
+  template<typename Channel>
+  auto Thread::manager_connection(Channel & channel)
+  {
+    if constexpr (is_emulated_channel<Channel>::value)
+      return channel.mgr_connection;
+    else
+      return _mgr_connection;
+  }
+
+  template<typename Channel>
+  int64_t Thread::pull_input(Channel & channel)
+  {
+    auto desc = reinterpret_cast<rdmalib::functions::PullDescriptor*>(rcv.data());
+    // Emulated transports don't read from the client.
+    if(!_pull_pool) {
+      spdlog::error("Thread {} can't pull inputs over the {} transport", id, rdmalib::transport_name(_transport));
+      return -1;
+    }
+    if(_pull_buffer.size() < desc->length) {
+      // Previous buffer goes back to the pool first.
+      _pull_buffer.release();
+      _pull_buffer = _pull_pool->allocate<char>(desc->length);
+      if(!_pull_buffer.ptr()) {
+        spdlog::error("Thread {} couldn't allocate {} bytes for the input", id, desc->length);
+        return -1;
+      }
+    }
+
+    for(uint32_t offset = 0; offset < desc->length; offset += PULL_CHUNK_SIZE) {
+      if(_reads.full()) {
+        int ret = channel.post_batch(_reads);
+        _reads.clear();
+        if(ret < 0)
+          return -1;
+      }
+      uint32_t chunk = std::min(PULL_CHUNK_SIZE, desc->length - offset);
+      _reads.add_read(_pull_buffer.sge(chunk, offset), {desc->address + offset, desc->rkey});
+    }
+    // Reads complete in order, the last completion covers all chunks.
+    _reads.signal_last();
+    int ret = _reads.empty() ? 0 : channel.post_batch(_reads);
+    _reads.clear();
+    if(ret < 0)
+      return -1;
+    SPDLOG_DEBUG("Thread {} pulls {} bytes from {} rkey {}", id, desc->length, desc->address, desc->rkey);
+    return desc->length;
+  }
+
+  // Chunks of a stream invocation in flight, the context of the streams passed to the function.
+  template<typename Channel>
+  struct StreamTransfer {
+    Thread & thread;
+    Channel & channel;
+    rdmalib::functions::StreamDescriptor desc;
+    rdmalib::RemoteBuffer output;
+    uint32_t chunk_size;
+    // Input bytes with posted reads, known to have arrived, and handed to the function.
+    uint64_t requested;
+    uint64_t arrived;
+    uint64_t consumed;
+    // Output bytes sent, and writes that might still read from their slots.
+    uint64_t written;
+    uint32_t outputs;
+    uint32_t unconfirmed_writes;
+    bool input_failed;
+    bool output_failed;
+
+    char* slot(uint32_t idx)
+    {
+      return thread._stream_buffer.data() + static_cast<size_t>(idx) * chunk_size;
+    }
+
+    uint32_t input_slot(uint64_t offset) const
+    {
+      return (offset / chunk_size) % Thread::STREAM_CHUNKS;
+    }
+
+    uint32_t output_slot() const
+    {
+      return Thread::STREAM_CHUNKS + outputs % Thread::STREAM_CHUNKS;
+    }
+
+    // Requests complete in order - once the last signaled one has, all reads have arrived.
+    bool drain()
+    {
+      bool success = channel.drain_send_queue();
+      arrived = requested;
+      unconfirmed_writes = 0;
+      return success;
+    }
+
+    bool post_reads(uint64_t limit)
+    {
+      auto & reads = thread._reads;
+      limit = std::min(limit, desc.length);
+      while(requested < limit) {
+        if(reads.full()) {
+          int ret = channel.post_batch(reads);
+          reads.clear();
+          if(ret < 0)
+            return false;
+        }
+        uint32_t chunk = std::min<uint64_t>(chunk_size, desc.length - requested);
+        uint64_t offset = static_cast<uint64_t>(input_slot(requested)) * chunk_size;
+        reads.add_read(thread._stream_buffer.sge(chunk, offset), {desc.address + requested, desc.rkey});
+        requested += chunk;
+      }
+      reads.signal_last();
+      int ret = reads.empty() ? 0 : channel.post_batch(reads);
+      reads.clear();
+      return ret >= 0;
+    }
+
+    static rdmalib::functions::InputStream::Chunk next_chunk(void* context)
+    {
+      auto & transfer = *static_cast<StreamTransfer*>(context);
+      uint64_t offset = transfer.consumed;
+      if(transfer.input_failed || offset >= transfer.desc.length)
+        return {nullptr, 0};
+      // Wait for the chunk, then prefetch into the slots released by the function.
+      if(transfer.arrived <= offset)
+        transfer.input_failed = !transfer.post_reads(offset + transfer.chunk_size) || !transfer.drain();
+      if(!transfer.input_failed)
+        transfer.input_failed = !transfer.post_reads(offset + Thread::STREAM_CHUNKS * transfer.chunk_size);
+      if(transfer.input_failed) {
+        spdlog::error("Thread {} couldn't read the stream input at offset {}", transfer.thread.id, offset);
+        return {nullptr, 0};
+      }
+      uint32_t size = std::min<uint64_t>(transfer.chunk_size, transfer.desc.length - offset);
+      transfer.consumed += size;
+      return {transfer.slot(transfer.input_slot(offset)), size};
+    }
+
+    static char* chunk_buffer(void* context, uint32_t* capacity)
+    {
+      auto & transfer = *static_cast<StreamTransfer*>(context);
+      // A slot is reused only after its previous write has completed.
+      if(transfer.unconfirmed_writes == Thread::STREAM_CHUNKS && !transfer.drain())
+        transfer.output_failed = true;
+      *capacity = transfer.chunk_size;
+      return transfer.slot(transfer.output_slot());
+    }
+
+    static bool commit_chunk(void* context, uint32_t size)
+    {
+      auto & transfer = *static_cast<StreamTransfer*>(context);
+      if(transfer.output_failed)
+        return false;
+      if(size > transfer.chunk_size || transfer.written + size > transfer.desc.output_capacity) {
+        spdlog::error(
+          "Thread {} stream output of {} bytes exceeds the capacity of {} bytes",
+          transfer.thread.id, transfer.written + size, transfer.desc.output_capacity
+        );
+        transfer.output_failed = true;
+        return false;
+      }
+      if(!size)
+        return true;
+      // Chunks follow the result header, which is written last.
+      auto & writes = transfer.thread._results;
+      writes.add_write(
+        transfer.thread._stream_buffer.sge(size, static_cast<size_t>(transfer.output_slot()) * transfer.chunk_size),
+        {transfer.output.addr + sizeof(rdmalib::functions::StreamResult) + transfer.written, transfer.output.rkey},
+        false
+      );
+      writes.signal_last();
+      int ret = transfer.channel.post_batch(writes);
+      writes.clear();
+      if(ret < 0) {
+        transfer.output_failed = true;
+        return false;
+      }
+      transfer.written += size;
+      ++transfer.outputs;
+      ++transfer.unconfirmed_writes;
+      return true;
+    }
+  };
+
+  template<typename Channel>
+  uint32_t Thread::execute_stream(Channel & channel, int func_id, const rdmalib::RemoteBuffer & output,
+      rdmalib::functions::InvocationStatus & status)
+  {
+    using rdmalib::functions::InvocationStatus;
+    auto desc = *reinterpret_cast<rdmalib::functions::StreamDescriptor*>(rcv.data());
+    auto func = _functions.stream_function(func_id);
+    if(!func) {
+      spdlog::error("Thread {} has no streaming entry point at function index {}", id, func_id);
+      status = InvocationStatus::FUNCTION_FAILED;
+      return 0;
+    }
+    if(!_pull_pool) {
+      spdlog::error("Thread {} can't stream inputs over the {} transport", id, rdmalib::transport_name(_transport));
+      status = InvocationStatus::INPUT_TRANSFER_FAILED;
+      return 0;
+    }
+    uint32_t chunk_size = desc.chunk_size ? std::min(desc.chunk_size, MAX_STREAM_CHUNK_SIZE) : PULL_CHUNK_SIZE;
+    size_t ring_size = 2 * STREAM_CHUNKS * static_cast<size_t>(chunk_size);
+    if(_stream_buffer.size() < ring_size) {
+      _stream_buffer.release();
+      _stream_buffer = _pull_pool->allocate<char>(ring_size);
+      if(!_stream_buffer.ptr()) {
+        spdlog::error("Thread {} couldn't allocate {} bytes for stream chunks", id, ring_size);
+        status = InvocationStatus::INPUT_TRANSFER_FAILED;
+        return 0;
+      }
+    }
+    SPDLOG_DEBUG(
+      "Thread {} streams {} bytes from {} rkey {} in chunks of {} bytes",
+      id, desc.length, desc.address, desc.rkey, chunk_size
+    );
+
+    StreamTransfer<Channel> transfer{
+      *this, channel, desc, output, chunk_size, 0, 0, 0, 0, 0, 0, false, false
+    };
+    rdmalib::functions::InputStream in{&transfer, desc.length, &StreamTransfer<Channel>::next_chunk};
+    rdmalib::functions::OutputStream out{
+      &transfer, &StreamTransfer<Channel>::chunk_buffer, &StreamTransfer<Channel>::commit_chunk
+    };
+    uint32_t ret = (*func)(&in, &out);
+    // Reads prefetched beyond what the function consumed must not outlive the invocation.
+    if(transfer.requested > transfer.arrived && !transfer.drain())
+      transfer.input_failed = true;
+
+    if(transfer.input_failed)
+      status = InvocationStatus::INPUT_TRANSFER_FAILED;
+    else if(transfer.output_failed)
+      status = InvocationStatus::OUTPUT_TRANSFER_FAILED;
+    else if(ret)
+      status = InvocationStatus::FUNCTION_FAILED;
+    reinterpret_cast<rdmalib::functions::StreamResult*>(send.ptr())->length = transfer.written;
+    return sizeof(rdmalib::functions::StreamResult);
+  }
+
+  template<typename Channel>
+  Accounting::timepoint_t Thread::work(Channel & channel, int invoc_id, int func_id, bool solicited, bool pull, bool stream,
+      uint32_t in_size)
   {
     // FIXME: load func ptr
-    rdmalib::functions::Submission* header = reinterpret_cast<rdmalib::functions::Submission*>(rcv.ptr());
-    auto ptr = _functions.function(func_id);
+    // With memory polling, the buffer begins with the header of the flag message.
+    auto header = reinterpret_cast<rdmalib::functions::Submission*>(
+      rcv.data() - rdmalib::functions::Submission::DATA_HEADER_SIZE
+    );
+    auto status = rdmalib::functions::InvocationStatus::SUCCESS;
+    // Stream invocations read their input while the function runs.
+    // The descriptor must be the one of the kind marked in the submission.
+    pull = pull && !stream;
+    if((stream && in_size != sizeof(rdmalib::functions::StreamDescriptor)) ||
+        (pull && in_size != sizeof(rdmalib::functions::PullDescriptor))) {
+      spdlog::error("Thread {} received a descriptor of {} bytes with invocation {}", id, in_size, invoc_id);
+      status = rdmalib::functions::InvocationStatus::INPUT_TRANSFER_FAILED;
+    }
+    // Start reading the input before we wait for the previous result.
+    int64_t pulled = pull && status == rdmalib::functions::InvocationStatus::SUCCESS ? pull_input(channel) : in_size;
+    // The send buffer is reused - the previous result must leave it before we overwrite it.
+    // Inlined results are copied when posting; others are signaled and usually complete long before.
+    // Pulled input has arrived once the queue is drained.
+    bool drained = channel.drain_send_queue();
+    if(pulled < 0 || ((pull || stream) && !drained))
+      status = rdmalib::functions::InvocationStatus::INPUT_TRANSFER_FAILED;
 
     SPDLOG_DEBUG("Thread {} begins work! Executing function {} with size {}, invoc id {}, solicited reply? {}",
-      id, _functions._names[func_id], in_size, invoc_id, solicited
+      id, func_id, pulled, invoc_id, solicited
     );
     auto start = std::chrono::high_resolution_clock::now();
-    // Data to ignore header passed in the buffer
-    uint32_t out_size = (*ptr)(rcv.data(), in_size, send.ptr());
-    SPDLOG_DEBUG("Thread {} finished work!", id);
+    uint32_t out_size = 0;
+    if(status == rdmalib::functions::InvocationStatus::SUCCESS) {
+      if(stream)
+        out_size = execute_stream(channel, func_id, {header->r_address, header->r_key}, status);
+      else if(auto ptr = _functions.function(func_id)) {
+        // Data to ignore header passed in the buffer
+        void* input = pull ? _pull_buffer.data() : rcv.data();
+        out_size = (*ptr)(input, pulled, send.ptr());
+      } else {
+        spdlog::error("Thread {} has no function at index {}, invocation {}", id, func_id, invoc_id);
+        status = rdmalib::functions::InvocationStatus::FUNCTION_FAILED;
+      }
+      SPDLOG_DEBUG("Thread {} finished work!", id);
+    } else
+      spdlog::error("Thread {} couldn't read the input of invocation {}", id, invoc_id);
 
     // Send back: the value of immediate write
     // first 16 bytes - invocation id
     // second 16 bytes - return value (0 on no error)
-    conn->post_write(
-      send.sge(out_size, 0),
-      {header->r_address, header->r_key},
-      (invoc_id << 16) | 0,
-      out_size <= max_inline_data,
-      solicited
-    );
+    // All results share the send buffer - the chain must be flushed before the next invocation.
+    uint32_t result_id = (invoc_id << 16) | static_cast<uint32_t>(status);
+    if constexpr (std::is_same_v<Channel, MemoryChannel>) {
+      // The flag is written after the result, on the same queue pair - it's placed after the result.
+      if(out_size > 0)
+        _results.add_write(send.sge(out_size, 0), {header->r_address, header->r_key}, out_size <= max_inline_data);
+      channel.results.add_write(_results, {}, result_id, out_size, true);
+    } else {
+      _results.add_write(
+        send.sge(out_size, 0),
+        {header->r_address, header->r_key},
+        result_id,
+        out_size <= max_inline_data,
+        solicited
+      );
+    }
+    if(out_size > max_inline_data)
+      _results.signal_last();
+    channel.post_batch(_results);
+    _results.clear();
     auto end = std::chrono::high_resolution_clock::now();
     _accounting.update_execution_time(start, end);
-    _accounting.send_updated_execution(_mgr_connection, _accounting_buf, _mgr_conn);
+    if(auto mgr_connection = manager_connection(channel)) {
+      auto lock = lock_manager();
+      _accounting.send_updated_execution(mgr_connection, _accounting_buf, _mgr_conn);
+    }
     //int cpu = sched_getcpu();
     //spdlog::info("Execution + sent took {} us on {} CPU", std::chrono::duration_cast<std::chrono::microseconds>(end-start).count(), cpu);
     return end;
   }
 
-  void Thread::hot(uint32_t timeout)
+  template<typename Channel>
+  void Thread::hot(Channel & channel, uint32_t timeout)
   {
     //rdmalib::Benchmarker<1> server_processing_times{max_repetitions};
     SPDLOG_DEBUG("Thread {} Begins hot polling", id);
@@ -66,39 +351,29 @@ namespace server {
     while(repetitions < max_repetitions) {
 
       // if we block, we never handle the interruption
-      auto wcs = wc_buffer.poll();
-      if(std::get<1>(wcs)) {
-        for(int i = 0; i < std::get<1>(wcs); ++i) {
+      auto wcs = channel.poll_completions();
+      if(!wcs.empty()) {
+        for(auto wc : wcs) {
 
           //server_processing_times.start();
-          ibv_wc* wc = &std::get<0>(wcs)[i];
-          if(wc->status) {
-            spdlog::error("Failed work completion! Reason: {}", ibv_wc_status_str(wc->status));
-            continue;
-          }
-          int info = ntohl(wc->imm_data);
-          int func_id = info & invocation_mask;
-          int invoc_id = info >> 16;
-          bool solicited = info & solicited_mask;
           SPDLOG_DEBUG(
             "Thread {} Invoc id {} Execute func {} Repetition {}",
-            id, invoc_id, func_id, repetitions
+            id, wc.invocation_id, wc.function(), repetitions
           );
 
           // Measure hot polling time until we started execution
           auto now = std::chrono::high_resolution_clock::now();
-          auto func_end = work(invoc_id, func_id, solicited,
-              wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE
+          auto func_end = work(channel, wc.invocation_id, wc.function(), wc.solicited(), wc.pull(), wc.stream(),
+              wc.byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE
           );
           _accounting.update_polling_time(start, now);
           i = 0;
           start = func_end;
 
           //sum += server_processing_times.end();
-          conn->poll_wc(rdmalib::QueueType::SEND, true);
           repetitions += 1;
         }
-        wc_buffer.refill();
+        channel.refill();
       }
       ++i;
 
@@ -106,13 +381,16 @@ namespace server {
       if(i == HOT_POLLING_VERIFICATION_PERIOD) {
         auto now = std::chrono::high_resolution_clock::now();
         auto time_passed = _accounting.update_polling_time(start, now);
-        _accounting.send_updated_polling(_mgr_connection, _accounting_buf, _mgr_conn);
+        if(auto mgr_connection = manager_connection(channel)) {
+          auto lock = lock_manager();
+          _accounting.send_updated_polling(mgr_connection, _accounting_buf, _mgr_conn);
+        }
         start = now;
 
         if(_polling_state != PollingState::HOT_ALWAYS && time_passed >= timeout) {
           _polling_state = PollingState::WARM;
           // FIXME: can we miss an event here?
-          conn->notify_events();
+          channel.notify_events();
           SPDLOG_DEBUG("Switching to warm polling after {} us with no invocations", time_passed);
           return;
         }
@@ -121,7 +399,8 @@ namespace server {
     }
   }
 
-  void Thread::warm()
+  template<typename Channel>
+  void Thread::warm(Channel & channel)
   {
     //rdmalib::Benchmarker<1> server_processing_times{max_repetitions};
     // FIXME: this should be automatic
@@ -130,32 +409,24 @@ namespace server {
     while(repetitions < max_repetitions) {
 
       // if we block, we never handle the interruption
-      auto wcs = wc_buffer.poll();
-      if(std::get<1>(wcs)) {
-        for(int i = 0; i < std::get<1>(wcs); ++i) {
+      auto wcs = channel.poll_completions();
+      if(!wcs.empty()) {
+        for(auto wc : wcs) {
 
           //server_processing_times.start();
-          ibv_wc* wc = &std::get<0>(wcs)[i];
-          if(wc->status) {
-            spdlog::error("Failed work completion! Reason: {}", ibv_wc_status_str(wc->status));
-            continue;
-          }
-          int info = ntohl(wc->imm_data);
-          int func_id = info & invocation_mask;
-          bool solicited = info & solicited_mask;
-          int invoc_id = info >> 16;
           SPDLOG_DEBUG(
             "Thread {} Invoc id {} Execute func {} Repetition {}",
-            id, invoc_id, func_id, repetitions
+            id, wc.invocation_id, wc.function(), repetitions
           );
 
-          work(invoc_id, func_id, solicited, wc->byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE);
+          work(channel, wc.invocation_id, wc.function(), wc.solicited(), wc.pull(), wc.stream(),
+            wc.byte_len - rdmalib::functions::Submission::DATA_HEADER_SIZE
+          );
 
           //sum += server_processing_times.end();
-          conn->poll_wc(rdmalib::QueueType::SEND, true);
           repetitions += 1;
         }
-        wc_buffer.refill();
+        channel.refill();
         if(_polling_state != PollingState::WARM_ALWAYS) {
           SPDLOG_DEBUG("Switching to hot polling after invocation!");
           _polling_state = PollingState::HOT;
@@ -166,37 +437,187 @@ namespace server {
       // Do waiting after a single polling - avoid missing an events that
       // arrived before we called notify_events
       if(repetitions < max_repetitions) {
-        auto cq = conn->wait_events();
-        conn->ack_events(cq, 1);
-        conn->notify_events();
+        channel.wait_events();
+        channel.notify_events();
       }
     }
     SPDLOG_DEBUG("Thread {} Stopped warm polling", id);
   }
 
-  void Thread::thread_work(int timeout)
+  void Thread::allocate_buffers(ibv_pd* pd)
   {
-    rdmalib::RDMAActive mgr_connection(_mgr_conn.addr, _mgr_conn.port, wc_buffer._rcv_buf_size, max_inline_data);
-    mgr_connection.allocate();
-    this->_mgr_connection = &mgr_connection.connection();
-    _accounting_buf.register_memory(mgr_connection.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
-    if(!mgr_connection.connect(_mgr_conn.secret))
+    rdmalib::AllocationPolicy policy = buffer_policy.resolve(pd->context);
+    send = rdmalib::Buffer<char>(buf_size, 0, policy);
+    // Memory polling adds the header and the trailer of flag messages.
+    uint32_t header = rdmalib::functions::Submission::DATA_HEADER_SIZE;
+    if(_memory_polling)
+      rcv = rdmalib::Buffer<char>(buf_size + rdmalib::FlagRing::TRAILER_SPACE, header + rdmalib::FlagRing::HEADER_SIZE, policy);
+    else
+      rcv = rdmalib::Buffer<char>(buf_size, header, policy);
+    _pull_pool.reset(new rdmalib::MemoryPool(pd, IBV_ACCESS_LOCAL_WRITE));
+  }
+
+  std::unique_lock<std::mutex> Thread::lock_manager()
+  {
+    return _group ? std::unique_lock<std::mutex>{_group->mgr_mutex} : std::unique_lock<std::mutex>{};
+  }
+
+  template<typename Channel>
+  void Thread::run(Channel & channel, int timeout)
+  {
+    spdlog::info("Thread {} begins work with timeout {}", id, timeout);
+
+    // FIXME: catch interrupt handler here
+    while(repetitions < max_repetitions) {
+      if(_polling_state == PollingState::HOT || _polling_state == PollingState::HOT_ALWAYS)
+        hot(channel, timeout);
+      else
+        warm(channel);
+    }
+
+    // Submit final accounting information
+    if(auto mgr_connection = manager_connection(channel)) {
+      auto lock = lock_manager();
+      _accounting.send_updated_execution(mgr_connection, _accounting_buf, _mgr_conn, true, false);
+      _accounting.send_updated_polling(mgr_connection, _accounting_buf, _mgr_conn, true, false);
+      mgr_connection->poll_wc(rdmalib::QueueType::SEND, true, 2);
+    }
+    spdlog::info(
+      "Thread {} finished work, spent {} ns hot polling and {} ns computation, {} executions.",
+      id, _accounting.total_hot_polling_time , _accounting.total_execution_time, repetitions
+    );
+  }
+
+  bool Thread::establish_group()
+  {
+    ThreadGroup & group = *_group;
+    int lanes = group.threads.size();
+    std::vector<rdmalib::Buffer<char>> func_buffers;
+    func_buffers.reserve(lanes);
+    for(Thread* thread : group.threads)
+      func_buffers.emplace_back(thread->_functions.memory(), thread->_functions.size());
+
+    auto mgr_future = _mgr_connector->connect(_mgr_conn.secret,
+      [&group](rdmalib::Connection & conn) {
+        for(Thread* thread : group.threads)
+          thread->_accounting_buf.register_memory(conn.qp()->pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
+      }
+    );
+    // The client learns the number of lanes from the private data.
+    auto client_future = _client_connector->connect(lanes,
+      [&group, &func_buffers](rdmalib::Connection & conn) {
+        ibv_pd* pd = conn.qp()->pd;
+        // Libraries arrive in the order of lanes, before any invocation.
+        for(size_t i = 0; i < group.threads.size(); ++i) {
+          group.threads[i]->allocate_buffers(pd);
+          func_buffers[i].register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+          conn.post_recv(func_buffers[i]);
+        }
+      }
+    );
+    group.mgr_connection = mgr_future.get();
+    group.conn = client_future.get();
+    if(!group.mgr_connection || !group.conn)
+      return false;
+    spdlog::info("Thread {} Established connections of a group with {} threads", id, lanes);
+    ibv_pd* pd = group.conn->qp()->pd;
+
+    // Receives of all lanes are posted before the client learns about our buffers.
+    group.shared.reset(new rdmalib::SharedConnection{*group.conn, lanes, wc_buffer._rcv_buf_size});
+    rdmalib::Buffer<rdmalib::BufferInformation> buf(lanes);
+    buf.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+    for(int i = 0; i < lanes; ++i) {
+      Thread & thread = *group.threads[i];
+      thread.send.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+      thread.rcv.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+      buf.data()[i].r_addr = thread.rcv.address();
+      buf.data()[i].r_key = thread.rcv.rkey();
+    }
+    // Lanes are not used yet - the connection still owns its send queue.
+    group.conn->post_send(buf, 0, buf.bytes() <= group.conn->max_inline_data());
+    group.conn->poll_wc(rdmalib::QueueType::SEND, true, 1);
+
+    // One library message for each lane.
+    for(int received = 0; received < lanes;) {
+      int count = std::get<1>(group.conn->poll_wc(rdmalib::QueueType::RECV, true, lanes - received));
+      if(count < 0)
+        return false;
+      received += count;
+    }
+    return true;
+  }
+
+  bool Thread::join_group()
+  {
+    if(_group->threads.front() == this)
+      _group->established.set_value(establish_group());
+    if(!_group->ready.get())
+      return false;
+
+    this->conn = _group->conn.get();
+    this->_mgr_connection = _group->mgr_connection.get();
+    _lane = &_group->shared->lane(_lane_idx);
+    // Results are not waited for - only every n-th write generates a completion.
+    _lane->selective_signaling();
+    max_inline_data = std::min(max_inline_data, this->conn->max_inline_data());
+    _functions.process_library();
+    spdlog::info("Thread {} Established connection to client on lane {}", id, _lane_idx);
+    return true;
+  }
+
+  template<rdmalib::Transport T>
+  void Thread::emulated_work(int timeout)
+  {
+    typedef rdmalib::EmulatedTransport<T> Traits;
+    typename Traits::ProtectionDomain pd;
+    send = pd.template allocate<char>(buf_size);
+    rcv = pd.template allocate<char>(buf_size, rdmalib::functions::Submission::DATA_HEADER_SIZE);
+    auto func_buffer = pd.template allocate<char>(_functions.size());
+    auto buf = pd.template allocate<rdmalib::BufferInformation>(1);
+
+    // Executors spawned by the manager add their accounting to its buffer.
+    std::unique_ptr<typename Traits::RDMAActive> mgr_active;
+    if(!_mgr_conn.addr.empty()) {
+      mgr_active.reset(Traits::active(_mgr_conn.addr, _mgr_conn.port, pd));
+      if(!mgr_active->connect(_mgr_conn.secret))
+        return;
+      _accounting_buf = pd.template allocate<uint64_t>(1);
+      spdlog::info("Thread {} Established connection to the manager over the {} transport", id, rdmalib::transport_name(T));
+    }
+
+    std::unique_ptr<typename Traits::RDMAActive> active{Traits::active(_client_address, _client_port, pd)};
+    if(!active->connect())
       return;
-    spdlog::info("Thread {} Established connection to the manager!", id);
+    auto & connection = active->connection();
+    // The library arrives first, invocations follow.
+    if(connection.post_recv(func_buffer.sge(func_buffer.bytes(), 0), 0) < 0 ||
+        connection.post_recv({}, -1, wc_buffer._rcv_buf_size) < 0)
+      return;
+    spdlog::info("Thread {} Established connection to client over the {} transport", id, rdmalib::transport_name(T));
 
-    // FIXME: why rdmaactive needs rcv_buf_size?
-    rdmalib::RDMAActive active(addr, port, wc_buffer._rcv_buf_size, max_inline_data);
-    rdmalib::Buffer<char> func_buffer(_functions.memory(), _functions.size());
+    buf.data()[0].r_addr = rcv.address();
+    buf.data()[0].r_key = rcv.rkey();
+    connection.post_send(buf);
+    connection.poll_wc(rdmalib::QueueType::SEND, true, 1);
 
-    active.allocate();
-    this->conn = &active.connection();
-    // Receive function data from the client - this WC must be posted first
-    // We do it before connection to ensure that client does not start sending before us
-    func_buffer.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
-    this->conn->post_recv(func_buffer);
+    auto [wcs, count] = connection.poll_wc(rdmalib::QueueType::RECV, true, 1);
+    if(count != 1 || wcs[0].status != IBV_WC_SUCCESS) {
+      spdlog::error("Thread {} didn't receive the library", id);
+      return;
+    }
+    memcpy(_functions.memory(), func_buffer.data(), _functions.size());
+    _functions.process_library();
+
+    if(_polling_state == PollingState::WARM_ALWAYS || _polling_state == PollingState::WARM)
+      connection.notify_events();
+    EmulatedChannel<typename Traits::Connection> channel{
+      connection, 0, mgr_active ? &mgr_active->connection() : nullptr
+    };
+    run(channel, timeout);
+  }
 
-    // Request notification before connecting - avoid missing a WC!
-    // Do it only when starting from a warm directly
+  void Thread::thread_work(int timeout)
+  {
     if(timeout == -1) {
       _polling_state = PollingState::HOT_ALWAYS;
     } else if(timeout == 0) {
@@ -204,50 +625,102 @@ namespace server {
     } else {
       _polling_state = PollingState::HOT;
     }
-    if(_polling_state == PollingState::WARM_ALWAYS || _polling_state == PollingState::WARM)
-      conn->notify_events();
 
-    if(!active.connect())
+    if(_group) {
+      if(join_group())
+        run(*_lane, timeout);
+      return;
+    }
+
+    if(_transport == rdmalib::Transport::SHM) {
+      emulated_work<rdmalib::Transport::SHM>(timeout);
+      return;
+    } else if(_transport == rdmalib::Transport::TCP) {
+      emulated_work<rdmalib::Transport::TCP>(timeout);
+      return;
+    }
+
+    rdmalib::Buffer<char> func_buffer(_functions.memory(), _functions.size());
+    // With memory polling, the client sends the location of its result ring after the library.
+    rdmalib::Buffer<rdmalib::RemoteBuffer> result_ring(1);
+    // Both handshakes proceed concurrently, and with the handshakes of other threads.
+    auto mgr_future = _mgr_connector->connect(_mgr_conn.secret,
+      [this](rdmalib::Connection & conn) {
+        _accounting_buf.register_memory(conn.qp()->pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
+      }
+    );
+    auto client_future = _client_connector->connect(0,
+      [this, &func_buffer, &result_ring](rdmalib::Connection & conn) {
+        ibv_pd* pd = conn.qp()->pd;
+        allocate_buffers(pd);
+        // Receive function data from the client - this WC must be posted first
+        // We do it before connection to ensure that client does not start sending before us
+        func_buffer.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+        conn.post_recv(func_buffer);
+        if(_memory_polling) {
+          result_ring.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+          conn.post_recv(result_ring);
+        }
+        // Request notification before connecting - avoid missing a WC!
+        // Do it only when starting from a warm directly
+        if(_polling_state == PollingState::WARM_ALWAYS || _polling_state == PollingState::WARM)
+          conn.notify_events();
+      }
+    );
+    // Both futures must be waited for - the preparation refers to func_buffer.
+    std::unique_ptr<rdmalib::Connection> mgr_connection = mgr_future.get();
+    std::unique_ptr<rdmalib::Connection> active = client_future.get();
+    if(!mgr_connection || !active)
       return;
+    this->_mgr_connection = mgr_connection.get();
+    this->conn = active.get();
+    spdlog::info("Thread {} Established connection to the manager!", id);
+    ibv_pd* pd = this->conn->qp()->pd;
+
+    // Negative option selects the inline capacity of the connection.
+    max_inline_data = std::min(max_inline_data, this->conn->max_inline_data());
 
     // Now generic receives for function invocations
-    send.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE);
-    rcv.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
-    this->wc_buffer.connect(this->conn);
+    send.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
+    rcv.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    // Memory polling doesn't consume receives.
+    if(!_memory_polling)
+      this->wc_buffer.connect(this->conn);
     spdlog::info("Thread {} Established connection to client!", id);
 
     // Send to the client information about thread buffer
     rdmalib::Buffer<rdmalib::BufferInformation> buf(1);
-    buf.register_memory(active.pd(), IBV_ACCESS_LOCAL_WRITE);
+    buf.register_memory(pd, IBV_ACCESS_LOCAL_WRITE);
     buf.data()[0].r_addr = rcv.address();
     buf.data()[0].r_key = rcv.rkey();
     SPDLOG_DEBUG("Thread {} Sends buffer details to client!", id);
     this->conn->post_send(buf, 0, buf.size() <= max_inline_data);
     this->conn->poll_wc(rdmalib::QueueType::SEND, true, 1);
     SPDLOG_DEBUG("Thread {} Sent buffer details to client!", id);
+    // Results are not waited for - only every n-th write generates a completion.
+    this->conn->selective_signaling();
 
     // We should have received functions data - just one message
     this->conn->poll_wc(rdmalib::QueueType::RECV, true, 1);
     _functions.process_library();
 
-    spdlog::info("Thread {} begins work with timeout {}", id, timeout);
-
-    // FIXME: catch interrupt handler here
-    while(repetitions < max_repetitions) {
-      if(_polling_state == PollingState::HOT || _polling_state == PollingState::HOT_ALWAYS)
-        hot(timeout);
-      else
-        warm();
+    if(_memory_polling) {
+      this->conn->poll_wc(rdmalib::QueueType::RECV, true, 1);
+      const rdmalib::RemoteBuffer & ring = result_ring.data()[0];
+      uint32_t slot_size = rdmalib::FlagRing::slot_size(0);
+      rdmalib::FlagSender results;
+      results.connect(pd, ring, slot_size, ring.size / slot_size);
+      rdmalib::FlagRing inputs{rcv.ptr(), rcv.bytes(), 1};
+      rdmalib::FlagPoller poller;
+      poller.attach(inputs);
+      spdlog::info("Thread {} Polls memory for invocations, results ring of {} slots", id, ring.size / slot_size);
+      MemoryChannel channel{*this->conn, poller, results};
+      run(channel, timeout);
+      return;
     }
 
-    // Submit final accounting information
-    _accounting.send_updated_execution(_mgr_connection, _accounting_buf, _mgr_conn, true, false);
-    _accounting.send_updated_polling(_mgr_connection, _accounting_buf, _mgr_conn, true, false);
-    mgr_connection.connection().poll_wc(rdmalib::QueueType::SEND, true, 2);
-    spdlog::info(
-      "Thread {} finished work, spent {} ns hot polling and {} ns computation, {} executions.",
-      id, _accounting.total_hot_polling_time , _accounting.total_execution_time, repetitions
-    );
+    DedicatedChannel channel{*this->conn, wc_buffer};
+    run(channel, timeout);
     // FIXME: revert after manager starts to detect disconnection events
     //mgr_connection.disconnect();
   }
@@ -259,21 +732,67 @@ namespace server {
       int recv_buf_size,
       int max_inline_data,
       int pin_threads,
-      const executor::ManagerConnection & mgr_conn
+      const rdmalib::AllocationPolicy & buffer_policy,
+      const executor::ManagerConnection & mgr_conn,
+      int threads_per_qp,
+      bool memory_polling,
+      rdmalib::Transport transport
   ):
+    // Emulated transports connect to the client and the manager on their own.
+    _client_connector(transport == rdmalib::Transport::RDMA ?
+      new rdmalib::AsyncConnector(client_addr, port, recv_buf_size + 1, max_inline_data) : nullptr
+    ),
+    _mgr_connector(transport == rdmalib::Transport::RDMA ?
+      new rdmalib::AsyncConnector(mgr_conn.addr, mgr_conn.port, recv_buf_size + 1, max_inline_data) : nullptr
+    ),
     _closing(false),
     _numcores(numcores),
     _max_repetitions(0),
     _pin_threads(pin_threads)
     //_mgr_conn(mgr_conn)
   {
+    threads_per_qp = std::max(1, std::min(threads_per_qp, rdmalib::SharedConnection::MAX_LANES));
+    if(memory_polling && threads_per_qp > 1) {
+      spdlog::error("Memory polling requires dedicated queue pairs, ignoring {} threads per queue pair", threads_per_qp);
+      threads_per_qp = 1;
+    }
+    if(transport != rdmalib::Transport::RDMA && (memory_polling || threads_per_qp > 1)) {
+      spdlog::error("The {} transport supports only dedicated connections polling completions", rdmalib::transport_name(transport));
+      memory_polling = false;
+      threads_per_qp = 1;
+    }
+    // Each pending invocation can produce a result in the send queue.
+    // Shared queue pairs hold receives of all lanes, and a library message for each of them.
+    if(_client_connector && threads_per_qp > 1)
+      _client_connector->configuration()
+        .pipeline_depth(threads_per_qp * (recv_buf_size + 1))
+        .recv_depth(threads_per_qp * (recv_buf_size + 2));
+    else if(_client_connector)
+      _client_connector->configuration().pipeline_depth(recv_buf_size + 1);
     // Reserve place to ensure that no reallocations happen
     _threads_data.reserve(numcores);
     for(int i = 0; i < numcores; ++i)
       _threads_data.emplace_back(
-        client_addr, port, i, func_size, msg_size,
-        recv_buf_size, max_inline_data, mgr_conn
+        _client_connector.get(), _mgr_connector.get(), i, func_size, msg_size,
+        recv_buf_size, max_inline_data, buffer_policy, mgr_conn
       );
+    for(auto & thread : _threads_data) {
+      thread._memory_polling = memory_polling;
+      thread._transport = transport;
+      thread._client_address = client_addr;
+      thread._client_port = port;
+    }
+
+    if(threads_per_qp > 1) {
+      for(int i = 0; i < numcores; ++i) {
+        if(i % threads_per_qp == 0)
+          _groups.emplace_back(new ThreadGroup{});
+        _groups.back()->threads.push_back(&_threads_data[i]);
+        _threads_data[i]._group = _groups.back().get();
+        _threads_data[i]._lane_idx = i % threads_per_qp;
+      }
+      spdlog::info("{} threads share {} queue pairs", numcores, _groups.size());
+    }
   }
 
   FastExecutors::~FastExecutors()
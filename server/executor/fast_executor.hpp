@@ -8,11 +8,20 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 #include <rdmalib/buffer.hpp>
 #include <rdmalib/connection.hpp>
+#include <rdmalib/connector.hpp>
+#include <rdmalib/flag_ring.hpp>
+#include <rdmalib/memory_pool.hpp>
+#include <rdmalib/multiplex.hpp>
 #include <rdmalib/recv_buffer.hpp>
 #include <rdmalib/functions.hpp>
+#include <rdmalib/transport.hpp>
 
 #include "functions.hpp"
 #include "common.hpp"
@@ -43,8 +52,10 @@ namespace server {
       total_execution_time += diff;
     }
 
+    // Connection is rdmalib::Connection or a connection of an emulated transport.
+    template<typename Connection>
     inline void send_updated_execution(
-      rdmalib::Connection* mgr_connection, rdmalib::Buffer<uint64_t> & _accounting_buf,
+      Connection* mgr_connection, rdmalib::Buffer<uint64_t> & _accounting_buf,
       const executor::ManagerConnection & _mgr_conn,
       bool force = false,
       bool wait = true
@@ -73,8 +84,10 @@ namespace server {
       return time_passed;
     }
 
+    // Connection is rdmalib::Connection or a connection of an emulated transport.
+    template<typename Connection>
     inline void send_updated_polling(
-      rdmalib::Connection* mgr_connection, rdmalib::Buffer<uint64_t> & _accounting_buf,
+      Connection* mgr_connection, rdmalib::Buffer<uint64_t> & _accounting_buf,
       const executor::ManagerConnection & _mgr_conn,
       bool force = false,
       bool wait = true
@@ -105,23 +118,177 @@ namespace server {
     WARM_ALWAYS
   };
 
+  // Dedicated queue pair of a thread, with the interface of rdmalib::Lane.
+  struct DedicatedChannel {
+    rdmalib::Connection & conn;
+    rdmalib::RecvBuffer & wc_buffer;
+
+    int32_t post_batch(rdmalib::WorkRequestBatch & batch)
+    {
+      return conn.post_batch(batch);
+    }
+
+    bool drain_send_queue()
+    {
+      return conn.drain_send_queue();
+    }
+
+    rdmalib::CompletionSpan<rdmalib::LogCompletionErrors> poll_completions()
+    {
+      return wc_buffer.poll_completions();
+    }
+
+    bool refill()
+    {
+      return wc_buffer.refill();
+    }
+
+    void notify_events()
+    {
+      conn.notify_events();
+    }
+
+    void wait_events()
+    {
+      auto cq = conn.wait_events();
+      conn.ack_events(cq, 1);
+    }
+  };
+
+  // Dedicated queue pair of a thread polling memory instead of the completion queue.
+  // Invocations are messages written into the receive buffer of the thread, which is
+  // the only slot of its input ring; results are followed by a message in a ring of the client.
+  struct MemoryChannel {
+    rdmalib::Connection & conn;
+    rdmalib::FlagPoller & inputs;
+    rdmalib::FlagSender & results;
+
+    int32_t post_batch(rdmalib::WorkRequestBatch & batch)
+    {
+      return conn.post_batch(batch);
+    }
+
+    bool drain_send_queue()
+    {
+      return conn.drain_send_queue();
+    }
+
+    rdmalib::CompletionSpan<rdmalib::LogCompletionErrors> poll_completions()
+    {
+      return inputs.poll_completions();
+    }
+
+    // No receives are consumed.
+    bool refill()
+    {
+      return false;
+    }
+
+    void notify_events() {}
+
+    void wait_events()
+    {
+      inputs.wait_events();
+    }
+  };
+
+  // Dedicated connection of an emulated transport, see rdmalib::EmulatedTransport.
+  // Invocations consume empty receives, which are posted again by refill.
+  // Accounting goes to the manager over the same transport.
+  template<typename Connection>
+  struct EmulatedChannel {
+    Connection & conn;
+    int consumed;
+    Connection* mgr_connection;
+
+    int32_t post_batch(rdmalib::WorkRequestBatch & batch)
+    {
+      return conn.post_batch(batch);
+    }
+
+    bool drain_send_queue()
+    {
+      return conn.drain_send_queue();
+    }
+
+    rdmalib::CompletionSpan<rdmalib::LogCompletionErrors> poll_completions()
+    {
+      auto [wcs, count] = conn.poll_wc(rdmalib::QueueType::RECV, false);
+      consumed += count;
+      return {wcs, count, rdmalib::LogCompletionErrors{}};
+    }
+
+    bool refill()
+    {
+      if(!consumed)
+        return false;
+      conn.post_recv({}, -1, consumed);
+      consumed = 0;
+      return true;
+    }
+
+    void notify_events()
+    {
+      conn.notify_events();
+    }
+
+    void wait_events()
+    {
+      conn.wait_events();
+    }
+  };
+
+  template<typename Channel>
+  struct is_emulated_channel : std::false_type {};
+
+  template<typename Connection>
+  struct is_emulated_channel<EmulatedChannel<Connection>> : std::true_type {};
+
+  struct ThreadGroup;
+
   // FIXME: is not movable or copyable at the moment
   struct Thread {
 
 
-    constexpr static int invocation_mask = 0x00007FFF;
+    constexpr static int invocation_mask = 0x000003FF;
     constexpr static int solicited_mask = 0x00008000;
     Functions _functions;
-    std::string addr;
-    int port;
+    // Shared by all threads, connections of threads are established concurrently.
+    // Emulated transports don't use them.
+    rdmalib::AsyncConnector* _client_connector;
+    rdmalib::AsyncConnector* _mgr_connector;
+    // Emulated transports connect to the client and the manager without the connectors.
+    rdmalib::Transport _transport;
+    std::string _client_address;
+    int _client_port;
     uint32_t  max_inline_data;
     int id, repetitions;
     int max_repetitions;
     uint64_t sum;
+    // Payload buffers are allocated by the thread once the device is known.
+    int buf_size;
+    rdmalib::AllocationPolicy buffer_policy;
     rdmalib::Buffer<char> send, rcv;
     rdmalib::RecvBuffer wc_buffer;
+    rdmalib::WorkRequestBatch _results;
+    // Inputs of pull invocations are read in chunks into a buffer that grows on demand.
+    constexpr static uint32_t PULL_CHUNK_SIZE = 1024 * 1024;
+    std::unique_ptr<rdmalib::MemoryPool> _pull_pool;
+    rdmalib::PooledBuffer<char> _pull_buffer;
+    rdmalib::WorkRequestBatch _reads;
+    // Stream invocations read input chunks into a ring and write output chunks from another,
+    // both in one buffer from the pull pool - memory is bounded by the chunk size, not the input.
+    constexpr static uint32_t STREAM_CHUNKS = 4;
+    constexpr static uint32_t MAX_STREAM_CHUNK_SIZE = 16 * 1024 * 1024;
+    rdmalib::PooledBuffer<char> _stream_buffer;
     rdmalib::Connection* conn;
     rdmalib::Connection* _mgr_connection;
+    // Set when the thread shares queue pairs with other threads of its group.
+    ThreadGroup* _group;
+    int _lane_idx;
+    rdmalib::Lane* _lane;
+    // Invocations are detected by polling the receive buffer, see MemoryChannel.
+    bool _memory_polling;
     const executor::ManagerConnection & _mgr_conn;
     Accounting _accounting;
     rdmalib::Buffer<uint64_t> _accounting_buf;
@@ -129,37 +296,94 @@ namespace server {
     constexpr static int HOT_POLLING_VERIFICATION_PERIOD = 10000;
     PollingState _polling_state;
 
-    Thread(std::string addr, int port, int id, int functions_size,
+    Thread(rdmalib::AsyncConnector* client_connector, rdmalib::AsyncConnector* mgr_connector,
+        int id, int functions_size,
         int buf_size, int recv_buffer_size, int max_inline_data,
+        const rdmalib::AllocationPolicy & buffer_policy,
         const executor::ManagerConnection & mgr_conn):
       _functions(functions_size),
-      addr(addr),
-      port(port),
+      _client_connector(client_connector),
+      _mgr_connector(mgr_connector),
+      _transport(rdmalib::Transport::RDMA),
+      _client_port(0),
       max_inline_data(max_inline_data),
       id(id),
       repetitions(0),
       max_repetitions(0),
       sum(0),
-      send(buf_size),
-      rcv(buf_size, rdmalib::functions::Submission::DATA_HEADER_SIZE),
+      buf_size(buf_size),
+      buffer_policy(buffer_policy),
       // +1 to handle batching of functions work completions + initial code submission
       wc_buffer(recv_buffer_size + 1),
       conn(nullptr),
+      _mgr_connection(nullptr),
+      _group(nullptr),
+      _lane_idx(0),
+      _lane(nullptr),
+      _memory_polling(false),
       _mgr_conn(mgr_conn),
       _accounting({0,0,0,0}),
       _accounting_buf(1)
     {
     }
 
-    Accounting::timepoint_t work(int invoc_id, int func_id, bool solicited, uint32_t in_size);
-    void hot(uint32_t hot_timeout);
-    void warm();
+    // Channel is DedicatedChannel, MemoryChannel, EmulatedChannel or rdmalib::Lane.
+    template<typename Channel>
+    Accounting::timepoint_t work(Channel & channel, int invoc_id, int func_id, bool solicited, bool pull, bool stream,
+        uint32_t in_size);
+    // Post reads of the input described in the receive buffer, returns the input size or -1.
+    template<typename Channel>
+    int64_t pull_input(Channel & channel);
+    // Run the streaming entry point on the input described in the receive buffer.
+    // Returns the size of the StreamResult placed in the send buffer.
+    template<typename Channel>
+    uint32_t execute_stream(Channel & channel, int func_id, const rdmalib::RemoteBuffer & output,
+        rdmalib::functions::InvocationStatus & status);
+    template<typename Channel>
+    void hot(Channel & channel, uint32_t hot_timeout);
+    template<typename Channel>
+    void warm(Channel & channel);
+    template<typename Channel>
+    void run(Channel & channel, int timeout);
+    void allocate_buffers(ibv_pd* pd);
+    // The first thread of the group connects on behalf of all of them.
+    bool establish_group();
+    bool join_group();
+    // The manager connection is shared by the thread group.
+    std::unique_lock<std::mutex> lock_manager();
+    // Connection to the manager used by the channel, nullptr without a manager.
+    template<typename Channel>
+    auto manager_connection(Channel & channel);
+    // Payload buffers and the library are placed in the arena of the transport.
+    template<rdmalib::Transport T>
+    void emulated_work(int timeout);
     void thread_work(int timeout);
   };
 
+  // Threads multiplexed over one queue pair to the client and one to the manager.
+  // Each thread uses its own lane of the client queue pair; accounting updates are
+  // rare, and the manager connection is only guarded by a mutex.
+  struct ThreadGroup {
+    std::vector<Thread*> threads;
+    std::unique_ptr<rdmalib::Connection> conn;
+    std::unique_ptr<rdmalib::SharedConnection> shared;
+    std::unique_ptr<rdmalib::Connection> mgr_connection;
+    std::mutex mgr_mutex;
+    std::promise<bool> established;
+    std::shared_future<bool> ready;
+
+    ThreadGroup():
+      ready(established.get_future())
+    {}
+  };
+
   struct FastExecutors {
 
+    // Address lookup is done once for all threads.
+    std::unique_ptr<rdmalib::AsyncConnector> _client_connector;
+    std::unique_ptr<rdmalib::AsyncConnector> _mgr_connector;
     std::vector<Thread> _threads_data;
+    std::vector<std::unique_ptr<ThreadGroup>> _groups;
     std::vector<std::thread> _threads;
     bool _closing;
     int _numcores;
@@ -176,7 +400,11 @@ namespace server {
       int recv_buf_size,
       int max_inline_data,
       int pin_threads,
-      const executor::ManagerConnection & mgr_conn
+      const rdmalib::AllocationPolicy & buffer_policy,
+      const executor::ManagerConnection & mgr_conn,
+      int threads_per_qp = 1,
+      bool memory_polling = false,
+      rdmalib::Transport transport = rdmalib::Transport::RDMA
     );
     ~FastExecutors();
 
@@ -102,12 +102,32 @@ namespace server {
     return this->_memory_handle;
   }
 
+  bool Functions::is_stream_function(int idx) const
+  {
+    const std::string & name = _names[idx];
+    size_t suffix = sizeof(rdmalib::functions::STREAM_SUFFIX) - 1;
+    return name.size() > suffix &&
+      name.compare(name.size() - suffix, suffix, rdmalib::functions::STREAM_SUFFIX) == 0;
+  }
+
   Functions::FuncType Functions::function(int idx)
   {
+    if(idx < 0 || static_cast<size_t>(idx) >= _names.size() || is_stream_function(idx))
+      return nullptr;
     if(!_functions[idx]) {
       _functions[idx] = dlsym(_library_handle, _names[idx].c_str());
     }
     return reinterpret_cast<FuncType>(_functions[idx]);
   }
+
+  Functions::StreamFuncType Functions::stream_function(int idx)
+  {
+    if(idx < 0 || static_cast<size_t>(idx) >= _names.size() || !is_stream_function(idx))
+      return nullptr;
+    if(!_functions[idx]) {
+      _functions[idx] = dlsym(_library_handle, _names[idx].c_str());
+    }
+    return reinterpret_cast<StreamFuncType>(_functions[idx]);
+  }
 }
 
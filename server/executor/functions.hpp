@@ -6,6 +6,7 @@
 #include <string>
 
 #include <rdmalib/buffer.hpp>
+#include <rdmalib/functions.hpp>
 
 namespace server {
 
@@ -22,6 +23,7 @@ namespace server {
     std::vector<void*> _functions;
 
     typedef uint32_t (*FuncType)(void*, uint32_t, void*);
+    typedef rdmalib::functions::StreamFuncType StreamFuncType;
 
     Functions(size_t size);
     ~Functions();
@@ -29,7 +31,11 @@ namespace server {
     void process_library();
     size_t size() const;
     void* memory() const;
+    // Entry points are told apart by name, see rdmalib::functions::STREAM_SUFFIX.
+    // Both return nullptr when the symbol is of the other kind, or the index is out of range.
     FuncType function(int idx);
+    StreamFuncType stream_function(int idx);
+    bool is_stream_function(int idx) const;
   };
 
 }
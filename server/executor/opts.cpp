@@ -14,10 +14,15 @@ namespace server {
       ("cheap", "Number of cheap executors", cxxopts::value<int>()->default_value("0"))
       ("fast", "Number of fast executors", cxxopts::value<int>()->default_value("1"))
       ("polling-mgr", "Polling manager: server, thread, server-notify", cxxopts::value<std::string>()->default_value("server"))
-      ("polling-type", "Polling type: wc (work completions), dram", cxxopts::value<std::string>()->default_value("wc"))
+      ("polling-type", "Polling type: wc (work completions), dram (flags of messages written to memory)", cxxopts::value<std::string>()->default_value("wc"))
       ("warmup-iters", "Number of warm-up iterations", cxxopts::value<int>()->default_value("1"))
       ("pin-threads", "Pin worker threads to CPU cores", cxxopts::value<int>()->default_value("-1"))
-      ("max-inline-data", "Maximum size of inlined message", cxxopts::value<int>()->default_value("0"))
+      ("max-inline-data", "Maximum size of inlined message, -1 selects the device limit", cxxopts::value<int>()->default_value("0"))
+      ("transport", "Transport of client connections: rdma, shm (same host), tcp; the manager is reached over the same transport", cxxopts::value<std::string>()->default_value("rdma"))
+      ("threads-per-qp", "Number of worker threads sharing a queue pair", cxxopts::value<int>()->default_value("1"))
+      ("hugepages", "Page size of payload buffers: none, 2mb, 1gb", cxxopts::value<std::string>()->default_value("none"))
+      ("prefault", "Prefault payload buffers", cxxopts::value<bool>()->default_value("false"))
+      ("numa-node", "NUMA node of payload buffers: any, local, device or node index", cxxopts::value<std::string>()->default_value("any"))
       ("x,requests", "Size of recv buffer", cxxopts::value<int>()->default_value("32"))
       ("func-size", "Size of functions library", cxxopts::value<int>())
       ("timeout", "Timeout for switching hot to warm polling; -1 always hot, 0 always warm", cxxopts::value<int>())
@@ -25,6 +30,8 @@ namespace server {
       ("r,repetitions", "Repetitions to execute", cxxopts::value<int>()->default_value("1"))
       ("f,file", "Output server status.", cxxopts::value<std::string>())
       ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("stats-file", "Output JSON file for connection statistics, empty logs them", cxxopts::value<std::string>()->default_value(""))
+      ("stats-period", "Period of connection statistics in ms, 0 reports only on exit", cxxopts::value<int>()->default_value("0"))
       ("mgr-address", "Use selected address", cxxopts::value<std::string>())
       ("mgr-port", "Use selected port", cxxopts::value<int>())
       ("mgr-secret", "Use selected port", cxxopts::value<int>())
@@ -45,14 +52,28 @@ namespace server {
     result.verbose = parsed_options["verbose"].as<bool>();
     result.pin_threads = parsed_options["pin-threads"].as<int>();
     result.max_inline_data = parsed_options["max-inline-data"].as<int>();
+    result.threads_per_qp = parsed_options["threads-per-qp"].as<int>();
     result.func_size = parsed_options["func-size"].as<int>();
     result.timeout = parsed_options["timeout"].as<int>();
+    result.stats_file = parsed_options["stats-file"].as<std::string>();
+    result.stats_period = parsed_options["stats-period"].as<int>();
 
-    result.mgr_address = parsed_options["mgr-address"].as<std::string>();
-    result.mgr_port = parsed_options["mgr-port"].as<int>();
-    result.mgr_secret = parsed_options["mgr-secret"].as<int>();
-    result.accounting_buffer_addr = parsed_options["mgr-buf-addr"].as<uint64_t>();
-    result.accounting_buffer_rkey = parsed_options["mgr-buf-rkey"].as<uint32_t>();
+    std::string transport = parsed_options["transport"].as<std::string>();
+    if(!rdmalib::parse_transport(transport, result.transport))
+      throw std::runtime_error("Unrecognized choice for transport option: " + transport);
+
+    // Executors of emulated transports can be started directly, without the manager.
+    if(result.transport == rdmalib::Transport::RDMA || parsed_options.count("mgr-address")) {
+      result.mgr_address = parsed_options["mgr-address"].as<std::string>();
+      result.mgr_port = parsed_options["mgr-port"].as<int>();
+      result.mgr_secret = parsed_options["mgr-secret"].as<int>();
+      result.accounting_buffer_addr = parsed_options["mgr-buf-addr"].as<uint64_t>();
+      result.accounting_buffer_rkey = parsed_options["mgr-buf-rkey"].as<uint32_t>();
+    } else {
+      result.mgr_port = result.mgr_secret = 0;
+      result.accounting_buffer_addr = 0;
+      result.accounting_buffer_rkey = 0;
+    }
 
     std::string polling_mgr = parsed_options["polling-mgr"].as<std::string>();
     if(polling_mgr == "server") {
@@ -74,6 +95,38 @@ namespace server {
       throw std::runtime_error("Unrecognized choice for polling-type option: " + polling_type);
     }
 
+    std::string hugepages = parsed_options["hugepages"].as<std::string>();
+    if(hugepages == "none") {
+      result.buffer_policy.page_size = rdmalib::AllocationPolicy::PageSize::DEFAULT;
+    } else if(hugepages == "2mb") {
+      result.buffer_policy.page_size = rdmalib::AllocationPolicy::PageSize::HUGE_2MB;
+    } else if(hugepages == "1gb") {
+      result.buffer_policy.page_size = rdmalib::AllocationPolicy::PageSize::HUGE_1GB;
+    } else {
+      throw std::runtime_error("Unrecognized choice for hugepages option: " + hugepages);
+    }
+    result.buffer_policy.populate = parsed_options["prefault"].as<bool>();
+
+    std::string numa_node = parsed_options["numa-node"].as<std::string>();
+    if(numa_node == "any") {
+      result.buffer_policy.numa_node = rdmalib::AllocationPolicy::ANY_NODE;
+    } else if(numa_node == "local") {
+      result.buffer_policy.numa_node = rdmalib::AllocationPolicy::LOCAL_NODE;
+    } else if(numa_node == "device") {
+      result.buffer_policy.numa_node = rdmalib::AllocationPolicy::DEVICE_NODE;
+    } else {
+      size_t parsed = 0;
+      int node = -1;
+      try {
+        node = std::stoi(numa_node, &parsed);
+      } catch(const std::logic_error &) {
+      }
+      // Negative values are reserved for the named policies.
+      if(node < 0 || parsed != numa_node.size())
+        throw std::runtime_error("Unrecognized choice for numa-node option: " + numa_node);
+      result.buffer_policy.numa_node = node;
+    }
+
     return result;
   }
 }
@@ -10,6 +10,7 @@
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/connection.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/transport.hpp>
 
 #include "fast_executor.hpp"
 
@@ -47,11 +48,19 @@ namespace server {
     int warmup_iters;
     int pin_threads;
     int max_inline_data;
+    // Worker threads multiplexed over one queue pair to the client.
+    int threads_per_qp;
+    rdmalib::Transport transport;
     int func_size;
     int timeout;
     bool verbose;
     PollingMgr polling_manager;
     PollingType polling_type;
+    // Backing memory of the payload buffers.
+    rdmalib::AllocationPolicy buffer_policy;
+    // Connection statistics, written on exit and every period when it's positive.
+    std::string stats_file;
+    int stats_period;
 
     std::string mgr_address;
     int mgr_port;
@@ -12,6 +12,7 @@
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/server.hpp>
 #include <rdmalib/connection.hpp>
+#include <rdmalib/statistics.hpp>
 
 #include "manager.hpp"
 
@@ -53,12 +54,23 @@ int main(int argc, char ** argv)
   // Read executor manager settings
   std::ifstream in_cfg{opts.json_config};
   rfaas::executor_manager::Settings settings = rfaas::executor_manager::Settings::deserialize(in_cfg);
+  settings.exec.stats_file = opts.stats_file;
+  settings.exec.stats_period = opts.stats_period;
+  settings.client_lease_ms = opts.client_lease;
+
+  auto & stats = rdmalib::StatisticsRegistry::instance();
+  if(opts.stats_period > 0)
+    stats.start_reporting(std::chrono::milliseconds{opts.stats_period}, opts.stats_file);
 
   rfaas::executor_manager::Manager mgr{settings, opts.skip_rm};
   instance = &mgr;
   mgr.start();
 
   spdlog::info("Executor manager is closing down");
+  if(opts.stats_period > 0)
+    stats.stop_reporting();
+  else
+    stats.report(opts.stats_file);
   std::this_thread::sleep_for(std::chrono::seconds(1)); 
 
   return 0;
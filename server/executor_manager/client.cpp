@@ -14,21 +14,28 @@ namespace rfaas::executor_manager {
 
   Client::Client(rdmalib::Connection* conn, ibv_pd* pd): //, Accounting & _acc):
     connection(conn),
-    allocation_requests(RECV_BUF_SIZE),
-    rcv_buffer(RECV_BUF_SIZE),
     accounting(1),
     //accounting(_acc),
     allocation_time(0),
-    _active(false)
+    _active(false),
+    datagram_id(0),
+    last_seen(std::chrono::steady_clock::now())
   {
     // Make the buffer accessible to clients
     memset(accounting.data(), 0, accounting.data_size());
     accounting.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
-    // Make the buffer accessible to clients
-    allocation_requests.register_memory(pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
-    // Initialize batch receive WCs
-    connection->initialize_batched_recv(allocation_requests, sizeof(rdmalib::AllocationRequest));
-    rcv_buffer.connect(connection);
+  }
+
+  Client::Client(ArenaAccounting && acc):
+    connection(nullptr),
+    accounting(std::move(acc)),
+    allocation_time(0),
+    _active(false),
+    datagram_id(0),
+    last_seen(std::chrono::steady_clock::now())
+  {
+    // Slots of the arena are reused by clients.
+    memset(accounting.data(), 0, accounting.data_size());
   }
 
   //void Client::reinitialize(rdmalib::Connection* conn)
@@ -39,18 +46,15 @@ namespace rfaas::executor_manager {
   //  rcv_buffer.connect(conn);
   //}
 
-  void Client::reload_queue()
-  {
-    rcv_buffer.refill();
-  }
-
   void Client::disable(int id)
   {
-    rdma_disconnect(connection->id());
-    SPDLOG_DEBUG(
-      "[Client] Disconnect client with connection {} id {}",
-      fmt::ptr(connection), fmt::ptr(connection->id())
-    );
+    if(connection) {
+      rdma_disconnect(connection->id());
+      SPDLOG_DEBUG(
+        "[Client] Disconnect client with connection {} id {}",
+        fmt::ptr(connection), fmt::ptr(connection->id())
+      );
+    }
     // First, we check if the child is still alive
     if(executor) {
       int status;
@@ -71,9 +75,11 @@ namespace rfaas::executor_manager {
     //acc.hot_polling_time = acc.execution_time = 0;
     // SEGFAULT?
     //ibv_dereg_mr(allocation_requests._mr);
-    connection->close();
-    delete connection;
-    connection = nullptr;
+    if(connection) {
+      connection->close();
+      delete connection;
+      connection = nullptr;
+    }
     _active=false;
   }
 
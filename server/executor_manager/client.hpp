@@ -3,6 +3,7 @@
 #define __SERVER_EXECUTOR_MANAGER_CLIENT_HPP__
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 
 #include <rdmalib/connection.hpp>
@@ -19,19 +20,30 @@ namespace rdmalib {
 
 namespace rfaas::executor_manager {
 
+  // Accounting of a client in the arena of an emulated transport, released with the arena.
+  struct ArenaAccounting : rdmalib::Buffer<Accounting>
+  {
+    ArenaAccounting(Accounting* ptr, ibv_mr* mr):
+      rdmalib::Buffer<Accounting>(ptr, mr, 1, 0)
+    {}
+  };
+
+  // Allocation requests of all clients are received by the shared receive queue of the manager,
+  // or by its datagram queue pair - such clients have no connection.
+  // Connections of emulated transports are kept by the manager, see Manager::poll_emulated.
   struct Client
   {
-    static constexpr int RECV_BUF_SIZE = 8;
     rdmalib::Connection* connection;
-    rdmalib::Buffer<rdmalib::AllocationRequest> allocation_requests;
-    rdmalib::RecvBuffer rcv_buffer;
     std::unique_ptr<ActiveExecutor> executor;
     rdmalib::Buffer<Accounting> accounting;
     uint32_t allocation_time;
     bool _active;
+    // Identifier chosen by a datagram client, and the time of its last request.
+    uint64_t datagram_id;
+    std::chrono::steady_clock::time_point last_seen;
 
     Client(rdmalib::Connection* conn, ibv_pd* pd);
-    void reload_queue();
+    Client(ArenaAccounting && accounting);
     void disable(int);
     bool active();
   };
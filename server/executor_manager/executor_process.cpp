@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <tuple>
 
 #include <unistd.h>
@@ -8,6 +9,7 @@
 #include <spdlog/spdlog.h>
 
 #include <rdmalib/allocation.hpp>
+#include <rdmalib/transport.hpp>
 
 #include "executor_process.hpp"
 #include "settings.hpp"
@@ -71,6 +73,8 @@ namespace rfaas::executor_manager {
     std::string client_func_size = std::to_string(request.func_buf_size);
     std::string client_cores = std::to_string(request.cores);
     std::string client_timeout = std::to_string(request.hot_timeout);
+    std::string client_threads_per_qp = std::to_string(std::max<int16_t>(request.threads_per_qp, 1));
+    const char* client_polling_type = request.memory_polling ? "dram" : "wc";
     //spdlog::error("Child fork begins work on PID {}", mypid);
     std::string executor_repetitions = std::to_string(exec.repetitions);
     std::string executor_warmups = std::to_string(exec.warmup_iters);
@@ -82,6 +86,8 @@ namespace rfaas::executor_manager {
     else
       executor_pin_threads = std::to_string(exec.pin_threads);
     bool use_docker = exec.use_docker;
+    std::string executor_stats_period = std::to_string(exec.stats_period);
+    std::string executor_transport = rdmalib::transport_name(exec.transport);
 
     std::string mgr_port = std::to_string(conn.port);
     std::string mgr_secret = std::to_string(conn.secret);
@@ -95,6 +101,9 @@ namespace rfaas::executor_manager {
     if(mypid == 0) {
       mypid = getpid();
       auto out_file = ("executor_" + std::to_string(mypid));
+      std::string executor_stats_file;
+      if(!exec.stats_file.empty())
+        executor_stats_file = exec.stats_file + "." + out_file;
 
       spdlog::info("Child fork begins work on PID {}, using Docker? {}", mypid, use_docker);
       int fd = open(out_file.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
@@ -113,6 +122,8 @@ namespace rfaas::executor_manager {
           "--fast", client_cores.c_str(),
           "--warmup-iters", executor_warmups.c_str(),
           "--max-inline-data", executor_max_inline.c_str(),
+          "--threads-per-qp", client_threads_per_qp.c_str(),
+          "--polling-type", client_polling_type,
           "--func-size", client_func_size.c_str(),
           "--timeout", client_timeout.c_str(),
           "--mgr-address", conn.addr.c_str(),
@@ -120,6 +131,9 @@ namespace rfaas::executor_manager {
           "--mgr-secret", mgr_secret.c_str(),
           "--mgr-buf-addr", mgr_buf_addr.c_str(),
           "--mgr-buf-rkey", mgr_buf_rkey.c_str(),
+          "--stats-file", executor_stats_file.c_str(),
+          "--stats-period", executor_stats_period.c_str(),
+          "--transport", executor_transport.c_str(),
           nullptr
         };
         int ret = execvp(argv[0], const_cast<char**>(&argv[0]));
@@ -180,6 +194,8 @@ namespace rfaas::executor_manager {
           "--fast", client_cores.c_str(),
           "--warmup-iters", executor_warmups.c_str(),
           "--max-inline-data", executor_max_inline.c_str(),
+          "--threads-per-qp", client_threads_per_qp.c_str(),
+          "--polling-type", client_polling_type,
           "--func-size", client_func_size.c_str(),
           "--timeout", client_timeout.c_str(),
           "--mgr-address", conn.addr.c_str(),
@@ -187,6 +203,7 @@ namespace rfaas::executor_manager {
           "--mgr-secret", mgr_secret.c_str(),
           "--mgr-buf-addr", mgr_buf_addr.c_str(),
           "--mgr-buf-rkey", mgr_buf_rkey.c_str(),
+          "--transport", executor_transport.c_str(),
           nullptr
         };
         int ret = execvp(argv[0], const_cast<char**>(&argv[0]));
@@ -11,6 +11,7 @@
 
 #include <rdmalib/connection.hpp>
 #include <rdmalib/allocation.hpp>
+#include <rdmalib/transport.hpp>
 
 #include "manager.hpp"
 #include "rdmalib/rdmalib.hpp"
@@ -22,14 +23,24 @@ namespace rfaas::executor_manager {
   Manager::Manager(Settings & settings, bool skip_rm):
     _q1(100), _q2(100),
     _ids(0),
-    _state(settings.device->ip_address, settings.rdma_device_port,
-        settings.device->default_receive_buffer_size, true),
+    // Emulated transports don't need a device.
+    _state(
+      settings.device->transport == rdmalib::Transport::RDMA ?
+        rdmalib::RDMAPassive{settings.device->ip_address, settings.rdma_device_port,
+          settings.device->default_receive_buffer_size, true} :
+        rdmalib::RDMAPassive{}
+    ),
     _settings(settings),
     // FIXME: randomly generated
     _secret(0x1234),
     _skip_rm(skip_rm),
     _shutdown(false)
   {
+    if(settings.device->transport != rdmalib::Transport::RDMA)
+      return;
+    // One receive slot per active client.
+    _state.enable_srq(MAX_CLIENTS_ACTIVE, sizeof(rdmalib::AllocationRequest));
+    _control.reset(new rdmalib::DatagramServer{settings.device->ip_address, settings.rdma_device_port});
     if(!_skip_rm) {
       _res_mgr_connection = std::move(rdmalib::RDMAActive{
         settings.resource_manager_address,
@@ -47,6 +58,25 @@ namespace rfaas::executor_manager {
 
   void Manager::start()
   {
+    rdmalib::Transport transport = _settings.device->transport;
+    if(transport != rdmalib::Transport::RDMA) {
+      if(!_skip_rm) {
+        spdlog::error("Resource manager is reached over RDMA, the {} transport requires skipping it", rdmalib::transport_name(transport));
+        return;
+      }
+      spdlog::info(
+        "Begin listening at {}:{} over the {} transport!",
+        _settings.device->ip_address,
+        _settings.rdma_device_port,
+        rdmalib::transport_name(transport)
+      );
+      if(transport == rdmalib::Transport::SHM)
+        poll_emulated<rdmalib::Transport::SHM>();
+      else
+        poll_emulated<rdmalib::Transport::TCP>();
+      return;
+    }
+
     rdmalib::RecvBuffer _rcv_buffer{32};
     if(!_skip_rm) {
       spdlog::info(
@@ -84,9 +114,7 @@ namespace rfaas::executor_manager {
         continue;
       spdlog::debug("[Manager-listen] Polled new rdmacm event");
 
-      auto [conn, conn_status] = _state.poll_events(
-        false
-      );
+      auto [conn, conn_status] = _state.poll_events();
       spdlog::debug(
         "[Manager-listen] New rdmacm connection event - connection {}, status {}",
         fmt::ptr(conn), conn_status
@@ -106,7 +134,7 @@ namespace rfaas::executor_manager {
         spdlog::debug("[Manager-listen] Requested new connection {}", fmt::ptr(conn));
         // FIXME: users sending their ID 
         if(!conn->private_data()) {
-          int pos = _ids++;
+          int pos = _ids.fetch_add(1);
           Client client{conn, _state.pd()};
           client._active = true;
           _state.accept(conn);
@@ -138,123 +166,339 @@ namespace rfaas::executor_manager {
     spdlog::info("Background thread stops waiting for rdmacm events.");
   }
 
+  void Manager::receive_connections()
+  {
+    std::pair<int, rdmalib::Connection*>* p1 = _q1.peek();
+    while(p1) {
+      int client = p1->first;
+      SPDLOG_DEBUG("Connected executor for client {}", client);
+      int pos = _clients.find(client)->second.executor->connections_len++;
+      _clients.find(client)->second.executor->connections[pos] = p1->second; 
+      _q1.pop();
+      p1 = _q1.peek();
+    }
+    std::pair<int,Client>* p2 = _q2.peek();
+    while(p2) {
+      _qp_clients[p2->second.connection->qp()->qp_num] = p2->first;
+      _clients.insert(std::make_pair(p2->first, std::move(p2->second)));
+      SPDLOG_DEBUG("Connected new client id {}", p2->first);
+      _q2.pop();
+      p2 = _q2.peek();
+    }
+    atomic_thread_fence(std::memory_order_acquire);
+  }
+
+  std::map<int, Client>::iterator Manager::find_client(uint32_t qp_num)
+  {
+    auto it = _qp_clients.find(qp_num);
+    // The request could have arrived before we received the new client.
+    if(it == _qp_clients.end()) {
+      receive_connections();
+      it = _qp_clients.find(qp_num);
+      if(it == _qp_clients.end())
+        return _clients.end();
+    }
+    return _clients.find(it->second);
+  }
+
+  void Manager::release(int id, Client & client)
+  {
+    spdlog::info("Client {} disconnects", id);
+    if(client.executor) {
+      auto now = std::chrono::high_resolution_clock::now();
+      client.allocation_time +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          now - client.executor->_allocation_finished
+        ).count();
+    }
+    //client.disable(i, _accounting_data.data()[i]);
+    client.disable(id);
+  }
+
+  bool Manager::process_request(int i, Client & client, const rdmalib::AllocationRequest & request)
+  {
+    int16_t cores = request.cores;
+    const char * client_address = request.listen_address;
+    int client_port = request.listen_port;
+
+    if(cores <= 0) {
+      release(i, client);
+      return false;
+    }
+
+    spdlog::info(
+      "Client {} requests executor with {} threads, it should connect to {}:{},"
+      "it should have buffer of size {}, func buffer {}, and hot timeout {}",
+      i, request.cores,
+      request.listen_address,
+      request.listen_port,
+      request.input_buf_size,
+      request.func_buf_size,
+      request.hot_timeout
+    );
+    int secret = (i << 16) | (this->_secret & 0xFFFF);
+    uint64_t addr = client.accounting.address(); //+ sizeof(Accounting)*i;
+    // FIXME: Docker
+    auto now = std::chrono::high_resolution_clock::now();
+    client.executor.reset(
+      ProcessExecutor::spawn(
+        request,
+        _settings.exec,
+        {
+          _settings.device->ip_address,
+          _settings.rdma_device_port,
+          secret, addr, client.accounting.rkey()
+        }
+      )
+    );
+    auto end = std::chrono::high_resolution_clock::now();
+    spdlog::info(
+      "Client {} at {}:{} has executor with {} ID and {} cores, time {} us",
+      i, client_address, client_port, client.executor->id(), cores,
+      std::chrono::duration_cast<std::chrono::microseconds>(end-now).count()
+    );
+    return true;
+  }
+
+  rdmalib::DatagramStatus Manager::process_datagram(
+    const rdmalib::DatagramMessage & msg,
+    std::vector<std::map<int, Client>::iterator> & removals,
+    std::vector<uint64_t> & forgotten
+  )
+  {
+    auto it = _datagram_clients.find(msg.client);
+    // Datagram clients exist from their first allocation until they release it.
+    if(it == _datagram_clients.end() && msg.type == rdmalib::DatagramType::ALLOCATE) {
+      int pos = _ids.fetch_add(1);
+      Client client{nullptr, _state.pd()};
+      client._active = true;
+      client.datagram_id = msg.client;
+      _clients.insert(std::make_pair(pos, std::move(client)));
+      it = _datagram_clients.emplace(msg.client, pos).first;
+      SPDLOG_DEBUG("Connected new datagram client id {}", pos);
+    }
+    if(it == _datagram_clients.end()) {
+      forgotten.push_back(msg.client);
+      // Acknowledgment of the release was lost, and the client has retransmitted it.
+      if(msg.type == rdmalib::DatagramType::RELEASE)
+        return rdmalib::DatagramStatus::SUCCESS;
+      spdlog::error("Datagram request from unknown client {}", msg.client);
+      return rdmalib::DatagramStatus::UNKNOWN_CLIENT;
+    }
+
+    auto client_it = _clients.find(it->second);
+    Client & client = client_it->second;
+    client.last_seen = std::chrono::steady_clock::now();
+    switch(msg.type) {
+      case rdmalib::DatagramType::ALLOCATE:
+        process_request(client_it->first, client, msg.request);
+        return rdmalib::DatagramStatus::SUCCESS;
+      case rdmalib::DatagramType::RELEASE:
+        release(client_it->first, client);
+        _datagram_clients.erase(it);
+        forgotten.push_back(msg.client);
+        removals.push_back(client_it);
+        return rdmalib::DatagramStatus::SUCCESS;
+      case rdmalib::DatagramType::HEARTBEAT:
+        return rdmalib::DatagramStatus::SUCCESS;
+      default:
+        spdlog::error("Unknown datagram request {} from client {}", static_cast<int>(msg.type), msg.client);
+        return rdmalib::DatagramStatus::FAILURE;
+    }
+  }
+
+  void Manager::check_clients(std::vector<std::map<int, Client>::iterator> & removals)
+  {
+    auto timestamp = std::chrono::steady_clock::now();
+    for(auto it = _clients.begin(); it != _clients.end(); ++it) {
+
+      Client & client = it->second;
+      int i = it->first;
+      // Datagram clients don't disconnect when they fail, their allocations expire.
+      if(
+        client.active() && client.datagram_id && _settings.client_lease_ms > 0 &&
+        timestamp - client.last_seen > std::chrono::milliseconds{_settings.client_lease_ms}
+      ) {
+        spdlog::info("Lease of client {} expired", i);
+        release(i, client);
+        _datagram_clients.erase(client.datagram_id);
+        _control->forget(client.datagram_id);
+        removals.push_back(it);
+        continue;
+      }
+      if(client.active() && client.executor) {
+        auto status = client.executor->check();
+        if(std::get<0>(status) != ActiveExecutor::Status::RUNNING) {
+          auto now = std::chrono::high_resolution_clock::now();
+          client.allocation_time +=
+            std::chrono::duration_cast<std::chrono::microseconds>(
+              now - client.executor->_allocation_finished
+            ).count();
+          // FIXME: update global manager
+          spdlog::info(
+            "Executor at client {} exited, status {}, time allocated {} us, polling {} us, execution {} us",
+            i, std::get<1>(status), client.allocation_time,
+            client.accounting.data()[0].hot_polling_time,
+            client.accounting.data()[0].execution_time
+          );
+          client.executor.reset(nullptr);
+          spdlog::info("Finished cleanup");
+        }
+      }
+    }
+  }
+
+  template<rdmalib::Transport T>
+  void Manager::poll_emulated()
+  {
+    typedef rdmalib::EmulatedTransport<T> Traits;
+    typedef typename Traits::Connection Connection;
+    // Connections of a client and of the threads of its executor.
+    struct EmulatedClient {
+      int slot;
+      std::unique_ptr<Connection> connection;
+      std::vector<std::unique_ptr<Connection>> executors;
+    };
+
+    typename Traits::ProtectionDomain pd;
+    std::unique_ptr<typename Traits::RDMAPassive> passive{
+      Traits::passive(_settings.device->ip_address, _settings.rdma_device_port, pd)
+    };
+    // Each active client has a receive slot and an accounting buffer, executors add to it with atomics.
+    auto requests = pd.template allocate<rdmalib::AllocationRequest>(MAX_CLIENTS_ACTIVE);
+    auto accounting = pd.template allocate<Accounting>(MAX_CLIENTS_ACTIVE);
+    std::vector<int> free_slots;
+    for(int i = MAX_CLIENTS_ACTIVE - 1; i >= 0; --i)
+      free_slots.push_back(i);
+    std::map<int, EmulatedClient> connections;
+    uint32_t obj_size = sizeof(rdmalib::AllocationRequest);
+
+    while(!_shutdown.load()) {
+
+      // Without clients, we sleep until the next connection.
+      if(passive->nonblocking_poll_events(connections.empty() ? POLLING_TIMEOUT_MS : 0)) {
+        std::unique_ptr<Connection> conn{passive->poll_events()};
+        uint32_t private_data = conn ? conn->private_data() : 0;
+        if(!conn) {
+          spdlog::error("Failed connection creation");
+        } else if(!private_data) {
+          if(free_slots.empty()) {
+            spdlog::error("Rejecting new client, {} clients are active", MAX_CLIENTS_ACTIVE);
+          } else {
+            int slot = free_slots.back();
+            free_slots.pop_back();
+            // The request of the client waits until we post the receive.
+            conn->post_recv(requests.sge(obj_size, slot * obj_size), slot);
+            int pos = _ids.fetch_add(1);
+            Client client{ArenaAccounting{accounting.data() + slot, accounting.mr()}};
+            client._active = true;
+            _clients.insert(std::make_pair(pos, std::move(client)));
+            connections.emplace(pos, EmulatedClient{slot, std::move(conn), {}});
+            SPDLOG_DEBUG("Connected new client id {}", pos);
+          }
+        } else if((private_data & 0xFFFF) == this->_secret && connections.count(private_data >> 16)) {
+          SPDLOG_DEBUG("Executor for client {}", private_data >> 16);
+          connections[private_data >> 16].executors.push_back(std::move(conn));
+        } else {
+          spdlog::error("New connection's private data that we can't understand: {}", private_data);
+        }
+      }
+
+      std::vector<std::map<int, Client>::iterator> removals;
+      for(auto & [id, emulated] : connections) {
+        auto it = _clients.find(id);
+        // Transports executing atomics at the target apply accounting when polled.
+        for(auto & executor : emulated.executors)
+          executor->poll_wc(rdmalib::QueueType::RECV, false);
+
+        auto [wcs, count] = emulated.connection->poll_wc(rdmalib::QueueType::RECV, false);
+        bool released = false;
+        for(int j = 0; j < count && !released; ++j) {
+          if(wcs[j].status != IBV_WC_SUCCESS)
+            continue;
+          // Copy the request and return the slot to the client immediately.
+          rdmalib::AllocationRequest request = requests.data()[emulated.slot];
+          emulated.connection->post_recv(requests.sge(obj_size, emulated.slot * obj_size), emulated.slot);
+          released = !process_request(id, it->second, request);
+        }
+        // Clients failing without a release.
+        if(!released && emulated.connection->status() != rdmalib::ConnectionStatus::ESTABLISHED) {
+          release(id, it->second);
+          released = true;
+        }
+        if(released)
+          removals.push_back(it);
+      }
+
+      check_clients(removals);
+      for(auto & [id, emulated] : connections) {
+        // Connections of an executor that exited.
+        if(!_clients.find(id)->second.executor)
+          emulated.executors.clear();
+      }
+      for(auto it : removals) {
+        spdlog::info("Remove client id {}", it->first);
+        auto conn_it = connections.find(it->first);
+        free_slots.push_back(conn_it->second.slot);
+        connections.erase(conn_it);
+        _clients.erase(it);
+      }
+    }
+    spdlog::info("Background thread stops processing {} events.", rdmalib::transport_name(T));
+    _clients.clear();
+    connections.clear();
+  }
+
   void Manager::poll_rdma()
   {
+    rdmalib::SharedReceiveQueue & srq = *_state.srq();
     // FIXME: sleep when there are no clients
     bool active_clients = true;
     while(active_clients && !_shutdown.load()) {
-      {
-        std::pair<int, rdmalib::Connection*>* p1 = _q1.peek();
-        if(p1){
-          int client = p1->first;
-          SPDLOG_DEBUG("Connected executor for client {}", client);
-          int pos = _clients.find(client)->second.executor->connections_len++;
-          _clients.find(client)->second.executor->connections[pos] = p1->second; 
-          _q1.pop();
-        }; 
-        std::pair<int,Client>* p2 = _q2.peek();
-        if(p2){
-          _clients.insert(std::make_pair(p2->first, std::move(p2->second)));
-          SPDLOG_DEBUG("Connected new client id {}", p2->first);
-          _q2.pop();
-        };  
-      }
 
-      atomic_thread_fence(std::memory_order_acquire);
+      receive_connections();
+
       std::vector<std::map<int, Client>::iterator> removals;
-      for(auto it = _clients.begin(); it != _clients.end(); ++it) {
-
-        Client & client = it->second;
-        int i = it->first;
-        auto wcs = client.rcv_buffer.poll(false);
-        if(std::get<1>(wcs)) {
-          SPDLOG_DEBUG(
-            "Received at {}, work completions {}",
-            i, std::get<1>(wcs)
-          );
-          for(int j = 0; j < std::get<1>(wcs); ++j) {
-
-            auto wc = std::get<0>(wcs)[j];
-            if(wc.status != 0)
-              continue;
-            uint64_t id = wc.wr_id;
-            int16_t cores = client.allocation_requests.data()[id].cores;
-            char * client_address = client.allocation_requests.data()[id].listen_address;
-            int client_port = client.allocation_requests.data()[id].listen_port;
-
-            if(cores > 0) {
-              spdlog::info(
-                "Client {} requests executor with {} threads, it should connect to {}:{},"
-                "it should have buffer of size {}, func buffer {}, and hot timeout {}",
-                i, client.allocation_requests.data()[id].cores,
-                client.allocation_requests.data()[id].listen_address,
-                client.allocation_requests.data()[id].listen_port,
-                client.allocation_requests.data()[id].input_buf_size,
-                client.allocation_requests.data()[id].func_buf_size,
-                client.allocation_requests.data()[id].hot_timeout
-              );
-              int secret = (i << 16) | (this->_secret & 0xFFFF);
-              uint64_t addr = client.accounting.address(); //+ sizeof(Accounting)*i;
-              // FIXME: Docker
-              auto now = std::chrono::high_resolution_clock::now();
-              client.executor.reset(
-                ProcessExecutor::spawn(
-                  client.allocation_requests.data()[id],
-                  _settings.exec,
-                  {
-                    _settings.device->ip_address,
-                    _settings.rdma_device_port,
-                    secret, addr, client.accounting.rkey()
-                  }
-                )
-              );
-              auto end = std::chrono::high_resolution_clock::now();
-              spdlog::info(
-                "Client {} at {}:{} has executor with {} ID and {} cores, time {} us",
-                i, client_address, client_port, client.executor->id(), cores,
-                std::chrono::duration_cast<std::chrono::microseconds>(end-now).count()
-              );
-            } else {
-              spdlog::info("Client {} disconnects", i);
-              if(client.executor) {
-                auto now = std::chrono::high_resolution_clock::now();
-                client.allocation_time +=
-                  std::chrono::duration_cast<std::chrono::microseconds>(
-                    now - client.executor->_allocation_finished
-                  ).count();
-              }
-              //client.disable(i, _accounting_data.data()[i]);
-              client.disable(i);
-              removals.push_back(it);
-              break;
-            }
-          }
-          //if(client.connection)
-          //  client.connection->poll_wc(rdmalib::QueueType::SEND, false);
+      // Requests of all clients arrive to a single completion queue.
+      auto wcs = srq.poll(false);
+      if(std::get<1>(wcs)) {
+        SPDLOG_DEBUG("Received work completions {}", std::get<1>(wcs));
+      }
+      for(int j = 0; j < std::get<1>(wcs); ++j) {
+
+        auto wc = std::get<0>(wcs)[j];
+        uint64_t id = wc.wr_id;
+        if(wc.status != 0) {
+          srq.post(id);
+          continue;
         }
-        if(client.active()) {
-          client.rcv_buffer.refill();
-          if(client.executor) {
-            auto status = client.executor->check();
-            if(std::get<0>(status) != ActiveExecutor::Status::RUNNING) {
-              auto now = std::chrono::high_resolution_clock::now();
-              client.allocation_time +=
-                std::chrono::duration_cast<std::chrono::microseconds>(
-                  now - client.executor->_allocation_finished
-                ).count();
-              // FIXME: update global manager
-              spdlog::info(
-                "Executor at client {} exited, status {}, time allocated {} us, polling {} us, execution {} us",
-                i, std::get<1>(status), client.allocation_time,
-                client.accounting.data()[i].hot_polling_time,
-                client.accounting.data()[i].execution_time
-              );
-              client.executor.reset(nullptr);
-              spdlog::info("Finished cleanup");
-            }
-          }
+        auto it = find_client(wc.qp_num);
+        if(it == _clients.end() || !it->second.active()) {
+          spdlog::error("Allocation request from unknown connection, QPN {}", wc.qp_num);
+          srq.post(id);
+          continue;
+        }
+        // Copy the request and return the slot to the queue immediately.
+        rdmalib::AllocationRequest request = *static_cast<rdmalib::AllocationRequest*>(srq.slot(id));
+        srq.post(id);
+        if(!process_request(it->first, it->second, request)) {
+          _qp_clients.erase(wc.qp_num);
+          removals.push_back(it);
         }
       }
+
+      // Requests of clients without a connection.
+      std::vector<uint64_t> forgotten;
+      _control->process_events();
+      _control->poll(
+        [&](const rdmalib::DatagramMessage & msg) {
+          return process_datagram(msg, removals, forgotten);
+        }
+      );
+      for(uint64_t client : forgotten)
+        _control->forget(client);
+
+      check_clients(removals);
       if(removals.size()) {
         for(auto it : removals) {
           spdlog::info("Remove client id {}", it->first);
@@ -264,6 +508,8 @@ namespace rfaas::executor_manager {
     }
     spdlog::info("Background thread stops processing RDMA events.");
     _clients.clear();
+    _qp_clients.clear();
+    _datagram_clients.clear();
   }
 
   //void Manager::poll_rdma()
@@ -8,12 +8,15 @@
 #include <vector>
 #include <mutex>
 #include <map>
+#include <unordered_map>
 
 #include <rdmalib/connection.hpp>
+#include <rdmalib/datagram.hpp>
 #include <rdmalib/rdmalib.hpp>
 #include <rdmalib/server.hpp>
 #include <rdmalib/buffer.hpp>
 #include <rdmalib/recv_buffer.hpp>
+#include <rdmalib/transport.hpp>
 
 #include "client.hpp"
 #include "settings.hpp"
@@ -31,6 +34,9 @@ namespace rfaas::executor_manager {
     std::string device_database;
     bool skip_rm;
     bool verbose;
+    std::string stats_file;
+    int stats_period;
+    int client_lease;
   };
   Options opts(int, char**);
 
@@ -46,14 +52,21 @@ namespace rfaas::executor_manager {
 
     std::mutex clients;
     std::map<int, Client> _clients;
-    int _ids;
+    // Clients are identified by the queue pair that delivered their request.
+    std::unordered_map<uint32_t, int> _qp_clients;
+    // Clients of the datagram control plane, by the identifier they have chosen.
+    std::unordered_map<uint64_t, int> _datagram_clients;
+    std::atomic<int> _ids;
 
     //std::vector<Client> _clients;
     //std::atomic<int> _clients_active;
     rdmalib::RDMAActive _res_mgr_connection;
     //std::unique_ptr<rdmalib::Connection> _res_mgr_connection;
 
+    // Emulated transports replace the listener, the shared receive queue and datagrams.
     rdmalib::RDMAPassive _state;
+    // Allocation requests without a connection, on the same port in the UDP space of rdmacm.
+    std::unique_ptr<rdmalib::DatagramServer> _control;
     //rdmalib::server::ServerStatus _status;
     Settings _settings;
     //rdmalib::Buffer<Accounting> _accounting_data;
@@ -66,7 +79,24 @@ namespace rfaas::executor_manager {
     void start();
     void listen();
     void poll_rdma();
+    // Accepts, polls and accounts clients and executors in a single thread,
+    // the accounting of all clients is in the arena of the transport.
+    template<rdmalib::Transport T>
+    void poll_emulated();
     void shutdown();
+  private:
+    void receive_connections();
+    std::map<int, Client>::iterator find_client(uint32_t qp_num);
+    void release(int id, Client & client);
+    // Returns false when the client releases its allocation.
+    bool process_request(int id, Client & client, const rdmalib::AllocationRequest & request);
+    // Expires leases of datagram clients and collects executors that exited.
+    void check_clients(std::vector<std::map<int, Client>::iterator> & removals);
+    rdmalib::DatagramStatus process_datagram(
+      const rdmalib::DatagramMessage & msg,
+      std::vector<std::map<int, Client>::iterator> & removals,
+      std::vector<uint64_t> & forgotten
+    );
   };
 
 }
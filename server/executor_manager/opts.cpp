@@ -13,6 +13,9 @@ namespace rfaas::executor_manager {
       ("device-database", "JSON configuration of devices.", cxxopts::value<std::string>())
       ("skip-resource-manager", "Ignore resource manager and don't connect to it.", cxxopts::value<bool>()->default_value("false"))
       ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+      ("stats-file", "Output JSON file for connection statistics, empty logs them; executors append their PID", cxxopts::value<std::string>()->default_value(""))
+      ("stats-period", "Period of connection statistics in ms, 0 reports only on exit", cxxopts::value<int>()->default_value("0"))
+      ("client-lease", "Release datagram clients without a heartbeat for this period in ms, 0 disables it", cxxopts::value<int>()->default_value("0"))
     ;
     auto parsed_options = options.parse(argc, argv);
 
@@ -21,6 +24,9 @@ namespace rfaas::executor_manager {
     result.device_database = parsed_options["device-database"].as<std::string>();
     result.verbose = parsed_options["verbose"].as<bool>();
     result.skip_rm = parsed_options["skip-resource-manager"].as<bool>();
+    result.stats_file = parsed_options["stats-file"].as<std::string>();
+    result.stats_period = parsed_options["stats-period"].as<int>();
+    result.client_lease = parsed_options["client-lease"].as<int>();
 
     return result;
   }
@@ -21,8 +21,9 @@ namespace rfaas::executor_manager {
     settings.device = dev;
 
     // executor options
-    settings.exec.max_inline_data = dev->max_inline_data;
+    settings.exec.max_inline_data = dev->inline_threshold();
     settings.exec.recv_buffer_size = dev->default_receive_buffer_size;
+    settings.exec.transport = dev->transport;
 
     return settings;
   }
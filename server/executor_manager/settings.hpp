@@ -5,6 +5,7 @@
 
 #include <string>
 
+#include <rdmalib/transport.hpp>
 #include <rfaas/devices.hpp>
 
 #include <cereal/details/helpers.hpp>
@@ -19,6 +20,11 @@ namespace rfaas::executor_manager {
     int recv_buffer_size;
     int max_inline_data;
     bool pin_threads;
+    // Set from the device, executors reach the client and the manager over it.
+    rdmalib::Transport transport;
+    // Set from the command line, not the config.
+    std::string stats_file;
+    int stats_period;
 
     template <class Archive>
     void load(Archive & ar )
@@ -46,6 +52,10 @@ namespace rfaas::executor_manager {
     // Passed to the scheduled executor
     ExecutorSettings exec;
 
+    // Set from the command line, not the config.
+    // Datagram clients are released after this period without requests, 0 disables it.
+    int client_lease_ms;
+
     template <class Archive>
     void load(Archive & ar )
     {
@@ -44,9 +44,7 @@ namespace rfaas::resource_manager {
       if(!result)
         continue;
 
-      auto [conn, conn_status] = _state.poll_events(
-        false
-      );
+      auto [conn, conn_status] = _state.poll_events();
       if(conn == nullptr){
         spdlog::error("Failed connection creation");
         continue;
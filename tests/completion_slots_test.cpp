@@ -0,0 +1,103 @@
+
+#include <thread>
+#include <vector>
+
+#include <rfaas/completion_slots.hpp>
+
+#include <gtest/gtest.h>
+
+TEST(CompletionSlots, ResolvesFuture)
+{
+  rfaas::completion_slots slots{4};
+  auto f = slots.acquire(1);
+  ASSERT_TRUE(f.valid());
+  EXPECT_FALSE(f.ready());
+  // Invocations that were not acquired have no slot.
+  EXPECT_FALSE(slots.complete(2, 0));
+  EXPECT_TRUE(slots.complete(1, 0, 24));
+  EXPECT_TRUE(f.ready());
+  // Synchronous invocations return the length of their result.
+  EXPECT_EQ(f.bytes(), 24u);
+  EXPECT_EQ(f.get(), 0);
+  EXPECT_FALSE(f.valid());
+}
+
+TEST(CompletionSlots, WaitsForAllResults)
+{
+  rfaas::completion_slots slots;
+  auto f = slots.acquire(7, 3);
+  EXPECT_TRUE(slots.complete(7, 0));
+  EXPECT_TRUE(slots.complete(7, 2));
+  EXPECT_FALSE(f.ready());
+  EXPECT_TRUE(slots.complete(7, 3));
+  // The first failure is reported.
+  EXPECT_EQ(f.get(), 2);
+}
+
+TEST(CompletionSlots, ResolvedByLanes)
+{
+  rfaas::completion_slots slots{4};
+  auto f = slots.acquire(3, 2);
+  // Lanes of a vector invocation have distinct ids in the same slot.
+  EXPECT_TRUE(slots.complete(slots.lane_id(3, 1), 0));
+  EXPECT_FALSE(slots.complete(slots.lane_id(3, 2), 0));
+  EXPECT_FALSE(f.ready());
+  EXPECT_TRUE(slots.complete(slots.lane_id(3, 0), 0));
+  EXPECT_EQ(f.get(), 0);
+}
+
+TEST(CompletionSlots, SlotsAreReused)
+{
+  rfaas::completion_slots slots{3};
+  EXPECT_EQ(slots.capacity(), 4u);
+
+  auto f = slots.acquire(1);
+  // Same slot, the first invocation is still in flight.
+  EXPECT_FALSE(slots.acquire(5).valid());
+  slots.complete(1, 0);
+  EXPECT_EQ(f.get(), 0);
+  auto g = slots.acquire(5);
+  ASSERT_TRUE(g.valid());
+
+  // Dropped futures release the slot when their result arrives.
+  g = rfaas::future{};
+  EXPECT_FALSE(slots.acquire(9).valid());
+  EXPECT_TRUE(slots.complete(5, 0));
+  EXPECT_TRUE(slots.acquire(9).valid());
+}
+
+TEST(CompletionSlots, MatchesTruncatedInvocationIds)
+{
+  rfaas::completion_slots slots;
+  auto f = slots.acquire(0x10003);
+  // Results carry only the lower 16 bits of the id.
+  EXPECT_FALSE(slots.complete(0x0403, 0));
+  EXPECT_TRUE(slots.complete(0x0003, 0));
+  EXPECT_EQ(f.get(), 0);
+}
+
+TEST(CompletionSlots, ResolvedByAnotherThread)
+{
+  rfaas::completion_slots slots{64};
+  int invocations = 10000;
+  std::vector<rfaas::future> futures;
+  std::atomic<int> submitted{0};
+  std::thread poller{
+    [&]() {
+      for(int i = 0; i < invocations; ++i) {
+        while(submitted.load() <= i)
+          std::this_thread::yield();
+        EXPECT_TRUE(slots.complete(i, i % 2));
+      }
+    }
+  };
+  int failed = 0;
+  for(int i = 0; i < invocations; ++i) {
+    auto f = slots.acquire(i);
+    ASSERT_TRUE(f.valid());
+    submitted.store(i + 1);
+    failed += f.get();
+  }
+  poller.join();
+  EXPECT_EQ(failed, invocations / 2);
+}
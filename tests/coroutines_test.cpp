@@ -0,0 +1,96 @@
+#include <fstream>
+#include <vector>
+
+#include <rfaas/rfaas.hpp>
+#include <rfaas/coroutines.hpp>
+#include <rfaas/devices.hpp>
+
+#include "config.h"
+
+#include <gtest/gtest.h>
+
+// The target is built as C++20, the awaitable interface must be available.
+#ifndef RFAAS_HAS_COROUTINES
+#error "Coroutines test requires a compiler with C++20 coroutines"
+#endif
+
+class CoroutinesTest : public ::testing::Test {
+
+public:
+  static std::string _device_name;
+  static constexpr int NUMCORES = 2;
+  static constexpr int INPUT_SIZE = 64;
+
+protected:
+  void SetUp() override
+  {
+    {
+      // Read connection details to the managers
+      std::ifstream in_cfg("servers.json");
+      rfaas::servers::deserialize(in_cfg);
+    }
+
+    {
+      // Read device details to the managers
+      std::ifstream in_cfg(Settings::DEVICE_JSON_PATH);
+      rfaas::devices::deserialize(in_cfg);
+    }
+  }
+};
+std::string CoroutinesTest::_device_name;
+
+// Parameters, unlike captures of a lambda, are kept in the coroutine frame.
+rfaas::task awaited_invocation(rfaas::invocation_loop & loop, rdmalib::Buffer<char> & in,
+    rdmalib::Buffer<char> & out, int & completed, int & failed)
+{
+  int ret = co_await loop.invoke("empty", in, out);
+  failed += ret != 0;
+  ++completed;
+}
+
+// Invocations beyond the threads of the executor wait in the loop until results release a thread.
+TEST_F(CoroutinesTest, MoreInvocationsThanThreads) {
+  rfaas::devices & dev = rfaas::devices::instance();
+  rfaas::executor executor(*dev.device(_device_name));
+  ASSERT_TRUE(executor.allocate(
+    std::string{Settings::FLIB_PATH},
+    NUMCORES,
+    INPUT_SIZE,
+    rfaas::polling_type::HOT_ALWAYS,
+    false
+  ));
+
+  const int invocations = 4 * NUMCORES;
+  std::vector<rdmalib::Buffer<char>> ins, outs;
+  for(int i = 0; i < invocations; ++i) {
+    ins.emplace_back(INPUT_SIZE, rdmalib::functions::Submission::DATA_HEADER_SIZE);
+    ins.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE);
+    *reinterpret_cast<int*>(ins.back().data()) = i;
+    outs.emplace_back(INPUT_SIZE);
+    outs.back().register_memory(executor._state.pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  }
+
+  int completed = 0, failed = 0;
+  {
+    rfaas::invocation_loop loop{executor};
+    for(int i = 0; i < invocations; ++i)
+      awaited_invocation(loop, ins[i], outs[i], completed, failed);
+    EXPECT_GT(loop.waiting(), 0u);
+    loop.run();
+    EXPECT_EQ(loop.in_flight(), 0u);
+    EXPECT_EQ(loop.waiting(), 0u);
+  }
+  EXPECT_EQ(completed, invocations);
+  EXPECT_EQ(failed, 0);
+  for(int i = 0; i < invocations; ++i)
+    EXPECT_EQ(*reinterpret_cast<int*>(outs[i].data()), i);
+
+  executor.deallocate();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  std::string arg{argc == 1 ? "" : argv[1]};
+  CoroutinesTest::_device_name = arg;
+  return RUN_ALL_TESTS();
+}
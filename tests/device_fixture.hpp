@@ -0,0 +1,71 @@
+#ifndef __TESTS_DEVICE_FIXTURE_HPP__
+#define __TESTS_DEVICE_FIXTURE_HPP__
+
+#include <fstream>
+#include <string>
+
+#include <infiniband/verbs.h>
+
+#include <rfaas/devices.hpp>
+
+#include "config.h"
+
+#include <gtest/gtest.h>
+
+// Protection domain of the first RDMA device.
+// Tests are skipped when the machine has no device.
+class DeviceTest : public ::testing::Test {
+
+protected:
+  ibv_context* _ctx = nullptr;
+  ibv_pd* _pd = nullptr;
+
+  void SetUp() override
+  {
+    int num_devices = 0;
+    ibv_device** devices = ibv_get_device_list(&num_devices);
+    if(!devices || !num_devices) {
+      if(devices)
+        ibv_free_device_list(devices);
+      GTEST_SKIP() << "No RDMA device available";
+    }
+    _ctx = ibv_open_device(devices[0]);
+    ibv_free_device_list(devices);
+    ASSERT_NE(_ctx, nullptr);
+    _pd = ibv_alloc_pd(_ctx);
+    ASSERT_NE(_pd, nullptr);
+  }
+
+  void TearDown() override
+  {
+    if(_pd)
+      ibv_dealloc_pd(_pd);
+    if(_ctx)
+      ibv_close_device(_ctx);
+  }
+};
+
+// Device of the testing configuration, its name is the first argument of the test.
+// Tests are skipped when no device is configured.
+// Fixtures extending the setup return when IsSkipped() holds after calling it.
+class ConfiguredDeviceTest : public ::testing::Test {
+
+public:
+  static inline std::string _device_name;
+
+protected:
+  rfaas::device_data* _device = nullptr;
+
+  void SetUp() override
+  {
+    std::ifstream in_cfg(Settings::DEVICE_JSON_PATH);
+    if(_device_name.empty() || !in_cfg.is_open())
+      GTEST_SKIP() << "No RDMA device configured";
+    rfaas::devices::deserialize(in_cfg);
+    _device = rfaas::devices::instance().device(_device_name);
+    if(!_device)
+      GTEST_SKIP() << "Device " << _device_name << " not found in the database";
+  }
+};
+
+#endif
@@ -0,0 +1,75 @@
+
+#include <thread>
+
+#include <rfaas/dispatcher.hpp>
+
+#include <gtest/gtest.h>
+
+TEST(Dispatcher, RoundRobinSkipsBusyWorkers)
+{
+  rfaas::dispatcher dispatcher;
+  dispatcher.reset(3);
+
+  int first = dispatcher.select();
+  EXPECT_EQ(first, 0);
+  dispatcher.submitted(first, 10);
+  EXPECT_EQ(dispatcher.select(), 1);
+  dispatcher.submitted(1, 11);
+  EXPECT_EQ(dispatcher.select(), 2);
+  dispatcher.submitted(2, 12);
+  // Each worker has one invocation in flight.
+  EXPECT_EQ(dispatcher.select(), -1);
+
+  EXPECT_TRUE(dispatcher.completed(11));
+  EXPECT_FALSE(dispatcher.completed(11));
+  EXPECT_EQ(dispatcher.outstanding(1), 0);
+  EXPECT_EQ(dispatcher.select(), 1);
+}
+
+TEST(Dispatcher, LeastOutstanding)
+{
+  rfaas::dispatcher dispatcher{rfaas::DispatchPolicy::LEAST_OUTSTANDING, 4};
+  dispatcher.reset(2);
+
+  dispatcher.submitted(0, 1);
+  dispatcher.submitted(0, 2);
+  dispatcher.submitted(1, 3);
+  EXPECT_EQ(dispatcher.select(), 1);
+  dispatcher.submitted(1, 4);
+  dispatcher.submitted(1, 5);
+  EXPECT_EQ(dispatcher.select(), 0);
+  EXPECT_EQ(dispatcher.outstanding(0), 2);
+  EXPECT_EQ(dispatcher.outstanding(1), 3);
+}
+
+TEST(Dispatcher, LatencyEwmaPrefersFasterWorkers)
+{
+  rfaas::dispatcher dispatcher{rfaas::DispatchPolicy::LATENCY_EWMA, 2};
+  dispatcher.reset(2);
+
+  dispatcher.submitted(0, 1);
+  dispatcher.submitted(1, 2);
+  EXPECT_TRUE(dispatcher.completed(2));
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_TRUE(dispatcher.completed(1));
+  EXPECT_GT(dispatcher.latency(0), dispatcher.latency(1));
+
+  // The faster worker is chosen even with an invocation in flight.
+  EXPECT_EQ(dispatcher.select(), 1);
+  dispatcher.submitted(1, 3);
+  EXPECT_EQ(dispatcher.select(), 1);
+  dispatcher.submitted(1, 4);
+  EXPECT_EQ(dispatcher.select(), 0);
+}
+
+TEST(Dispatcher, MatchesTruncatedInvocationIds)
+{
+  rfaas::dispatcher dispatcher;
+  dispatcher.reset(1);
+
+  // Results carry only the lower 16 bits of the id.
+  dispatcher.submitted(0, 0x10005);
+  EXPECT_FALSE(dispatcher.completed(6));
+  EXPECT_TRUE(dispatcher.completed(5));
+  EXPECT_EQ(dispatcher.outstanding(0), 0);
+}
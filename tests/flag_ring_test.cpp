@@ -0,0 +1,148 @@
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <rdmalib/flag_ring.hpp>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+  // Place parts of a message like the RDMA write of FlagSender would.
+  struct Message {
+    char* slot;
+    rdmalib::FlagHeader header;
+    std::string payload;
+
+    void write_header()
+    {
+      memcpy(slot, &header, sizeof(header));
+    }
+
+    void write_payload()
+    {
+      memcpy(slot + rdmalib::FlagRing::HEADER_SIZE, payload.data(), payload.size());
+    }
+
+    void write_trailer()
+    {
+      uint64_t trailer = rdmalib::FlagRing::trailer(header.seq);
+      uint32_t offset = rdmalib::FlagRing::HEADER_SIZE + payload.size() + rdmalib::FlagRing::padding(payload.size());
+      memcpy(slot + offset, &trailer, sizeof(trailer));
+    }
+
+    void write()
+    {
+      write_header();
+      write_payload();
+      write_trailer();
+    }
+  };
+
+  Message message(std::vector<uint64_t> & memory, uint32_t slot_size, int slot,
+      uint32_t seq, const std::string & payload, uint32_t imm)
+  {
+    char* ptr = reinterpret_cast<char*>(memory.data()) + slot * slot_size;
+    return Message{ptr, {seq, static_cast<uint32_t>(payload.size()), imm, static_cast<uint32_t>(payload.size())}, payload};
+  }
+
+}
+
+TEST(FlagRing, Layout)
+{
+  EXPECT_EQ(rdmalib::FlagRing::padding(0), 0u);
+  EXPECT_EQ(rdmalib::FlagRing::padding(13), 3u);
+  EXPECT_EQ(rdmalib::FlagRing::message_size(13), 16u + 13u + 3u + 8u);
+  EXPECT_LE(rdmalib::FlagRing::message_size(13), rdmalib::FlagRing::slot_size(13));
+  EXPECT_EQ(rdmalib::FlagRing::slot_size(0) % 8, 0u);
+}
+
+TEST(FlagRing, MessageArrivesWithTrailer)
+{
+  uint32_t slot_size = rdmalib::FlagRing::slot_size(64);
+  std::vector<uint64_t> memory(slot_size / sizeof(uint64_t), 0);
+  rdmalib::FlagRing ring{memory.data(), slot_size, 1};
+  std::array<ibv_wc, 4> wcs;
+
+  auto msg = message(memory, slot_size, 0, 1, "invocation input", (7 << 16) | 3);
+  msg.write_header();
+  EXPECT_FALSE(ring.pending());
+  EXPECT_EQ(ring.poll(wcs.data(), wcs.size()), 0);
+  msg.write_payload();
+  EXPECT_EQ(ring.poll(wcs.data(), wcs.size()), 0);
+  msg.write_trailer();
+  EXPECT_TRUE(ring.pending());
+  ASSERT_EQ(ring.poll(wcs.data(), wcs.size()), 1);
+  EXPECT_EQ(wcs[0].status, IBV_WC_SUCCESS);
+  EXPECT_EQ(wcs[0].wr_id, 0u);
+  EXPECT_EQ(wcs[0].byte_len, msg.payload.size());
+  EXPECT_EQ(std::string(ring.payload(0), msg.payload.size()), msg.payload);
+
+  // The message is not delivered twice, and stale trailers don't match the next one.
+  EXPECT_EQ(ring.poll(wcs.data(), wcs.size()), 0);
+  auto next = message(memory, slot_size, 0, 2, "short", 0);
+  next.write_header();
+  EXPECT_EQ(ring.poll(wcs.data(), wcs.size()), 0);
+  next.write_payload();
+  next.write_trailer();
+  EXPECT_EQ(ring.poll(wcs.data(), wcs.size()), 1);
+}
+
+TEST(FlagRing, SlotsWrapAround)
+{
+  uint32_t slot_size = rdmalib::FlagRing::slot_size(16);
+  int slots = 3;
+  std::vector<uint64_t> memory(slots * slot_size / sizeof(uint64_t), 0);
+  rdmalib::FlagRing ring{memory.data(), slot_size, slots};
+  std::array<ibv_wc, 2> wcs;
+
+  for(uint32_t seq = 1; seq <= 4; ++seq)
+    message(memory, slot_size, (seq - 1) % slots, seq, "x", seq).write();
+  // Only the fourth message is in its slot now, the first one was overwritten.
+  EXPECT_EQ(ring.poll(wcs.data(), wcs.size()), 0);
+
+  std::vector<uint64_t> fresh(memory.size(), 0);
+  rdmalib::FlagRing second{fresh.data(), slot_size, slots};
+  for(uint32_t seq = 1; seq <= 3; ++seq)
+    message(fresh, slot_size, seq - 1, seq, "x", seq).write();
+  ASSERT_EQ(second.poll(wcs.data(), wcs.size()), 2);
+  ASSERT_EQ(second.poll(wcs.data(), wcs.size()), 1);
+  EXPECT_EQ(wcs[0].wr_id, 2u);
+  message(fresh, slot_size, 0, 4, "y", 4).write();
+  ASSERT_EQ(second.poll(wcs.data(), wcs.size()), 1);
+  EXPECT_EQ(wcs[0].wr_id, 0u);
+}
+
+TEST(FlagPoller, DecodesCompletionsOfAllRings)
+{
+  uint32_t slot_size = rdmalib::FlagRing::slot_size(0);
+  std::vector<uint64_t> first_memory(4 * slot_size / sizeof(uint64_t), 0);
+  std::vector<uint64_t> second_memory(first_memory.size(), 0);
+  rdmalib::FlagRing first{first_memory.data(), slot_size, 4};
+  rdmalib::FlagRing second{second_memory.data(), slot_size, 4};
+  rdmalib::FlagPoller poller;
+  poller.attach(first);
+  poller.attach(second);
+
+  EXPECT_TRUE(poller.poll_completions().empty());
+  // Results carry the invocation id and the return value, and the output size in the value.
+  auto result = message(first_memory, slot_size, 0, 1, "", (11 << 16) | 2);
+  result.header.value = 128;
+  result.write();
+  message(second_memory, slot_size, 0, 1, "", 12 << 16).write();
+
+  int count = 0;
+  for(auto wc : poller.poll_completions(true)) {
+    if(wc.invocation_id == 11) {
+      EXPECT_EQ(wc.return_value(), 2);
+      EXPECT_EQ(wc.byte_len, 128u);
+    } else {
+      EXPECT_EQ(wc.invocation_id, 12u);
+      EXPECT_EQ(wc.return_value(), 0);
+    }
+    ++count;
+  }
+  EXPECT_EQ(count, 2);
+  EXPECT_TRUE(poller.poll_completions().empty());
+}
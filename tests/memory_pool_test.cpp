@@ -0,0 +1,144 @@
+
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <rdmalib/memory_pool.hpp>
+
+#include "device_fixture.hpp"
+
+#include <gtest/gtest.h>
+
+// Pools register memory in the protection domain of the first device.
+using MemoryPoolTest = DeviceTest;
+
+TEST(MemoryPool, SizeClasses) {
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(1), rdmalib::MemoryPool::MIN_SIZE_CLASS);
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(64), 6);
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(65), 7);
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(4096), 12);
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(4097), 13);
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(1u << 31), rdmalib::MemoryPool::MAX_SIZE_CLASS);
+}
+
+// Blocks above the largest size class are rejected before any memory is registered.
+TEST(MemoryPool, Oversize) {
+  EXPECT_EQ(rdmalib::MemoryPool::size_class((1u << 31) + 1), -1);
+  EXPECT_EQ(rdmalib::MemoryPool::size_class(UINT32_MAX), -1);
+
+  rdmalib::MemoryPool pool{nullptr};
+  EXPECT_EQ(pool.allocate_block((1ul << 31) + 1).ptr, nullptr);
+  // Element size and header don't wrap around 32 bits.
+  EXPECT_EQ(pool.allocate<int>(1u << 30).ptr(), nullptr);
+  EXPECT_EQ(pool.allocate<char>(UINT32_MAX, 64).ptr(), nullptr);
+  EXPECT_EQ(pool.registered_bytes(), 0);
+}
+
+// Buffers use the registration of their arena, and data follows the header.
+TEST_F(MemoryPoolTest, Layout) {
+  rdmalib::MemoryPool pool{_pd, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE, 64 * 1024};
+  rdmalib::PooledBuffer<int> first = pool.allocate<int>(100, 12);
+  rdmalib::PooledBuffer<int> second = pool.allocate<int>(100, 12);
+  ASSERT_NE(first.ptr(), nullptr);
+  ASSERT_NE(second.ptr(), nullptr);
+
+  EXPECT_EQ(first.data_size(), 100);
+  EXPECT_EQ(first.bytes(), 100 * sizeof(int) + 12);
+  EXPECT_EQ(reinterpret_cast<char*>(first.data()), static_cast<char*>(first.ptr()) + 12);
+  // Both blocks are carved out of the same arena.
+  EXPECT_EQ(first.lkey(), second.lkey());
+  EXPECT_EQ(first.rkey(), second.rkey());
+  EXPECT_EQ(first.mr(), second.mr());
+  // Blocks of the size class 512 are aligned to it and don't overlap.
+  EXPECT_EQ(first.address() % 512, 0);
+  EXPECT_EQ(second.address() % 512, 0);
+  EXPECT_GE(std::max(first.address(), second.address()) - std::min(first.address(), second.address()), 512);
+  EXPECT_EQ(pool.registered_bytes(), 64 * 1024);
+}
+
+// Blocks larger than the arena get an arena of their own.
+TEST_F(MemoryPoolTest, Arenas) {
+  rdmalib::MemoryPool pool{_pd, IBV_ACCESS_LOCAL_WRITE, 64 * 1024};
+  rdmalib::PooledBuffer<char> small = pool.allocate<char>(1024);
+  rdmalib::PooledBuffer<char> large = pool.allocate<char>(256 * 1024);
+  ASSERT_NE(large.ptr(), nullptr);
+  EXPECT_NE(small.mr(), large.mr());
+  EXPECT_EQ(pool.registered_bytes(), (64 + 256) * 1024);
+
+  // A full arena is followed by a new one.
+  std::vector<rdmalib::PooledBuffer<char>> buffers;
+  for(int i = 0; i < 64; ++i)
+    buffers.push_back(pool.allocate<char>(1024));
+  EXPECT_EQ(pool.registered_bytes(), (64 + 256 + 64) * 1024);
+}
+
+// Released blocks are reused by the next allocation of their size class.
+TEST_F(MemoryPoolTest, Reuse) {
+  rdmalib::MemoryPool pool{_pd};
+  void* ptr = nullptr;
+  {
+    rdmalib::PooledBuffer<char> buf = pool.allocate<char>(1000);
+    ptr = buf.ptr();
+  }
+  rdmalib::PooledBuffer<char> same_class = pool.allocate<char>(1024);
+  EXPECT_EQ(same_class.ptr(), ptr);
+  rdmalib::PooledBuffer<char> other_class = pool.allocate<char>(100);
+  EXPECT_NE(other_class.ptr(), ptr);
+
+  // Moved buffers return their block once.
+  rdmalib::PooledBuffer<char> moved{std::move(same_class)};
+  EXPECT_EQ(same_class.ptr(), nullptr);
+  moved.release();
+  EXPECT_EQ(moved.ptr(), nullptr);
+  rdmalib::PooledBuffer<char> first = pool.allocate<char>(1024);
+  rdmalib::PooledBuffer<char> second = pool.allocate<char>(1024);
+  EXPECT_EQ(first.ptr(), ptr);
+  EXPECT_NE(second.ptr(), ptr);
+}
+
+// Blocks spilled from a full thread cache are available to other threads.
+TEST_F(MemoryPoolTest, ThreadCacheSpill) {
+  rdmalib::MemoryPool pool{_pd};
+  std::set<void*> released;
+  {
+    std::vector<rdmalib::PooledBuffer<char>> buffers;
+    for(int i = 0; i < rdmalib::MemoryPool::THREAD_CACHE_SIZE + 1; ++i)
+      buffers.push_back(pool.allocate<char>(256));
+    for(auto & buf : buffers)
+      released.insert(buf.ptr());
+  }
+  size_t registered = pool.registered_bytes();
+
+  int reused = 0;
+  std::thread other{[&]() {
+    std::vector<rdmalib::PooledBuffer<char>> buffers;
+    for(int i = 0; i < rdmalib::MemoryPool::THREAD_CACHE_SIZE; ++i) {
+      buffers.push_back(pool.allocate<char>(256));
+      reused += released.count(buffers.back().ptr());
+    }
+  }};
+  other.join();
+  // Half of the cache and the block that overflowed it; the rest is carved from the arena.
+  EXPECT_EQ(reused, rdmalib::MemoryPool::THREAD_CACHE_SIZE / 2 + 1);
+  EXPECT_EQ(pool.registered_bytes(), registered);
+}
+
+// Buffers can be released by another thread, which reuses their blocks.
+TEST_F(MemoryPoolTest, CrossThreadRelease) {
+  rdmalib::MemoryPool pool{_pd};
+  rdmalib::PooledBuffer<char> buf = pool.allocate<char>(4096);
+  void* ptr = buf.ptr();
+
+  void* reused = nullptr;
+  std::thread other{[&]() {
+    buf.release();
+    rdmalib::PooledBuffer<char> next = pool.allocate<char>(4096);
+    reused = next.ptr();
+  }};
+  other.join();
+  EXPECT_EQ(reused, ptr);
+
+  // The block stays in the cache of the other thread.
+  rdmalib::PooledBuffer<char> next = pool.allocate<char>(4096);
+  EXPECT_NE(next.ptr(), ptr);
+}
@@ -0,0 +1,147 @@
+#include <array>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/multiplex.hpp>
+#include <rdmalib/rdmalib.hpp>
+
+#include "device_fixture.hpp"
+
+#include <gtest/gtest.h>
+
+// Lanes multiplexed over the executor side of a loopback connection on the test device.
+// The client listens, like rfaas::executor, and the executor side connects.
+class MultiplexTest : public ConfiguredDeviceTest {
+
+public:
+  static constexpr int LANES = 4;
+  static constexpr int RECV_DEPTH = 8;
+  static constexpr int MSG_SIZE = 64;
+
+protected:
+  std::unique_ptr<rdmalib::RDMAPassive> _passive;
+  std::unique_ptr<rdmalib::RDMAActive> _active;
+  std::shared_ptr<rdmalib::Connection> _client;
+  std::unique_ptr<rdmalib::SharedConnection> _shared;
+  rdmalib::Buffer<char> _client_buf, _exec_buf;
+
+  void SetUp() override
+  {
+    ConfiguredDeviceTest::SetUp();
+    if(IsSkipped())
+      return;
+
+    // The receive queue holds the receives of all lanes.
+    _passive.reset(new rdmalib::RDMAPassive{_device->ip_address, 0, RECV_DEPTH});
+    _active.reset(new rdmalib::RDMAActive{_device->ip_address, _passive->_addr._port, LANES * RECV_DEPTH});
+    ASSERT_TRUE(_active->allocate());
+
+    bool connected = false;
+    std::thread executor{[this, &connected]() { connected = _active->connect(); }};
+    while(!_client) {
+      auto [conn, status] = _passive->poll_events();
+      if(status == rdmalib::ConnectionStatus::REQUESTED) {
+        _client.reset(conn);
+        _passive->accept(conn);
+      }
+    }
+    while(std::get<1>(_passive->poll_events()) != rdmalib::ConnectionStatus::ESTABLISHED);
+    executor.join();
+    ASSERT_TRUE(connected);
+
+    _shared.reset(new rdmalib::SharedConnection{_active->connection(), LANES, RECV_DEPTH});
+    ASSERT_EQ(_shared->lanes(), LANES);
+
+    _exec_buf = rdmalib::Buffer<char>(LANES * MSG_SIZE);
+    _exec_buf.register_memory(_active->pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    _client_buf = rdmalib::Buffer<char>(LANES * MSG_SIZE);
+    _client_buf.register_memory(_passive->pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+  }
+
+  void TearDown() override
+  {
+    _shared.reset();
+    if(_active && _active->is_connected())
+      _active->disconnect();
+  }
+};
+
+// Receive completions are delivered to the lane named in their immediate,
+// including the ones polled from the shared queue by another lane.
+TEST_F(MultiplexTest, LaneRouting) {
+  rdmalib::WorkRequestBatch batch;
+  for(int lane = 0; lane < LANES; ++lane) {
+    uint32_t immediate = (static_cast<uint32_t>(lane + 1) << 16) |
+      (static_cast<uint32_t>(lane) << rdmalib::InvocationCompletion::LANE_SHIFT);
+    ASSERT_TRUE(batch.add_write(
+      _client_buf.sge(MSG_SIZE, lane * MSG_SIZE), {_exec_buf.address() + lane * MSG_SIZE, _exec_buf.rkey()},
+      immediate, false, false
+    ));
+  }
+  batch.signal_last();
+  ASSERT_EQ(_client->post_batch(batch), LANES);
+  ASSERT_TRUE(_client->drain_send_queue());
+
+  // The last lane polls the shared queue first, the other completions wait in the rings of their lanes.
+  for(int lane = LANES - 1; lane >= 0; --lane) {
+    auto wcs = _shared->lane(lane).poll_completions(true);
+    ASSERT_EQ(wcs.size(), 1);
+    for(const rdmalib::InvocationCompletion & wc : wcs) {
+      EXPECT_EQ(wc.lane(), lane);
+      EXPECT_EQ(wc.invocation_id, static_cast<uint32_t>(lane + 1));
+    }
+  }
+}
+
+// Each lane posts many times its slice of the send queue. Slots are returned by
+// whichever lane polls send completions, and all writes arrive.
+TEST_F(MultiplexTest, SharedSendCredits) {
+  constexpr int ROUNDS = 4;
+  for(int lane = 0; lane < LANES; ++lane)
+    memset(_exec_buf.data() + lane * MSG_SIZE, lane + 1, MSG_SIZE);
+  memset(_client_buf.data(), 0, _client_buf.bytes());
+
+  std::array<int, LANES> posted{};
+  std::array<int, LANES> drained{};
+  std::vector<std::thread> threads;
+  for(int lane = 0; lane < LANES; ++lane) {
+    threads.emplace_back([&, lane]() {
+      rdmalib::Lane & l = _shared->lane(lane);
+      l.selective_signaling(4);
+      rdmalib::WorkRequestBatch batch;
+      for(int round = 0; round < ROUNDS; ++round) {
+        for(int i = 0; i < rdmalib::WorkRequestBatch::MAX_WORK_REQUESTS; ++i)
+          batch.add_write(
+            _exec_buf.sge(MSG_SIZE, lane * MSG_SIZE), {_client_buf.address() + lane * MSG_SIZE, _client_buf.rkey()}
+          );
+        // Drain waits for the last signaled request, the final one must be signaled.
+        if(round == ROUNDS - 1)
+          batch.signal_last();
+        int32_t ret = l.post_batch(batch);
+        batch.clear();
+        if(ret > 0)
+          posted[lane] += ret;
+      }
+      drained[lane] = l.drain_send_queue();
+    });
+  }
+  for(auto & thread : threads)
+    thread.join();
+
+  for(int lane = 0; lane < LANES; ++lane) {
+    EXPECT_EQ(posted[lane], ROUNDS * rdmalib::WorkRequestBatch::MAX_WORK_REQUESTS);
+    EXPECT_TRUE(drained[lane]);
+    for(int i = 0; i < MSG_SIZE; ++i)
+      ASSERT_EQ(_client_buf.data()[lane * MSG_SIZE + i], lane + 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  std::string arg{argc == 1 ? "" : argv[1]};
+  ConfiguredDeviceTest::_device_name = arg;
+  return RUN_ALL_TESTS();
+}
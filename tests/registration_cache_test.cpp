@@ -0,0 +1,216 @@
+
+// mmap
+#include <sys/mman.h>
+// sysconf
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+
+#include <rdmalib/registration_cache.hpp>
+
+#include "device_fixture.hpp"
+
+#include <gtest/gtest.h>
+
+// Ranges of page-aligned memory are registered by a fake registration, without a device.
+class RegistrationCacheTest : public ::testing::Test {
+
+protected:
+  static constexpr int PAGES = 8;
+  char* _memory = nullptr;
+  size_t _page = sysconf(_SC_PAGESIZE);
+  // Regions of the fake registration, all of them are released by the cache.
+  std::set<ibv_mr*> _regions;
+  uint32_t _registrations = 0;
+  bool _fail_registration = false;
+
+  void SetUp() override
+  {
+    void* ptr = mmap(nullptr, PAGES * _page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    _memory = static_cast<char*>(ptr);
+  }
+
+  void TearDown() override
+  {
+    EXPECT_TRUE(_regions.empty());
+    if(_memory)
+      munmap(_memory, PAGES * _page);
+  }
+
+  rdmalib::RegistrationCache::Hooks hooks()
+  {
+    return {
+      [this](ibv_pd*, void* ptr, size_t bytes, int) -> ibv_mr* {
+        if(_fail_registration)
+          return nullptr;
+        ibv_mr* mr = new ibv_mr{};
+        mr->addr = ptr;
+        mr->length = bytes;
+        mr->lkey = mr->rkey = ++_registrations;
+        _regions.insert(mr);
+        return mr;
+      },
+      [this](ibv_mr* mr) {
+        EXPECT_EQ(_regions.erase(mr), 1);
+        delete mr;
+      }
+    };
+  }
+
+  char* page(int idx)
+  {
+    return _memory + idx * _page;
+  }
+};
+
+// Ranges are extended to pages, and covered requests reuse the registration.
+TEST_F(RegistrationCacheTest, Covered) {
+  rdmalib::RegistrationCache cache{nullptr, IBV_ACCESS_LOCAL_WRITE, rdmalib::RegistrationCache::DEFAULT_PINNED_BUDGET, hooks()};
+  ibv_mr* mr = cache.acquire(page(1) + 16, _page);
+  ASSERT_NE(mr, nullptr);
+  EXPECT_EQ(static_cast<char*>(mr->addr), page(1));
+  EXPECT_EQ(mr->length, 2 * _page);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+
+  ibv_mr* covered = cache.acquire(page(2), 128);
+  EXPECT_EQ(covered, mr);
+  EXPECT_EQ(cache.size(), 1);
+  cache.release(covered);
+  cache.release(mr);
+  // Unused ranges stay registered within the budget.
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+  EXPECT_EQ(cache.acquire(page(1), _page), mr);
+  cache.release(mr);
+}
+
+// Overlapping ranges are replaced by a single registration covering all of them.
+TEST_F(RegistrationCacheTest, Overlap) {
+  rdmalib::RegistrationCache cache{nullptr, IBV_ACCESS_LOCAL_WRITE, rdmalib::RegistrationCache::DEFAULT_PINNED_BUDGET, hooks()};
+  ibv_mr* first = cache.acquire(page(0), 2 * _page);
+  ibv_mr* second = cache.acquire(page(3), 2 * _page);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  cache.release(second);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.pinned_bytes(), 4 * _page);
+
+  ibv_mr* merged = cache.acquire(page(1), 3 * _page);
+  ASSERT_NE(merged, nullptr);
+  EXPECT_EQ(static_cast<char*>(merged->addr), page(0));
+  EXPECT_EQ(merged->length, 5 * _page);
+  EXPECT_EQ(cache.size(), 1);
+  // The unused range is gone, the first one is still in use.
+  EXPECT_EQ(cache.pinned_bytes(), (2 + 5) * _page);
+  cache.release(first);
+  EXPECT_EQ(cache.pinned_bytes(), 5 * _page);
+  EXPECT_EQ(cache.acquire(page(4), _page), merged);
+  cache.release(merged);
+  cache.release(merged);
+}
+
+// Adjacent ranges don't overlap and keep separate registrations.
+TEST_F(RegistrationCacheTest, Adjacent) {
+  rdmalib::RegistrationCache cache{nullptr, IBV_ACCESS_LOCAL_WRITE, rdmalib::RegistrationCache::DEFAULT_PINNED_BUDGET, hooks()};
+  ibv_mr* first = cache.acquire(page(0), _page);
+  ibv_mr* second = cache.acquire(page(1), _page);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+  EXPECT_EQ(cache.acquire(page(0), _page), first);
+  EXPECT_EQ(cache.acquire(page(1), _page), second);
+  cache.release(first);
+  cache.release(first);
+  cache.release(second);
+  cache.release(second);
+}
+
+// Invalidated ranges are deregistered once unused.
+TEST_F(RegistrationCacheTest, Invalidate) {
+  rdmalib::RegistrationCache cache{nullptr, IBV_ACCESS_LOCAL_WRITE, rdmalib::RegistrationCache::DEFAULT_PINNED_BUDGET, hooks()};
+  ibv_mr* used = cache.acquire(page(0), _page);
+  ibv_mr* unused = cache.acquire(page(2), _page);
+  ASSERT_NE(used, nullptr);
+  ASSERT_NE(unused, nullptr);
+  cache.release(unused);
+
+  cache.invalidate(page(0), 4 * _page);
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.pinned_bytes(), _page);
+  // New requests don't reuse the invalidated range.
+  ibv_mr* fresh = cache.acquire(page(0), _page);
+  ASSERT_NE(fresh, nullptr);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+  cache.release(used);
+  EXPECT_EQ(cache.pinned_bytes(), _page);
+  cache.release(fresh);
+}
+
+// The least recently released ranges are evicted to stay within the budget.
+TEST_F(RegistrationCacheTest, Eviction) {
+  rdmalib::RegistrationCache cache{nullptr, IBV_ACCESS_LOCAL_WRITE, 2 * _page, hooks()};
+  ibv_mr* a = cache.acquire(page(0), _page);
+  cache.release(a);
+  ibv_mr* b = cache.acquire(page(2), _page);
+  cache.release(b);
+  EXPECT_EQ(cache.size(), 2);
+
+  ibv_mr* c = cache.acquire(page(4), _page);
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+  // The later one is kept.
+  EXPECT_EQ(cache.acquire(page(2), _page), b);
+
+  // Ranges in use are never evicted, the budget is exceeded.
+  ibv_mr* d = cache.acquire(page(6), _page);
+  ASSERT_NE(d, nullptr);
+  EXPECT_EQ(cache.size(), 3);
+  EXPECT_EQ(cache.pinned_bytes(), 3 * _page);
+  // Released ranges are evicted until the cache fits the budget again.
+  cache.release(b);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+  cache.release(c);
+  cache.release(d);
+  EXPECT_EQ(cache.pinned_bytes(), 2 * _page);
+}
+
+// Failed registrations aren't cached.
+TEST_F(RegistrationCacheTest, RegistrationFailure) {
+  rdmalib::RegistrationCache cache{nullptr, IBV_ACCESS_LOCAL_WRITE, rdmalib::RegistrationCache::DEFAULT_PINNED_BUDGET, hooks()};
+  _fail_registration = true;
+  EXPECT_EQ(cache.acquire(page(0), _page), nullptr);
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.pinned_bytes(), 0);
+
+  _fail_registration = false;
+  ibv_mr* mr = cache.acquire(page(0), _page);
+  ASSERT_NE(mr, nullptr);
+  EXPECT_EQ(cache.size(), 1);
+  cache.release(mr);
+}
+
+// User memory is registered in the protection domain of the first device.
+using RegistrationCacheDevice = DeviceTest;
+
+TEST_F(RegistrationCacheDevice, UserMemory) {
+  std::vector<char> data(16 * 1024);
+  rdmalib::RegistrationCache cache{_pd, IBV_ACCESS_LOCAL_WRITE};
+  ibv_mr* mr = cache.acquire(data.data(), data.size());
+  ASSERT_NE(mr, nullptr);
+  EXPECT_EQ(mr->pd, _pd);
+  EXPECT_LE(static_cast<char*>(mr->addr), data.data());
+  EXPECT_GE(static_cast<char*>(mr->addr) + mr->length, data.data() + data.size());
+  EXPECT_EQ(cache.acquire(data.data() + 1024, 1024), mr);
+  cache.release(mr);
+  cache.release(mr);
+  cache.invalidate(data.data(), data.size());
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.pinned_bytes(), 0);
+}
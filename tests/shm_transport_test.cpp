@@ -0,0 +1,203 @@
+
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <rdmalib/shm.hpp>
+
+#include <gtest/gtest.h>
+
+struct ShmTransport : ::testing::Test {
+  static constexpr size_t ARENA_SIZE = 1024 * 1024;
+  static constexpr uint32_t SECRET = 42;
+
+  std::string path;
+  rdmalib::shm::ProtectionDomain active_pd{ARENA_SIZE};
+  rdmalib::shm::ProtectionDomain passive_pd{ARENA_SIZE};
+  std::unique_ptr<rdmalib::shm::RDMAPassive> passive;
+  std::unique_ptr<rdmalib::shm::Connection> server;
+  std::unique_ptr<rdmalib::shm::RDMAActive> active;
+
+  void SetUp() override
+  {
+    path = "/tmp/rdmalib_shm_test_" + std::to_string(getpid());
+    passive.reset(new rdmalib::shm::RDMAPassive{path, passive_pd});
+    active.reset(new rdmalib::shm::RDMAActive{path, active_pd});
+    std::thread accept{
+      [this]() {
+        server.reset(passive->poll_events());
+      }
+    };
+    ASSERT_TRUE(active->connect(SECRET));
+    accept.join();
+    ASSERT_TRUE(server);
+    ASSERT_EQ(server->private_data(), SECRET);
+    ASSERT_TRUE(active->is_connected());
+  }
+};
+
+// Listeners wait for connections with a timeout, e.g. the executor manager.
+TEST_F(ShmTransport, NonblockingPollEvents)
+{
+  EXPECT_FALSE(passive->nonblocking_poll_events(10));
+
+  rdmalib::shm::ProtectionDomain pd{ARENA_SIZE};
+  rdmalib::shm::RDMAActive second{path, pd};
+  bool connected = false;
+  std::thread connect{
+    [&]() {
+      connected = second.connect(SECRET + 1);
+    }
+  };
+  EXPECT_TRUE(passive->nonblocking_poll_events(1000));
+  std::unique_ptr<rdmalib::shm::Connection> conn{passive->poll_events()};
+  connect.join();
+  ASSERT_TRUE(conn);
+  EXPECT_TRUE(connected);
+  EXPECT_EQ(conn->private_data(), SECRET + 1);
+}
+
+TEST_F(ShmTransport, SendRecv)
+{
+  auto src = active_pd.allocate<int>(4);
+  auto dest = passive_pd.allocate<int>(4);
+  for(int i = 0; i < 4; ++i)
+    src.data()[i] = i + 1;
+
+  ASSERT_EQ(server->post_recv(dest, 7), 7);
+  ASSERT_GE(active->connection().post_send(src), 0);
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, true);
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(wcs[0].wr_id, 7u);
+  EXPECT_EQ(wcs[0].opcode, IBV_WC_RECV);
+  EXPECT_EQ(wcs[0].byte_len, 4 * sizeof(int));
+  for(int i = 0; i < 4; ++i)
+    EXPECT_EQ(dest.data()[i], i + 1);
+
+  auto [swcs, scount] = active->connection().poll_wc(rdmalib::QueueType::SEND, false);
+  EXPECT_EQ(scount, 1);
+  EXPECT_EQ(swcs[0].opcode, IBV_WC_SEND);
+}
+
+TEST_F(ShmTransport, WriteWithImmediate)
+{
+  auto src = active_pd.allocate<char>(64);
+  auto dest = passive_pd.allocate<char>(64);
+  src.data()[0] = 'x';
+  src.data()[63] = 'y';
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+
+  server->post_recv({}, 1);
+  ASSERT_GE(active->connection().post_write(src, remote, 0x10001, false, true), 0);
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, true);
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(wcs[0].opcode, IBV_WC_RECV_RDMA_WITH_IMM);
+  EXPECT_EQ(ntohl(wcs[0].imm_data), 0x10001u);
+  EXPECT_EQ(wcs[0].byte_len, 64u);
+  EXPECT_EQ(dest.data()[0], 'x');
+  EXPECT_EQ(dest.data()[63], 'y');
+}
+
+TEST_F(ShmTransport, RejectsForeignMemory)
+{
+  auto src = active_pd.allocate<char>(64);
+  auto dest = passive_pd.allocate<char>(64);
+
+  rdmalib::RemoteBuffer wrong_key{dest.address(), dest.rkey() + 1};
+  EXPECT_EQ(active->connection().post_write(src, wrong_key), -1);
+  rdmalib::RemoteBuffer out_of_bounds{passive_pd.address() + ARENA_SIZE - 32, dest.rkey()};
+  EXPECT_EQ(active->connection().post_write(src, out_of_bounds), -1);
+}
+
+TEST_F(ShmTransport, Atomics)
+{
+  auto counter = passive_pd.allocate<uint64_t>(1);
+  auto result = active_pd.allocate<uint64_t>(1);
+  counter.data()[0] = 5;
+  rdmalib::RemoteBuffer remote{counter.address(), counter.rkey()};
+
+  active->connection().post_atomic_fadd(result, remote, 3);
+  EXPECT_EQ(result.data()[0], 5u);
+  EXPECT_EQ(counter.data()[0], 8u);
+
+  active->connection().post_cas(result, remote, 7, 1);
+  EXPECT_EQ(result.data()[0], 8u);
+  EXPECT_EQ(counter.data()[0], 8u);
+
+  active->connection().post_cas(result, remote, 8, 1);
+  EXPECT_EQ(result.data()[0], 8u);
+  EXPECT_EQ(counter.data()[0], 1u);
+}
+
+TEST_F(ShmTransport, SolicitedEvents)
+{
+  auto src = active_pd.allocate<char>(8);
+  auto dest = passive_pd.allocate<char>(8);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+  server->post_recv({}, -1, 2);
+
+  server->notify_events(true);
+  std::thread waiter{
+    [this]() {
+      EXPECT_TRUE(server->wait_events());
+    }
+  };
+  // Unsolicited completion does not wake up the waiter.
+  active->connection().post_write(src, remote, 1, false, false);
+  active->connection().post_write(src, remote, 2, false, true);
+  waiter.join();
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, false);
+  ASSERT_EQ(count, 2);
+  EXPECT_EQ(ntohl(wcs[0].imm_data), 1u);
+  EXPECT_EQ(ntohl(wcs[1].imm_data), 2u);
+}
+
+TEST_F(ShmTransport, Batch)
+{
+  auto src = active_pd.allocate<char>(16);
+  auto dest = passive_pd.allocate<char>(16);
+  src.data()[0] = 'a';
+  src.data()[8] = 'b';
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+  server->post_recv({}, -1, 2);
+
+  rdmalib::WorkRequestBatch batch;
+  batch.add_write(src.sge(8, 0), remote, 1u);
+  batch.add_write(src.sge(8, 8), {dest.address() + 8, dest.rkey()}, 2u, false, true);
+  batch.signal_last();
+  ASSERT_EQ(active->connection().post_batch(batch), 2);
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, false);
+  ASSERT_EQ(count, 2);
+  EXPECT_EQ(ntohl(wcs[0].imm_data), 1u);
+  EXPECT_EQ(ntohl(wcs[1].imm_data), 2u);
+  EXPECT_EQ(dest.data()[0], 'a');
+  EXPECT_EQ(dest.data()[8], 'b');
+
+  // Only the signaled write completes, and draining drops its completion.
+  EXPECT_TRUE(active->connection().drain_send_queue());
+  auto [swcs, scount] = active->connection().poll_wc(rdmalib::QueueType::SEND, false);
+  EXPECT_EQ(scount, 0);
+}
+
+TEST_F(ShmTransport, BatchReportsPostedRequests)
+{
+  auto src = active_pd.allocate<char>(16);
+  auto dest = passive_pd.allocate<char>(16);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+
+  rdmalib::WorkRequestBatch batch;
+  batch.add_write(src.sge(8, 0), remote);
+  // Reads are not emulated, the batch fails at the second request.
+  batch.add_read(src.sge(8, 8), {dest.address() + 8, dest.rkey()});
+  batch.add_write(src.sge(8, 8), {dest.address() + 8, dest.rkey()});
+  EXPECT_EQ(active->connection().post_batch(batch), -1);
+  EXPECT_EQ(batch.posted(), 1);
+  batch.clear();
+  EXPECT_EQ(batch.posted(), 0);
+}
@@ -0,0 +1,48 @@
+
+#include <string>
+
+#include <rdmalib/statistics.hpp>
+
+#include <gtest/gtest.h>
+
+TEST(Statistics, QueueCounters)
+{
+  rdmalib::QueueStatistics stats;
+  stats.record_poll(0);
+  stats.record_poll(3);
+  stats.record_poll(-1);
+  EXPECT_EQ(stats.polls.value(), 3u);
+  EXPECT_EQ(stats.empty_polls.value(), 1u);
+  EXPECT_EQ(stats.completions.value(), 3u);
+
+  ibv_wc wc{};
+  wc.status = IBV_WC_RNR_RETRY_EXC_ERR;
+  stats.record_error(wc);
+  wc.status = IBV_WC_RETRY_EXC_ERR;
+  stats.record_error(wc);
+  wc.status = IBV_WC_LOC_PROT_ERR;
+  stats.record_error(wc);
+  EXPECT_EQ(stats.errors.value(), 3u);
+  EXPECT_EQ(stats.retry_errors.value(), 1u);
+  EXPECT_EQ(stats.rnr_retry_errors.value(), 1u);
+}
+
+TEST(Statistics, ClosedConnectionsAreAggregated)
+{
+  auto & registry = rdmalib::StatisticsRegistry::instance();
+  auto first = registry.create("first");
+  auto second = registry.create("second");
+  first->qp_num = 17;
+  first->send.posted.add(5);
+  second->recv.refills.add(2);
+
+  std::string json = registry.json();
+  EXPECT_NE(json.find("{\"name\": \"first\", \"qp_num\": 17, \"send\": {\"posted\": 5"), std::string::npos);
+  EXPECT_NE(json.find("\"name\": \"second\""), std::string::npos);
+
+  second.reset();
+  json = registry.json();
+  EXPECT_EQ(json.find("\"name\": \"second\""), std::string::npos);
+  EXPECT_NE(json.find("\"closed\": {\"connections\": 1"), std::string::npos);
+  EXPECT_NE(json.find("\"refills\": 2"), std::string::npos);
+}
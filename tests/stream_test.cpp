@@ -0,0 +1,59 @@
+
+#include <string>
+#include <vector>
+
+#include <rdmalib/functions.hpp>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+  // Chunks of a string, as the executor would hand them to a function.
+  struct Chunks {
+    std::string data;
+    uint32_t chunk_size;
+    uint64_t consumed = 0;
+
+    static rdmalib::functions::InputStream::Chunk next(void* context)
+    {
+      auto & chunks = *static_cast<Chunks*>(context);
+      if(chunks.consumed >= chunks.data.size())
+        return {nullptr, 0};
+      uint32_t size = std::min<uint64_t>(chunks.chunk_size, chunks.data.size() - chunks.consumed);
+      const char* ptr = chunks.data.data() + chunks.consumed;
+      chunks.consumed += size;
+      return {ptr, size};
+    }
+  };
+
+}
+
+TEST(InputStream, IteratesOverChunks)
+{
+  Chunks chunks{"streamed input of a function", 8};
+  rdmalib::functions::InputStream in{&chunks, chunks.data.size(), &Chunks::next};
+
+  std::vector<std::string> received;
+  for(auto chunk : in)
+    received.emplace_back(chunk.data, chunk.size);
+  ASSERT_EQ(received.size(), 4u);
+  EXPECT_EQ(received[0], "streamed");
+  EXPECT_EQ(received[3], "tion");
+  EXPECT_EQ(in.next().data, nullptr);
+}
+
+TEST(InputStream, EmptyInput)
+{
+  Chunks chunks{"", 8};
+  rdmalib::functions::InputStream in{&chunks, 0, &Chunks::next};
+  int count = 0;
+  for(auto chunk : in)
+    count += chunk.size > 0;
+  EXPECT_EQ(count, 0);
+}
+
+TEST(StreamDescriptor, DistinctFromPull)
+{
+  EXPECT_NE(sizeof(rdmalib::functions::StreamDescriptor), sizeof(rdmalib::functions::PullDescriptor));
+  EXPECT_EQ(sizeof(rdmalib::functions::StreamResult), 8u);
+}
@@ -0,0 +1,260 @@
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include <rdmalib/tcp.hpp>
+
+#include <gtest/gtest.h>
+
+struct TcpTransport : ::testing::Test {
+  static constexpr size_t ARENA_SIZE = 1024 * 1024;
+  static constexpr uint32_t SECRET = 42;
+
+  rdmalib::tcp::ProtectionDomain active_pd{ARENA_SIZE};
+  rdmalib::tcp::ProtectionDomain passive_pd{ARENA_SIZE};
+  std::unique_ptr<rdmalib::tcp::RDMAPassive> passive;
+  std::unique_ptr<rdmalib::tcp::Connection> server;
+  std::unique_ptr<rdmalib::tcp::RDMAActive> active;
+
+  void SetUp() override
+  {
+    passive.reset(new rdmalib::tcp::RDMAPassive{"127.0.0.1", 0, passive_pd});
+    active.reset(new rdmalib::tcp::RDMAActive{"127.0.0.1", passive->port(), active_pd});
+    std::thread accept{
+      [this]() {
+        server.reset(passive->poll_events());
+      }
+    };
+    ASSERT_TRUE(active->connect(SECRET));
+    accept.join();
+    ASSERT_TRUE(server);
+    ASSERT_EQ(server->private_data(), SECRET);
+    ASSERT_TRUE(active->is_connected());
+  }
+};
+
+// Listeners wait for connections with a timeout, e.g. the executor manager.
+TEST_F(TcpTransport, NonblockingPollEvents)
+{
+  EXPECT_FALSE(passive->nonblocking_poll_events(10));
+
+  rdmalib::tcp::ProtectionDomain pd{ARENA_SIZE};
+  rdmalib::tcp::RDMAActive second{"127.0.0.1", passive->port(), pd};
+  bool connected = false;
+  std::thread connect{
+    [&]() {
+      connected = second.connect(SECRET + 1);
+    }
+  };
+  EXPECT_TRUE(passive->nonblocking_poll_events(1000));
+  std::unique_ptr<rdmalib::tcp::Connection> conn{passive->poll_events()};
+  connect.join();
+  ASSERT_TRUE(conn);
+  EXPECT_TRUE(connected);
+  EXPECT_EQ(conn->private_data(), SECRET + 1);
+}
+
+TEST_F(TcpTransport, SendRecv)
+{
+  auto src = active_pd.allocate<int>(4);
+  auto dest = passive_pd.allocate<int>(4);
+  for(int i = 0; i < 4; ++i)
+    src.data()[i] = i + 1;
+
+  ASSERT_EQ(server->post_recv(dest, 7), 7);
+  ASSERT_GE(active->connection().post_send(src), 0);
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, true);
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(wcs[0].wr_id, 7u);
+  EXPECT_EQ(wcs[0].opcode, IBV_WC_RECV);
+  EXPECT_EQ(wcs[0].byte_len, 4 * sizeof(int));
+  for(int i = 0; i < 4; ++i)
+    EXPECT_EQ(dest.data()[i], i + 1);
+
+  auto [swcs, scount] = active->connection().poll_wc(rdmalib::QueueType::SEND, false);
+  EXPECT_EQ(scount, 1);
+  EXPECT_EQ(swcs[0].opcode, IBV_WC_SEND);
+}
+
+TEST_F(TcpTransport, WriteWithImmediate)
+{
+  auto src = active_pd.allocate<char>(64);
+  auto dest = passive_pd.allocate<char>(64);
+  src.data()[0] = 'x';
+  src.data()[63] = 'y';
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+
+  server->post_recv({}, 1);
+  ASSERT_GE(active->connection().post_write(src, remote, 0x10001, false, true), 0);
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, true);
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(wcs[0].opcode, IBV_WC_RECV_RDMA_WITH_IMM);
+  EXPECT_EQ(ntohl(wcs[0].imm_data), 0x10001u);
+  EXPECT_EQ(wcs[0].byte_len, 64u);
+  EXPECT_EQ(dest.data()[0], 'x');
+  EXPECT_EQ(dest.data()[63], 'y');
+}
+
+TEST_F(TcpTransport, RejectsForeignMemory)
+{
+  auto src = active_pd.allocate<char>(64);
+  auto dest = passive_pd.allocate<char>(64);
+
+  // Writes are validated by the target, which closes the connection.
+  rdmalib::RemoteBuffer out_of_bounds{passive_pd.address() + ARENA_SIZE - 32, dest.rkey()};
+  ASSERT_GE(active->connection().post_write(src, out_of_bounds), 0);
+  server->poll_wc(rdmalib::QueueType::RECV, true);
+  EXPECT_EQ(server->status(), rdmalib::ConnectionStatus::DISCONNECTED);
+}
+
+TEST_F(TcpTransport, Atomics)
+{
+  auto counter = passive_pd.allocate<uint64_t>(1);
+  auto result = active_pd.allocate<uint64_t>(1);
+  counter.data()[0] = 5;
+  rdmalib::RemoteBuffer remote{counter.address(), counter.rkey()};
+
+  // Atomics are executed when the target polls.
+  std::thread target{
+    [this]() {
+      server->poll_wc(rdmalib::QueueType::RECV, true);
+    }
+  };
+  active->connection().post_atomic_fadd(result, remote, 3);
+  ASSERT_EQ(std::get<1>(active->connection().poll_wc(rdmalib::QueueType::SEND, true)), 1);
+  EXPECT_EQ(result.data()[0], 5u);
+  EXPECT_EQ(counter.data()[0], 8u);
+
+  active->connection().post_cas(result, remote, 7, 1);
+  ASSERT_EQ(std::get<1>(active->connection().poll_wc(rdmalib::QueueType::SEND, true)), 1);
+  EXPECT_EQ(result.data()[0], 8u);
+  EXPECT_EQ(counter.data()[0], 8u);
+
+  active->connection().post_cas(result, remote, 8, 1);
+  ASSERT_EQ(std::get<1>(active->connection().poll_wc(rdmalib::QueueType::SEND, true)), 1);
+  EXPECT_EQ(result.data()[0], 8u);
+  EXPECT_EQ(counter.data()[0], 1u);
+
+  // Wake up the target with a message.
+  server->post_recv({}, 0);
+  active->connection().post_send({});
+  target.join();
+}
+
+TEST_F(TcpTransport, SolicitedEvents)
+{
+  auto src = active_pd.allocate<char>(8);
+  auto dest = passive_pd.allocate<char>(8);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+  server->post_recv({}, -1, 2);
+
+  server->notify_events(true);
+  active->connection().post_write(src, remote, 1, false, false);
+  active->connection().post_write(src, remote, 2, false, true);
+  // Returns after the solicited completion, both are available.
+  EXPECT_TRUE(server->wait_events());
+
+  auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, false);
+  ASSERT_EQ(count, 2);
+  EXPECT_EQ(ntohl(wcs[0].imm_data), 1u);
+  EXPECT_EQ(ntohl(wcs[1].imm_data), 2u);
+}
+
+TEST_F(TcpTransport, BatchWaitsForReceives)
+{
+  auto src = active_pd.allocate<int>(4);
+  auto dest = passive_pd.allocate<int>(4);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+  for(int i = 0; i < 4; ++i)
+    src.data()[i] = i;
+
+  rdmalib::WorkRequestBatch batch;
+  for(int i = 0; i < 4; ++i)
+    batch.add_write(
+      src.sge(sizeof(int), i * sizeof(int)),
+      rdmalib::RemoteBuffer{remote.addr + i * sizeof(int), remote.rkey},
+      static_cast<uint32_t>(i)
+    );
+  batch.signal_last();
+  ASSERT_EQ(active->connection().post_batch(batch), 4);
+  ASSERT_EQ(std::get<1>(active->connection().poll_wc(rdmalib::QueueType::SEND, true)), 1);
+
+  // Writes with immediate wait for receives posted by the target.
+  EXPECT_EQ(std::get<1>(server->poll_wc(rdmalib::QueueType::RECV, false)), 0);
+  server->post_recv({}, -1, 4);
+  int received = 0;
+  while(received < 4) {
+    auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, true);
+    for(int i = 0; i < count; ++i)
+      EXPECT_EQ(ntohl(wcs[i].imm_data), static_cast<uint32_t>(received + i));
+    received += count;
+  }
+  for(int i = 0; i < 4; ++i)
+    EXPECT_EQ(dest.data()[i], i);
+}
+
+TEST_F(TcpTransport, LargePayloads)
+{
+  // Larger than the receive ring, read directly into the targets.
+  constexpr uint32_t SIZE = 256 * 1024;
+  auto src = active_pd.allocate<char>(SIZE);
+  auto dest = passive_pd.allocate<char>(SIZE);
+  auto first = passive_pd.allocate<char>(SIZE / 4);
+  auto second = passive_pd.allocate<char>(SIZE);
+  for(uint32_t i = 0; i < SIZE; ++i)
+    src.data()[i] = static_cast<char>(i % 251);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+
+  // Small messages before and after share the reads of the ring.
+  rdmalib::ScatterGatherElement sges;
+  sges.add(first);
+  sges.add(second);
+  server->post_recv({}, -1, 3);
+  server->post_recv(std::move(sges), 1);
+  rdmalib::WorkRequestBatch batch;
+  batch.add_write(src.sge(8, 0), remote, 1u);
+  batch.add_write(src.sge(SIZE, 0), remote, 2u);
+  batch.add_write(src.sge(8, 0), remote, 3u);
+  ASSERT_EQ(active->connection().post_batch(batch), 3);
+  ASSERT_GE(active->connection().post_send(src), 0);
+
+  std::vector<ibv_wc> received;
+  while(received.size() < 4) {
+    auto [wcs, count] = server->poll_wc(rdmalib::QueueType::RECV, true);
+    received.insert(received.end(), wcs, wcs + count);
+  }
+  for(uint32_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(ntohl(received[i].imm_data), i + 1);
+    EXPECT_EQ(received[i].opcode, IBV_WC_RECV_RDMA_WITH_IMM);
+  }
+  EXPECT_EQ(received[3].opcode, IBV_WC_RECV);
+  EXPECT_EQ(received[3].wr_id, 1u);
+  EXPECT_EQ(received[3].byte_len, SIZE);
+  EXPECT_EQ(memcmp(dest.data(), src.data(), SIZE), 0);
+  EXPECT_EQ(memcmp(first.data(), src.data(), SIZE / 4), 0);
+  EXPECT_EQ(memcmp(second.data(), src.data() + SIZE / 4, SIZE - SIZE / 4), 0);
+}
+
+TEST_F(TcpTransport, DrainSendQueue)
+{
+  auto src = active_pd.allocate<char>(64);
+  auto dest = passive_pd.allocate<char>(64);
+  rdmalib::RemoteBuffer remote{dest.address(), dest.rkey()};
+
+  rdmalib::WorkRequestBatch batch;
+  batch.add_write(src.sge(64, 0), remote);
+  batch.signal_last();
+  ASSERT_EQ(active->connection().post_batch(batch), 1);
+  EXPECT_TRUE(active->connection().drain_send_queue());
+  EXPECT_EQ(std::get<1>(active->connection().poll_wc(rdmalib::QueueType::SEND, false)), 0);
+
+  // Reads are not emulated.
+  batch.clear();
+  batch.add_read(dest.sge(64, 0), {src.address(), src.rkey()});
+  EXPECT_EQ(active->connection().post_batch(batch), -1);
+}
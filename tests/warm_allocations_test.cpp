@@ -0,0 +1,237 @@
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#include <rdmalib/buffer.hpp>
+#include <rdmalib/connection.hpp>
+#include <rdmalib/functions.hpp>
+#include <rdmalib/rdmalib.hpp>
+
+#include <rfaas/executor.hpp>
+
+#include "device_fixture.hpp"
+
+#include <gtest/gtest.h>
+
+// Count heap allocations made while a test has counting enabled.
+static std::atomic<bool> counting{false};
+static std::atomic<int> allocations{0};
+
+void* operator new(std::size_t size)
+{
+  if(counting)
+    ++allocations;
+  void* ptr = std::malloc(size ? size : 1);
+  if(!ptr)
+    throw std::bad_alloc{};
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+  if(counting && ptr)
+    ++allocations;
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  operator delete(ptr);
+}
+
+struct AllocationCounter {
+
+  AllocationCounter()
+  {
+    allocations = 0;
+    counting = true;
+  }
+
+  ~AllocationCounter()
+  {
+    counting = false;
+  }
+
+  int count() const
+  {
+    return allocations;
+  }
+};
+
+TEST(WarmAllocations, ScatterGatherElement) {
+  char data[64];
+  uint64_t addr = reinterpret_cast<uint64_t>(data);
+
+  AllocationCounter counter;
+  rdmalib::ScatterGatherElement sge{addr, 16, 1};
+  for(int i = 1; i < rdmalib::ScatterGatherElement::MAX_SGE; ++i)
+    sge.add(addr + 16 * i, 8, 1);
+  rdmalib::ScatterGatherElement copy{sge};
+  rdmalib::ScatterGatherElement moved{std::move(copy)};
+  EXPECT_EQ(counter.count(), 0);
+
+  EXPECT_EQ(moved.size(), rdmalib::ScatterGatherElement::MAX_SGE);
+  EXPECT_EQ(moved.array()[1].addr, addr + 16);
+  EXPECT_EQ(moved.array()[1].length, 8);
+}
+
+TEST(WarmAllocations, ScatterGatherElementCapacity) {
+  rdmalib::ScatterGatherElement sge;
+  for(int i = 0; i < rdmalib::ScatterGatherElement::MAX_SGE; ++i)
+    EXPECT_TRUE(sge.add(i, 1, 1));
+  EXPECT_FALSE(sge.add(rdmalib::ScatterGatherElement::MAX_SGE, 1, 1));
+  EXPECT_EQ(sge.size(), rdmalib::ScatterGatherElement::MAX_SGE);
+}
+
+// Invocation and result writes are prepared without touching the heap.
+TEST(WarmAllocations, WorkRequestBatch) {
+  char data[64];
+  uint64_t addr = reinterpret_cast<uint64_t>(data);
+  rdmalib::WorkRequestBatch batch;
+
+  AllocationCounter counter;
+  for(int i = 0; i < 4; ++i) {
+    batch.add_write({addr, 64, 1}, {addr, 2}, (i << 16) | 1, false, true);
+    batch.add_write({addr, 64, 1}, {addr, 2});
+    EXPECT_EQ(batch.size(), 2);
+    batch.clear();
+  }
+  EXPECT_EQ(counter.count(), 0);
+}
+
+// The same with scatter-gather elements created from registered buffers.
+using WarmAllocationsDevice = DeviceTest;
+
+TEST_F(WarmAllocationsDevice, RegisteredBuffer) {
+  rdmalib::Buffer<char> buf(4096);
+  buf.register_memory(_pd, IBV_ACCESS_LOCAL_WRITE);
+  rdmalib::WorkRequestBatch batch;
+
+  AllocationCounter counter;
+  rdmalib::ScatterGatherElement sge{buf};
+  sge.add(buf, 128, 64);
+  batch.add_write(buf.sge(256, 0), {buf.address(), buf.rkey()}, 1, false, true);
+  batch.add_send(sge);
+  batch.clear();
+  EXPECT_EQ(counter.count(), 0);
+}
+
+// A client and an executor thread connected over the loopback of the test device.
+// The client listens, like rfaas::executor, and the executor side connects.
+class WarmPathTest : public ConfiguredDeviceTest {
+
+public:
+  static constexpr int RCV_BUF_SIZE = 16;
+  static constexpr int INPUT_SIZE = 64;
+  static constexpr int OUTPUT_SIZE = 64;
+
+protected:
+  std::unique_ptr<rdmalib::RDMAPassive> _passive;
+  std::unique_ptr<rdmalib::RDMAActive> _active;
+  std::shared_ptr<rdmalib::Connection> _client;
+  std::unique_ptr<rfaas::executor_state> _state;
+  rdmalib::Buffer<char> _in, _out, _rcv, _send;
+
+  void SetUp() override
+  {
+    ConfiguredDeviceTest::SetUp();
+    if(IsSkipped())
+      return;
+
+    _passive.reset(new rdmalib::RDMAPassive{_device->ip_address, 0, RCV_BUF_SIZE});
+    _active.reset(new rdmalib::RDMAActive{_device->ip_address, _passive->_addr._port, RCV_BUF_SIZE});
+    ASSERT_TRUE(_active->allocate());
+
+    // The executor thread receives submissions into its input buffer.
+    _rcv = rdmalib::Buffer<char>(rdmalib::functions::Submission::DATA_HEADER_SIZE + INPUT_SIZE);
+    _rcv.register_memory(_active->pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    _send = rdmalib::Buffer<char>(OUTPUT_SIZE);
+    _send.register_memory(_active->pd(), IBV_ACCESS_LOCAL_WRITE);
+    _active->connection().post_batched_empty_recv(RCV_BUF_SIZE);
+
+    bool connected = false;
+    std::thread executor{[this, &connected]() { connected = _active->connect(); }};
+    while(!_client) {
+      auto [conn, status] = _passive->poll_events();
+      if(status == rdmalib::ConnectionStatus::REQUESTED) {
+        _client.reset(conn);
+        _state.reset(new rfaas::executor_state{_client, RCV_BUF_SIZE});
+        _state->_rcv_buffer.connect(_client.get());
+        _passive->accept(conn);
+      }
+    }
+    while(std::get<1>(_passive->poll_events()) != rdmalib::ConnectionStatus::ESTABLISHED);
+    executor.join();
+    ASSERT_TRUE(connected);
+
+    _in = rdmalib::Buffer<char>(INPUT_SIZE, rdmalib::functions::Submission::DATA_HEADER_SIZE);
+    _in.register_memory(_passive->pd(), IBV_ACCESS_LOCAL_WRITE);
+    _out = rdmalib::Buffer<char>(OUTPUT_SIZE);
+    _out.register_memory(_passive->pd(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    _state->remote_input = rdmalib::RemoteBuffer{_rcv.address(), _rcv.rkey(), _rcv.bytes()};
+  }
+
+  void TearDown() override
+  {
+    if(_active && _active->is_connected())
+      _active->disconnect();
+  }
+
+  // Client submission, the result path of the executor and the receipt of the result.
+  void invoke(int invoc_id, rdmalib::WorkRequestBatch & results)
+  {
+    // Client: the header of the input points to the output.
+    char* data = static_cast<char*>(_in.ptr());
+    *reinterpret_cast<uint64_t*>(data) = _out.address();
+    *reinterpret_cast<uint32_t*>(data + 8) = _out.rkey();
+    rdmalib::ScatterGatherElement sge;
+    sge.add(_in, _in.bytes(), 0);
+    ASSERT_TRUE(_state->add_submission(std::move(sge), _state->submission_id(invoc_id, 0)));
+    ASSERT_EQ(_state->post_batch(), 1);
+
+    // Executor: receive the submission and write the result back.
+    rdmalib::Connection & exec = _active->connection();
+    auto submissions = exec.poll<rdmalib::QueueType::RECV>(true);
+    ASSERT_EQ(submissions.size(), 1);
+    exec.post_batched_empty_recv(1);
+    ASSERT_TRUE(exec.drain_send_queue());
+    auto header = reinterpret_cast<rdmalib::functions::Submission*>(_rcv.data());
+    results.add_write(
+      _send.sge(OUTPUT_SIZE, 0), {header->r_address, header->r_key},
+      static_cast<uint32_t>(invoc_id) << 16, OUTPUT_SIZE <= exec.max_inline_data()
+    );
+    if(OUTPUT_SIZE > exec.max_inline_data())
+      results.signal_last();
+    exec.post_batch(results);
+    results.clear();
+
+    // Client: the result arrives, and the receive buffer is refilled.
+    auto wcs = _state->_rcv_buffer.poll_completions(true);
+    ASSERT_EQ(wcs.size(), 1);
+    for(const rdmalib::InvocationCompletion & wc : wcs)
+      EXPECT_EQ(wc.invocation_id, static_cast<uint32_t>(invoc_id));
+    _state->_rcv_buffer.refill();
+  }
+};
+
+// Warm invocations don't allocate on either side.
+TEST_F(WarmPathTest, Invocation) {
+  rdmalib::WorkRequestBatch results;
+  // Cover a refill of receive buffers on both sides before counting.
+  for(int i = 0; i < 2 * RCV_BUF_SIZE; ++i)
+    invoke(i, results);
+
+  AllocationCounter counter;
+  for(int i = 0; i < 4 * RCV_BUF_SIZE; ++i)
+    invoke(i, results);
+  EXPECT_EQ(counter.count(), 0);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  std::string arg{argc == 1 ? "" : argv[1]};
+  ConfiguredDeviceTest::_device_name = arg;
+  return RUN_ALL_TESTS();
+}